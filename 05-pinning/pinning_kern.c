@@ -12,15 +12,21 @@
 #include "workshop/common.h"
 
 /*
-    这个定义与上一节中的counters定义相似。
+    stats_config是这个程序的配置，它只包含一个字段：程序对每个数据包返回的XDP action
 
-    这里的关键区别是我们在本节中使从用户空间更新这个BPF MAP。
+    它被声明为'const volatile'全局变量，所以会被放入.rodata段中
+    用户态在加载程序之前（见pinning_user.c中的attach）会用自己的值覆盖它，加载之后它就再也不能被修改了
+    因为验证器和JIT在加载时就已经知道它的值，所以读取它只是一个常量，而不是每个数据包都要进行一次BPF MAP查找
+    代价是修改action需要重新加载程序
+    默认值XDP_ABORTED和原来用户态没有设置action时的行为保持一致
 */
-struct bpf_map_def SEC("maps") action = {
-    .type = BPF_MAP_TYPE_ARRAY,
-    .key_size = sizeof(__u32),
-    .value_size = sizeof(long),
-    .max_entries = 1,
+struct stats_config
+{
+    __u32 action;
+};
+
+const volatile struct stats_config config = {
+    .action = XDP_ABORTED,
 };
 
 /*
@@ -63,28 +69,13 @@ static __always_inline __u32 update_action_stats(struct xdp_md *ctx, __u32 actio
     return action;
 }
 
-/*
-    函数'get_action'处理检索xdp程序'stats'的定义返回代码。如果它还没有被用户空间的 控制程序，则返回XDP_ABORTED。
-*/
-static __always_inline __u32 get_action()
-{
-    __u32 action_idx = 0;
-    __u32 *elem = bpf_map_lookup_elem(&action, &action_idx);
-    if (!elem)
-    {
-        return XDP_ABORTED;
-    }
-
-    return *elem;
-}
-
 SEC("stats")
 int stats_fn(struct xdp_md *ctx)
 {
     /*
-        找到用户态程序设置的action
+        用户态程序在加载时设置的action
     */
-    __u32 action = get_action();
+    __u32 action = config.action;
 
     /*
         更新用户定义的动作的统计信息，并将该动作返回给内核
@@ -18,10 +18,19 @@
 static __u32 xdp_flags = XDP_FLAGS_UPDATE_IF_NOEXIST;
 
 /*
-    handle_action'是我们使用libbpf来更新来自用户空间的BPF MAP
-    这样底层的XDP程序就可以根据我们更新的这些数据来改变它对数据包的响应方式
+    stats_config和pinning_kern.c中的定义相同，是内核态程序.rodata段中的配置
 */
-static int handle_action(const char *str_action)
+struct stats_config
+{
+    __u32 action;
+};
+
+/*
+    handle_action'把用户传入的action字符串转换为内核态程序的配置
+    这个配置会在下面的attach中，在加载程序之前写入程序的.rodata段
+    这样内核态的程序就不需要在每个数据包上都去查询一次BPF MAP
+*/
+static int handle_action(const char *str_action, struct stats_config *config)
 {
     /*
         由于我们从这个程序的调用中传入了一个字符串，我们需要找到相对应的XDP action
@@ -35,35 +44,7 @@ static int handle_action(const char *str_action)
         return EXIT_FAIL_OPTIONS;
     }
 
-    /*
-        在获得了我们想要进行的XDP action之后，
-        我们就需要一个文件描述符，找到相应的BPF MAP，这与我们在上一节所做的非常相似。
-        事实上，这个'open_bpf_map'函数和之前讲到的是同一个函数
-        ACTION_MAP_PATH定义在constans.h中
-        #define COUNTER_MAP_PATH "/sys/fs/bpf/action_counters"
-    */
-    int map_fd = open_bpf_map(ACTION_MAP_PATH);
-    if (map_fd < 0)
-    {
-        return EXIT_FAIL_XDP_MAP_OPEN;
-    }
-
-    /*
-        和之前讲的是类似的，具体可以参考上一节
-    */
-    __u32 action_idx = 0;
-
-    /*
-        我们调用'bpf_map_update_elem'，它从用户空间获取我们要更新的BPF MAP的文件描述符，
-        一个指向我们要更新的键的指针，以及一个指向我们要设置键的值的指针
-        内核态的程序会来读取这个程序以此来完成相应的操作
-    */
-    if (bpf_map_update_elem(map_fd, &action_idx, &action, 0) != 0)
-    {
-        printf("ERR: Failed to set specified action '%s' err(%d): %s\n",
-               str_action, errno, strerror(errno));
-        return EXIT_FAIL_XDP_MAP_UPDATE;
-    }
+    config->action = action;
     return EXIT_OK;
 }
 
@@ -160,30 +141,73 @@ static int load_section(struct bpf_object *bpf_obj, char *section)
 
     这取代了我们上次用iproute2和bpftool来附加程序和pinning BPF MAP的过程。
 */
-static int attach(int if_index, char *prog_path, char *section)
+static int attach(int if_index, char *prog_path, char *section, struct stats_config *config)
 {
     /*
         这里的作用和detach中的同样
     */
     struct bpf_object *bpf_obj;
+    struct bpf_program *bpf_prog;
+    struct bpf_map *bpf_map;
     int bpf_prog_fd = -1;
     int ret = 0;
 
     /*
-        以下三个调用'bpf_prog_load', 'load_section', 和'bpf_set_link_xdp_fd'相当于运行：
+        以下几个调用'bpf_object__open', 'bpf_object__load', 'load_section', 和'bpf_set_link_xdp_fd'相当于运行：
         'sudo ip link set dev ${device name} xdp obj ${object file} sec ${section name}'
     */
 
     /*
-        同上面的detach
+        和detach不同，这里不能直接使用'bpf_prog_load'，因为它会在打开对象文件之后立即加载程序
+        而我们需要在加载之前修改程序的.rodata段，所以要把它拆成'bpf_object__open'和'bpf_object__load'两步
     */
-    ret = bpf_prog_load(prog_path, BPF_PROG_TYPE_XDP, &bpf_obj, &bpf_prog_fd);
+    bpf_obj = bpf_object__open(prog_path);
+    ret = libbpf_get_error(bpf_obj);
+    if (ret != 0)
+    {
+        printf("ERR: Unable to open XDP program from file '%s' err(%d): %s\n",
+               prog_path, -ret, strerror(-ret));
+        return EXIT_FAIL_XDP_ATTACH;
+    }
+
+    /*
+        'bpf_prog_load'会帮我们设置程序的类型，这里需要自己设置
+    */
+    bpf_object__for_each_program(bpf_prog, bpf_obj)
+    {
+        bpf_program__set_type(bpf_prog, BPF_PROG_TYPE_XDP);
+    }
+
+    /*
+        libbpf会为.rodata段创建一个内部的BPF MAP，名字以'.rodata'结尾
+        'bpf_map__set_initial_value'用我们的配置替换它的初始值，加载之后这个MAP会被冻结，内核态程序看到的就是常量
+        如果没有指定配置，就使用pinning_kern.c中的默认值
+    */
+    if (config != NULL)
+    {
+        bpf_object__for_each_map(bpf_map, bpf_obj)
+        {
+            if (strstr(bpf_map__name(bpf_map), ".rodata") != NULL)
+            {
+                break;
+            }
+        }
+
+        if (bpf_map == NULL || bpf_map__set_initial_value(bpf_map, config, sizeof(*config)) != 0)
+        {
+            printf("ERR: Unable to set the configuration of XDP program '%s'\n", prog_path);
+            return EXIT_FAIL_XDP_ATTACH;
+        }
+    }
+
+    ret = bpf_object__load(bpf_obj);
     if (ret != 0)
     {
         printf("ERR: Unable to load XDP program from file '%s' err(%d): %s\n",
                prog_path, -ret, strerror(-ret));
         return EXIT_FAIL_XDP_ATTACH;
     }
+    bpf_prog_fd = bpf_program__fd(bpf_program__next(NULL, bpf_obj));
 
     /*
         load_section'是对libbpf提供的接口的一个封装
@@ -248,7 +272,8 @@ int main(int argc, char **argv)
     bool should_detach = false;
     bool should_attach = false;
 
-    char *action = NULL;
+    struct stats_config config;
+    bool has_config = false;
 
     int rlimit_ret = set_rlimit();
     if (rlimit_ret != EXIT_OK)
@@ -327,9 +352,12 @@ int main(int argc, char **argv)
             break;
         case 's':   // 打印已经加载的XDP程序的统计数据
             return print_action_stats();
-        case 'e':   // 设置xdp程序的XDP action
-            action = alloca(strlen(tmp_value));
-            strcpy(action, tmp_value);
+        case 'e':   // 设置xdp程序的XDP action，在attach时生效
+            if (handle_action(tmp_value, &config) != EXIT_OK)
+            {
+                return EXIT_FAIL_OPTIONS;
+            }
+            has_config = true;
             break;
         case 'h':
         default:
@@ -348,15 +376,18 @@ int main(int argc, char **argv)
 
     if (should_attach)
     {
-        return attach(if_index, prog_path == NULL ? default_prog_path : prog_path, section == NULL ? default_section : section);
+        return attach(if_index, prog_path == NULL ? default_prog_path : prog_path, section == NULL ? default_section : section,
+                      has_config ? &config : NULL);
     }
 
     /*
-        处理其它xdp action
+        action现在是程序加载时的常量，只能在attach的同时设置
+        想要修改一个已经挂载的程序的action，需要先detach再重新attach
     */
-    if (action != NULL)
+    if (has_config)
     {
-        return handle_action(action);
+        printf("ERR: '-e|--set-action' must be combined with '-a|--attach', the action is fixed when the program is loaded.\n");
+        return EXIT_FAIL_OPTIONS;
     }
 
     return EXIT_OK;
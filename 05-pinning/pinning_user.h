@@ -26,21 +26,6 @@
 #include "workshop/user/options.h"
 #include "workshop/user/utils.h"
 
-#define ACTION_MAP_PATH "/sys/fs/bpf/action"
-
-static int str2action(const char *action)
-{
-    int i;
-    for (i = 0; i < XDP_MAX_ACTIONS; i++)
-    {
-        if (strcmp(xdp_action_names[i], action) == 0)
-        {
-            return i;
-        }
-    }
-    return -1;
-}
-
 /*
     默认加载的xdp程序和对应的section
 */
@@ -81,7 +66,7 @@ static const char *long_options_descriptions[] = {
     [3] = "将指定的xdp程序附加到指定的网络设备上 / Attach the specified XDP program to the specified network device.",
     [4] = "将指定的xdp程序从指定的网络设备中卸载 / Detach the specified XDP program from the specified network device.",
     [5] = "打印已经加载的XDP程序的统计数据 / Print statistics from the already loaded XDP program.",
-    [6] = "设置xdp程序的XDP action / Set the XDP action for the XDP program to return.",
+    [6] = "设置xdp程序的XDP action，需要和--attach一起使用 / Set the XDP action for the XDP program to return, must be used together with --attach.",
 };
 
 #endif /* _PINNING_USER_H */
@@ -15,6 +15,22 @@
     它负责通过'nh_offset'跟踪我们在数据包中的位置，以及通过'nh_proto'跟踪下一个头协议是什么
     这个结构还持有当前数据包的开始和结束以及总长度的指针
     以减少我们在'xdp_md'结构的data/data_end ints和void指针之间的转换次数
+
+    由于各层的检查被拆分成了通过尾调用串联起来的多个程序，解析时还需要记录下第三层和第四层头部的偏移与协议，
+    这样后面的程序不需要重新解析前面的头部，就可以直接找到自己要检查的头部
+    'stage'代表下一次尾调用要跳转到的'xdpfw_stages'中的位置，'generation'是进入流水线时黑名单的版本号
+    'frag'代表这个数据包是不是IPv4的分片，取值为'ipv4_frag_type'中的一个
+    'rx_queue'是收到这个数据包的网卡队列，AF_XDP的socket是按队列绑定的，'ifindex'是收到这个数据包的网卡
+    'tcp_flags'是parse_tcp从TCP头部中取出的标志位，连接跟踪的状态机由它驱动，不是TCP的数据包为0
+    'rule'是决定了这个数据包命运的规则，由'RULE_ID'组成，它只在一个程序内部使用，不会在尾调用之间保存
+    'verdict_*'是流水线中已经匹配到、但是还不能立即执行的规则，见'rule_policy'，'verdict_priority'为POLICY_NONE时代表没有
+    'nocache'代表这个数据包经过了限速类别的检查，它的结果不能被流表缓存和连接跟踪记录下来，否则后续的数据包就会绕过限速
+    'redirect_ifindex'是XDP_REDIRECT的目标网卡，为0时代表交给AF_XDP的socket
+    'l2_offset'是当前被检查的以太网头部的偏移，外层总是0
+    'tunnel'是这个数据包被解开的封装，取值为'tunnel_type'中的一个，不是tunnel_none时'inner_*'是内层头部的偏移和协议，
+    'inner_eth'代表内层是否有以太网头部；流水线中的每一层先检查外层，再用swap_layers交换两组字段检查内层，'inner'代表当前是否是内层
+    'prof_*'只在使用'make PROFILE=1'编译时存在，是被抽中计时的数据包的开始时间和上一个计时点的时间，见xdpfw_kern_profile.h
+    在尾调用之间，除了两个指针之外的字段都会被保存在'pipeline_context'中，指针则由每个程序根据'xdp_md'重新计算
 */
 struct context
 {
@@ -24,8 +40,96 @@ struct context
 
     __u32 nh_proto;
     __u32 nh_offset;
+
+    __u32 l3_proto;
+    __u32 l3_offset;
+    __u32 l4_proto;
+    __u32 l4_offset;
+
+    __u32 l2_offset;
+    __u32 tunnel;
+    __u32 inner;
+    __u32 inner_eth;
+    __u32 inner_l2_offset;
+    __u32 inner_l3_proto;
+    __u32 inner_l3_offset;
+    __u32 inner_l4_proto;
+    __u32 inner_l4_offset;
+
+    __u32 stage;
+    __u32 generation;
+    __u32 frag;
+    __u32 rx_queue;
+    __u32 ifindex;
+    __u32 tcp_flags;
+    __u32 rule;
+
+    __u32 verdict_action;
+    __u32 verdict_priority;
+    __u32 verdict_arg;
+    __u32 verdict_rule;
+    __u32 nocache;
+    __u32 redirect_ifindex;
+
+#ifdef XDPFW_PROFILE
+    __u64 prof_start;
+    __u64 prof_mark;
+#endif
+};
+
+/*
+    ipv4_frag_type代表一个IPv4数据包是否是分片，以及是哪一种分片
+    只有第一个分片中带有第四层的头部，后续分片的载荷不能被当作TCP/UDP的头部来解析
+*/
+enum ipv4_frag_type
+{
+    ipv4_frag_none,
+    ipv4_frag_first,
+    ipv4_frag_later,
 };
 
+/*
+    xdpfw_stage代表流水线中每一层检查对应的程序，也是它们在'xdpfw_stage_progs'中的下标
+    用户态会按照这个顺序，把有规则的那些层依次放入'xdpfw_stages'中，没有规则的层会被直接跳过
+*/
+enum xdpfw_stage
+{
+    stage_mac,
+    stage_l3,
+    stage_l4,
+    stage_acl,
+    stage_syncookie,
+    XDPFW_STAGES,
+};
+
+/*
+    'xdpfw_stages'分成两半，每一半有XDPFW_PIPELINE_SLOTS个位置，最后一个位置永远是空的
+    用户态总是在没有被使用的那一半中拼接新的流水线，写完之后再通过黑名单的版本号一次性地切换过去
+*/
+#define XDPFW_PIPELINE_SLOTS (XDPFW_STAGES + 1)
+
+/*
+    prof_point代表'make PROFILE=1'编译出来的程序中的计时点，小于XDPFW_STAGES的值就是流水线中对应的那一层
+    prof_parse_*是入口程序中解析各层头部的时间，prof_prefilter是限速、连接跟踪和查询流表缓存的时间，prof_total是整个数据包的时间
+    每个计时点有PROF_BUCKETS个以2为底的对数桶，最后一个桶也包含了所有更大的延迟
+    XDPFW_PROFILE_SAMPLE代表每多少个数据包抽取一个进行计时
+*/
+enum prof_point
+{
+    prof_parse_l2 = XDPFW_STAGES,
+    prof_parse_l3,
+    prof_parse_l4,
+    prof_prefilter,
+    prof_total,
+    PROF_POINTS,
+};
+
+#define PROF_BUCKETS 32
+
+#ifndef XDPFW_PROFILE_SAMPLE
+#define XDPFW_PROFILE_SAMPLE 64
+#endif
+
 /*
     lpm_v4_key 代表一个IPv4地址范围，除了地址长度之外，它与IPv6的对应部分是相同的。
 */
@@ -35,6 +139,123 @@ struct lpm_v4_key
     __u8 address[4];
 };
 
+/*
+    policy_action代表黑名单中的一条规则被命中之后的动作，默认的policy_drop为0，这样全部为0的值仍然代表丢弃
+    policy_pass是白名单，命中之后立即结束检查并通过，也不会再应用'default_action'
+    policy_ratelimit让命中的数据包经过'arg'指定的限速类别，policy_redirect把数据包重定向到'arg'指定的网卡，为0时交给AF_XDP的socket
+    policy_tx把数据包从收到它的网卡发回去
+*/
+enum policy_action
+{
+    policy_drop,
+    policy_pass,
+    policy_ratelimit,
+    policy_redirect,
+    policy_tx,
+    POLICY_ACTIONS,
+};
+
+/*
+    rule_policy是一条规则的动作和优先级，和ACL一样，优先级的数值越小越优先
+    一个数据包可能在流水线的不同层中命中多条规则，最终执行的是其中优先级最高的那一条，优先级相同时白名单优先
+    白名单的规则命中之后不再需要继续检查；其他的规则只有比所有白名单规则都优先时才能立即执行，否则要等到流水线结束
+    没有白名单规则时，所有的规则都会像以前一样被立即执行
+    expires是这条规则的过期时间，和bpf_ktime_get_ns使用同一个时钟，为0代表永不过期
+    过期的规则在查找时被当作不存在，之后由用户态的'--sweep'删除
+    prefixlen只在LPM黑名单的规则中使用，是这条规则自己的前缀长度，查找到的前缀过期时内核从比它更短的前缀继续查找
+*/
+struct rule_policy
+{
+    __u32 action;
+    __u32 priority;
+    __u32 arg;
+    __u32 prefixlen;
+    __u64 expires;
+};
+
+/*
+    rule_value是MAC、IPv4和IPv6黑名单的值：这条规则的命中计数和它的动作
+*/
+struct rule_value
+{
+    struct counters counters;
+    struct rule_policy policy;
+};
+
+/*
+    POLICY_DEFAULT_PRIORITY是没有指定优先级的规则的优先级，和ACL的默认优先级相同
+    POLICY_NONE代表'context'中没有待执行的规则，也用在'policy_state'中代表没有白名单规则
+    POLICY_MAX_CLASSES是限速类别的数量
+*/
+#define POLICY_DEFAULT_PRIORITY 100
+#define POLICY_NONE 0xffffffff
+#define POLICY_MAX_CLASSES 64
+
+/*
+    policy_state是'policy_state'中唯一的元素，由用户态在每次修改规则之后重新计算
+    allow_priority是所有白名单规则中最高的优先级，没有白名单规则时为POLICY_NONE
+*/
+struct policy_state
+{
+    __u32 allow_priority;
+};
+
+/*
+    v4_engine代表检查IPv4源地址黑名单时使用的查找引擎，在加载时选择
+    v4_engine_lpm使用LPM_TRIE，查找的开销随着前缀的深度增长；v4_engine_dir24使用DIR-24-8的两级数组，每次查找最多两次数组访问
+*/
+enum v4_engine
+{
+    v4_engine_lpm,
+    v4_engine_dir24,
+    V4_ENGINES,
+};
+
+/*
+    DIR-24-8的两级表：第一级'v4_dir24'以地址的高24位为下标，第二级'v4_dir8'由多个256项的组构成，以地址的低8位为组内的下标
+    表项为0代表没有匹配的前缀，最高位DIR_EXTENDED被设置时，剩下的位是第二级中组的编号，否则就是规则的编号
+    只有长度超过24的前缀才需要第二级的组
+*/
+#define DIR24_ENTRIES (1 << 24)
+#define DIR8_GROUP_ENTRIES 256
+#define DIR8_MAX_GROUPS 16384
+#define DIR_EXTENDED 0x80000000
+#define DIR_MAX_RULES (1 << 18)
+
+/*
+    dir_rule是'v4_dir_rules'的值，下标就是规则的编号，编号0不使用
+    address是网络字节序的前缀，counters是这条规则的命中计数，所有CPU共用一份，policy是这条规则的动作
+    next_free只在这个编号空闲时有意义，是下一个空闲编号，这样用户态分配和回收编号都是O(1)的
+    parent是覆盖这个前缀的最长的更短前缀的规则编号，没有时为0，这条规则过期时内核沿着它继续查找
+*/
+struct dir_rule
+{
+    __u32 address;
+    __u32 prefixlen;
+    __u32 in_use;
+    __u32 next_free;
+    __u32 parent;
+    __u32 pad;
+    struct counters counters;
+    struct rule_policy policy;
+};
+
+/*
+    dir_meta是'v4_dir_meta'中唯一的元素，只由用户态读写
+    next_rule和next_group是从未使用过的最小的规则编号和组编号，free_rule和free_group是回收之后的空闲链表的头，0代表空
+    组空闲时，它的第一个表项保存了链表中下一个空闲的组
+*/
+struct dir_meta
+{
+    __u32 engine;
+    __u32 next_rule;
+    __u32 free_rule;
+    __u32 next_group;
+    __u32 free_group;
+    __u32 rules;
+    __u32 groups;
+};
+
 /*
     lpm_v6_key "代表一个IPv6地址范围，除了地址长度外，与IPv4的对应部分相同
 */
@@ -44,6 +265,15 @@ struct lpm_v6_key
     __u8 address[16];
 };
 
+/*
+    v6_prefix_key是'v6_blacklist_64'和'v6_blacklist_48'的键，也就是网络字节序的地址的前8个字节
+    /48的前缀只使用前6个字节，剩下的两个字节总是0
+*/
+struct v6_prefix_key
+{
+    __u8 address[8];
+};
+
 /*
     这里的'port_type'代表我们希望ban的端口的类型，在这种情况下是源端口或目的端口。
 */
@@ -63,23 +293,806 @@ enum port_protocol
 };
 
 /*
-    port_key'是我们将使用的结构，用于在我们的防火墙中匹配udp或tcp端口
-    BPF MAP是对键的值进行原始的字节散列，而不考虑数据的实际C类型
-    因此，如果一个键的字节结构是相同的，那么即使这些值的类型不同，也会匹配
-    然而，你需要注意字节的界限，
-    在这种情况下，我们必须使用'__u32'，尽管一个端口永远不会大于'__u16'，但是需要确保额外的填充来满足这里的'12'的字节界限被正确处理
-    但简单的解释是，你用作键的结构需要有一个可被4整除的字节大小
-    否则编译器将添加填充字节来满足这一要求，它可能（也可能不）在MAP中丢掉匹配。
+    端口黑名单不再使用哈希表，而是为每一种(port_type, port_protocol)的组合各准备一个65536位的位图
+    每个端口对应位图中的一位，所有的位图按顺序存放在同一个BPF_MAP_TYPE_ARRAY中，每个元素是一个64位的字
+    这样检查一个端口只需要一次数组读取加上一次位测试，而且可以直接按范围设置端口
+    PORT_BITMAP_INDEX计算某个端口所在的字在数组中的下标，PORT_BITMAP_BIT计算它在这个字中对应的位
+*/
+#define PORT_BITMAP_WORD_BITS 64
+#define PORT_BITMAP_WORDS (65536 / PORT_BITMAP_WORD_BITS)
+
+#define PORT_BITMAP_INDEX(type, proto, port) \
+    ((((type) * 2 + (proto)) * PORT_BITMAP_WORDS) + ((port) / PORT_BITMAP_WORD_BITS))
+#define PORT_BITMAP_BIT(port) (1ULL << ((port) % PORT_BITMAP_WORD_BITS))
+
+/*
+    位图中的每一位没有地方存放计数，所以端口规则的命中计数单独存放在'port_rule_counters'中
+    PORT_RULE_KEY把(port_type, port_protocol, port)编码成一个__u32作为它的键
+*/
+#define PORT_RULE_KEY(type, proto, port) (((__u32)((type) * 2 + (proto)) << 16) | (port))
+
+/*
+    flow_key是流表缓存所使用的键，代表一条流的五元组
+    IPv4地址只占用地址字段的前4个字节，其余部分保持为0，这样v4和v6的流可以共用同一个BPF MAP
+    另外我们把源MAC地址也放进了键中，因为mac_blacklist的判定结果同样取决于它
+    这里需要注意字节的界限，整个结构的大小为44字节，可以被4整除，不会有隐藏的填充字节
+*/
+struct flow_key
+{
+    __u8 src_mac[6];
+    __u8 proto;
+    __u8 pad;
+    __u16 src_port;
+    __u16 dst_port;
+    __u8 src_addr[16];
+    __u8 dst_addr[16];
+};
+
+/*
+    FLOW_TABLE_MAX_ENTRIES是流量统计表中最多能够同时记录的流的数量，FLOW_RING_SIZE是导出流记录的ring buffer的大小
+    FLOW_DEFAULT_ACTIVE_TIMEOUT和FLOW_DEFAULT_IDLE_TIMEOUT是默认的活动超时和空闲超时，单位为秒，含义和IPFIX中的相同：
+    一条流持续超过活动超时之后导出一次已有的计数并重新开始计数，超过空闲超时没有数据包之后导出并删除
+*/
+#define FLOW_TABLE_MAX_ENTRIES 65536
+#define FLOW_RING_SIZE (1 << 20)
+#define FLOW_DEFAULT_ACTIVE_TIMEOUT 60
+#define FLOW_DEFAULT_IDLE_TIMEOUT 15
+
+/*
+    flow_counters是流量统计表'flow_table'的值，键是和流表缓存相同的'flow_key'，每个CPU只统计自己处理的数据包
+    first_ns和last_ns是这一段计数中第一个和最后一个数据包的时间，和bpf_ktime_get_ns使用同一个时钟
+    tcp_flags是所有数据包的TCP标志位的或，family是4或6，'flow_key'中无法区分两者
+    packets为0代表这个CPU上还没有这条流的数据包
+*/
+struct flow_counters
+{
+    __u64 packets;
+    __u64 bytes;
+    __u64 first_ns;
+    __u64 last_ns;
+    __u32 ifindex;
+    __u8 tcp_flags;
+    __u8 family;
+    __u8 pad[2];
+};
+
+/*
+    flow_end_reason是一条流的计数被导出的原因，取值和IPFIX中的flowEndReason相同
+    flow_end_resources代表流量统计表已满，这个数据包无法被记录，内核把它单独作为一条记录导出
+*/
+enum flow_end_reason
+{
+    flow_end_idle = 1,
+    flow_end_active = 2,
+    flow_end_forced = 4,
+    flow_end_resources = 5,
+};
+
+/*
+    flow_export是一条导出的流记录，'reason'取值为'flow_end_reason'中的一个
+    'flow_ring'中只有表满时无法记录的数据包，超时的流由用户态从表中取出，在所有CPU上合并之后编码成同样的记录
+    计数放在最前面，这样整个结构没有隐藏的填充字节
 */
-struct port_key
+struct flow_export
 {
-    enum port_type type;
-    enum port_protocol proto;
-    __u32 port;
+    struct flow_counters counters;
+    struct flow_key key;
+    __u32 reason;
+};
+
+/*
+    flow_meta是'flow_meta'中唯一的元素，是以纳秒为单位的活动超时和空闲超时，为0代表没有这个超时
+    用户态在挂载时写入，导出程序从这里读取
+*/
+struct flow_meta
+{
+    __u64 active_ns;
+    __u64 idle_ns;
+};
+
+/*
+    flow_result用作'flow_stats'的索引
+    flow_created是新建的流，超时被导出之后又有数据包的流也会被重新创建；flow_overflow是表满时单独导出的数据包，
+    flow_lost是'flow_ring'满了而丢失的记录
+*/
+enum flow_result
+{
+    flow_created,
+    flow_overflow,
+    flow_lost,
+    FLOW_RESULTS,
+};
+
+/*
+    flow_verdict是流表缓存中保存的值，也就是这条流最后一次的判定结果
+    generation记录写入这个结果时黑名单的版本号，用户态每次修改黑名单时都会增加版本号
+    这样所有旧的缓存项在下一次命中时就会自动失效，而不需要用户态去遍历清空整个缓存
+*/
+struct flow_verdict
+{
+    __u32 action;
+    __u32 generation;
+};
+
+/*
+    flow_cache_result代表流表缓存的查询结果，用作flow_cache_stats的索引，以便统计命中率
+*/
+enum flow_cache_result
+{
+    flow_cache_hit,
+    flow_cache_miss,
+    FLOW_CACHE_RESULTS,
+};
+
+/*
+    ACL_MAX_TUPLES代表ACL分类器最多能有多少个不同的元组
+    每个数据包最多需要在每个元组中查找一次，所以这个值也就是ACL这一层每个数据包最多的哈希查找次数
+*/
+#define ACL_MAX_TUPLES 16
+
+/*
+    ACL使用元组空间搜索（tuple space search）进行多字段的匹配
+    所有的规则按照(地址族, 源前缀长度, 目的前缀长度, 协议掩码, 源端口掩码, 目的端口掩码)分组，每一组就是一个元组
+    同一个元组中的规则使用相同的掩码，所以只需要把数据包的各个字段按这个掩码处理之后进行一次精确的哈希查找
+
+    acl_tuple描述一个元组，它在'acl_tuples'中的下标就是它的ID
+    掩码都是网络字节序的，由用户态在添加规则时预先计算好，内核中只需要做按位与
+    rules代表这个元组中有多少条规则，为0时表示这个位置是空的
+    priority是这个元组中所有规则里最高的优先级（数值越小优先级越高），如果已经匹配到的规则比它更优先，就可以跳过这个元组
+*/
+struct acl_tuple
+{
+    __u32 rules;
+    __u32 priority;
+    __u8 family;
+    __u8 proto_mask;
+    __u16 src_port_mask;
+    __u16 dst_port_mask;
+    __u16 pad;
+    __u32 src_mask[4];
+    __u32 dst_mask[4];
+};
+
+/*
+    acl_key是'acl_rules'的键，也就是按照某个元组的掩码处理之后的五元组
+    因为所有的元组共用一个哈希表，所以键中包含元组的ID，相当于每个元组都有一张自己的哈希表
+    IPv4地址只使用地址字段的第一个字，其余部分保持为0
+*/
+struct acl_key
+{
+    __u32 tuple;
+    __u8 family;
+    __u8 proto;
+    __u16 pad;
+    __u16 src_port;
+    __u16 dst_port;
+    __u32 src_addr[4];
+    __u32 dst_addr[4];
+};
+
+/*
+    acl_rule是'acl_rules'的值，代表一条规则的优先级和匹配之后返回的action
+*/
+struct acl_rule
+{
+    __u32 priority;
+    __u32 action;
+};
+
+/*
+    ratelimit_proto代表限速规则针对的协议，也是'ratelimit_limit'中'rates'的下标
+    ratelimit_any对应所有协议，只有数据包的协议没有单独配置速率时才会使用它
+*/
+enum ratelimit_proto
+{
+    ratelimit_any,
+    ratelimit_tcp,
+    ratelimit_udp,
+    ratelimit_icmp,
+    RATELIMIT_PROTOS,
+};
+
+/*
+    ratelimit_rate描述一个令牌桶的参数
+    rate是每秒补充的令牌数，也就是每秒允许通过的数据包数量，为0代表没有限速
+    burst是桶的容量，也就是最多能够连续通过的数据包数量
+    bucket是划分令牌桶时使用的源地址前缀长度，例如IPv4的32代表每个源地址一个桶，24代表每个/24网段共用一个桶
+    fill_ns是把空桶填满需要的纳秒数，由用户态在写入时计算，内核用它判断桶是否已经填满，不需要再做除法
+*/
+struct ratelimit_rate
+{
+    __u32 rate;
+    __u32 burst;
+    __u32 bucket;
+    __u32 pad;
+    __u64 fill_ns;
+};
+
+/*
+    ratelimit_limit是'ratelimit_v4'和'ratelimit_v6'的值，代表某个源地址前缀下每种协议的限速参数
+*/
+struct ratelimit_limit
+{
+    struct ratelimit_rate rates[RATELIMIT_PROTOS];
+};
+
+/*
+    ratelimit_key是'ratelimit_buckets'的键，代表一个令牌桶
+    其中的地址是按照'bucket'处理过的源地址，IPv4地址只使用第一个字
+    键中同时包含了前缀长度，这样不同粒度的桶即使地址相同也不会冲突
+*/
+struct ratelimit_key
+{
+    __u8 family;
+    __u8 proto;
+    __u8 bucket;
+    __u8 pad;
+    __u32 addr[4];
+};
+
+#ifndef NSEC_PER_SEC
+#define NSEC_PER_SEC 1000000000ULL
+#endif
+
+/*
+    token_bucket是'ratelimit_buckets'的值
+    为了避免在内核中做除法，令牌的数量以'纳秒 * 每秒令牌数'为单位保存，一个数据包消耗NSEC_PER_SEC个单位
+    补充令牌时只需要一次乘法，判断桶是否已经填满使用的是用户态预先算好的'fill_ns'
+    last_ns是上一次补充令牌的时间
+*/
+struct token_bucket
+{
+    __u64 tokens;
+    __u64 last_ns;
+};
+
+/*
+    syncookie_result代表SYN cookie这一层对数据包的处理结果，用作'syncookie_stats'的索引
+    syncookie_sent代表回复了带有cookie的SYN-ACK，syncookie_valid和syncookie_invalid代表ACK中的cookie是否有效
+*/
+enum syncookie_result
+{
+    syncookie_sent,
+    syncookie_valid,
+    syncookie_invalid,
+    SYNCOOKIE_RESULTS,
+};
+
+/*
+    frag_key是分片跟踪表'frag_table'的键，同一个IP数据报的所有分片都有相同的(源地址, 目的地址, ID, 协议)
+*/
+struct frag_key
+{
+    __be32 saddr;
+    __be32 daddr;
+    __be16 id;
+    __u8 proto;
+    __u8 pad;
+};
+
+/*
+    frag_verdict是'frag_table'的值
+    action是第一个分片经过完整检查之后得到的结果，后续分片直接继承这个结果
+    fragments是这个数据报目前为止出现过的分片数量，用来限制分片洪泛
+*/
+struct frag_verdict
+{
+    __u32 action;
+    __u32 fragments;
+};
+
+/*
+    frag_result用作'frag_stats'的索引
+    frag_first代表记录了结果的第一个分片，frag_inherited代表继承了结果的后续分片，
+    frag_orphan代表找不到第一个分片的后续分片，它们按照'frag_orphan_policy'处理，frag_over_limit代表超过了分片数量限制的分片，它们会被丢弃
+*/
+enum frag_result
+{
+    frag_first,
+    frag_inherited,
+    frag_orphan,
+    frag_over_limit,
+    FRAG_RESULTS,
+};
+
+/*
+    FRAG_DEFAULT_LIMIT是默认情况下每个数据报最多允许的分片数量，64KB的数据报按照1500的MTU分片大约是45个
+*/
+#define FRAG_DEFAULT_LIMIT 64
+
+/*
+    frag_orphan_policy决定了找不到第一个分片的后续分片的处理方式
+    分片可能乱序到达，第一个分片也可能已经被LRU淘汰，所以它们不一定是攻击流量
+    orphan_default和通过了所有检查的数据包一样应用'default_action'，orphan_drop直接丢弃，orphan_pass直接交给协议栈
+*/
+enum frag_orphan_policy
+{
+    orphan_default,
+    orphan_drop,
+    orphan_pass,
+    ORPHAN_POLICIES,
+};
+
+/*
+    STEER_MAX_CPUS是CPUMAP引流最多能使用的CPU数量，同时也是CPU编号的上限
+    STEER_DEFAULT_QSIZE是每个目标CPU的队列默认能容纳的数据包数量
+*/
+#define STEER_MAX_CPUS 64
+#define STEER_DEFAULT_QSIZE 2048
+
+/*
+    steer_counters是'steer_stats'的值，下标是目标CPU的编号
+    enqueued是被引流到这个CPU的数据包数量，processed是这个CPU实际从队列中取出处理的数据包数量
+    两者之差就是在队列满了之后被丢弃的数据包数量（加上还在队列中的少量数据包）
+*/
+struct steer_counters
+{
+    __u64 enqueued;
+    __u64 processed;
+};
+
+/*
+    rule_source代表决定了一个数据包命运的规则属于哪一类，rule_none代表没有规则，rule_malformed代表格式错误的数据包
+    RULE_ID把规则的类别和类别内部的细节组合成一个整数，细节的含义取决于类别：
+    端口规则是'PORT_RULE_KEY'，ACL规则是优先级，限速规则是'ratelimit_proto'，分片是'frag_result'，
+    IPv6规则命中/64或/48的哈希表时是前缀的长度，连接跟踪是'ct_result'，格式错误是'malformed_reason'，其他的类别为0
+    在隧道的内层头部上命中的规则和格式错误会再带上RULE_INNER这一位，RULE_DETAIL不包含这一位
+*/
+enum rule_source
+{
+    rule_none,
+    rule_default,
+    rule_mac,
+    rule_v4,
+    rule_v6,
+    rule_port,
+    rule_acl,
+    rule_ratelimit,
+    rule_syncookie,
+    rule_frag,
+    rule_conntrack,
+    rule_malformed,
+    RULE_SOURCES,
+};
+
+#define RULE_INNER (1U << 23)
+#define RULE_ID(source, detail) (((__u32)(source) << 24) | ((__u32)(detail) & (RULE_INNER - 1)))
+#define RULE_SOURCE(rule) ((rule) >> 24)
+#define RULE_DETAIL(rule) ((rule) & (RULE_INNER - 1))
+#define RULE_IS_INNER(rule) (((rule) & RULE_INNER) != 0)
+
+/*
+    malformed_reason代表一个格式错误的数据包在哪一个头部被丢弃，大多数是头部被截断了
+    malformed_ipv6_ext是在'ipv6_ext_depth'个扩展头之内找不到第四层头部，并且'ipv6_ext_policy'为drop的数据包
+    malformed_mpls是在栈底之前被截断的MPLS标签栈
+*/
+enum malformed_reason
+{
+    malformed_eth,
+    malformed_vlan,
+    malformed_ipv4,
+    malformed_ipv6,
+    malformed_ipv6_ext,
+    malformed_udp,
+    malformed_tcp,
+    malformed_mpls,
+    MALFORMED_REASONS,
+};
+
+/*
+    'drop_stats'按照丢弃的原因统计被丢弃的数据包，原因由决定了这个数据包命运的规则得到：
+    规则的类别直接作为下标，格式错误的数据包再按照'malformed_reason'细分，放在所有类别之后
+    在隧道内层命中的原因放在外层的所有原因之后，所以'drop_stats'一共有DROP_REASONS * DROP_LAYERS个元素
+*/
+#define DROP_REASONS (RULE_SOURCES + MALFORMED_REASONS)
+#define DROP_LAYERS 2
+#define DROP_REASON(rule) ((RULE_SOURCE(rule) == rule_malformed ? RULE_SOURCES + RULE_DETAIL(rule) : RULE_SOURCE(rule)) + \
+                           (RULE_IS_INNER(rule) ? DROP_REASONS : 0))
+
+/*
+    CAPTURE_RING_SIZE是抓包使用的ring buffer的大小，必须是页大小的2的幂次倍
+    CAPTURE_MAX_SNAPLEN是每个被抓取的数据包最多保存的字节数
+*/
+#define CAPTURE_RING_SIZE (1 << 22)
+#define CAPTURE_MAX_SNAPLEN 256
+#define CAPTURE_DEFAULT_SNAPLEN 128
+
+/*
+    capture_control是'capture_control'中唯一的元素，由用户态在抓包期间动态调整
+    sample_rate为K代表每K个被丢弃的数据包抽取一个，为0代表不抓包；snaplen代表每个数据包保存的字节数
+*/
+struct capture_control
+{
+    __u32 sample_rate;
+    __u32 snaplen;
+};
+
+/*
+    capture_stats是每个CPU上抓包的统计数据
+    sampled是被抽中的数据包数量，lost是因为ring buffer满了而没能抓取的数量，busy_ns是抓包花费的时间
+*/
+struct capture_stats
+{
+    __u64 sampled;
+    __u64 lost;
+    __u64 busy_ns;
+};
+
+/*
+    capture_record是ring buffer中的一条记录
+    timestamp是bpf_ktime_get_ns的时间，len是数据包的原始长度，caplen是data中实际保存的字节数
+*/
+struct capture_record
+{
+    __u64 timestamp;
+    __u32 rule;
+    __u32 ifindex;
+    __u32 rx_queue;
+    __u32 len;
+    __u32 caplen;
+    __u32 pad;
+    __u8 data[CAPTURE_MAX_SNAPLEN];
+};
+
+/*
+    hash_mix和hash_final是murmur3的32位版本中的混合函数和最终的雪崩处理
+    把需要哈希的字段依次用hash_mix混合进来，最后经过hash_final就得到一个分布均匀的32位哈希值
+    用户态需要计算出和内核完全相同的哈希值（例如布隆过滤器），所以它们定义在这里
+*/
+static __always_inline __u32 hash_mix(__u32 hash, __u32 value)
+{
+    value *= 0xcc9e2d51;
+    value = (value << 15) | (value >> 17);
+    value *= 0x1b873593;
+
+    hash ^= value;
+    hash = (hash << 13) | (hash >> 19);
+
+    return hash * 5 + 0xe6546b64;
+}
+
+static __always_inline __u32 hash_final(__u32 hash)
+{
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+/*
+    MAC_BLOOM_WORDS是'mac_bloom'中64位字的数量，MAC_BLOOM_HASHES是每个MAC地址在其中对应的位的数量
+    4096个字一共262144位，放入4096个MAC地址时的理论误报率大约是0.01%
+*/
+#define MAC_BLOOM_WORDS 4096
+#define MAC_BLOOM_BITS (MAC_BLOOM_WORDS * 64)
+#define MAC_BLOOM_HASHES 3
+
+/*
+    mac_bloom_hashes计算一个MAC地址的两个基础哈希值，第i个位是'(h1 + i * h2) % MAC_BLOOM_BITS'
+    h2总是奇数，这样在2的幂次大小的位图中，不同的i一定对应不同的位
+*/
+static __always_inline void mac_bloom_hashes(const __u8 *mac, __u32 *h1, __u32 *h2)
+{
+    __u32 low = mac[0] | (mac[1] << 8) | (mac[2] << 16) | ((__u32)mac[3] << 24);
+    __u32 high = mac[4] | (mac[5] << 8);
+
+    *h1 = hash_final(hash_mix(hash_mix(0x9747b28c, low), high));
+    *h2 = hash_final(hash_mix(hash_mix(0x5bd1e995, low), high)) | 1;
+}
+
+/*
+    bloom_result代表布隆过滤器的检查结果，也是'mac_bloom_stats'的下标
+    bloom_negative代表过滤器确定地址不在黑名单中，不需要再查哈希表
+    bloom_hit代表过滤器和哈希表都命中，bloom_false_positive代表过滤器命中但哈希表中没有这个地址
+*/
+enum bloom_result
+{
+    bloom_negative,
+    bloom_hit,
+    bloom_false_positive,
+    BLOOM_RESULTS,
+};
+
+/*
+    SKETCH_DEPTH和SKETCH_WIDTH是按源地址统计流量的count-min sketch的行数和每一行的列数，列数必须是2的幂
+    一个地址的估计值是它在每一行中对应的计数的最小值，只会多估不会少估，多估的部分不超过总流量的'e / SKETCH_WIDTH'
+    SKETCH_CANDIDATES是'sketch_candidates'中最多记录的候选地址的数量，sketch本身无法列出其中有哪些地址
+    一个地址在某个CPU上的估计值达到SKETCH_REPORT_MIN之后，每增加SKETCH_REPORT_STRIDE它就被写入一次候选地址，
+    这样被挤出LRU的大流量来源很快就会回来；SKETCH_REPORT_STRIDE必须是2的幂
+*/
+#define SKETCH_DEPTH 4
+#define SKETCH_WIDTH 4096
+#define SKETCH_CANDIDATES 4096
+#define SKETCH_REPORT_MIN 64
+#define SKETCH_REPORT_STRIDE 64
+
+/*
+    sketch_key是一个源地址，也是'sketch_candidates'的键，IPv4地址只使用第一个字
+*/
+struct sketch_key
+{
+    __u32 family;
+    __u32 addr[4];
+};
+
+/*
+    sketch_hashes计算一个源地址的两个基础哈希值，它在第i行中对应的列是'(h1 + i * h2) % SKETCH_WIDTH'
+    和'mac_bloom_hashes'一样，h2总是奇数，用户态需要用它计算出和内核相同的列
+*/
+static __always_inline void sketch_hashes(const struct sketch_key *key, __u32 *h1, __u32 *h2)
+{
+    __u32 hash = hash_mix(0x2f693e1d, key->family);
+    hash = hash_mix(hash, key->addr[0]);
+    hash = hash_mix(hash, key->addr[1]);
+    hash = hash_mix(hash, key->addr[2]);
+    hash = hash_mix(hash, key->addr[3]);
+
+    *h1 = hash_final(hash);
+    *h2 = hash_final(hash_mix(hash, 0x5bd1e995)) | 1;
+}
+
+#define SKETCH_INDEX(row, h1, h2) ((row) * SKETCH_WIDTH + (((h1) + (row) * (h2)) & (SKETCH_WIDTH - 1)))
+
+/*
+    hll_registers是估计不同源地址数量的HyperLogLog，每个CPU有一份，用户态把它们逐个取最大值合并
+    源地址哈希值'h1'的高HLL_PRECISION位选择一个寄存器，其余的位中第一个1的位置（从1开始）是这个地址的秩，寄存器保存见过的最大的秩
+    4096个寄存器的标准误差大约是1.6%，不论有多少个源地址，内存都是固定的
+*/
+#define HLL_PRECISION 12
+#define HLL_REGISTERS (1 << HLL_PRECISION)
+
+struct hll_registers
+{
+    __u8 registers[HLL_REGISTERS];
+};
+
+/*
+    hll_meta是'hll_meta'中唯一的元素，reset_ns是用户态最后一次清空寄存器的时间
+    用户态按照'--hll-interval'定期清空寄存器，last_estimate和last_interval_ns是清空之前那个完整区间的估计值和长度，
+    用它们计算每秒的不同源地址数量，为0代表还没有完整的区间
+*/
+struct hll_meta
+{
+    __u64 reset_ns;
+    __u64 last_estimate;
+    __u64 last_interval_ns;
+};
+
+/*
+    XSK_MAX_QUEUES是'xsk_map'中最多能绑定的网卡队列的数量，同时也是队列编号的上限
+*/
+#define XSK_MAX_QUEUES 64
+
+/*
+    IPV6_EXT_MAX_DEPTH是parse_ipv6最多能够跳过的IPv6扩展头的数量
+*/
+#define IPV6_EXT_MAX_DEPTH 6
+
+/*
+    ipv6_ext_policy决定了无法找到第四层头部的IPv6数据包的处理方式
+    这些数据包的扩展头超过了配置的数量，或者是不包含第四层头部的后续分片，它们无法经过端口的检查
+    ipv6_ext_drop直接丢弃，ipv6_ext_pass跳过第四层的检查继续处理，ipv6_ext_count和ipv6_ext_pass相同，但是会进行计数
+*/
+enum ipv6_ext_policy
+{
+    ipv6_ext_drop,
+    ipv6_ext_pass,
+    ipv6_ext_count,
+    IPV6_EXT_POLICIES,
+};
+
+/*
+    ipv6_ext_result用作'ipv6_ext_stats'的索引，只有在ipv6_ext_count模式下才会计数
+    ipv6_ext_resolved代表带有扩展头并且成功找到了第四层头部的数据包，ipv6_ext_unresolved则代表没有找到的数据包
+*/
+enum ipv6_ext_result
+{
+    ipv6_ext_resolved,
+    ipv6_ext_unresolved,
+    IPV6_EXT_RESULTS,
+};
+
+/*
+    TCP头部第13个字节中的标志位，'context'中的'tcp_flags'就是这个字节
+*/
+#define CT_TCP_FIN 0x01
+#define CT_TCP_SYN 0x02
+#define CT_TCP_RST 0x04
+#define CT_TCP_ACK 0x10
+
+/*
+    ct_mode代表连接跟踪的工作模式
+    ct_on代表通过了所有检查的TCP/UDP流会被记录下来，之后同一条连接上的数据包（包括回复）不再经过任何一层的检查
+    ct_strict在此基础上丢弃不属于任何已知连接、又不是SYN或SYN-ACK的TCP数据包，也就是只允许新建的和已经建立的连接
+*/
+enum ct_mode
+{
+    ct_off,
+    ct_on,
+    ct_strict,
+    CT_MODES,
+};
+
+/*
+    ct_state代表一条连接在连接跟踪表中的状态
+    XDP只能看到进入网卡的数据包，所以这个状态机是根据单个方向也能推进的方式设计的：
+    例如本机发起的连接，我们只会看到对方的SYN-ACK和之后的数据包，收到SYN-ACK之后的下一个ACK就认为连接已经建立
+    UDP没有握手，只看到一个方向的数据包时是ct_udp_new，两个方向都出现过之后是ct_udp_stream，超时时间更长
+*/
+enum ct_state
+{
+    ct_syn_sent,
+    ct_syn_recv,
+    ct_established,
+    ct_fin_wait,
+    ct_time_wait,
+    ct_close,
+    ct_udp_new,
+    ct_udp_stream,
+    CT_STATES,
+};
+
+/*
+    每个状态下的连接多久没有数据包之后过期，单位为秒
+*/
+#define CT_TIMEOUT_SYN_SENT 120
+#define CT_TIMEOUT_SYN_RECV 60
+#define CT_TIMEOUT_ESTABLISHED 3600
+#define CT_TIMEOUT_FIN_WAIT 120
+#define CT_TIMEOUT_TIME_WAIT 120
+#define CT_TIMEOUT_CLOSE 10
+#define CT_TIMEOUT_UDP 30
+#define CT_TIMEOUT_UDP_STREAM 180
+
+/*
+    ct_result用作'conntrack_stats'的索引
+    ct_hit代表属于已知连接、跳过了所有检查的数据包，ct_new代表新记录的连接
+    ct_expired代表找到了已经超时的连接，ct_stale代表找到的连接是在黑名单修改之前记录的，需要重新检查
+    ct_invalid代表ct_strict模式下被丢弃的数据包
+*/
+enum ct_result
+{
+    ct_hit,
+    ct_new,
+    ct_expired,
+    ct_stale,
+    ct_invalid,
+    CT_RESULTS,
+};
+
+/*
+    ct_key是连接跟踪表的键，代表经过了规范化的五元组
+    两端的地址和端口按照大小排列，较小的一端放在'a'，这样同一条连接两个方向的数据包会得到相同的键
+    IPv4地址只占用地址字段的前4个字节，'family'是4或6，整个结构的大小为40字节，没有隐藏的填充字节
+*/
+struct ct_key
+{
+    __u8 addr_a[16];
+    __u8 addr_b[16];
+    __u16 port_a;
+    __u16 port_b;
+    __u8 proto;
+    __u8 family;
+    __u8 pad[2];
+};
+
+/*
+    ct_entry是连接跟踪表的值
+    last_seen是最后一个数据包到达的时间，单位为纳秒，和'bpf_ktime_get_ns'使用同一个时钟
+    generation是记录这条连接时黑名单的版本号，黑名单修改之后连接上的下一个数据包需要重新经过检查
+    initiator是发起连接的一端，0代表'a'，1代表'b'，fin_seen的两位分别代表两端是否发送过FIN
+*/
+struct ct_entry
+{
+    __u64 last_seen;
+    __u64 packets;
+    __u64 bytes;
+    __u32 generation;
+    __u8 state;
+    __u8 initiator;
+    __u8 fin_seen;
+    __u8 pad;
+};
+
+/*
+    VLAN_MAX_DEPTH是parse_eth最多能够解开的vlan头的层数
+*/
+#define VLAN_MAX_DEPTH 2
+
+/*
+    tunnel_type代表parse_tunnel能够解开的封装，也是'tunnel_stats'的下标，TUNNEL_BIT用来在'xdpfw_config'的'tunnels'中表示其中一种
+    vxlan是目的端口为VXLAN_PORT的UDP，gre是版本0的GRE，内层可以是以太网、IPv4、IPv6或MPLS，ipip是IPv4或IPv6中直接封装的IPv4或IPv6
+    mpls是以太网或GRE之后的MPLS标签栈，最多跳过MPLS_MAX_DEPTH个标签，栈底之后按照第一个字节的高4位判断是IPv4还是IPv6
+    以太网之后的MPLS没有外层的IP头部，所以标签栈之后的IP头部直接被当作外层的第三层检查，它不会设置context中的'tunnel'
+    只解开一层封装，内层之中的封装不会被继续解开
+*/
+enum tunnel_type
+{
+    tunnel_none,
+    tunnel_vxlan,
+    tunnel_gre,
+    tunnel_ipip,
+    tunnel_mpls,
+    TUNNEL_TYPES,
+};
+
+#define TUNNEL_BIT(type) (1U << (type))
+#define VXLAN_PORT 4789
+#define MPLS_MAX_DEPTH 8
+
+/*
+    tunnel_stats是'tunnel_stats'中每种封装的计数
+    decapsulated是解开了封装、内层头部会被检查的数据包，unparsed是看起来是这种封装但是无法解开的数据包，
+    例如GRE的版本不是0、VXLAN没有设置I标志位、MPLS标签栈太深或者内层不是IP，它们只检查外层
+*/
+struct tunnel_stats
+{
+    __u64 decapsulated;
+    __u64 unparsed;
+};
+
+/*
+    STAGE_BIT用来在'xdpfw_config'的'layers'中表示流水线中的某一层
+*/
+#define STAGE_BIT(stage) (1U << (stage))
+#define XDPFW_ALL_LAYERS (STAGE_BIT(stage_mac) | STAGE_BIT(stage_l3) | STAGE_BIT(stage_l4) | STAGE_BIT(stage_acl) | \
+                          STAGE_BIT(stage_syncookie))
+
+/*
+    xdpfw_config是xdpfw_kern.o的加载时配置，它以'const volatile'全局变量的形式存放在程序的.rodata段中
+    用户态在加载程序之前写入这些值，加载之后它们对于验证器和JIT来说就是常量，
+    所以被关闭的功能对应的分支会在加载时被直接删除，而不是在每个数据包上都去判断一次
+    修改其中任何一个值都需要重新加载程序
+
+    default_action代表通过了所有检查的数据包最终返回的action
+    layers代表启用了流水线中的哪几层，每一位对应一个'xdpfw_stage'
+    vlan_depth代表最多解开几层vlan头，不能超过VLAN_MAX_DEPTH
+    ipv4和ipv6代表是否解析和检查对应版本的IP数据包
+    ratelimit代表是否对每个源地址进行限速
+    ipv6_ext_depth代表最多跳过几个IPv6扩展头，不能超过IPV6_EXT_MAX_DEPTH，ipv6_ext_policy的含义见'ipv6_ext_policy'
+    frag_limit代表每个IPv4数据报最多允许的分片数量，为0代表不限制
+    frag_orphan代表找不到第一个分片的后续分片的处理方式，取值为'frag_orphan_policy'中的一个
+    v4_engine代表IPv4源地址黑名单使用的查找引擎，取值为'v4_engine'中的一个
+    mac_bloom代表是否在查询'mac_blacklist'之前先检查布隆过滤器'mac_bloom'
+    conntrack代表连接跟踪的工作模式，取值为'ct_mode'中的一个
+    sketch代表是否对每个数据包按照源地址更新count-min sketch和HyperLogLog
+    tunnels代表解开哪些封装，每一位对应一个'tunnel_type'，为0代表只检查最外层的头部
+    flows代表是否按照五元组统计每条流的数据包和字节数，并通过'flow_ring'导出
+    steer_cpus和steer_cpu_count代表把通过检查的数据包引流到哪些CPU上，steer_cpu_count为0代表不进行引流
+*/
+struct xdpfw_config
+{
+    __u32 default_action;
+    __u32 layers;
+    __u32 vlan_depth;
+    __u32 ipv4;
+    __u32 ipv6;
+    __u32 ratelimit;
+    __u32 ipv6_ext_depth;
+    __u32 ipv6_ext_policy;
+    __u32 frag_limit;
+    __u32 frag_orphan;
+    __u32 mac_bloom;
+    __u32 v4_engine;
+    __u32 conntrack;
+    __u32 sketch;
+    __u32 tunnels;
+    __u32 flows;
+    __u32 steer_cpu_count;
+    __u32 steer_cpus[STEER_MAX_CPUS];
 };
 
 #ifndef XDP_MAX_ACTIONS
 #define XDP_MAX_ACTIONS (XDP_REDIRECT + 1)
 #endif
 
+/*
+    XDPFW_ACCEPT是流水线内部使用的结果，代表数据包命中了白名单，检查立即结束并通过，不再应用'default_action'
+    它只在流水线和流表缓存中出现，返回给内核之前一定会被转换为XDP_PASS
+*/
+#define XDPFW_ACCEPT XDP_MAX_ACTIONS
+
 #endif /* _COMMON_H */
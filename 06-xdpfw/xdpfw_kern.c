@@ -9,11 +9,34 @@
 #include <linux/in.h>
 
 #include "xdpfw_kern_utils.h"
+#include "xdpfw_kern_profile.h"
+
+#include "xdpfw_kern_ratelimit.h"
+#include "xdpfw_kern_policy.h"
 
 #include "xdpfw_kern_l2.h"
+#include "xdpfw_kern_dir24.h"
 #include "xdpfw_kern_l3.h"
 #include "xdpfw_kern_l4.h"
+#include "xdpfw_kern_tunnel.h"
+#include "xdpfw_kern_acl.h"
+#include "xdpfw_kern_syncookie.h"
+
+#include "xdpfw_kern_frag.h"
+#include "xdpfw_kern_xsk.h"
+#include "xdpfw_kern_steer.h"
+#include "xdpfw_kern_capture.h"
+#include "xdpfw_kern_cache.h"
+#include "xdpfw_kern_flow.h"
+#include "xdpfw_kern_sketch.h"
+#include "xdpfw_kern_conntrack.h"
+#include "xdpfw_kern_pipeline.h"
 
+/*
+    xdpfw_fn是整个防火墙的入口
+    它只负责解析数据包的各层头部并查询流表缓存，真正的黑名单检查被拆分成了下面几个独立的程序，
+    通过'xdpfw_stages'中的尾调用串联起来，用户态可以在运行时把没有规则的层从流水线中拿掉
+*/
 SEC("xdpfw")
 int xdpfw_fn(struct xdp_md *xdp_ctx)
 {
@@ -26,41 +49,51 @@ int xdpfw_fn(struct xdp_md *xdp_ctx)
         将提供的'xdp_md'结构转换为我们自定义的'context'结构，以便于后续处理。
     */
     struct context ctx = to_ctx(xdp_ctx);
+    prof_begin(&ctx);
 
     /*
-        解析我们的以太网头，并从这个数据包中解开任何潜在的vlan头。同时还要确保这个数据包的源MAC地址不在我们的黑名单中
+        解析我们的以太网头，并从这个数据包中解开任何潜在的vlan头
     */
     action = parse_eth(&ctx);
+
+    /*
+        启用了MPLS时，以太网之后的MPLS标签栈和vlan头一样被跳过
+    */
+    if (action == XDP_PASS && (config.tunnels & TUNNEL_BIT(tunnel_mpls)))
+    {
+        action = skip_mpls(&ctx);
+    }
+    prof_mark(&ctx, prof_parse_l2);
     if (action != XDP_PASS)
     {
         goto ret;
     }
 
     /*
-        检查这个数据包中包含的第三层协议，在这种情况下，我们只关心IPv4和IPv6，所以如果它不是其中之一
-        就返回最后设置的action。
+        检查这个数据包中包含的第三层协议，在这种情况下，我们只关心IPv4和IPv6
+        其他协议的数据包不需要继续解析，但仍然要经过MAC这一层的检查
+        加载时关闭了的IP版本会被当作其他协议处理
+        l3_parsed记录是否解析了IP头部，只有这时'nh_proto'才是第四层的协议号，否则它仍然是以太网协议号
     */
+    int l3_parsed = 0;
     switch (ctx.nh_proto)
     {
     case ETH_P_IP:
-        /*
-            我们有一个IPv4数据包，所以让我们解析出它的源地址，并根据我们的黑名单检查它，看看我们是否应该放弃它
-        */
-        action = parse_ipv4(&ctx);
+        if (config.ipv4)
+        {
+            action = parse_ipv4(&ctx);
+            l3_parsed = 1;
+        }
         break;
     case ETH_P_IPV6:
-        /*
-            我们有一个IPv6数据包，所以让我们解析出它的源地址，并对照我们的黑名单
-            看看我们是否应该丢弃它。如果不是，就抓取下一个头，继续处理下一层协议。
-        */
-        action = parse_ipv6(&ctx);
+        if (config.ipv6)
+        {
+            action = parse_ipv6(&ctx);
+            l3_parsed = 1;
+        }
         break;
-    default:
-        /*
-            不是ipv4或者ipv6的数据包
-        */
-        goto ret;
     }
+    prof_mark(&ctx, prof_parse_l3);
 
     if (action != XDP_PASS)
     {
@@ -71,29 +104,256 @@ int xdpfw_fn(struct xdp_md *xdp_ctx)
     }
 
     /*
-        检查TCP和UDP
+        按照源地址统计流量，这里在所有的检查之前，所以之后被丢弃的数据包也会被计入
     */
-    switch (ctx.nh_proto)
+    if (config.sketch)
     {
-    case IPPROTO_UDP:
-        /*
-            检查udp
-        */
-        action = parse_udp(&ctx);
-        break;
-    case IPPROTO_TCP:
-        /*
-            检查tcp
-        */
-        action = parse_tcp(&ctx);
-        break;
+        update_sketch(&ctx);
+    }
+
+    /*
+        IPv4的后续分片中没有第四层的头部，它们直接继承第一个分片的结果，不再进行任何检查
+        记录下来的已经是最终的结果，所以这里不需要再应用'default_action'
+    */
+    if (ctx.frag == ipv4_frag_later)
+    {
+        return end_packet(&ctx, check_fragment(&ctx));
+    }
+
+    /*
+        确保TCP和UDP的头部是完整的，不是IP的数据包没有第四层
+    */
+    if (l3_parsed)
+    {
+        switch (ctx.nh_proto)
+        {
+        case IPPROTO_UDP:
+            action = parse_udp(&ctx);
+            break;
+        case IPPROTO_TCP:
+            action = parse_tcp(&ctx);
+            break;
+        }
+    }
+
+    /*
+        解开加载时启用了的封装，流水线中的MAC、第三层和第四层的检查会在外层之后再检查一次内层
+    */
+    if (action == XDP_PASS && config.tunnels)
+    {
+        action = parse_tunnel(&ctx);
+    }
+    prof_mark(&ctx, prof_parse_l4);
+
+    if (action != XDP_PASS)
+    {
+        goto ret;
+    }
+
+    /*
+        按照五元组统计流量，和sketch一样在所有的检查之前进行，之后被丢弃的数据包也会被计入
+    */
+    if (config.flows)
+    {
+        update_flow_table(&ctx);
+    }
+
+    /*
+        对源地址进行限速
+        限速必须在查询流表缓存之前进行，否则已经被缓存的流就可以绕过限速
+    */
+    if (config.ratelimit)
+    {
+        action = check_ratelimit(&ctx);
+        if (action != XDP_PASS)
+        {
+            goto ret;
+        }
+    }
+
+    ctx.generation = get_flow_generation();
+
+    /*
+        开启了连接跟踪时，属于已知连接的数据包（包括回复）直接通过，跳过流表缓存和所有的检查
+        和流表缓存一样，它必须在限速之后进行，否则已经建立的连接就可以绕过限速
+        解开了封装的数据包不查询连接跟踪和流表缓存，它们都只记录了外层的五元组
+    */
+    if (config.conntrack != ct_off && ctx.tunnel == tunnel_none && ct_track(&ctx, &action))
+    {
+        goto ret;
+    }
+
+    /*
+        在流表缓存中查找这条流
+        如果命中并且缓存的结果仍然有效，就直接使用缓存的结果，跳过所有的黑名单检查
+    */
+    if (ctx.tunnel == tunnel_none && lookup_flow_cache(&ctx, &action))
+    {
+        action = accept_flow(&ctx, action);
+        goto ret;
     }
 
-ret:
     /*
-        更新counter
+        从当前这一份流水线的第一层开始进行检查
     */
-    return update_action_stats(&ctx, action);
+    prof_mark(&ctx, prof_prefilter);
+    ctx.stage = (ctx.generation & 1) * XDPFW_PIPELINE_SLOTS;
+    return next_stage(xdp_ctx, &ctx);
+
+ret:
+    return end_packet(&ctx, action);
+}
+
+/*
+    xdpfw_mac_fn是流水线中MAC这一层的检查，对应common.h中的'stage_mac'
+    下面每一层的检查都先判断这一层是否在加载时被启用，被关闭的层在加载时就会变成一个直接继续下一层的空程序
+    MAC、第三层和第四层在外层通过之后，如果数据包被解开了封装，再用swap_layers换到内层检查一次
+*/
+SEC("xdpfw/mac")
+int xdpfw_mac_fn(struct xdp_md *xdp_ctx)
+{
+    struct context ctx;
+    if (restore_ctx(xdp_ctx, &ctx) != 0)
+    {
+        return XDP_ABORTED;
+    }
+
+    __u32 action = XDP_PASS;
+    if (config.layers & STAGE_BIT(stage_mac))
+    {
+        action = check_eth(&ctx);
+        if (action == XDP_PASS && ctx.inner_eth)
+        {
+            swap_layers(&ctx);
+            action = check_eth(&ctx);
+            swap_layers(&ctx);
+        }
+    }
+
+    prof_mark(&ctx, stage_mac);
+    return end_stage(xdp_ctx, &ctx, action);
+}
+
+/*
+    xdpfw_l3_fn是流水线中第三层的检查，对应common.h中的'stage_l3'
+*/
+SEC("xdpfw/l3")
+int xdpfw_l3_fn(struct xdp_md *xdp_ctx)
+{
+    struct context ctx;
+    if (restore_ctx(xdp_ctx, &ctx) != 0)
+    {
+        return XDP_ABORTED;
+    }
+
+    __u32 action = XDP_PASS;
+    if (config.layers & STAGE_BIT(stage_l3))
+    {
+        action = check_l3(&ctx);
+        if (action == XDP_PASS && ctx.tunnel != tunnel_none)
+        {
+            swap_layers(&ctx);
+            action = check_l3(&ctx);
+            swap_layers(&ctx);
+        }
+    }
+
+    prof_mark(&ctx, stage_l3);
+    return end_stage(xdp_ctx, &ctx, action);
+}
+
+/*
+    xdpfw_l4_fn是流水线中第四层的检查，对应common.h中的'stage_l4'
+*/
+SEC("xdpfw/l4")
+int xdpfw_l4_fn(struct xdp_md *xdp_ctx)
+{
+    struct context ctx;
+    if (restore_ctx(xdp_ctx, &ctx) != 0)
+    {
+        return XDP_ABORTED;
+    }
+
+    __u32 action = XDP_PASS;
+    if (config.layers & STAGE_BIT(stage_l4))
+    {
+        action = check_l4(&ctx);
+        if (action == XDP_PASS && ctx.tunnel != tunnel_none)
+        {
+            swap_layers(&ctx);
+            action = check_l4(&ctx);
+            swap_layers(&ctx);
+        }
+    }
+
+    prof_mark(&ctx, stage_l4);
+    return end_stage(xdp_ctx, &ctx, action);
+}
+
+/*
+    xdpfw_acl_fn是流水线中ACL这一层的检查，对应common.h中的'stage_acl'
+*/
+SEC("xdpfw/acl")
+int xdpfw_acl_fn(struct xdp_md *xdp_ctx)
+{
+    struct context ctx;
+    if (restore_ctx(xdp_ctx, &ctx) != 0)
+    {
+        return XDP_ABORTED;
+    }
+
+    __u32 action = XDP_PASS;
+    if (config.layers & STAGE_BIT(stage_acl))
+    {
+        action = check_acl(&ctx);
+    }
+
+    prof_mark(&ctx, stage_acl);
+    return end_stage(xdp_ctx, &ctx, action);
+}
+
+/*
+    xdpfw_syncookie_fn是流水线中SYN cookie这一层的检查，对应common.h中的'stage_syncookie'
+    它是流水线的最后一层，这样被黑名单拦截的SYN就不会得到回复
+*/
+SEC("xdpfw/syncookie")
+int xdpfw_syncookie_fn(struct xdp_md *xdp_ctx)
+{
+    struct context ctx;
+    if (restore_ctx(xdp_ctx, &ctx) != 0)
+    {
+        return XDP_ABORTED;
+    }
+
+    __u32 action = XDP_PASS;
+    if (config.layers & STAGE_BIT(stage_syncookie))
+    {
+        action = check_syncookie(xdp_ctx, &ctx);
+        if (action == XDP_DROP)
+        {
+            ctx.rule = RULE_ID(rule_syncookie, 0);
+        }
+    }
+
+    prof_mark(&ctx, stage_syncookie);
+    return end_stage(xdp_ctx, &ctx, action);
+}
+
+/*
+    xdpfw_steer_fn挂载在'cpu_map'的每个条目上，在目标CPU从队列中取出数据包时运行
+    它只负责统计这个CPU实际处理了多少个数据包，然后把数据包交给协议栈
+*/
+SEC("xdp_cpumap/steer")
+int xdpfw_steer_fn(struct xdp_md *xdp_ctx)
+{
+    __u32 cpu = bpf_get_smp_processor_id();
+    struct steer_counters *counters = bpf_map_lookup_elem(&steer_stats, &cpu);
+    if (counters)
+    {
+        counters->processed += 1;
+    }
+
+    return XDP_PASS;
 }
 
-char _license[] SEC("license") = "GPL";
+char _license[] SEC("license") = "GPL";
\ No newline at end of file
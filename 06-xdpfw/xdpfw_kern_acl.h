@@ -0,0 +1,146 @@
+#ifndef _XDPFW_KERN_ACL_H
+#define _XDPFW_KERN_ACL_H
+
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/udp.h>
+
+/*
+    这个定义代表了ACL中最多能有多少条规则
+*/
+#ifndef ACL_RULES_MAX_ENTRIES
+#define ACL_RULES_MAX_ENTRIES 65536
+#endif
+
+/*
+    acl_tuples保存了所有元组的描述，下标就是元组的ID，结构的定义见common.h中的'acl_tuple'
+*/
+struct bpf_map_def SEC("maps") acl_tuples = {
+    .type = BPF_MAP_TYPE_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(struct acl_tuple),
+    .max_entries = ACL_MAX_TUPLES,
+};
+
+/*
+    acl_rules保存了所有的ACL规则，键是按照所属元组的掩码处理过的五元组加上元组的ID
+    所有的元组共用这一个哈希表
+*/
+struct bpf_map_def SEC("maps") acl_rules = {
+    .type = BPF_MAP_TYPE_HASH,
+    .key_size = sizeof(struct acl_key),
+    .value_size = sizeof(struct acl_rule),
+    .max_entries = ACL_RULES_MAX_ENTRIES,
+    .map_flags = BPF_F_NO_PREALLOC,
+};
+
+/*
+    check_acl是流水线中ACL这一层的检查
+    它依次在每个元组中查找这个数据包，最后返回匹配到的优先级最高的那条规则的action
+    如果没有匹配到任何规则，则返回XDP_PASS继续下一层
+*/
+static __always_inline __u32 check_acl(struct context *ctx)
+{
+    /*
+        先取出这个数据包未经掩码处理的各个字段
+    */
+    struct acl_key packet = {};
+
+    if (ctx->l3_proto == ETH_P_IP)
+    {
+        struct iphdr *ip = ctx->data_start + ctx->l3_offset;
+        if (ip + 1 > ctx->data_end)
+        {
+            return drop_malformed(ctx, malformed_ipv4);
+        }
+
+        packet.family = 4;
+        packet.src_addr[0] = ip->saddr;
+        packet.dst_addr[0] = ip->daddr;
+    }
+    else if (ctx->l3_proto == ETH_P_IPV6)
+    {
+        struct ipv6hdr *ip = ctx->data_start + ctx->l3_offset;
+        if (ip + 1 > ctx->data_end)
+        {
+            return drop_malformed(ctx, malformed_ipv6);
+        }
+
+        packet.family = 6;
+        __builtin_memcpy(packet.src_addr, &ip->saddr, sizeof(packet.src_addr));
+        __builtin_memcpy(packet.dst_addr, &ip->daddr, sizeof(packet.dst_addr));
+    }
+    else
+    {
+        return XDP_PASS;
+    }
+
+    packet.proto = ctx->l4_proto;
+
+    /*
+        TCP和UDP头部的前4个字节都是源端口和目的端口，所以这里统一按照udphdr来读取
+        其他协议的端口保持为0
+    */
+    if (ctx->l4_proto == IPPROTO_TCP || ctx->l4_proto == IPPROTO_UDP)
+    {
+        struct udphdr *l4 = ctx->data_start + ctx->l4_offset;
+        if (l4 + 1 > ctx->data_end)
+        {
+            return drop_malformed(ctx, ctx->l4_proto == IPPROTO_TCP ? malformed_tcp : malformed_udp);
+        }
+
+        packet.src_port = l4->source;
+        packet.dst_port = l4->dest;
+    }
+
+    __u32 best_priority = 0xffffffff;
+    __u32 action = XDP_PASS;
+
+    /*
+        元组的数量有上限，所以这个循环可以被展开
+        空的元组、地址族不同的元组，以及最高优先级都不如已经匹配到的规则的元组都会被直接跳过，不需要进行哈希查找
+    */
+#pragma unroll
+    for (__u32 i = 0; i < ACL_MAX_TUPLES; i++)
+    {
+        __u32 idx = i;
+        struct acl_tuple *tuple = bpf_map_lookup_elem(&acl_tuples, &idx);
+        if (!tuple || tuple->rules == 0 || tuple->family != packet.family || tuple->priority >= best_priority)
+        {
+            continue;
+        }
+
+        struct acl_key key = {
+            .tuple = i,
+            .family = packet.family,
+            .proto = packet.proto & tuple->proto_mask,
+            .src_port = packet.src_port & tuple->src_port_mask,
+            .dst_port = packet.dst_port & tuple->dst_port_mask,
+        };
+
+#pragma unroll
+        for (int j = 0; j < 4; j++)
+        {
+            key.src_addr[j] = packet.src_addr[j] & tuple->src_mask[j];
+            key.dst_addr[j] = packet.dst_addr[j] & tuple->dst_mask[j];
+        }
+
+        struct acl_rule *rule = bpf_map_lookup_elem(&acl_rules, &key);
+        if (rule && rule->priority < best_priority)
+        {
+            best_priority = rule->priority;
+            action = rule->action;
+        }
+    }
+
+    if (best_priority != 0xffffffff)
+    {
+        ctx->rule = RULE_ID(rule_acl, best_priority);
+    }
+
+    return action;
+}
+
+#endif // _XDPFW_KERN_ACL_H
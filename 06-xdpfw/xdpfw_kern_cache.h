@@ -0,0 +1,192 @@
+#ifndef _XDPFW_KERN_CACHE_H
+#define _XDPFW_KERN_CACHE_H
+
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+
+/*
+    这个定义代表了流表缓存中每个CPU最多能够缓存的流的数量
+*/
+#ifndef FLOW_CACHE_MAX_ENTRIES
+#define FLOW_CACHE_MAX_ENTRIES 65536
+#endif
+
+/*
+    flow_cache保存了每条流最后一次的判定结果，其类型为'BPF_MAP_TYPE_LRU_PERCPU_HASH'
+    这样对于一条已经建立的流来说，每个数据包只需要一次哈希查找，而不是依次查询mac_blacklist、v4/v6_blacklist和两次port_blacklist
+    使用PERCPU的版本是因为同一条流的数据包基本上总是落在同一个CPU上，这样内核更新缓存时就不需要考虑锁的问题
+    而LRU则保证了缓存满了之后，最久没有被访问的流会被自动淘汰
+    注意LRU类型的MAP不支持'BPF_F_NO_PREALLOC'
+*/
+struct bpf_map_def SEC("maps") flow_cache = {
+    .type = BPF_MAP_TYPE_LRU_PERCPU_HASH,
+    .key_size = sizeof(struct flow_key),
+    .value_size = sizeof(struct flow_verdict),
+    .max_entries = FLOW_CACHE_MAX_ENTRIES,
+};
+
+/*
+    flow_generation只有一个元素，代表黑名单当前的版本号
+    用户态每次插入或删除黑名单中的条目时都会将它加1，从而让所有旧的缓存项失效
+    它的最低位同时决定了数据包使用'xdpfw_stages'中的哪一份流水线
+*/
+struct bpf_map_def SEC("maps") flow_generation = {
+    .type = BPF_MAP_TYPE_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(__u32),
+    .max_entries = 1,
+};
+
+/*
+    flow_cache_stats用来统计流表缓存的命中和未命中次数，索引为common.h中定义的'flow_cache_result'
+*/
+struct bpf_map_def SEC("maps") flow_cache_stats = {
+    .type = BPF_MAP_TYPE_PERCPU_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(__u64),
+    .max_entries = FLOW_CACHE_RESULTS,
+};
+
+/*
+    build_flow_key根据parse_eth和parse_ipv4/parse_ipv6记录下来的偏移，从数据包中取出流的五元组以及源MAC地址
+    只有完整的IPv4/IPv6的TCP/UDP数据包才能被缓存，其他情况返回-1
+*/
+static __always_inline int build_flow_key(struct context *ctx, struct flow_key *key)
+{
+    if (ctx->l4_proto != IPPROTO_TCP && ctx->l4_proto != IPPROTO_UDP)
+    {
+        return -1;
+    }
+
+    /*
+        因为键会被直接按字节进行哈希，所以必须先把包括填充字节在内的整个键清零
+    */
+    __builtin_memset(key, 0, sizeof(*key));
+
+    struct ethhdr *eth = ctx->data_start;
+    if (eth + 1 > ctx->data_end)
+    {
+        return -1;
+    }
+
+    __builtin_memcpy(key->src_mac, eth->h_source, sizeof(key->src_mac));
+
+    if (ctx->l3_proto == ETH_P_IP)
+    {
+        struct iphdr *ip = ctx->data_start + ctx->l3_offset;
+        if (ip + 1 > ctx->data_end)
+        {
+            return -1;
+        }
+
+        __builtin_memcpy(key->src_addr, &ip->saddr, sizeof(ip->saddr));
+        __builtin_memcpy(key->dst_addr, &ip->daddr, sizeof(ip->daddr));
+    }
+    else if (ctx->l3_proto == ETH_P_IPV6)
+    {
+        struct ipv6hdr *ip = ctx->data_start + ctx->l3_offset;
+        if (ip + 1 > ctx->data_end)
+        {
+            return -1;
+        }
+
+        __builtin_memcpy(key->src_addr, &ip->saddr, sizeof(ip->saddr));
+        __builtin_memcpy(key->dst_addr, &ip->daddr, sizeof(ip->daddr));
+    }
+    else
+    {
+        return -1;
+    }
+
+    /*
+        TCP和UDP头部的前4个字节都是源端口和目的端口，所以这里统一按照udphdr来读取
+    */
+    struct udphdr *l4 = ctx->data_start + ctx->l4_offset;
+    if (l4 + 1 > ctx->data_end)
+    {
+        return -1;
+    }
+
+    key->proto = ctx->l4_proto;
+    key->src_port = l4->source;
+    key->dst_port = l4->dest;
+
+    return 0;
+}
+
+/*
+    update_flow_cache_stats更新flow_cache_stats中对应查询结果的计数
+*/
+static __always_inline void update_flow_cache_stats(__u32 result)
+{
+    __u64 *count = bpf_map_lookup_elem(&flow_cache_stats, &result);
+    if (count)
+    {
+        *count += 1;
+    }
+}
+
+/*
+    get_flow_generation返回黑名单当前的版本号
+*/
+static __always_inline __u32 get_flow_generation()
+{
+    __u32 idx = 0;
+    __u32 *generation = bpf_map_lookup_elem(&flow_generation, &idx);
+    if (!generation)
+    {
+        return 0;
+    }
+
+    return *generation;
+}
+
+/*
+    lookup_flow_cache在流表缓存中查找这条流
+    只有在缓存项存在，并且它的版本号和进入流水线时黑名单的版本号一致时才算命中，此时将缓存的结果写入'action'并返回1
+*/
+static __always_inline int lookup_flow_cache(struct context *ctx, __u32 *action)
+{
+    struct flow_key key;
+    if (build_flow_key(ctx, &key) != 0)
+    {
+        return 0;
+    }
+
+    struct flow_verdict *verdict = bpf_map_lookup_elem(&flow_cache, &key);
+    if (!verdict || verdict->generation != ctx->generation)
+    {
+        update_flow_cache_stats(flow_cache_miss);
+        return 0;
+    }
+
+    update_flow_cache_stats(flow_cache_hit);
+    *action = verdict->action;
+
+    return 1;
+}
+
+/*
+    update_flow_cache将这条流经过完整检查之后得到的结果写入流表缓存
+*/
+static __always_inline void update_flow_cache(struct context *ctx, __u32 action)
+{
+    struct flow_key key;
+    if (build_flow_key(ctx, &key) != 0)
+    {
+        return;
+    }
+
+    struct flow_verdict verdict = {
+        .action = action,
+        .generation = ctx->generation,
+    };
+
+    bpf_map_update_elem(&flow_cache, &key, &verdict, BPF_ANY);
+}
+
+#endif // _XDPFW_KERN_CACHE_H
@@ -0,0 +1,111 @@
+#ifndef _XDPFW_KERN_CAPTURE_H
+#define _XDPFW_KERN_CAPTURE_H
+
+/*
+    capture_ring是把被丢弃的数据包送到用户态的'BPF_MAP_TYPE_RINGBUF'，每条记录是一个'capture_record'
+    它被所有的CPU共享，用户态的'xdpfw_user --capture'从中批量读取记录并写入pcap文件
+*/
+struct bpf_map_def SEC("maps") capture_ring = {
+    .type = BPF_MAP_TYPE_RINGBUF,
+    .max_entries = CAPTURE_RING_SIZE,
+};
+
+/*
+    capture_control保存了抽样率和抓取长度，结构的定义见common.h中的'capture_control'
+    默认的抽样率为0，也就是不抓包，这时被丢弃的数据包只多了一次数组查找的开销
+*/
+struct bpf_map_def SEC("maps") capture_control = {
+    .type = BPF_MAP_TYPE_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(struct capture_control),
+    .max_entries = 1,
+};
+
+/*
+    capture_stats统计每个CPU上抓包的开销，用户态根据其中的'busy_ns'动态调整抽样率
+*/
+struct bpf_map_def SEC("maps") capture_stats = {
+    .type = BPF_MAP_TYPE_PERCPU_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(struct capture_stats),
+    .max_entries = 1,
+};
+
+/*
+    capture_drop按照'capture_control'中的抽样率抽取被丢弃的数据包，把它的前'snaplen'个字节和元数据写入'capture_ring'
+    数据包的长度在验证时是未知的，所以这里逐个字节地直接复制，每个字节都检查了数据包的边界，循环的次数被限制在CAPTURE_MAX_SNAPLEN以内
+    这里不使用bpf_probe_read_kernel，它是给跟踪程序用的，需要额外的权限，而且不知道复制的是数据包
+    提交记录时不唤醒用户态，用户态会定期批量地读取，这样抓包不会在数据路径上引起额外的唤醒
+*/
+static __always_inline void capture_drop(struct context *ctx, __u32 action)
+{
+    if (action != XDP_DROP)
+    {
+        return;
+    }
+
+    __u32 idx = 0;
+    struct capture_control *control = bpf_map_lookup_elem(&capture_control, &idx);
+    if (!control || control->sample_rate == 0)
+    {
+        return;
+    }
+
+    if (control->sample_rate > 1 && bpf_get_prandom_u32() % control->sample_rate != 0)
+    {
+        return;
+    }
+
+    struct capture_stats *stats = bpf_map_lookup_elem(&capture_stats, &idx);
+    if (!stats)
+    {
+        return;
+    }
+
+    __u64 start = bpf_ktime_get_ns();
+    stats->sampled += 1;
+
+    struct capture_record *record = bpf_ringbuf_reserve(&capture_ring, sizeof(*record), 0);
+    if (!record)
+    {
+        stats->lost += 1;
+        stats->busy_ns += bpf_ktime_get_ns() - start;
+        return;
+    }
+
+    __u32 caplen = ctx->length;
+    if (caplen > control->snaplen)
+    {
+        caplen = control->snaplen;
+    }
+    if (caplen > CAPTURE_MAX_SNAPLEN)
+    {
+        caplen = CAPTURE_MAX_SNAPLEN;
+    }
+
+    __u8 *data = ctx->data_start;
+    __u32 copied = 0;
+    for (__u32 i = 0; i < CAPTURE_MAX_SNAPLEN; i++)
+    {
+        if (i >= caplen || data + i + 1 > (__u8 *)ctx->data_end)
+        {
+            break;
+        }
+        record->data[i] = data[i];
+        copied++;
+    }
+    caplen = copied;
+
+    record->timestamp = start;
+    record->rule = ctx->rule;
+    record->ifindex = ctx->ifindex;
+    record->rx_queue = ctx->rx_queue;
+    record->len = ctx->length;
+    record->caplen = caplen;
+    record->pad = 0;
+
+    bpf_ringbuf_submit(record, BPF_RB_NO_WAKEUP);
+    stats->busy_ns += bpf_ktime_get_ns() - start;
+}
+
+#endif // _XDPFW_KERN_CAPTURE_H
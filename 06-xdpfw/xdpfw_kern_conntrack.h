@@ -0,0 +1,370 @@
+#ifndef _XDPFW_KERN_CONNTRACK_H
+#define _XDPFW_KERN_CONNTRACK_H
+
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/udp.h>
+
+/*
+    这个定义代表了连接跟踪表中最多能同时跟踪多少条连接
+*/
+#ifndef CT_TABLE_MAX_ENTRIES
+#define CT_TABLE_MAX_ENTRIES 262144
+#endif
+
+/*
+    conntrack是连接跟踪表，键和值的定义见common.h中的'ct_key'和'ct_entry'
+    和流表缓存不同，这里不能使用PERCPU的版本，因为同一条连接两个方向的数据包通常会被网卡的RSS分到不同的CPU上
+    LRU保证了表满了之后最久没有数据包的连接会被淘汰，超时的连接则在下一次被查到时删除
+*/
+struct bpf_map_def SEC("maps") conntrack = {
+    .type = BPF_MAP_TYPE_LRU_HASH,
+    .key_size = sizeof(struct ct_key),
+    .value_size = sizeof(struct ct_entry),
+    .max_entries = CT_TABLE_MAX_ENTRIES,
+};
+
+/*
+    conntrack_stats统计连接跟踪的查询结果，索引为common.h中的'ct_result'
+*/
+struct bpf_map_def SEC("maps") conntrack_stats = {
+    .type = BPF_MAP_TYPE_PERCPU_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(__u64),
+    .max_entries = CT_RESULTS,
+};
+
+static __always_inline void update_ct_stats(__u32 result)
+{
+    __u64 *count = bpf_map_lookup_elem(&conntrack_stats, &result);
+    if (count)
+    {
+        *count += 1;
+    }
+}
+
+/*
+    ct_timeout返回一条连接在给定状态下多久没有数据包之后过期，单位为纳秒
+*/
+static __always_inline __u64 ct_timeout(__u32 state)
+{
+    __u64 seconds = CT_TIMEOUT_CLOSE;
+
+    switch (state)
+    {
+    case ct_syn_sent:
+        seconds = CT_TIMEOUT_SYN_SENT;
+        break;
+    case ct_syn_recv:
+        seconds = CT_TIMEOUT_SYN_RECV;
+        break;
+    case ct_established:
+        seconds = CT_TIMEOUT_ESTABLISHED;
+        break;
+    case ct_fin_wait:
+        seconds = CT_TIMEOUT_FIN_WAIT;
+        break;
+    case ct_time_wait:
+        seconds = CT_TIMEOUT_TIME_WAIT;
+        break;
+    case ct_udp_new:
+        seconds = CT_TIMEOUT_UDP;
+        break;
+    case ct_udp_stream:
+        seconds = CT_TIMEOUT_UDP_STREAM;
+        break;
+    }
+
+    return seconds * 1000000000ULL;
+}
+
+/*
+    build_ct_key从数据包中取出规范化的五元组，'side'返回这个数据包是从哪一端发出的，0代表'a'，1代表'b'
+    只有IPv4/IPv6的TCP/UDP数据包才能被跟踪，其他情况返回-1
+*/
+static __always_inline int build_ct_key(struct context *ctx, struct ct_key *key, __u32 *side)
+{
+    if (ctx->l4_proto != IPPROTO_TCP && ctx->l4_proto != IPPROTO_UDP)
+    {
+        return -1;
+    }
+
+    __u32 src[4] = {0};
+    __u32 dst[4] = {0};
+
+    __builtin_memset(key, 0, sizeof(*key));
+
+    if (ctx->l3_proto == ETH_P_IP)
+    {
+        struct iphdr *ip = ctx->data_start + ctx->l3_offset;
+        if (ip + 1 > ctx->data_end)
+        {
+            return -1;
+        }
+
+        src[0] = ip->saddr;
+        dst[0] = ip->daddr;
+        key->family = 4;
+    }
+    else if (ctx->l3_proto == ETH_P_IPV6)
+    {
+        struct ipv6hdr *ip = ctx->data_start + ctx->l3_offset;
+        if (ip + 1 > ctx->data_end)
+        {
+            return -1;
+        }
+
+        __builtin_memcpy(src, &ip->saddr, sizeof(src));
+        __builtin_memcpy(dst, &ip->daddr, sizeof(dst));
+        key->family = 6;
+    }
+    else
+    {
+        return -1;
+    }
+
+    /*
+        TCP和UDP头部的前4个字节都是源端口和目的端口，所以这里统一按照udphdr来读取
+    */
+    struct udphdr *l4 = ctx->data_start + ctx->l4_offset;
+    if (l4 + 1 > ctx->data_end)
+    {
+        return -1;
+    }
+
+    /*
+        先比较地址，地址相同时再比较端口，只要两个方向得到的顺序一致即可，所以这里直接比较网络字节序的值
+    */
+    __u32 swap = 0;
+    __u32 decided = 0;
+
+#pragma unroll
+    for (int i = 0; i < 4; i++)
+    {
+        if (!decided && src[i] != dst[i])
+        {
+            swap = src[i] > dst[i];
+            decided = 1;
+        }
+    }
+
+    if (!decided)
+    {
+        swap = l4->source > l4->dest;
+    }
+
+    if (swap)
+    {
+        __builtin_memcpy(key->addr_a, dst, sizeof(dst));
+        __builtin_memcpy(key->addr_b, src, sizeof(src));
+        key->port_a = l4->dest;
+        key->port_b = l4->source;
+    }
+    else
+    {
+        __builtin_memcpy(key->addr_a, src, sizeof(src));
+        __builtin_memcpy(key->addr_b, dst, sizeof(dst));
+        key->port_a = l4->source;
+        key->port_b = l4->dest;
+    }
+
+    key->proto = ctx->l4_proto;
+    *side = swap;
+
+    return 0;
+}
+
+/*
+    ct_advance根据数据包的方向和TCP的标志位推进一条连接的状态
+    我们只能看到进入网卡的数据包，所以握手中缺失的那一半会被跳过：
+    对方发起的连接在SYN之后直接等待对方的ACK，本机发起的连接从对方的SYN-ACK开始
+*/
+static __always_inline void ct_advance(struct ct_entry *entry, struct context *ctx, __u32 side)
+{
+    __u32 flags = ctx->tcp_flags;
+    __u32 from_initiator = side == entry->initiator;
+
+    if (ctx->l4_proto == IPPROTO_UDP)
+    {
+        if (entry->state == ct_udp_new && !from_initiator)
+        {
+            entry->state = ct_udp_stream;
+        }
+        return;
+    }
+
+    if (flags & CT_TCP_RST)
+    {
+        entry->state = ct_close;
+        return;
+    }
+
+    switch (entry->state)
+    {
+    case ct_syn_sent:
+        if ((flags & CT_TCP_SYN) && (flags & CT_TCP_ACK) && !from_initiator)
+        {
+            entry->state = ct_syn_recv;
+        }
+        else if (!(flags & CT_TCP_SYN) && (flags & CT_TCP_ACK) && from_initiator)
+        {
+            entry->state = ct_established;
+        }
+        break;
+    case ct_syn_recv:
+        if (!(flags & CT_TCP_SYN) && (flags & CT_TCP_ACK))
+        {
+            entry->state = ct_established;
+        }
+        break;
+    case ct_established:
+    case ct_fin_wait:
+        if (flags & CT_TCP_FIN)
+        {
+            entry->fin_seen |= 1 << side;
+            entry->state = entry->fin_seen == 3 ? ct_time_wait : ct_fin_wait;
+        }
+        break;
+    case ct_time_wait:
+    case ct_close:
+        /*
+            连接关闭之后，同一个五元组上新的SYN代表一条新的连接
+        */
+        if ((flags & CT_TCP_SYN) && !(flags & CT_TCP_ACK))
+        {
+            entry->state = ct_syn_sent;
+            entry->initiator = side;
+            entry->fin_seen = 0;
+        }
+        break;
+    }
+}
+
+/*
+    ct_refresh更新一条连接的状态、最后一个数据包的时间和计数
+    同一条连接可能同时在多个CPU上被处理，所以计数使用原子加法，状态的竞争最多让状态机晚一个数据包推进
+*/
+static __always_inline void ct_refresh(struct ct_entry *entry, struct context *ctx, __u32 side, __u64 now)
+{
+    ct_advance(entry, ctx, side);
+    entry->last_seen = now;
+    __sync_fetch_and_add(&entry->packets, 1);
+    __sync_fetch_and_add(&entry->bytes, ctx->length);
+}
+
+/*
+    ct_track在进入流水线之前查询连接跟踪表，返回1代表这个数据包的结果已经确定，结果写入'action'
+    属于已知连接的数据包直接通过，不再经过流表缓存和流水线中的任何一层；连接是在黑名单修改之前记录的时，仍然要重新检查
+    ct_strict模式下，不属于任何连接、也不是SYN或SYN-ACK的TCP数据包会被丢弃
+*/
+static __always_inline int ct_track(struct context *ctx, __u32 *action)
+{
+    struct ct_key key;
+    __u32 side = 0;
+    if (build_ct_key(ctx, &key, &side) != 0)
+    {
+        return 0;
+    }
+
+    __u64 now = bpf_ktime_get_ns();
+    struct ct_entry *entry = bpf_map_lookup_elem(&conntrack, &key);
+    if (entry && now - entry->last_seen > ct_timeout(entry->state))
+    {
+        bpf_map_delete_elem(&conntrack, &key);
+        update_ct_stats(ct_expired);
+        entry = 0;
+    }
+
+    if (!entry)
+    {
+        if (config.conntrack == ct_strict && ctx->l4_proto == IPPROTO_TCP && !(ctx->tcp_flags & CT_TCP_SYN))
+        {
+            update_ct_stats(ct_invalid);
+            ctx->rule = RULE_ID(rule_conntrack, ct_invalid);
+            *action = XDP_DROP;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (entry->generation != ctx->generation)
+    {
+        update_ct_stats(ct_stale);
+        return 0;
+    }
+
+    ct_refresh(entry, ctx, side, now);
+    update_ct_stats(ct_hit);
+    *action = XDP_PASS;
+
+    return 1;
+}
+
+/*
+    ct_commit在一个数据包通过了所有的检查之后，把它所属的连接记录到连接跟踪表中
+    已经存在的连接是因为黑名单修改之后被重新检查的，只需要更新它的版本号
+    新连接的初始状态由这个数据包的标志位决定，SYN-ACK代表本机发起的连接，发起者是另一端
+    其他的TCP数据包只有在ct_on模式下才会走到这里，代表防火墙启动之前就已经建立的连接
+*/
+static __always_inline void ct_commit(struct context *ctx)
+{
+    if (config.conntrack == ct_off)
+    {
+        return;
+    }
+
+    struct ct_key key;
+    __u32 side = 0;
+    if (build_ct_key(ctx, &key, &side) != 0)
+    {
+        return;
+    }
+
+    __u64 now = bpf_ktime_get_ns();
+    struct ct_entry *entry = bpf_map_lookup_elem(&conntrack, &key);
+    if (entry)
+    {
+        entry->generation = ctx->generation;
+        ct_refresh(entry, ctx, side, now);
+        return;
+    }
+
+    struct ct_entry new_entry = {
+        .last_seen = now,
+        .packets = 1,
+        .bytes = ctx->length,
+        .generation = ctx->generation,
+        .initiator = side,
+    };
+
+    if (ctx->l4_proto == IPPROTO_UDP)
+    {
+        new_entry.state = ct_udp_new;
+    }
+    else if (ctx->tcp_flags & CT_TCP_RST)
+    {
+        return;
+    }
+    else if ((ctx->tcp_flags & CT_TCP_SYN) && (ctx->tcp_flags & CT_TCP_ACK))
+    {
+        new_entry.state = ct_syn_recv;
+        new_entry.initiator = !side;
+    }
+    else if (ctx->tcp_flags & CT_TCP_SYN)
+    {
+        new_entry.state = ct_syn_sent;
+    }
+    else
+    {
+        new_entry.state = ct_established;
+    }
+
+    if (bpf_map_update_elem(&conntrack, &key, &new_entry, BPF_NOEXIST) == 0)
+    {
+        update_ct_stats(ct_new);
+    }
+}
+
+#endif // _XDPFW_KERN_CONNTRACK_H
@@ -0,0 +1,116 @@
+#ifndef _XDPFW_KERN_DIR24_H
+#define _XDPFW_KERN_DIR24_H
+
+/*
+    DIR-24-8是IPv4源地址黑名单的另一种查找引擎，表的结构见common.h中'DIR24_ENTRIES'的说明
+    所有的表都由用户态根据前缀的集合计算出来，内核只负责查找，所以无论有多少条前缀，每个数据包最多只需要两次数组访问
+    没有选择这个引擎时，用户态会在加载之前把这些表缩小到一个元素，不会占用内存
+*/
+struct bpf_map_def SEC("maps") v4_dir24 = {
+    .type = BPF_MAP_TYPE_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(__u32),
+    .max_entries = DIR24_ENTRIES,
+};
+
+struct bpf_map_def SEC("maps") v4_dir8 = {
+    .type = BPF_MAP_TYPE_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(__u32),
+    .max_entries = DIR8_MAX_GROUPS * DIR8_GROUP_ENTRIES,
+};
+
+/*
+    v4_dir_rules保存了每条规则的前缀和命中计数，结构的定义见common.h中的'dir_rule'
+*/
+struct bpf_map_def SEC("maps") v4_dir_rules = {
+    .type = BPF_MAP_TYPE_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(struct dir_rule),
+    .max_entries = DIR_MAX_RULES,
+};
+
+/*
+    v4_dir_ids是从前缀到规则编号的索引，v4_dir_meta记录了编号和组的分配情况
+    它们只被用户态使用，定义在这里是为了和其他的表一起被创建和固定
+*/
+struct bpf_map_def SEC("maps") v4_dir_ids = {
+    .type = BPF_MAP_TYPE_HASH,
+    .key_size = sizeof(struct lpm_v4_key),
+    .value_size = sizeof(__u32),
+    .max_entries = DIR_MAX_RULES,
+    .map_flags = BPF_F_NO_PREALLOC,
+};
+
+struct bpf_map_def SEC("maps") v4_dir_meta = {
+    .type = BPF_MAP_TYPE_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(struct dir_meta),
+    .max_entries = 1,
+};
+
+/*
+    check_ipv4_dir24用DIR-24-8的表检查一个网络字节序的源地址，命中没有过期的规则时更新它的命中计数，并按照它的动作处理数据包
+*/
+static __always_inline __u32 check_ipv4_dir24(struct context *ctx, __u32 saddr)
+{
+    __u32 addr = bpf_ntohl(saddr);
+    __u32 idx = addr >> 8;
+
+    __u32 *entry = bpf_map_lookup_elem(&v4_dir24, &idx);
+    if (!entry)
+    {
+        return XDP_PASS;
+    }
+
+    __u32 id = *entry;
+    if (id & DIR_EXTENDED)
+    {
+        idx = (id & ~DIR_EXTENDED) * DIR8_GROUP_ENTRIES + (addr & 0xff);
+        entry = bpf_map_lookup_elem(&v4_dir8, &idx);
+        if (!entry)
+        {
+            return XDP_PASS;
+        }
+        id = *entry;
+    }
+
+    if (id == 0)
+    {
+        return XDP_PASS;
+    }
+
+    /*
+        规则过期时沿着'parent'找到覆盖它的更短的前缀，最多跳过RULE_EXPIRED_MAX_DEPTH条过期的规则
+    */
+    struct dir_rule *rule = 0;
+#pragma unroll
+    for (int i = 0; i <= RULE_EXPIRED_MAX_DEPTH; i++)
+    {
+        rule = bpf_map_lookup_elem(&v4_dir_rules, &id);
+        if (!rule)
+        {
+            return XDP_PASS;
+        }
+        if (!rule_expired(&rule->policy))
+        {
+            break;
+        }
+
+        id = rule->parent;
+        rule = 0;
+        if (id == 0)
+        {
+            return XDP_PASS;
+        }
+    }
+    if (!rule)
+    {
+        return XDP_PASS;
+    }
+
+    update_shared_rule_stats(ctx, &rule->counters);
+    return match_rule(ctx, &rule->policy, RULE_ID(rule_v4, 0));
+}
+
+#endif // _XDPFW_KERN_DIR24_H
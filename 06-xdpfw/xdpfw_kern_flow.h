@@ -0,0 +1,147 @@
+#ifndef _XDPFW_KERN_FLOW_H
+#define _XDPFW_KERN_FLOW_H
+
+#include <linux/errno.h>
+
+/*
+    flow_table按照五元组统计每条流的数据包和字节数，键和流表缓存相同，值是common.h中的'flow_counters'
+    使用PERCPU的版本，每个CPU只更新自己的那一份计数，不需要原子操作；用户态导出时把所有CPU的计数合并为一条记录
+    这里不使用LRU，被LRU悄悄淘汰的流就不会被导出了；表满时新的流无法被记录，它的数据包通过'flow_ring'单独导出
+    没有开启流量统计时，用户态在加载之前把它缩小到一个元素
+*/
+struct bpf_map_def SEC("maps") flow_table = {
+    .type = BPF_MAP_TYPE_PERCPU_HASH,
+    .key_size = sizeof(struct flow_key),
+    .value_size = sizeof(struct flow_counters),
+    .max_entries = FLOW_TABLE_MAX_ENTRIES,
+};
+
+/*
+    flow_ring是把表满时无法记录的数据包送到用户态的'BPF_MAP_TYPE_RINGBUF'，每条记录是一个'flow_export'
+    用户态的'xdpfw_user --ipfix'从中批量读取记录，和超时的流一起编码成IPFIX之后发送给收集器
+*/
+struct bpf_map_def SEC("maps") flow_ring = {
+    .type = BPF_MAP_TYPE_RINGBUF,
+    .max_entries = FLOW_RING_SIZE,
+};
+
+/*
+    flow_meta保存了活动超时和空闲超时，结构的定义见common.h中的'flow_meta'
+    它只被用户态使用，定义在这里是为了和其他的表一起被创建和固定
+*/
+struct bpf_map_def SEC("maps") flow_meta = {
+    .type = BPF_MAP_TYPE_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(struct flow_meta),
+    .max_entries = 1,
+};
+
+/*
+    flow_stats统计流量统计表的变化，索引为common.h中的'flow_result'
+*/
+struct bpf_map_def SEC("maps") flow_stats = {
+    .type = BPF_MAP_TYPE_PERCPU_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(__u64),
+    .max_entries = FLOW_RESULTS,
+};
+
+static __always_inline void update_flow_stats(__u32 result)
+{
+    __u64 *count = bpf_map_lookup_elem(&flow_stats, &result);
+    if (count)
+    {
+        *count += 1;
+    }
+}
+
+/*
+    export_flow把一条记录写入'flow_ring'
+    和抓包一样提交时不唤醒用户态，导出程序会定期批量地读取
+*/
+static __always_inline void export_flow(struct flow_key *key, struct flow_counters *flow, __u32 reason)
+{
+    struct flow_export *record = bpf_ringbuf_reserve(&flow_ring, sizeof(*record), 0);
+    if (!record)
+    {
+        update_flow_stats(flow_lost);
+        return;
+    }
+
+    record->counters = *flow;
+    record->key = *key;
+    record->reason = reason;
+
+    bpf_ringbuf_submit(record, BPF_RB_NO_WAKEUP);
+}
+
+/*
+    update_flow_table把一个数据包计入它所属的流，只统计完整的IPv4/IPv6的TCP/UDP数据包
+    超时由用户态的导出程序判断，它把超时的流从表中取出并删除，之后的数据包会重新创建这条流
+    表满时这个数据包作为一条只有一个数据包的记录导出，这样即使在表满的时候也没有数据包被悄悄地漏掉
+*/
+static __always_inline void update_flow_table(struct context *ctx)
+{
+    struct flow_key key;
+    if (build_flow_key(ctx, &key) != 0)
+    {
+        return;
+    }
+
+    __u64 now = bpf_ktime_get_ns();
+    struct flow_counters *flow = bpf_map_lookup_elem(&flow_table, &key);
+    if (!flow)
+    {
+        struct flow_counters initial = {
+            .packets = 1,
+            .bytes = ctx->length,
+            .first_ns = now,
+            .last_ns = now,
+            .ifindex = ctx->ifindex,
+            .tcp_flags = ctx->tcp_flags,
+            .family = ctx->l3_proto == ETH_P_IP ? 4 : 6,
+        };
+
+        long err = bpf_map_update_elem(&flow_table, &key, &initial, BPF_NOEXIST);
+        if (err == 0)
+        {
+            update_flow_stats(flow_created);
+            return;
+        }
+
+        if (err != -EEXIST)
+        {
+            update_flow_stats(flow_overflow);
+            export_flow(&key, &initial, flow_end_resources);
+            return;
+        }
+
+        /*
+            另一个CPU刚刚创建了这条流
+        */
+        flow = bpf_map_lookup_elem(&flow_table, &key);
+        if (!flow)
+        {
+            return;
+        }
+    }
+
+    /*
+        这条流是由另一个CPU创建的，这个CPU上的计数从这个数据包开始
+    */
+    if (flow->packets == 0)
+    {
+        flow->bytes = 0;
+        flow->first_ns = now;
+        flow->ifindex = ctx->ifindex;
+        flow->tcp_flags = 0;
+        flow->family = ctx->l3_proto == ETH_P_IP ? 4 : 6;
+    }
+
+    flow->packets += 1;
+    flow->bytes += ctx->length;
+    flow->last_ns = now;
+    flow->tcp_flags |= ctx->tcp_flags;
+}
+
+#endif // _XDPFW_KERN_FLOW_H
@@ -0,0 +1,149 @@
+#ifndef _XDPFW_KERN_FRAG_H
+#define _XDPFW_KERN_FRAG_H
+
+#include <linux/errno.h>
+#include <linux/ip.h>
+
+/*
+    这个定义代表了分片跟踪表中最多能同时跟踪多少个IP数据报
+*/
+#ifndef FRAG_TABLE_MAX_ENTRIES
+#define FRAG_TABLE_MAX_ENTRIES 16384
+#endif
+
+/*
+    frag_table记录了每个分片数据报的第一个分片得到的结果，后续分片不需要重组就可以直接继承这个结果
+    这里不能使用PERCPU的版本，因为后续分片没有端口，网卡的RSS通常会把它们和第一个分片分到不同的CPU上
+    LRU保证了分片洪泛中大量的数据报不会把表填满
+*/
+struct bpf_map_def SEC("maps") frag_table = {
+    .type = BPF_MAP_TYPE_LRU_HASH,
+    .key_size = sizeof(struct frag_key),
+    .value_size = sizeof(struct frag_verdict),
+    .max_entries = FRAG_TABLE_MAX_ENTRIES,
+};
+
+/*
+    frag_stats统计分片的处理结果，索引为common.h中的'frag_result'
+*/
+struct bpf_map_def SEC("maps") frag_stats = {
+    .type = BPF_MAP_TYPE_PERCPU_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(__u64),
+    .max_entries = FRAG_RESULTS,
+};
+
+static __always_inline void update_frag_stats(__u32 result)
+{
+    __u64 *count = bpf_map_lookup_elem(&frag_stats, &result);
+    if (count)
+    {
+        *count += 1;
+    }
+}
+
+/*
+    build_frag_key从IPv4头部中取出分片跟踪表的键
+*/
+static __always_inline int build_frag_key(struct context *ctx, struct frag_key *key)
+{
+    struct iphdr *ip = ctx->data_start + ctx->l3_offset;
+    if (ip + 1 > ctx->data_end)
+    {
+        return -1;
+    }
+
+    __builtin_memset(key, 0, sizeof(*key));
+    key->saddr = ip->saddr;
+    key->daddr = ip->daddr;
+    key->id = ip->id;
+    key->proto = ip->protocol;
+
+    return 0;
+}
+
+/*
+    record_fragment在第一个分片得到最终的结果之后把它写入分片跟踪表，对其他数据包没有任何作用
+    XDP_TX是针对这个分片本身的回复，后续分片不能继承它，所以记录为XDP_DROP
+    重复的第一个分片（重传或者重叠分片）不会重置已有记录的分片计数，否则攻击者可以借此绕过'frag_limit'
+    它只能让已有的结果变得更严格：只要有一个第一个分片被丢弃，这个数据报剩下的分片也都会被丢弃
+*/
+static __always_inline void record_fragment(struct context *ctx, __u32 action)
+{
+    if (ctx->frag != ipv4_frag_first)
+    {
+        return;
+    }
+
+    struct frag_key key;
+    if (build_frag_key(ctx, &key) != 0)
+    {
+        return;
+    }
+
+    struct frag_verdict verdict = {
+        .action = action == XDP_TX ? XDP_DROP : action,
+        .fragments = 1,
+    };
+
+    if (bpf_map_update_elem(&frag_table, &key, &verdict, BPF_NOEXIST) == -EEXIST)
+    {
+        struct frag_verdict *existing = bpf_map_lookup_elem(&frag_table, &key);
+        if (existing)
+        {
+            __sync_fetch_and_add(&existing->fragments, 1);
+            if (verdict.action == XDP_DROP)
+            {
+                existing->action = XDP_DROP;
+            }
+        }
+    }
+    update_frag_stats(frag_first);
+}
+
+/*
+    check_fragment处理IPv4的后续分片，它们没有第四层的头部，所以不会经过流水线中的任何检查
+    找到了第一个分片的记录时继承它的结果，找不到时按照'frag_orphan'处理这个分片
+    同一个数据报的分片数量超过'frag_limit'之后，剩下的分片也会被丢弃
+*/
+static __always_inline __u32 check_fragment(struct context *ctx)
+{
+    struct frag_key key;
+    if (build_frag_key(ctx, &key) != 0)
+    {
+        return XDP_DROP;
+    }
+
+    struct frag_verdict *verdict = bpf_map_lookup_elem(&frag_table, &key);
+    if (!verdict)
+    {
+        update_frag_stats(frag_orphan);
+        ctx->rule = RULE_ID(rule_frag, frag_orphan);
+        if (config.frag_orphan == orphan_drop)
+        {
+            return XDP_DROP;
+        }
+        if (config.frag_orphan == orphan_pass)
+        {
+            return XDP_PASS;
+        }
+        return config.default_action;
+    }
+
+    /*
+        同一个数据报的分片可能同时在多个CPU上被处理，所以这里使用原子加法
+    */
+    __sync_fetch_and_add(&verdict->fragments, 1);
+    if (config.frag_limit && verdict->fragments > config.frag_limit)
+    {
+        update_frag_stats(frag_over_limit);
+        ctx->rule = RULE_ID(rule_frag, frag_over_limit);
+        return XDP_DROP;
+    }
+
+    update_frag_stats(frag_inherited);
+    ctx->rule = RULE_ID(rule_frag, frag_inherited);
+    return verdict->action;
+}
+
+#endif // _XDPFW_KERN_FRAG_H
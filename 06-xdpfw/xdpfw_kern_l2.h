@@ -28,25 +28,83 @@ struct vlan_hdr
     如果我们不指定这个标志，当我们加载程序时，整个BPF MAP就会被填满数据。
     在这里没有使用线程安全的MAP，因为我们并没有从内核中实际更新BPF MAP中的条目，我们只是判断BPF MAP中是否存在一个给定的MAC地址
     所以在这种情况下不需要担心锁的问题
-    最后，我们在这里指定value_size为1,我们只是使用它来测试对应key是否存在
+    最后，每个条目的值是这条规则的命中计数和动作（见common.h中的'rule_value'），类型为'BPF_MAP_TYPE_PERCPU_HASH'，这样每个CPU都有一份自己的计数，更新时不需要加锁
+    用户态通过'--rule-stats'把所有CPU上的计数汇总起来，以便找出哪些规则从来没有被命中过
 */
 struct bpf_map_def SEC("maps") mac_blacklist = {
-    .type = BPF_MAP_TYPE_HASH,
+    .type = BPF_MAP_TYPE_PERCPU_HASH,
     .key_size = ETH_ALEN,
-    .value_size = 1,
+    .value_size = sizeof(struct rule_value),
     .max_entries = MAC_BLACKLIST_MAX_ENTRIES,
     .map_flags = BPF_F_NO_PREALLOC,
 };
 
+/*
+    mac_bloom是'mac_blacklist'前面的布隆过滤器，它是一个由用户态维护的位图，每个元素是64位
+    绝大多数数据包的源MAC地址都不在黑名单中，对它们来说，检查几个位比一次必然失败的哈希查找便宜得多
+    这里没有使用'BPF_MAP_TYPE_BLOOM_FILTER'，因为它不支持删除，而ARRAY可以由用户态在删除之后原地重建
+    重建时每个字都被一次性写入新的值，新的值包含了所有剩余地址的位，所以重建的过程中不会出现漏报
+*/
+struct bpf_map_def SEC("maps") mac_bloom = {
+    .type = BPF_MAP_TYPE_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(__u64),
+    .max_entries = MAC_BLOOM_WORDS,
+};
+
+/*
+    mac_bloom_stats统计布隆过滤器的检查结果，索引为common.h中的'bloom_result'，用户态用它计算实际的误报率
+*/
+struct bpf_map_def SEC("maps") mac_bloom_stats = {
+    .type = BPF_MAP_TYPE_PERCPU_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(__u64),
+    .max_entries = BLOOM_RESULTS,
+};
+
+static __always_inline void update_bloom_stats(__u32 result)
+{
+    __u64 *count = bpf_map_lookup_elem(&mac_bloom_stats, &result);
+    if (count)
+    {
+        *count += 1;
+    }
+}
+
+/*
+    mac_bloom_contains检查一个MAC地址在布隆过滤器中对应的位是否全部被设置
+    返回0代表这个地址一定不在黑名单中，返回1代表它可能在黑名单中
+*/
+static __always_inline int mac_bloom_contains(const __u8 *mac)
+{
+    __u32 h1, h2;
+    mac_bloom_hashes(mac, &h1, &h2);
+
+#pragma unroll
+    for (__u32 i = 0; i < MAC_BLOOM_HASHES; i++)
+    {
+        __u32 bit = (h1 + i * h2) % MAC_BLOOM_BITS;
+        __u32 idx = bit / 64;
+
+        __u64 *word = bpf_map_lookup_elem(&mac_bloom, &idx);
+        if (!word || !(*word & (1ULL << (bit % 64))))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
 /*
     parse_eth'处理解析传入的数据包的以太网和vlan头（如果有的话）
-    它将解析出这个数据包的源MAC地址 并检查它是否存在于上面定义的'mac_blacklist' BPF MAP中
+    它只负责找到第三层头部的偏移和协议，并记录在context中，对源MAC地址的检查则交给下面的'check_eth'
     这里context是对xdp_md的一个封装，定义在xdpfw_kern_utils.h中
 */
 static __always_inline __u32 parse_eth(struct context *ctx)
 {
     /*
-        我们需要访问以太网头数据，以便找出这个数据包的源MAC地址是否被列入黑名单。 
+        我们需要访问以太网头数据，以便找出下一层的协议
         强转成ethhdr
         还要加上偏移以访问下一个以太网帧
     */
@@ -57,22 +115,11 @@ static __always_inline __u32 parse_eth(struct context *ctx)
     */
     if (eth + 1 > ctx->data_end)
     {
-        return XDP_DROP;
-    }
-
-    /*
-        一旦我们知道我们至少有一个完整的以太网头
-        让我们看看在我们上面定义的mac_blacklist map中是否有一个匹配的源MAC地址
-        如果有，立即返回XDP_DROP并丢弃这个数据包
-    */
-    if (bpf_map_lookup_elem(&mac_blacklist, &eth->h_source))
-    {
-        return XDP_DROP;
+        return drop_malformed(ctx, malformed_eth);
     }
 
     /*
-        如果当前数据包的源MAC地址不在黑名单中
-        则将偏移量更新为下一个头，并将下一个头的协议更新为以太网头中的协议
+        将偏移量更新为下一个头，并将下一个头的协议更新为以太网头中的协议
     */
     ctx->nh_offset += sizeof(*eth);
     ctx->nh_proto = bpf_ntohs(eth->h_proto);
@@ -80,14 +127,15 @@ static __always_inline __u32 parse_eth(struct context *ctx)
     /*
         在BPF程序中，一般循环是被禁止的，所以我们需要使用unroll来展开循环
         这个循环将试图展开vlan头，因为一个数据包中可能包含多层vlan头。
+        实际解开的层数由加载时的配置'vlan_depth'决定，超出的那几次循环会被验证器当作死代码删除
     */
 #pragma unroll
-    for (int i = 0; i < 2; i++)
+    for (int i = 0; i < VLAN_MAX_DEPTH; i++)
     {
         /*
             检查这个数据包的下一个是否是vlan头，即8021Q或8021AD协议头。
         */
-        if (ctx->nh_proto == ETH_P_8021Q || ctx->nh_proto == ETH_P_8021AD)
+        if (i < config.vlan_depth && (ctx->nh_proto == ETH_P_8021Q || ctx->nh_proto == ETH_P_8021AD))
         {
             /*
                 执行与上述原始以太网头相同的过程，以确保进入下一个头
@@ -96,7 +144,7 @@ static __always_inline __u32 parse_eth(struct context *ctx)
 
             if (vlan + 1 > ctx->data_end)
             {
-                return XDP_DROP;
+                return drop_malformed(ctx, malformed_vlan);
             }
 
             ctx->nh_offset += sizeof(*vlan);
@@ -104,10 +152,63 @@ static __always_inline __u32 parse_eth(struct context *ctx)
         }
     }
 
+    /*
+        记录第三层头部的位置，供后面的检查使用
+    */
+    ctx->l3_offset = ctx->nh_offset;
+    ctx->l3_proto = ctx->nh_proto;
+
     /*
         继续解析，所以返回XDP_PASS。
     */
     return XDP_PASS;
 }
 
+/*
+    check_eth是流水线中MAC这一层的检查
+    它检查这个数据包的源MAC地址是否存在于上面定义的'mac_blacklist' BPF MAP中
+*/
+static __always_inline __u32 check_eth(struct context *ctx)
+{
+    /*
+        外层的以太网头总是位于数据包的开头，内层的则在'l2_offset'，这里是一个新的程序，所以仍然需要重新检查边界
+    */
+    struct ethhdr *eth = ctx->data_start + ctx->l2_offset;
+    if (eth + 1 > ctx->data_end)
+    {
+        return drop_malformed(ctx, malformed_eth);
+    }
+
+    /*
+        开启了布隆过滤器时先检查它，过滤器确定不在黑名单中的地址不需要再查哈希表
+    */
+    if (config.mac_bloom && !mac_bloom_contains(eth->h_source))
+    {
+        update_bloom_stats(bloom_negative);
+        return XDP_PASS;
+    }
+
+    /*
+        看看在我们上面定义的mac_blacklist map中是否有一个匹配的源MAC地址
+        如果有并且没有过期，更新这条规则的命中计数，然后按照这条规则的动作处理这个数据包
+    */
+    struct rule_value *value = bpf_map_lookup_elem(&mac_blacklist, &eth->h_source);
+    if (value && !rule_expired(&value->policy))
+    {
+        if (config.mac_bloom)
+        {
+            update_bloom_stats(bloom_hit);
+        }
+        update_rule_stats(ctx, &value->counters);
+        return match_rule(ctx, &value->policy, RULE_ID(rule_mac, 0));
+    }
+
+    if (config.mac_bloom)
+    {
+        update_bloom_stats(bloom_false_positive);
+    }
+
+    return XDP_PASS;
+}
+
 #endif // _XDPFW_KERN_L2_H
\ No newline at end of file
@@ -1,9 +1,22 @@
 #ifndef _XDPFW_KERN_L3_H
 #define _XDPFW_KERN_L3_H
 
+#include <linux/in.h>
+#include <linux/in6.h>
 #include <linux/ip.h>
 #include <linux/ipv6.h>
 
+/*
+    IPv4头部中'frag_off'字段的各个部分，uapi中没有导出它们的定义
+*/
+#ifndef IP_MF
+#define IP_MF 0x2000
+#endif
+
+#ifndef IP_OFFSET
+#define IP_OFFSET 0x1fff
+#endif
+
 /*
     和xdpfw_kern_l2.h中的定义类似，只是前者定义对mac地址的黑名单数量
     这里限制ip地址的
@@ -26,11 +39,12 @@
     比如192.168.0.1会和192.168.0.0/24相匹配
 
     这里的键使用的是lpm_v4_key，它定义在common.h中
+    值是这条前缀的命中计数和动作，因为LPM_TRIE没有PERCPU的版本，所以所有CPU共用一份计数
 */
 struct bpf_map_def SEC("maps") v4_blacklist = {
     .type = BPF_MAP_TYPE_LPM_TRIE,
     .key_size = sizeof(struct lpm_v4_key),
-    .value_size = 1,
+    .value_size = sizeof(struct rule_value),
     .max_entries = V4_BLACKLIST_MAX_ENTRIES,
     .map_flags = BPF_F_NO_PREALLOC,
 };
@@ -41,20 +55,44 @@ struct bpf_map_def SEC("maps") v4_blacklist = {
 struct bpf_map_def SEC("maps") v6_blacklist = {
     .type = BPF_MAP_TYPE_LPM_TRIE,
     .key_size = sizeof(struct lpm_v6_key),
-    .value_size = 1,
+    .value_size = sizeof(struct rule_value),
     .max_entries = V6_BLACKLIST_MAX_ENTRIES,
     .map_flags = BPF_F_NO_PREALLOC,
 };
 
+/*
+    滥用的IPv6流量几乎总是以/64或/48为单位出现，这两种长度的前缀放在普通的哈希表中
+    检查时先用源地址的前64位和前48位各查询一次哈希表，都没有命中时才查询'v6_blacklist'，它只保存其他长度的前缀
+    值是命中计数和动作，和'mac_blacklist'一样使用PERCPU的版本
+*/
+#ifndef V6_PREFIX_MAX_ENTRIES
+#define V6_PREFIX_MAX_ENTRIES 65536
+#endif
+
+struct bpf_map_def SEC("maps") v6_blacklist_64 = {
+    .type = BPF_MAP_TYPE_PERCPU_HASH,
+    .key_size = sizeof(struct v6_prefix_key),
+    .value_size = sizeof(struct rule_value),
+    .max_entries = V6_PREFIX_MAX_ENTRIES,
+    .map_flags = BPF_F_NO_PREALLOC,
+};
+
+struct bpf_map_def SEC("maps") v6_blacklist_48 = {
+    .type = BPF_MAP_TYPE_PERCPU_HASH,
+    .key_size = sizeof(struct v6_prefix_key),
+    .value_size = sizeof(struct rule_value),
+    .max_entries = V6_PREFIX_MAX_ENTRIES,
+    .map_flags = BPF_F_NO_PREALLOC,
+};
+
 /*
     parse_ipv4处理解析传入的数据包的IPv4头
-    它将解析出数据包的源地址，并检查它是否存在于上面定义的'v4_blacklist'BPF MAP中。
+    它只负责找到第四层头部的偏移和协议，对源地址的检查则交给下面的'check_ipv4'
 */
 static __always_inline __u32 parse_ipv4(struct context *ctx)
 {
     /*
-        我们需要访问IPv4头数据，以便找出这个数据包的源IP地址是否被列入黑名单
-        如果不是，那么头中的下一个协议是什么，以便继续解析
+        我们需要访问IPv4头数据，以便找出头中的下一个协议是什么，以便继续解析
         我们需要添加一个头的偏移，这是在先前调用的parse_eth函数中确定的
     */
     struct iphdr *ip = ctx->data_start + ctx->nh_offset;
@@ -64,37 +102,35 @@ static __always_inline __u32 parse_ipv4(struct context *ctx)
     */
     if (ip + 1 > ctx->data_end)
     {
-        return XDP_DROP;
+        return drop_malformed(ctx, malformed_ipv4);
     }
 
-    struct lpm_v4_key key;
-
     /*
-        为了与上面定义的'v4_blacklist' BPF MAP中存储的IPv4范围正确匹配
-        我们需要将数据包中的源地址复制到我们key的'地址'字段
-        同时，因为我们在这里使用一个完整的IPv4地址作为密钥
-        我们需要将'prefixlen'设置为32，这是一个IPv4地址的最大尺寸
+        就像以太网帧的情况一样
+        我们需要更新数据包中下一个头的偏移量，并更新数据包中下一个头的协议
+        ihl = Internet Header Length 头部长度 要乘以单位4字节
     */
-    __builtin_memcpy(key.address, &ip->saddr, sizeof(key.address));
-    key.prefixlen = 32;
+    ctx->nh_offset += ip->ihl * 4;
+    ctx->nh_proto = ip->protocol;
 
     /*
-        使用LPM_TRIE的方法与其他BPF MAP相同
-        依旧是bpf_map_lookup_elem来处理对TRIE中存在的最长前缀的匹配
-        如果在我们的黑名单中确实存在匹配，则立即退出并丢弃数据包。
+        记录这个数据包是不是分片，后续分片中没有第四层的头部，由调用者根据第一个分片的结果来处理
     */
-    if (bpf_map_lookup_elem(&v4_blacklist, &key))
+    __u16 frag_off = bpf_ntohs(ip->frag_off);
+    if (frag_off & IP_OFFSET)
+    {
+        ctx->frag = ipv4_frag_later;
+    }
+    else if (frag_off & IP_MF)
     {
-        return XDP_DROP;
+        ctx->frag = ipv4_frag_first;
     }
 
     /*
-        就像以太网帧的情况一样，如果这个数据包的源IP地址在黑名单中不匹配
-        我们需要更新数据包中下一个头的偏移量，并更新数据包中下一个头的协议
-        ihl = Internet Header Length 头部长度 要乘以单位4字节
+        记录第四层头部的位置，供后面的检查使用
     */
-    ctx->nh_offset += ip->ihl * 4;
-    ctx->nh_proto = ip->protocol;
+    ctx->l4_offset = ctx->nh_offset;
+    ctx->l4_proto = ctx->nh_proto;
 
     /*
         继续
@@ -102,8 +138,135 @@ static __always_inline __u32 parse_ipv4(struct context *ctx)
     return XDP_PASS;
 }
 
+/*
+    ipv6_ext_stats统计带有扩展头的IPv6数据包的解析结果，索引为common.h中的'ipv6_ext_result'
+*/
+struct bpf_map_def SEC("maps") ipv6_ext_stats = {
+    .type = BPF_MAP_TYPE_PERCPU_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(__u64),
+    .max_entries = IPV6_EXT_RESULTS,
+};
+
+/*
+    分片扩展头的格式，uapi中没有导出它的定义
+*/
+struct ipv6_frag_hdr
+{
+    __u8 nexthdr;
+    __u8 reserved;
+    __be16 frag_off;
+    __be32 identification;
+};
+
+#define IPV6_FRAG_OFFSET_MASK 0xfff8
+
+static __always_inline void update_ipv6_ext_stats(__u32 result)
+{
+    if (config.ipv6_ext_policy != ipv6_ext_count)
+    {
+        return;
+    }
+
+    __u64 *count = bpf_map_lookup_elem(&ipv6_ext_stats, &result);
+    if (count)
+    {
+        *count += 1;
+    }
+}
+
+/*
+    ipv6_is_ext判断一个下一个头部的协议号是否是parse_ipv6_ext能够跳过的扩展头
+*/
+static __always_inline int ipv6_is_ext(__u32 proto)
+{
+    switch (proto)
+    {
+    case IPPROTO_HOPOPTS:
+    case IPPROTO_ROUTING:
+    case IPPROTO_DSTOPTS:
+    case IPPROTO_MH:
+    case IPPROTO_FRAGMENT:
+    case IPPROTO_AH:
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+    parse_ipv6_ext跳过IPv6头部之后的扩展头，直到遇到第四层的协议为止，成功时返回0
+    最多跳过'ipv6_ext_depth'个扩展头，所以这个循环可以被展开
+    扩展头超过这个数量，偏移超过HEADER_OFFSET_MASK，或者这是一个不包含第四层头部的后续分片时，返回-1
+    注意ESP之后的内容是加密的，所以它会被当作第四层的协议
+*/
+static __always_inline int parse_ipv6_ext(struct context *ctx)
+{
+#pragma unroll
+    for (__u32 i = 0; i < IPV6_EXT_MAX_DEPTH; i++)
+    {
+        if (!ipv6_is_ext(ctx->nh_proto))
+        {
+            return 0;
+        }
+        if (i >= config.ipv6_ext_depth)
+        {
+            return -1;
+        }
+
+        /*
+            所有扩展头的前两个字节都是下一个头部的协议和这个扩展头的长度，只是长度的单位不同
+        */
+        struct ipv6_opt_hdr *opt = ctx->data_start + ctx->nh_offset;
+        if (opt + 1 > ctx->data_end)
+        {
+            return -1;
+        }
+
+        __u32 len = 0;
+        switch (ctx->nh_proto)
+        {
+        case IPPROTO_FRAGMENT:
+        {
+            /*
+                'ipv6_opt_hdr'是packed的结构，这里直接从数据包中重新取出分片头，而不是转换'opt'的指针
+            */
+            struct ipv6_frag_hdr *frag = ctx->data_start + ctx->nh_offset;
+            if (frag + 1 > ctx->data_end)
+            {
+                return -1;
+            }
+            if (frag->frag_off & bpf_htons(IPV6_FRAG_OFFSET_MASK))
+            {
+                return -1;
+            }
+            len = sizeof(*frag);
+            break;
+        }
+        case IPPROTO_AH:
+            len = (opt->hdrlen + 2) * 4;
+            break;
+        default:
+            len = (opt->hdrlen + 1) * 8;
+            break;
+        }
+
+        ctx->nh_proto = opt->nexthdr;
+        ctx->nh_offset += len;
+        if (ctx->nh_offset > HEADER_OFFSET_MASK)
+        {
+            return -1;
+        }
+        ctx->nh_offset &= HEADER_OFFSET_MASK;
+    }
+
+    return ipv6_is_ext(ctx->nh_proto) ? -1 : 0;
+}
+
 /*
     功能和parse_ipv4相同，代码也几乎相同
+    不同的是IPv6头部之后可能跟着若干个扩展头，攻击者可以用它们让数据包绕过端口的检查，
+    所以这里需要先跳过所有的扩展头，找到真正的第四层头部
 */
 static __always_inline __u32 parse_ipv6(struct context *ctx)
 {
@@ -114,26 +277,197 @@ static __always_inline __u32 parse_ipv6(struct context *ctx)
 
     if (ip + 1 > ctx->data_end)
     {
-        return XDP_DROP;
+        return drop_malformed(ctx, malformed_ipv6);
     }
 
-    struct lpm_v6_key key;
+    /*
+        这里和parse_ipv4不同的是
+        ipv6包中没有Header Length，因为对于固定长度的报头，它是没有作用的
+        直接计算即可
+    */
+    ctx->nh_offset += sizeof(*ip);
+    ctx->nh_proto = ip->nexthdr;
+
+    if (ipv6_is_ext(ctx->nh_proto))
+    {
+        if (parse_ipv6_ext(ctx) != 0)
+        {
+            update_ipv6_ext_stats(ipv6_ext_unresolved);
+            if (config.ipv6_ext_policy == ipv6_ext_drop)
+            {
+                return drop_malformed(ctx, malformed_ipv6_ext);
+            }
+        }
+        else
+        {
+            update_ipv6_ext_stats(ipv6_ext_resolved);
+        }
+    }
+
+    /*
+        没有找到第四层头部时，l4_proto是一个扩展头的协议号，后面第四层的检查和流表缓存都会跳过这个数据包
+    */
+    ctx->l4_offset = ctx->nh_offset;
+    ctx->l4_proto = ctx->nh_proto;
+
+    return XDP_PASS;
+}
+
+/*
+    lookup_lpm_rule在LPM黑名单'map'中查找覆盖'key'的最长的没有过期的前缀，'key'的第一个字段必须是'prefixlen'
+    查找到的前缀过期时，把长度设置为比它短一位再查找一次，这样过期的前缀在被'--sweep'删除之前不会遮住更短的前缀
+    最多跳过RULE_EXPIRED_MAX_DEPTH个过期的前缀，'prefixlen'为0的规则无法继续查找
+*/
+static __always_inline struct rule_value *lookup_lpm_rule(void *map, void *key)
+{
+    __u32 *prefixlen = key;
+
+#pragma unroll
+    for (int i = 0; i <= RULE_EXPIRED_MAX_DEPTH; i++)
+    {
+        struct rule_value *value = bpf_map_lookup_elem(map, key);
+        if (!value || !rule_expired(&value->policy))
+        {
+            return value;
+        }
+
+        if (value->policy.prefixlen == 0 || value->policy.prefixlen > *prefixlen)
+        {
+            return 0;
+        }
+        *prefixlen = value->policy.prefixlen - 1;
+    }
+
+    return 0;
+}
+
+/*
+    check_ipv4是流水线中第三层检查的IPv4部分
+    它将取出数据包的源地址，并检查它是否存在于上面定义的'v4_blacklist'BPF MAP中。
+*/
+static __always_inline __u32 check_ipv4(struct context *ctx)
+{
+    /*
+        使用parse_eth记录下来的偏移找到IPv4头，并重新检查边界
+    */
+    struct iphdr *ip = ctx->data_start + ctx->l3_offset;
+    if (ip + 1 > ctx->data_end)
+    {
+        return drop_malformed(ctx, malformed_ipv4);
+    }
 
+    /*
+        加载时选择了DIR-24-8引擎时，不再查询'v4_blacklist'
+    */
+    if (config.v4_engine == v4_engine_dir24)
+    {
+        return check_ipv4_dir24(ctx, ip->saddr);
+    }
+
+    struct lpm_v4_key key;
+
+    /*
+        为了与上面定义的'v4_blacklist' BPF MAP中存储的IPv4范围正确匹配
+        我们需要将数据包中的源地址复制到我们key的'地址'字段
+        同时，因为我们在这里使用一个完整的IPv4地址作为密钥
+        我们需要将'prefixlen'设置为32，这是一个IPv4地址的最大尺寸
+    */
     __builtin_memcpy(key.address, &ip->saddr, sizeof(key.address));
-    key.prefixlen = 128;
+    key.prefixlen = 32;
 
-    if (bpf_map_lookup_elem(&v6_blacklist, &key))
+    /*
+        使用LPM_TRIE的方法与其他BPF MAP相同
+        依旧是bpf_map_lookup_elem来处理对TRIE中存在的最长前缀的匹配
+        如果在我们的黑名单中确实存在没有过期的匹配，则更新这条前缀的命中计数，然后按照这条前缀的动作处理数据包。
+    */
+    struct rule_value *value = lookup_lpm_rule(&v4_blacklist, &key);
+    if (value)
     {
-        return XDP_DROP;
+        update_shared_rule_stats(ctx, &value->counters);
+        return match_rule(ctx, &value->policy, RULE_ID(rule_v4, 0));
+    }
+
+    return XDP_PASS;
+}
+
+/*
+    功能和check_ipv4相同
+*/
+static __always_inline __u32 check_ipv6(struct context *ctx)
+{
+    struct ipv6hdr *ip = ctx->data_start + ctx->l3_offset;
+    if (ip + 1 > ctx->data_end)
+    {
+        return drop_malformed(ctx, malformed_ipv6);
     }
 
     /*
-        这里和parse_ipv4不同的是
-        ipv6包中没有Header Length，因为对于固定长度的报头，它是没有作用的
-        直接计算即可
+        先查询/64和/48的哈希表，再查询'v6_blacklist'
+        一条规则被命中之后，只有它的结果是继续检查时（例如它要等待更优先的白名单）才需要查询下一张表
     */
-    ctx->nh_offset += sizeof(*ip);
-    ctx->nh_proto = ip->nexthdr;
+    __u32 action = XDP_PASS;
+    struct v6_prefix_key prefix;
+    __builtin_memcpy(prefix.address, &ip->saddr, sizeof(prefix.address));
+
+    struct rule_value *value = bpf_map_lookup_elem(&v6_blacklist_64, &prefix);
+    if (value && !rule_expired(&value->policy))
+    {
+        update_rule_stats(ctx, &value->counters);
+        action = match_rule(ctx, &value->policy, RULE_ID(rule_v6, 64));
+        if (action != XDP_PASS)
+        {
+            return action;
+        }
+    }
+
+    prefix.address[6] = 0;
+    prefix.address[7] = 0;
+    value = bpf_map_lookup_elem(&v6_blacklist_48, &prefix);
+    if (value && !rule_expired(&value->policy))
+    {
+        update_rule_stats(ctx, &value->counters);
+        action = match_rule(ctx, &value->policy, RULE_ID(rule_v6, 48));
+        if (action != XDP_PASS)
+        {
+            return action;
+        }
+    }
+
+    struct lpm_v6_key key;
+
+    __builtin_memcpy(key.address, &ip->saddr, sizeof(key.address));
+    key.prefixlen = 128;
+
+    value = lookup_lpm_rule(&v6_blacklist, &key);
+    if (value)
+    {
+        update_shared_rule_stats(ctx, &value->counters);
+        return match_rule(ctx, &value->policy, RULE_ID(rule_v6, 0));
+    }
+
+    return XDP_PASS;
+}
+
+/*
+    check_l3按照第三层的协议选择check_ipv4或check_ipv6，加载时关闭了的IP版本不检查
+*/
+static __always_inline __u32 check_l3(struct context *ctx)
+{
+    switch (ctx->l3_proto)
+    {
+    case ETH_P_IP:
+        if (config.ipv4)
+        {
+            return check_ipv4(ctx);
+        }
+        break;
+    case ETH_P_IPV6:
+        if (config.ipv6)
+        {
+            return check_ipv6(ctx);
+        }
+        break;
+    }
 
     return XDP_PASS;
 }
@@ -4,31 +4,103 @@
 #include <linux/tcp.h>
 #include <linux/udp.h>
 
-#ifndef PORT_BLACKLIST_MAX_ENTRIES
-#define PORT_BLACKLIST_MAX_ENTRIES (65535 * 4) /* src + dest * tcp + udp */
-#endif
+#define PORT_BLACKLIST_MAX_ENTRIES (PORT_BITMAP_WORDS * 4) /* src + dest * tcp + udp */
 
 /*
     这里的port_blacklist代表我们想列入黑名单的tcp和udp源/目的端口的组合。
-    这里与mac_blacklist的唯一真正区别是，我们的键是一个任意的自定义类型
-    struct port_key定义在common.h中
+    它是由4个65536位的位图组成的BPF_MAP_TYPE_ARRAY，位图的布局见common.h中的PORT_BITMAP_INDEX
+    和哈希表不同，数组的下标可以直接由端口号计算出来，内核在验证时还会把数组的查找内联成一次简单的内存读取
+    总共只占用32KB的内存，不需要再考虑最多能放多少个端口
 */
 struct bpf_map_def SEC("maps") port_blacklist = {
-    .type = BPF_MAP_TYPE_HASH,
-    .key_size = sizeof(struct port_key),
-    .value_size = 1,
+    .type = BPF_MAP_TYPE_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(__u64),
     .max_entries = PORT_BLACKLIST_MAX_ENTRIES,
+};
+
+#ifndef PORT_RULE_COUNTERS_MAX_ENTRIES
+#define PORT_RULE_COUNTERS_MAX_ENTRIES 65536
+#endif
+
+/*
+    port_rule_counters保存了每个被命中过的端口规则的命中计数，键由common.h中的PORT_RULE_KEY计算得到
+    位图本身没有地方存放计数，而为所有可能的端口都预留计数又太浪费内存，所以这里使用哈希表，只在某个端口第一次被命中时才创建对应的条目
+    因为只有在丢弃数据包时才会访问它，所以不会增加正常流量的开销
+*/
+struct bpf_map_def SEC("maps") port_rule_counters = {
+    .type = BPF_MAP_TYPE_PERCPU_HASH,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(struct counters),
+    .max_entries = PORT_RULE_COUNTERS_MAX_ENTRIES,
+    .map_flags = BPF_F_NO_PREALLOC,
+};
+
+/*
+    port_policy保存了端口规则的动作，键和'port_rule_counters'相同
+    位图中没有地方存放动作，所以只有动作不是默认的丢弃、指定了优先级或者过期时间的端口才会出现在这里，它同样只在端口被命中时才会被查询
+*/
+struct bpf_map_def SEC("maps") port_policy = {
+    .type = BPF_MAP_TYPE_HASH,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(struct rule_policy),
+    .max_entries = PORT_RULE_COUNTERS_MAX_ENTRIES,
     .map_flags = BPF_F_NO_PREALLOC,
 };
 
+/*
+    check_port检查给定类型和协议的端口在位图中对应的位是否被设置
+    如果被设置，则更新这条端口规则的命中计数，并按照它的动作处理这个数据包，否则返回XDP_PASS
+*/
+static __always_inline __u32 check_port(struct context *ctx, enum port_type type, enum port_protocol proto, __u16 port)
+{
+    __u32 idx = PORT_BITMAP_INDEX(type, proto, port);
+    __u64 *word = bpf_map_lookup_elem(&port_blacklist, &idx);
+    if (!word || !(*word & PORT_BITMAP_BIT(port)))
+    {
+        return XDP_PASS;
+    }
+
+    __u32 key = PORT_RULE_KEY(type, proto, port);
+    struct rule_policy *policy = bpf_map_lookup_elem(&port_policy, &key);
+    if (policy && rule_expired(policy))
+    {
+        return XDP_PASS;
+    }
+
+    struct counters *counters = bpf_map_lookup_elem(&port_rule_counters, &key);
+    if (counters)
+    {
+        update_rule_stats(ctx, counters);
+    }
+    else
+    {
+        struct counters initial = {
+            .packets = 1,
+            .bytes = ctx->length,
+        };
+        bpf_map_update_elem(&port_rule_counters, &key, &initial, BPF_NOEXIST);
+    }
+
+    if (!policy)
+    {
+        struct rule_policy drop = {
+            .action = policy_drop,
+            .priority = POLICY_DEFAULT_PRIORITY,
+        };
+        return match_rule(ctx, &drop, RULE_ID(rule_port, key));
+    }
+
+    return match_rule(ctx, policy, RULE_ID(rule_port, key));
+}
+
 /*
     parse_udp'处理解析传入的数据包的UDP头
-    它将解析出数据包的源端口和目的端口，并检查是否存在于上面定义的'port_blacklist'中
+    在流水线的入口处，它只负责确保UDP头是完整的，对端口的检查则交给下面的'check_udp'
 */
 static __always_inline __u32 parse_udp(struct context *ctx)
 {
     /*
-        我们需要访问UDP头数据，以便找出这个数据包的源端口或输出端口是否被列入黑名单，并最终将数据包返回给内核
         偏移依旧是上次解析时确定的
     */
     struct udphdr *udp = ctx->data_start + ctx->nh_offset;
@@ -38,68 +110,91 @@ static __always_inline __u32 parse_udp(struct context *ctx)
     */
     if (udp + 1 > ctx->data_end)
     {
-        return XDP_DROP;
+        return drop_malformed(ctx, malformed_udp);
+    }
+
+    return XDP_PASS;
+}
+
+/*
+    功能和parse_udp类似，代码几乎一样，这里不做多解释
+*/
+static __always_inline __u32 parse_tcp(struct context *ctx)
+{
+    struct tcphdr *tcp = ctx->data_start + ctx->nh_offset;
+
+    if (tcp + 1 > ctx->data_end)
+    {
+        return drop_malformed(ctx, malformed_tcp);
     }
 
     /*
-        我们需要创建两个'port_key'值，以便我们可以在上面定义的'port_blacklist'中搜索源端口和目的端口
-        一个是源端口，另一个是目的端口
+        记录TCP的标志位，连接跟踪根据它们推进连接的状态
     */
-    struct port_key src_key = {
-        .type = source_port,
-        .proto = udp_port,
-    };
-    struct port_key dst_key = {
-        .type = destination_port,
-        .proto = udp_port,
-    };
+    ctx->tcp_flags = ((__u8 *)tcp)[13];
 
+    return XDP_PASS;
+}
+
+/*
+    check_udp是流水线中第四层检查的UDP部分
+    它将解析出数据包的源端口和目的端口，并检查是否存在于上面定义的'port_blacklist'中
+*/
+static __always_inline __u32 check_udp(struct context *ctx)
+{
     /*
-        转换字节序
+        我们需要访问UDP头数据，以便找出这个数据包的源端口或输出端口是否被列入黑名单
+        偏移是parse_ipv4/parse_ipv6记录下来的
     */
-    src_key.port = bpf_ntohs(udp->source);
-    dst_key.port = bpf_ntohs(udp->dest);
+    struct udphdr *udp = ctx->data_start + ctx->l4_offset;
+    if (udp + 1 > ctx->data_end)
+    {
+        return drop_malformed(ctx, malformed_udp);
+    }
 
     /*
-        依旧是bpf_map_lookup_elem
+        分别检查源端口和目的端口在各自的位图中是否被设置，注意要先转换字节序
     */
-    if (bpf_map_lookup_elem(&port_blacklist, &src_key) ||
-        bpf_map_lookup_elem(&port_blacklist, &dst_key))
+    __u32 action = check_port(ctx, source_port, udp_port, bpf_ntohs(udp->source));
+    if (action != XDP_PASS)
     {
-        return XDP_DROP;
+        return action;
     }
 
-    return XDP_PASS;
+    return check_port(ctx, destination_port, udp_port, bpf_ntohs(udp->dest));
 }
 
 /*
-    功能和parse_udp类似，代码几乎一样，这里不做多解释
+    功能和check_udp类似
 */
-static __always_inline __u32 parse_tcp(struct context *ctx)
+static __always_inline __u32 check_tcp(struct context *ctx)
 {
-    struct tcphdr *tcp = ctx->data_start + ctx->nh_offset;
-
+    struct tcphdr *tcp = ctx->data_start + ctx->l4_offset;
     if (tcp + 1 > ctx->data_end)
     {
-        return XDP_DROP;
+        return drop_malformed(ctx, malformed_tcp);
     }
 
-    struct port_key src_key = {
-        .type = source_port,
-        .proto = tcp_port,
-    };
-    struct port_key dst_key = {
-        .type = destination_port,
-        .proto = tcp_port,
-    };
+    __u32 action = check_port(ctx, source_port, tcp_port, bpf_ntohs(tcp->source));
+    if (action != XDP_PASS)
+    {
+        return action;
+    }
 
-    src_key.port = bpf_ntohs(tcp->source);
-    dst_key.port = bpf_ntohs(tcp->dest);
+    return check_port(ctx, destination_port, tcp_port, bpf_ntohs(tcp->dest));
+}
 
-    if (bpf_map_lookup_elem(&port_blacklist, &src_key) ||
-        bpf_map_lookup_elem(&port_blacklist, &dst_key))
+/*
+    check_l4按照第四层的协议选择check_udp或check_tcp
+*/
+static __always_inline __u32 check_l4(struct context *ctx)
+{
+    switch (ctx->l4_proto)
     {
-        return XDP_DROP;
+    case IPPROTO_UDP:
+        return check_udp(ctx);
+    case IPPROTO_TCP:
+        return check_tcp(ctx);
     }
 
     return XDP_PASS;
@@ -0,0 +1,244 @@
+#ifndef _XDPFW_KERN_PIPELINE_H
+#define _XDPFW_KERN_PIPELINE_H
+
+/*
+    xdpfw_stages是真正被执行的检查流水线，其类型为'BPF_MAP_TYPE_PROG_ARRAY'
+    入口程序'xdpfw_fn'从下标0开始依次尾调用其中的程序，每一层检查通过之后再尾调用下一个下标，直到遇到一个空的位置为止
+    用户态只会把有规则的那些层按顺序放进来，所以没有规则的层不会带来任何额外的开销
+    它有两份流水线，黑名单版本号的最低位决定数据包从哪一半的第一个位置开始，一个数据包在经过流水线的过程中不会换到另一半
+*/
+struct bpf_map_def SEC("maps") xdpfw_stages = {
+    .type = BPF_MAP_TYPE_PROG_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(__u32),
+    .max_entries = 2 * XDPFW_PIPELINE_SLOTS,
+};
+
+/*
+    xdpfw_stage_progs按照common.h中的'xdpfw_stage'保存了所有的检查程序，它本身不会被尾调用
+    用户态在加载时把每一层的程序放入这里，之后就可以随时从中取出程序，重新拼接'xdpfw_stages'
+*/
+struct bpf_map_def SEC("maps") xdpfw_stage_progs = {
+    .type = BPF_MAP_TYPE_PROG_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(__u32),
+    .max_entries = XDPFW_STAGES,
+};
+
+/*
+    pipeline_context用来在尾调用之间传递'context'
+    尾调用不会保留栈上的数据，所以在跳转之前需要把context保存在这个PERCPU的数组中，下一个程序再把它取出来
+    同一个CPU上同一时间只会处理一个数据包，所以一个元素就够了
+*/
+struct bpf_map_def SEC("maps") pipeline_context = {
+    .type = BPF_MAP_TYPE_PERCPU_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(struct context),
+    .max_entries = 1,
+};
+
+/*
+    save_ctx把context中除了指针以外的字段保存到'pipeline_context'中
+    数据包的指针不能被写入BPF MAP，所以这里需要逐个字段地复制
+*/
+static __always_inline int save_ctx(struct context *ctx)
+{
+    __u32 idx = 0;
+    struct context *saved = bpf_map_lookup_elem(&pipeline_context, &idx);
+    if (!saved)
+    {
+        return -1;
+    }
+
+    saved->length = ctx->length;
+    saved->nh_proto = ctx->nh_proto;
+    saved->nh_offset = ctx->nh_offset;
+    saved->l3_proto = ctx->l3_proto;
+    saved->l3_offset = ctx->l3_offset;
+    saved->l4_proto = ctx->l4_proto;
+    saved->l4_offset = ctx->l4_offset;
+    saved->l2_offset = ctx->l2_offset;
+    saved->tunnel = ctx->tunnel;
+    saved->inner = ctx->inner;
+    saved->inner_eth = ctx->inner_eth;
+    saved->inner_l2_offset = ctx->inner_l2_offset;
+    saved->inner_l3_proto = ctx->inner_l3_proto;
+    saved->inner_l3_offset = ctx->inner_l3_offset;
+    saved->inner_l4_proto = ctx->inner_l4_proto;
+    saved->inner_l4_offset = ctx->inner_l4_offset;
+    saved->stage = ctx->stage;
+    saved->generation = ctx->generation;
+    saved->frag = ctx->frag;
+    saved->tcp_flags = ctx->tcp_flags;
+    saved->verdict_action = ctx->verdict_action;
+    saved->verdict_priority = ctx->verdict_priority;
+    saved->verdict_arg = ctx->verdict_arg;
+    saved->verdict_rule = ctx->verdict_rule;
+    saved->nocache = ctx->nocache;
+#ifdef XDPFW_PROFILE
+    saved->prof_start = ctx->prof_start;
+    saved->prof_mark = ctx->prof_mark;
+#endif
+
+    return 0;
+}
+
+/*
+    restore_ctx在尾调用的目标程序中重新构造context
+    指针由'xdp_md'重新计算，其余的字段从'pipeline_context'中取出
+*/
+static __always_inline int restore_ctx(struct xdp_md *xdp_ctx, struct context *ctx)
+{
+    __u32 idx = 0;
+    struct context *saved = bpf_map_lookup_elem(&pipeline_context, &idx);
+    if (!saved)
+    {
+        return -1;
+    }
+
+    *ctx = to_ctx(xdp_ctx);
+    ctx->nh_proto = saved->nh_proto;
+    ctx->nh_offset = saved->nh_offset & HEADER_OFFSET_MASK;
+    ctx->l3_proto = saved->l3_proto;
+    ctx->l3_offset = saved->l3_offset & HEADER_OFFSET_MASK;
+    ctx->l4_proto = saved->l4_proto;
+    ctx->l4_offset = saved->l4_offset & HEADER_OFFSET_MASK;
+    ctx->l2_offset = saved->l2_offset & HEADER_OFFSET_MASK;
+    ctx->tunnel = saved->tunnel;
+    ctx->inner = saved->inner;
+    ctx->inner_eth = saved->inner_eth;
+    ctx->inner_l2_offset = saved->inner_l2_offset & HEADER_OFFSET_MASK;
+    ctx->inner_l3_proto = saved->inner_l3_proto;
+    ctx->inner_l3_offset = saved->inner_l3_offset & HEADER_OFFSET_MASK;
+    ctx->inner_l4_proto = saved->inner_l4_proto;
+    ctx->inner_l4_offset = saved->inner_l4_offset & HEADER_OFFSET_MASK;
+    ctx->stage = saved->stage;
+    ctx->generation = saved->generation;
+    ctx->frag = saved->frag;
+    ctx->tcp_flags = saved->tcp_flags;
+    ctx->verdict_action = saved->verdict_action;
+    ctx->verdict_priority = saved->verdict_priority;
+    ctx->verdict_arg = saved->verdict_arg;
+    ctx->verdict_rule = saved->verdict_rule;
+    ctx->nocache = saved->nocache;
+#ifdef XDPFW_PROFILE
+    ctx->prof_start = saved->prof_start;
+    ctx->prof_mark = saved->prof_mark;
+#endif
+
+    return 0;
+}
+
+/*
+    apply_default_action返回通过了所有检查的数据包最终的action，也就是加载时配置的'default_action'
+*/
+static __always_inline __u32 apply_default_action(struct context *ctx)
+{
+    if (config.default_action == XDP_DROP)
+    {
+        ctx->rule = RULE_ID(rule_default, 0);
+    }
+
+    return config.default_action;
+}
+
+/*
+    accept_flow处理流水线或者流表缓存给出的结果：通过了所有检查的数据包应用'default_action'，命中了白名单的数据包直接通过
+    最终的结果是XDP_PASS时，把它所属的连接记录到连接跟踪表中，经过了限速类别的数据包除外
+*/
+static __always_inline __u32 accept_flow(struct context *ctx, __u32 action)
+{
+    if (action == XDP_PASS)
+    {
+        action = apply_default_action(ctx);
+    }
+    else if (action == XDPFW_ACCEPT)
+    {
+        action = XDP_PASS;
+    }
+    else
+    {
+        return action;
+    }
+
+    if (action == XDP_PASS && !ctx->nocache)
+    {
+        ct_commit(ctx);
+    }
+
+    return action;
+}
+
+/*
+    end_packet是每个数据包的最后一步，不论它的结果是在入口程序中还是在流水线中得到的：
+    记录第一个分片的结果，把XDP_REDIRECT的数据包交给AF_XDP的socket，进行引流，抽样抓取被丢弃的数据包，并更新丢弃原因和action的统计信息
+    编译时开启了计时的话，最后记录这个数据包经过的总时间
+*/
+static __always_inline __u32 end_packet(struct context *ctx, __u32 action)
+{
+    record_fragment(ctx, action);
+    action = steer(ctx, redirect_xsk(ctx, action));
+    capture_drop(ctx, action);
+    update_drop_stats(ctx, action);
+    action = update_action_stats(ctx, action);
+    prof_end(ctx);
+
+    return action;
+}
+
+/*
+    finish_pipeline处理流水线的最后一步：执行还在等待的规则，把通过检查的流写入流表缓存，然后结束这个数据包
+*/
+static __always_inline __u32 finish_pipeline(struct context *ctx, __u32 action)
+{
+    /*
+        所有的层都检查完了，还在等待的规则没有被更优先的白名单覆盖，现在执行它
+    */
+    if (action == XDP_PASS && ctx->verdict_priority != POLICY_NONE)
+    {
+        ctx->rule = ctx->verdict_rule;
+        action = enforce_policy(ctx, ctx->verdict_action, ctx->verdict_arg);
+    }
+
+    /*
+        这里只缓存通过和命中白名单的结果，被丢弃的流每次都要重新经过黑名单检查，这样每条规则的命中计数才是准确的
+    */
+    if ((action == XDP_PASS || action == XDPFW_ACCEPT) && !ctx->nocache)
+    {
+        update_flow_cache(ctx, action);
+    }
+
+    return end_packet(ctx, accept_flow(ctx, action));
+}
+
+/*
+    next_stage尾调用流水线中的下一层检查
+    如果尾调用成功，这个函数就不会返回；如果下一个位置是空的，说明所有的检查都已经通过，直接结束流水线
+*/
+static __always_inline __u32 next_stage(struct xdp_md *xdp_ctx, struct context *ctx)
+{
+    __u32 stage = ctx->stage;
+
+    ctx->stage = stage + 1;
+    if (save_ctx(ctx) == 0)
+    {
+        bpf_tail_call(xdp_ctx, &xdpfw_stages, stage);
+    }
+
+    return finish_pipeline(ctx, XDP_PASS);
+}
+
+/*
+    end_stage是每一层检查程序的最后一步：如果这一层的检查没有通过，就直接结束流水线，否则继续下一层
+*/
+static __always_inline __u32 end_stage(struct xdp_md *xdp_ctx, struct context *ctx, __u32 action)
+{
+    if (action != XDP_PASS)
+    {
+        return finish_pipeline(ctx, action);
+    }
+
+    return next_stage(xdp_ctx, ctx);
+}
+
+#endif // _XDPFW_KERN_PIPELINE_H
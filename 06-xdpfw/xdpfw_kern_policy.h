@@ -0,0 +1,133 @@
+#ifndef _XDPFW_KERN_POLICY_H
+#define _XDPFW_KERN_POLICY_H
+
+/*
+    policy_state只有一个元素，结构的定义见common.h中的'policy_state'
+    每条规则被命中时都要查询一次它，才能知道这条规则能不能被立即执行，没有命中任何规则的数据包不需要查询
+*/
+struct bpf_map_def SEC("maps") policy_state = {
+    .type = BPF_MAP_TYPE_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(struct policy_state),
+    .max_entries = 1,
+};
+
+/*
+    policy_classes保存了每个限速类别的速率，下标就是类别的编号，'bucket'字段不使用
+    policy_class_buckets是每个类别的令牌桶，和'ratelimit_buckets'一样，每个CPU有自己的一份，速率是按照每个CPU单独计算的
+    命中同一个类别的所有数据包共用一个桶，所以它限制的是这一组规则的总速率，而不是每个源地址的速率
+*/
+struct bpf_map_def SEC("maps") policy_classes = {
+    .type = BPF_MAP_TYPE_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(struct ratelimit_rate),
+    .max_entries = POLICY_MAX_CLASSES,
+};
+
+struct bpf_map_def SEC("maps") policy_class_buckets = {
+    .type = BPF_MAP_TYPE_PERCPU_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(struct token_bucket),
+    .max_entries = POLICY_MAX_CLASSES,
+};
+
+/*
+    police_class让一个数据包经过一个限速类别，超过速率时返回XDP_DROP，否则返回XDP_PASS继续检查
+    没有配置速率的类别不限速，经过限速类别的数据包的结果都不能被缓存
+*/
+static __always_inline __u32 police_class(struct context *ctx, __u32 class)
+{
+    ctx->nocache = 1;
+
+    struct ratelimit_rate *rate = bpf_map_lookup_elem(&policy_classes, &class);
+    if (!rate || rate->rate == 0)
+    {
+        return XDP_PASS;
+    }
+
+    struct token_bucket *bucket = bpf_map_lookup_elem(&policy_class_buckets, &class);
+    if (!bucket)
+    {
+        return XDP_PASS;
+    }
+
+    if (consume_token(bucket, rate, bpf_ktime_get_ns()) == 0)
+    {
+        return XDP_PASS;
+    }
+
+    return XDP_DROP;
+}
+
+/*
+    enforce_policy执行一条规则的动作，返回流水线中这一层的结果
+*/
+static __always_inline __u32 enforce_policy(struct context *ctx, __u32 action, __u32 arg)
+{
+    switch (action)
+    {
+    case policy_pass:
+        return XDPFW_ACCEPT;
+    case policy_ratelimit:
+        return police_class(ctx, arg);
+    case policy_redirect:
+        ctx->redirect_ifindex = arg;
+        return XDP_REDIRECT;
+    case policy_tx:
+        return XDP_TX;
+    }
+
+    return XDP_DROP;
+}
+
+/*
+    RULE_EXPIRED_MAX_DEPTH是查找到的前缀过期时，最多沿着覆盖它的更短的前缀继续查找多少次
+*/
+#define RULE_EXPIRED_MAX_DEPTH 4
+
+/*
+    rule_expired判断一条规则是否已经过期，调用者要在更新命中计数之前检查，过期的规则既不计数也不执行
+    LPM和DIR-24-8只返回最长的那个前缀，所以它们在查找到过期的前缀时还要继续查找覆盖它的更短的前缀
+*/
+static __always_inline int rule_expired(struct rule_policy *policy)
+{
+    return policy->expires != 0 && policy->expires <= bpf_ktime_get_ns();
+}
+
+/*
+    match_rule在一个数据包命中了一条规则之后被调用，'rule'是这条规则的'RULE_ID'
+    已经有一条更优先的规则在等待执行时，这条规则被忽略；白名单立即结束检查
+    其他的规则比所有白名单规则都优先时立即执行，否则记录在context中，等到流水线结束时如果没有被白名单覆盖再执行
+    内层和外层的规则按照同样的优先级比较，内层命中的规则带有RULE_INNER
+*/
+static __always_inline __u32 match_rule(struct context *ctx, struct rule_policy *policy, __u32 rule)
+{
+    __u32 priority = policy->priority;
+    __u32 action = policy->action;
+
+    rule = layer_rule(ctx, rule);
+
+    if (priority > ctx->verdict_priority || (priority == ctx->verdict_priority && action != policy_pass))
+    {
+        return XDP_PASS;
+    }
+
+    if (action != policy_pass)
+    {
+        __u32 idx = 0;
+        struct policy_state *state = bpf_map_lookup_elem(&policy_state, &idx);
+        if (state && priority >= state->allow_priority)
+        {
+            ctx->verdict_action = action;
+            ctx->verdict_priority = priority;
+            ctx->verdict_arg = policy->arg;
+            ctx->verdict_rule = rule;
+            return XDP_PASS;
+        }
+    }
+
+    ctx->rule = rule;
+    return enforce_policy(ctx, action, policy->arg);
+}
+
+#endif // _XDPFW_KERN_POLICY_H
@@ -0,0 +1,134 @@
+#ifndef _XDPFW_KERN_PROFILE_H
+#define _XDPFW_KERN_PROFILE_H
+
+/*
+    这个文件中的计时只在使用'make PROFILE=1'编译时存在，否则下面的函数都是空的宏，'context'中也没有计时的字段
+    这样正常编译出来的程序中没有任何计时的指令和MAP，生产环境不需要为它付出任何开销
+*/
+#ifdef XDPFW_PROFILE
+
+/*
+    prof_hist是每个计时点的延迟直方图，下标为'计时点 * PROF_BUCKETS + 桶'，计时点见common.h中的'prof_point'
+    第i个桶统计的是延迟在[2^i, 2^(i+1))纳秒之间的次数，0纳秒也被计入第0个桶
+    使用PERCPU的版本，这样记录一次延迟只需要一次查找和一次加法，不需要原子操作
+*/
+struct bpf_map_def SEC("maps") prof_hist = {
+    .type = BPF_MAP_TYPE_PERCPU_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(__u64),
+    .max_entries = PROF_POINTS * PROF_BUCKETS,
+};
+
+/*
+    prof_log2计算一个延迟所在的桶，也就是它的二进制最高位，这里用二分的方法，不需要循环
+*/
+static __always_inline __u32 prof_log2(__u64 value)
+{
+    __u32 bucket = 0;
+
+    if (value >> 32)
+    {
+        value >>= 32;
+        bucket += 32;
+    }
+    if (value >> 16)
+    {
+        value >>= 16;
+        bucket += 16;
+    }
+    if (value >> 8)
+    {
+        value >>= 8;
+        bucket += 8;
+    }
+    if (value >> 4)
+    {
+        value >>= 4;
+        bucket += 4;
+    }
+    if (value >> 2)
+    {
+        value >>= 2;
+        bucket += 2;
+    }
+    if (value >> 1)
+    {
+        bucket += 1;
+    }
+
+    return bucket < PROF_BUCKETS ? bucket : PROF_BUCKETS - 1;
+}
+
+static __always_inline void prof_record(__u32 point, __u64 delta)
+{
+    __u32 idx = point * PROF_BUCKETS + prof_log2(delta);
+    __u64 *count = bpf_map_lookup_elem(&prof_hist, &idx);
+    if (count)
+    {
+        *count += 1;
+    }
+}
+
+/*
+    prof_begin在入口程序中按照XDPFW_PROFILE_SAMPLE的比例抽取数据包，只有被抽中的数据包才会被计时
+    'prof_start'为0代表这个数据包没有被抽中
+*/
+static __always_inline void prof_begin(struct context *ctx)
+{
+    ctx->prof_start = 0;
+    if (bpf_get_prandom_u32() % XDPFW_PROFILE_SAMPLE != 0)
+    {
+        return;
+    }
+
+    ctx->prof_start = bpf_ktime_get_ns();
+    ctx->prof_mark = ctx->prof_start;
+}
+
+/*
+    prof_mark记录从上一个计时点到现在经过的时间，作为'point'的一次延迟
+    流水线中每一层的延迟包含了进入这一层的尾调用，因为上一个计时点是在尾调用之前记录的
+*/
+static __always_inline void prof_mark(struct context *ctx, __u32 point)
+{
+    if (ctx->prof_start == 0)
+    {
+        return;
+    }
+
+    __u64 now = bpf_ktime_get_ns();
+    prof_record(point, now - ctx->prof_mark);
+    ctx->prof_mark = now;
+}
+
+/*
+    prof_end在一个数据包结束时记录它在整个程序中经过的时间
+*/
+static __always_inline void prof_end(struct context *ctx)
+{
+    if (ctx->prof_start == 0)
+    {
+        return;
+    }
+
+    prof_record(prof_total, bpf_ktime_get_ns() - ctx->prof_start);
+}
+
+#else
+
+#define prof_begin(ctx) \
+    do                  \
+    {                   \
+    } while (0)
+#define prof_mark(ctx, point) \
+    do                        \
+    {                         \
+    } while (0)
+#define prof_end(ctx) \
+    do                \
+    {                 \
+    } while (0)
+
+#endif // XDPFW_PROFILE
+
+#endif // _XDPFW_KERN_PROFILE_H
@@ -0,0 +1,245 @@
+#ifndef _XDPFW_KERN_RATELIMIT_H
+#define _XDPFW_KERN_RATELIMIT_H
+
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+
+/*
+    这些定义代表了限速规则和令牌桶的最大数量
+*/
+#ifndef RATELIMIT_RULES_MAX_ENTRIES
+#define RATELIMIT_RULES_MAX_ENTRIES 1024
+#endif
+
+#ifndef RATELIMIT_BUCKETS_MAX_ENTRIES
+#define RATELIMIT_BUCKETS_MAX_ENTRIES 65536
+#endif
+
+/*
+    ratelimit_v4和ratelimit_v6保存了每个源地址前缀的限速参数，和黑名单一样使用最长前缀匹配
+*/
+struct bpf_map_def SEC("maps") ratelimit_v4 = {
+    .type = BPF_MAP_TYPE_LPM_TRIE,
+    .key_size = sizeof(struct lpm_v4_key),
+    .value_size = sizeof(struct ratelimit_limit),
+    .max_entries = RATELIMIT_RULES_MAX_ENTRIES,
+    .map_flags = BPF_F_NO_PREALLOC,
+};
+
+struct bpf_map_def SEC("maps") ratelimit_v6 = {
+    .type = BPF_MAP_TYPE_LPM_TRIE,
+    .key_size = sizeof(struct lpm_v6_key),
+    .value_size = sizeof(struct ratelimit_limit),
+    .max_entries = RATELIMIT_RULES_MAX_ENTRIES,
+    .map_flags = BPF_F_NO_PREALLOC,
+};
+
+/*
+    ratelimit_buckets保存了所有的令牌桶，其类型为'BPF_MAP_TYPE_LRU_PERCPU_HASH'
+    使用PERCPU的版本可以让每个数据包都不需要加锁，代价是速率是按照每个CPU单独计算的，
+    来自同一个源的数据包被网卡分散到N个CPU上时，总的速率最多可以达到配置的N倍
+    LRU保证了洪泛攻击中大量的源地址不会把表填满，最久没有活动的桶会被自动淘汰
+*/
+struct bpf_map_def SEC("maps") ratelimit_buckets = {
+    .type = BPF_MAP_TYPE_LRU_PERCPU_HASH,
+    .key_size = sizeof(struct ratelimit_key),
+    .value_size = sizeof(struct token_bucket),
+    .max_entries = RATELIMIT_BUCKETS_MAX_ENTRIES,
+};
+
+/*
+    ratelimit_counters专门用来统计因为超过限速而被丢弃的数据包，它只有一个元素
+    这些数据包同样会被计入'action_counters'中XDP_DROP的计数
+*/
+struct bpf_map_def SEC("maps") ratelimit_counters = {
+    .type = BPF_MAP_TYPE_PERCPU_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(struct counters),
+    .max_entries = 1,
+};
+
+/*
+    to_ratelimit_proto把第四层协议转换为'ratelimit_proto'
+*/
+static __always_inline __u32 to_ratelimit_proto(__u32 l4_proto)
+{
+    switch (l4_proto)
+    {
+    case IPPROTO_TCP:
+        return ratelimit_tcp;
+    case IPPROTO_UDP:
+        return ratelimit_udp;
+    case IPPROTO_ICMP:
+    case IPPROTO_ICMPV6:
+        return ratelimit_icmp;
+    }
+
+    return ratelimit_any;
+}
+
+/*
+    prefix_mask返回网络字节序的地址中，第'word'个字在前缀长度为'prefixlen'时的掩码
+*/
+static __always_inline __u32 prefix_mask(__u32 prefixlen, __u32 word)
+{
+    if (prefixlen <= word * 32)
+    {
+        return 0;
+    }
+    if (prefixlen >= (word + 1) * 32)
+    {
+        return 0xffffffff;
+    }
+
+    return bpf_htonl(0xffffffff << (32 - (prefixlen - word * 32)));
+}
+
+/*
+    consume_token从令牌桶中取出一个令牌，取不到时返回-1
+    先根据距离上一次补充经过的时间补充令牌，桶中的令牌最多不会超过'burst'个
+*/
+static __always_inline int consume_token(struct token_bucket *bucket, struct ratelimit_rate *rate, __u64 now)
+{
+    __u64 pps = rate->rate;
+    __u64 capacity = (__u64)rate->burst * NSEC_PER_SEC;
+    __u64 elapsed = now - bucket->last_ns;
+    __u64 tokens = capacity;
+
+    /*
+        先判断这段时间是否已经足够把一个空桶填满，没有的话elapsed * pps小于capacity，乘法就不会溢出
+    */
+    if (elapsed < rate->fill_ns)
+    {
+        tokens = bucket->tokens + elapsed * pps;
+        if (tokens > capacity)
+        {
+            tokens = capacity;
+        }
+    }
+
+    bucket->last_ns = now;
+    if (tokens < NSEC_PER_SEC)
+    {
+        bucket->tokens = tokens;
+        return -1;
+    }
+
+    bucket->tokens = tokens - NSEC_PER_SEC;
+    return 0;
+}
+
+/*
+    check_ratelimit对数据包的源地址进行限速，超过限速的数据包返回XDP_DROP
+    它先在'ratelimit_v4'或'ratelimit_v6'中找到源地址所属的限速规则，
+    再按照规则中的前缀长度找到对应的令牌桶，第一次出现的桶是满的
+*/
+static __always_inline __u32 check_ratelimit(struct context *ctx)
+{
+    struct ratelimit_limit *limit;
+    struct ratelimit_key key = {};
+
+    if (ctx->l3_proto == ETH_P_IP)
+    {
+        struct iphdr *ip = ctx->data_start + ctx->l3_offset;
+        if (ip + 1 > ctx->data_end)
+        {
+            return drop_malformed(ctx, malformed_ipv4);
+        }
+
+        struct lpm_v4_key lpm = {
+            .prefixlen = 32,
+        };
+        __builtin_memcpy(lpm.address, &ip->saddr, sizeof(lpm.address));
+
+        limit = bpf_map_lookup_elem(&ratelimit_v4, &lpm);
+        key.family = 4;
+        key.addr[0] = ip->saddr;
+    }
+    else if (ctx->l3_proto == ETH_P_IPV6)
+    {
+        struct ipv6hdr *ip = ctx->data_start + ctx->l3_offset;
+        if (ip + 1 > ctx->data_end)
+        {
+            return drop_malformed(ctx, malformed_ipv6);
+        }
+
+        struct lpm_v6_key lpm = {
+            .prefixlen = 128,
+        };
+        __builtin_memcpy(lpm.address, &ip->saddr, sizeof(lpm.address));
+
+        limit = bpf_map_lookup_elem(&ratelimit_v6, &lpm);
+        key.family = 6;
+        __builtin_memcpy(key.addr, &ip->saddr, sizeof(key.addr));
+    }
+    else
+    {
+        return XDP_PASS;
+    }
+
+    if (!limit)
+    {
+        return XDP_PASS;
+    }
+
+    /*
+        这个协议没有单独配置速率时，使用对所有协议生效的速率
+    */
+    __u32 proto = to_ratelimit_proto(ctx->l4_proto);
+    if (proto >= RATELIMIT_PROTOS)
+    {
+        return XDP_PASS;
+    }
+
+    struct ratelimit_rate *rate = &limit->rates[proto];
+    if (rate->rate == 0)
+    {
+        proto = ratelimit_any;
+        rate = &limit->rates[ratelimit_any];
+    }
+    if (rate->rate == 0)
+    {
+        return XDP_PASS;
+    }
+
+    key.proto = proto;
+    key.bucket = rate->bucket;
+
+#pragma unroll
+    for (__u32 i = 0; i < 4; i++)
+    {
+        key.addr[i] &= prefix_mask(key.bucket, i);
+    }
+
+    __u64 now = bpf_ktime_get_ns();
+    struct token_bucket *bucket = bpf_map_lookup_elem(&ratelimit_buckets, &key);
+    if (!bucket)
+    {
+        struct token_bucket fresh = {
+            .tokens = ((__u64)rate->burst - 1) * NSEC_PER_SEC,
+            .last_ns = now,
+        };
+        bpf_map_update_elem(&ratelimit_buckets, &key, &fresh, BPF_ANY);
+
+        return XDP_PASS;
+    }
+
+    if (consume_token(bucket, rate, now) == 0)
+    {
+        return XDP_PASS;
+    }
+
+    __u32 idx = 0;
+    struct counters *counters = bpf_map_lookup_elem(&ratelimit_counters, &idx);
+    if (counters)
+    {
+        update_rule_stats(ctx, counters);
+    }
+
+    ctx->rule = RULE_ID(rule_ratelimit, proto);
+    return XDP_DROP;
+}
+
+#endif // _XDPFW_KERN_RATELIMIT_H
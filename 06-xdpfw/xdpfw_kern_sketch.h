@@ -0,0 +1,190 @@
+#ifndef _XDPFW_KERN_SKETCH_H
+#define _XDPFW_KERN_SKETCH_H
+
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+
+/*
+    sketch是按源地址统计数据包数和字节数的count-min sketch，下标为common.h中的'SKETCH_INDEX'
+    每个CPU有自己的一份，更新时只需要SKETCH_DEPTH次数组查找和加法，用户态把所有CPU上的计数加起来之后再取最小值
+    计数只增不减，用户态通过比较两次读取之间的差得到一段时间内的流量，'--sketch-reset'把它和候选地址一起清空
+*/
+struct bpf_map_def SEC("maps") sketch = {
+    .type = BPF_MAP_TYPE_PERCPU_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(struct counters),
+    .max_entries = SKETCH_DEPTH * SKETCH_WIDTH,
+};
+
+/*
+    sketch_candidates记录了可能是大流量来源的地址，值是它最后一次被写入的时间
+    它被所有的CPU共享，LRU保证了一段时间没有再出现的地址会被新的候选地址替换
+*/
+struct bpf_map_def SEC("maps") sketch_candidates = {
+    .type = BPF_MAP_TYPE_LRU_HASH,
+    .key_size = sizeof(struct sketch_key),
+    .value_size = sizeof(__u64),
+    .max_entries = SKETCH_CANDIDATES,
+};
+
+/*
+    hll是估计不同源地址数量的HyperLogLog寄存器，结构的定义见common.h中的'hll_registers'
+    整个数组是PERCPU_ARRAY中的一个元素，所以每个数据包只需要一次查找；用户态定期读取之后清空它们
+*/
+struct bpf_map_def SEC("maps") hll = {
+    .type = BPF_MAP_TYPE_PERCPU_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(struct hll_registers),
+    .max_entries = 1,
+};
+
+struct bpf_map_def SEC("maps") hll_meta = {
+    .type = BPF_MAP_TYPE_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(struct hll_meta),
+    .max_entries = 1,
+};
+
+/*
+    hll_rank计算一个去掉了寄存器编号之后的哈希值中第一个1的位置，也就是前导0的个数加1
+    和prof_log2一样用二分的方法，全为0时返回最大的秩
+*/
+static __always_inline __u8 hll_rank(__u32 value)
+{
+    if (value == 0)
+    {
+        return 32 - HLL_PRECISION + 1;
+    }
+
+    __u8 rank = 1;
+    if (!(value & 0xffff0000))
+    {
+        value <<= 16;
+        rank += 16;
+    }
+    if (!(value & 0xff000000))
+    {
+        value <<= 8;
+        rank += 8;
+    }
+    if (!(value & 0xf0000000))
+    {
+        value <<= 4;
+        rank += 4;
+    }
+    if (!(value & 0xc0000000))
+    {
+        value <<= 2;
+        rank += 2;
+    }
+    if (!(value & 0x80000000))
+    {
+        rank += 1;
+    }
+
+    return rank;
+}
+
+/*
+    update_hll把一个源地址的哈希值计入HyperLogLog，寄存器只在秩变大时才会被写入
+*/
+static __always_inline void update_hll(__u32 hash)
+{
+    __u32 idx = 0;
+    struct hll_registers *hll_regs = bpf_map_lookup_elem(&hll, &idx);
+    if (!hll_regs)
+    {
+        return;
+    }
+
+    __u32 reg = hash >> (32 - HLL_PRECISION);
+    __u8 rank = hll_rank(hash << HLL_PRECISION);
+    if (reg < HLL_REGISTERS && hll_regs->registers[reg] < rank)
+    {
+        hll_regs->registers[reg] = rank;
+    }
+}
+
+/*
+    build_sketch_key从IP头部中取出源地址，不是IP的数据包返回-1
+*/
+static __always_inline int build_sketch_key(struct context *ctx, struct sketch_key *key)
+{
+    __builtin_memset(key, 0, sizeof(*key));
+
+    if (ctx->l3_proto == ETH_P_IP)
+    {
+        struct iphdr *ip = ctx->data_start + ctx->l3_offset;
+        if (ip + 1 > ctx->data_end)
+        {
+            return -1;
+        }
+
+        key->family = 4;
+        key->addr[0] = ip->saddr;
+        return 0;
+    }
+
+    if (ctx->l3_proto == ETH_P_IPV6)
+    {
+        struct ipv6hdr *ip = ctx->data_start + ctx->l3_offset;
+        if (ip + 1 > ctx->data_end)
+        {
+            return -1;
+        }
+
+        key->family = 6;
+        __builtin_memcpy(key->addr, &ip->saddr, sizeof(key->addr));
+        return 0;
+    }
+
+    return -1;
+}
+
+/*
+    update_sketch把一个数据包计入它的源地址在每一行中对应的计数，同时得到这个CPU上对它的估计值
+    估计值达到SKETCH_REPORT_MIN之后每增加SKETCH_REPORT_STRIDE写入一次候选地址，绝大多数数据包只做数组的加法
+    持续的大流量来源会被定期重新写入，即使它曾经被其他地址挤出了LRU，也会很快回到候选地址中
+    同一个哈希值也被用来更新HyperLogLog
+*/
+static __always_inline void update_sketch(struct context *ctx)
+{
+    struct sketch_key key;
+    if (build_sketch_key(ctx, &key) != 0)
+    {
+        return;
+    }
+
+    __u32 h1 = 0;
+    __u32 h2 = 0;
+    sketch_hashes(&key, &h1, &h2);
+    update_hll(h1);
+
+    __u64 estimate = (__u64)-1;
+#pragma unroll
+    for (__u32 row = 0; row < SKETCH_DEPTH; row++)
+    {
+        __u32 idx = SKETCH_INDEX(row, h1, h2);
+        struct counters *counters = bpf_map_lookup_elem(&sketch, &idx);
+        if (!counters)
+        {
+            return;
+        }
+
+        counters->packets += 1;
+        counters->bytes += ctx->length;
+        if (counters->packets < estimate)
+        {
+            estimate = counters->packets;
+        }
+    }
+
+    if (estimate >= SKETCH_REPORT_MIN && (estimate & (SKETCH_REPORT_STRIDE - 1)) == 0)
+    {
+        __u64 now = bpf_ktime_get_ns();
+        bpf_map_update_elem(&sketch_candidates, &key, &now, BPF_ANY);
+    }
+}
+
+#endif // _XDPFW_KERN_SKETCH_H
@@ -0,0 +1,111 @@
+#ifndef _XDPFW_KERN_STEER_H
+#define _XDPFW_KERN_STEER_H
+
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/udp.h>
+
+/*
+    cpu_map是用来引流的'BPF_MAP_TYPE_CPUMAP'，键是目标CPU的编号，值是'bpf_cpumap_val'
+    被重定向到其中的数据包会进入目标CPU的队列，由目标CPU上的内核线程继续送入协议栈
+    这样即使网卡的RSS把一条很重的流放在了一个队列上，协议栈的处理也可以被分摊到多个CPU上
+    每个条目还挂载了下面的'xdpfw_steer_fn'，用来统计目标CPU实际处理了多少个数据包
+*/
+struct bpf_map_def SEC("maps") cpu_map = {
+    .type = BPF_MAP_TYPE_CPUMAP,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(struct bpf_cpumap_val),
+    .max_entries = STEER_MAX_CPUS,
+};
+
+/*
+    steer_stats统计每个目标CPU的入队和处理的数据包数量，结构的定义见common.h中的'steer_counters'
+    使用PERCPU的版本是因为所有的CPU都可能同时向同一个目标CPU引流，用户态需要把所有CPU上的值加起来
+*/
+struct bpf_map_def SEC("maps") steer_stats = {
+    .type = BPF_MAP_TYPE_PERCPU_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(struct steer_counters),
+    .max_entries = STEER_MAX_CPUS,
+};
+
+/*
+    flow_hash计算数据包所属的流的哈希值，同一条流的数据包总是得到相同的值，所以它们会被引流到同一个CPU上，不会乱序
+    IPv4的分片中只有第一个分片带有端口，所以分片只使用地址计算哈希，这样同一个数据报的分片也会落在同一个CPU上
+*/
+static __always_inline __u32 flow_hash(struct context *ctx)
+{
+    __u32 hash = ctx->l4_proto;
+
+    if (ctx->l3_proto == ETH_P_IP)
+    {
+        struct iphdr *ip = ctx->data_start + ctx->l3_offset;
+        if (ip + 1 > ctx->data_end)
+        {
+            return hash;
+        }
+
+        hash = hash_mix(hash, ip->saddr);
+        hash = hash_mix(hash, ip->daddr);
+    }
+    else if (ctx->l3_proto == ETH_P_IPV6)
+    {
+        struct ipv6hdr *ip = ctx->data_start + ctx->l3_offset;
+        if (ip + 1 > ctx->data_end)
+        {
+            return hash;
+        }
+
+#pragma unroll
+        for (int i = 0; i < 4; i++)
+        {
+            hash = hash_mix(hash, ip->saddr.in6_u.u6_addr32[i]);
+            hash = hash_mix(hash, ip->daddr.in6_u.u6_addr32[i]);
+        }
+    }
+
+    if (ctx->frag == ipv4_frag_none && (ctx->l4_proto == IPPROTO_TCP || ctx->l4_proto == IPPROTO_UDP))
+    {
+        struct udphdr *l4 = ctx->data_start + ctx->l4_offset;
+        if (l4 + 1 <= ctx->data_end)
+        {
+            hash = hash_mix(hash, ((__u32)l4->source << 16) | l4->dest);
+        }
+    }
+
+    return hash_final(hash);
+}
+
+/*
+    steer在开启了引流时，把最终结果为XDP_PASS的数据包按照流的哈希值重定向到'steer_cpus'中的一个CPU上
+    其他的结果，以及没有开启引流时，原样返回
+*/
+static __always_inline __u32 steer(struct context *ctx, __u32 action)
+{
+    if (action != XDP_PASS || config.steer_cpu_count == 0)
+    {
+        return action;
+    }
+
+    __u32 slot = flow_hash(ctx) % config.steer_cpu_count;
+    if (slot >= STEER_MAX_CPUS)
+    {
+        return action;
+    }
+
+    __u32 cpu = config.steer_cpus[slot];
+    struct steer_counters *counters = bpf_map_lookup_elem(&steer_stats, &cpu);
+    if (counters)
+    {
+        counters->enqueued += 1;
+    }
+
+    /*
+        flags的低两位是查找失败时返回的action，这样目标CPU不在cpu_map中时数据包仍然会被正常处理
+    */
+    return bpf_redirect_map(&cpu_map, cpu, XDP_PASS);
+}
+
+#endif // _XDPFW_KERN_STEER_H
@@ -0,0 +1,362 @@
+#ifndef _XDPFW_KERN_SYNCOOKIE_H
+#define _XDPFW_KERN_SYNCOOKIE_H
+
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/tcp.h>
+
+/*
+    SYN cookie模式需要内核开启'net.ipv4.tcp_syncookies'，这样协议栈才会接受带有cookie的ACK
+    建议设置为2，这样协议栈在SYN队列没有溢出时也会检查cookie
+
+    回复的SYN-ACK只带有MSS选项，所以这些连接不会使用窗口缩放、SACK和时间戳
+    SYNCOOKIE_TCP_LEN是回复的TCP头部的长度，SYNCOOKIE_WINDOW是其中的接收窗口
+*/
+#define SYNCOOKIE_TCP_LEN (sizeof(struct tcphdr) + 4)
+#define SYNCOOKIE_WINDOW 65535
+#define SYNCOOKIE_TTL 64
+
+#define TCP_MAX_HEADER_WORDS 15
+
+/*
+    下面这些定义来自内核内部的头文件，uapi中没有导出
+*/
+#ifndef TCPOPT_MSS
+#define TCPOPT_MSS 2
+#endif
+
+#ifndef TCPOLEN_MSS
+#define TCPOLEN_MSS 4
+#endif
+
+#ifndef IP_DF
+#define IP_DF 0x4000
+#endif
+
+/*
+    syncookie_ports是需要保护的TCP目的端口的位图，布局和'port_blacklist'中的一个位图相同
+*/
+struct bpf_map_def SEC("maps") syncookie_ports = {
+    .type = BPF_MAP_TYPE_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(__u64),
+    .max_entries = PORT_BITMAP_WORDS,
+};
+
+/*
+    syncookie_stats统计SYN cookie这一层的处理结果，索引为common.h中的'syncookie_result'
+*/
+struct bpf_map_def SEC("maps") syncookie_stats = {
+    .type = BPF_MAP_TYPE_PERCPU_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(__u64),
+    .max_entries = SYNCOOKIE_RESULTS,
+};
+
+static __always_inline void update_syncookie_stats(__u32 result)
+{
+    __u64 *count = bpf_map_lookup_elem(&syncookie_stats, &result);
+    if (count)
+    {
+        *count += 1;
+    }
+}
+
+/*
+    csum_fold把32位的校验和累加值折叠成16位的校验和
+*/
+static __always_inline __u16 csum_fold(__u32 csum)
+{
+    csum = (csum & 0xffff) + (csum >> 16);
+    csum = (csum & 0xffff) + (csum >> 16);
+
+    return ~csum;
+}
+
+/*
+    syncookie_reply把收到的SYN原地改写成带有cookie的SYN-ACK，调用之后需要返回XDP_TX把它从同一个网卡发回去
+    以太网头和IP头中的地址被交换，TCP头部被截断为只带有MSS选项的固定长度，最后重新计算校验和
+*/
+static __always_inline __u32 syncookie_reply(struct xdp_md *xdp_ctx, struct context *ctx, __u32 cookie, __u16 mss)
+{
+    /*
+        在调整数据包的长度之前，先保存需要的字段
+    */
+    struct tcphdr *tcp = ctx->data_start + ctx->l4_offset;
+    if (tcp + 1 > ctx->data_end)
+    {
+        return XDP_DROP;
+    }
+
+    __be16 sport = tcp->source;
+    __be16 dport = tcp->dest;
+    __u32 seq = bpf_ntohl(tcp->seq);
+
+    int delta = (int)(ctx->l4_offset + SYNCOOKIE_TCP_LEN) - (int)(ctx->data_end - ctx->data_start);
+    int adjusted = bpf_xdp_adjust_tail(xdp_ctx, delta);
+
+    /*
+        调整之后原来的指针全部失效，需要重新计算并检查边界
+        ctx中的指针也要一起更新，流水线结束时的统计和抓包还会通过它们读取数据包
+    */
+    refresh_ctx(xdp_ctx, ctx);
+    if (adjusted != 0)
+    {
+        return XDP_DROP;
+    }
+
+    void *data = ctx->data_start;
+    void *data_end = ctx->data_end;
+
+    struct ethhdr *eth = data;
+    tcp = data + ctx->l4_offset;
+    if (eth + 1 > data_end || (void *)tcp + SYNCOOKIE_TCP_LEN > data_end)
+    {
+        return XDP_DROP;
+    }
+
+    __u8 mac[ETH_ALEN];
+    __builtin_memcpy(mac, eth->h_source, ETH_ALEN);
+    __builtin_memcpy(eth->h_source, eth->h_dest, ETH_ALEN);
+    __builtin_memcpy(eth->h_dest, mac, ETH_ALEN);
+
+    tcp->source = dport;
+    tcp->dest = sport;
+    tcp->seq = bpf_htonl(cookie);
+    tcp->ack_seq = bpf_htonl(seq + 1);
+    tcp_flag_word(tcp) = bpf_htonl((SYNCOOKIE_TCP_LEN / 4) << 28) | TCP_FLAG_SYN | TCP_FLAG_ACK;
+    tcp->window = bpf_htons(SYNCOOKIE_WINDOW);
+    tcp->check = 0;
+    tcp->urg_ptr = 0;
+    *(__be32 *)(tcp + 1) = bpf_htonl((TCPOPT_MSS << 24) | (TCPOLEN_MSS << 16) | mss);
+
+    __u32 csum = 0;
+    if (ctx->l3_proto == ETH_P_IP)
+    {
+        struct iphdr *ip = data + ctx->l3_offset;
+        if (ip + 1 > data_end)
+        {
+            return XDP_DROP;
+        }
+
+        __be32 addr = ip->saddr;
+        ip->saddr = ip->daddr;
+        ip->daddr = addr;
+        ip->tot_len = bpf_htons(sizeof(*ip) + SYNCOOKIE_TCP_LEN);
+        ip->id = 0;
+        ip->frag_off = bpf_htons(IP_DF);
+        ip->ttl = SYNCOOKIE_TTL;
+        ip->check = 0;
+        ip->check = csum_fold(bpf_csum_diff(0, 0, (void *)ip, sizeof(*ip), 0));
+
+        struct
+        {
+            __be32 saddr;
+            __be32 daddr;
+            __u8 zero;
+            __u8 proto;
+            __be16 len;
+        } pseudo = {
+            .saddr = ip->saddr,
+            .daddr = ip->daddr,
+            .proto = IPPROTO_TCP,
+            .len = bpf_htons(SYNCOOKIE_TCP_LEN),
+        };
+        csum = bpf_csum_diff(0, 0, (void *)&pseudo, sizeof(pseudo), 0);
+    }
+    else
+    {
+        struct ipv6hdr *ip = data + ctx->l3_offset;
+        if (ip + 1 > data_end)
+        {
+            return XDP_DROP;
+        }
+
+        struct in6_addr addr = ip->saddr;
+        ip->saddr = ip->daddr;
+        ip->daddr = addr;
+        ip->payload_len = bpf_htons(SYNCOOKIE_TCP_LEN);
+        ip->hop_limit = SYNCOOKIE_TTL;
+
+        struct
+        {
+            struct in6_addr saddr;
+            struct in6_addr daddr;
+            __be32 len;
+            __u8 zero[3];
+            __u8 nexthdr;
+        } pseudo = {
+            .saddr = ip->saddr,
+            .daddr = ip->daddr,
+            .len = bpf_htonl(SYNCOOKIE_TCP_LEN),
+            .nexthdr = IPPROTO_TCP,
+        };
+        csum = bpf_csum_diff(0, 0, (void *)&pseudo, sizeof(pseudo), 0);
+    }
+
+    tcp->check = csum_fold(bpf_csum_diff(0, 0, (void *)tcp, SYNCOOKIE_TCP_LEN, csum));
+    update_syncookie_stats(syncookie_sent);
+
+    return XDP_TX;
+}
+
+/*
+    syncookie_handle用找到的监听socket处理SYN或ACK，'ip_len'在每个调用的地方都是常量
+    SYN会被改写成SYN-ACK返回XDP_TX；ACK中的cookie有效时交给协议栈，无效时丢弃
+    无论哪种情况，返回之前都必须释放socket的引用
+*/
+static __always_inline __u32 syncookie_handle(struct xdp_md *xdp_ctx, struct context *ctx, struct bpf_sock *sk,
+                                              void *ip, __u32 ip_len, struct tcphdr *tcp, __u32 *tcp_words, __u32 tcp_len)
+{
+    /*
+        没有监听socket的端口交给协议栈回复RST，已经建立的连接也直接放行
+    */
+    if (!sk)
+    {
+        return XDP_PASS;
+    }
+    if (sk->state != BPF_TCP_LISTEN)
+    {
+        bpf_sk_release(sk);
+        return XDP_PASS;
+    }
+
+    if (tcp->syn && !tcp->ack)
+    {
+        long long value = bpf_tcp_gen_syncookie(sk, ip, ip_len, tcp_words, tcp_len);
+        bpf_sk_release(sk);
+
+        /*
+            协议栈没有开启SYN cookie时会返回错误，此时这个SYN交给协议栈自己处理
+        */
+        if (value < 0)
+        {
+            return XDP_PASS;
+        }
+
+        return syncookie_reply(xdp_ctx, ctx, (__u32)value, (__u16)(value >> 32));
+    }
+
+    if (tcp->ack && !tcp->syn && !tcp->rst)
+    {
+        int ret = bpf_tcp_check_syncookie(sk, ip, ip_len, tcp_words, tcp_len);
+        bpf_sk_release(sk);
+
+        update_syncookie_stats(ret == 0 ? syncookie_valid : syncookie_invalid);
+        return ret == 0 ? XDP_PASS : XDP_DROP;
+    }
+
+    bpf_sk_release(sk);
+    return XDP_PASS;
+}
+
+/*
+    check_syncookie是流水线中SYN cookie这一层的检查，只处理发往'syncookie_ports'中端口的TCP数据包
+    它在当前的网络命名空间中查找这个数据包对应的socket，由监听socket来生成或检查cookie，
+    这样SYN洪泛攻击就不会进入协议栈的SYN队列，监听socket只会看到完成了三次握手的连接
+*/
+static __always_inline __u32 check_syncookie(struct xdp_md *xdp_ctx, struct context *ctx)
+{
+    if (ctx->l4_proto != IPPROTO_TCP)
+    {
+        return XDP_PASS;
+    }
+
+    struct tcphdr *tcp = ctx->data_start + ctx->l4_offset;
+    if (tcp + 1 > ctx->data_end)
+    {
+        return XDP_DROP;
+    }
+
+    __u16 port = bpf_ntohs(tcp->dest);
+    __u32 idx = port / PORT_BITMAP_WORD_BITS;
+    __u64 *word = bpf_map_lookup_elem(&syncookie_ports, &idx);
+    if (!word || !(*word & PORT_BITMAP_BIT(port)))
+    {
+        return XDP_PASS;
+    }
+
+    /*
+        cookie相关的函数需要完整的TCP头部（包括选项），并且要求长度的上界是验证器可以确定的
+        数据包中变长的头部很难满足这个要求，所以这里先把它逐字复制到栈上
+    */
+    __u32 tcp_words[TCP_MAX_HEADER_WORDS] = {};
+    __u32 tcp_len = tcp->doff * 4;
+    if (tcp_len < sizeof(*tcp))
+    {
+        return XDP_DROP;
+    }
+
+#pragma unroll
+    for (__u32 i = 0; i < TCP_MAX_HEADER_WORDS; i++)
+    {
+        __u32 *src = (__u32 *)tcp + i;
+        if (i * 4 >= tcp_len)
+        {
+            break;
+        }
+        if (src + 1 > (__u32 *)ctx->data_end)
+        {
+            return XDP_DROP;
+        }
+        tcp_words[i] = *src;
+    }
+
+    struct bpf_sock_tuple tuple = {};
+    if (ctx->l3_proto == ETH_P_IP)
+    {
+        struct iphdr *ip = ctx->data_start + ctx->l3_offset;
+        if (ip + 1 > ctx->data_end)
+        {
+            return XDP_DROP;
+        }
+
+        /*
+            带有IP选项的数据包交给协议栈处理，这样IP头部的长度就是常量
+            分片的数据包也交给协议栈，回复会改写IP头部，之后'record_fragment'就无法再用它记录这个数据报的结果
+        */
+        if (ip->ihl != 5 || ctx->frag != ipv4_frag_none)
+        {
+            return XDP_PASS;
+        }
+
+        tuple.ipv4.saddr = ip->saddr;
+        tuple.ipv4.daddr = ip->daddr;
+        tuple.ipv4.sport = tcp->source;
+        tuple.ipv4.dport = tcp->dest;
+
+        struct bpf_sock *sk = bpf_skc_lookup_tcp(xdp_ctx, &tuple, sizeof(tuple.ipv4), BPF_F_CURRENT_NETNS, 0);
+        return syncookie_handle(xdp_ctx, ctx, sk, ip, sizeof(*ip), tcp, tcp_words, tcp_len);
+    }
+
+    if (ctx->l3_proto == ETH_P_IPV6)
+    {
+        struct ipv6hdr *ip = ctx->data_start + ctx->l3_offset;
+        if (ip + 1 > ctx->data_end)
+        {
+            return XDP_DROP;
+        }
+
+        /*
+            和IPv4的选项一样，带有扩展头的数据包交给协议栈处理，syncookie_reply只能构造固定40字节的IPv6头部
+        */
+        if (ctx->l4_offset != ctx->l3_offset + sizeof(*ip))
+        {
+            return XDP_PASS;
+        }
+
+        __builtin_memcpy(tuple.ipv6.saddr, &ip->saddr, sizeof(tuple.ipv6.saddr));
+        __builtin_memcpy(tuple.ipv6.daddr, &ip->daddr, sizeof(tuple.ipv6.daddr));
+        tuple.ipv6.sport = tcp->source;
+        tuple.ipv6.dport = tcp->dest;
+
+        struct bpf_sock *sk = bpf_skc_lookup_tcp(xdp_ctx, &tuple, sizeof(tuple.ipv6), BPF_F_CURRENT_NETNS, 0);
+        return syncookie_handle(xdp_ctx, ctx, sk, ip, sizeof(*ip), tcp, tcp_words, tcp_len);
+    }
+
+    return XDP_PASS;
+}
+
+#endif // _XDPFW_KERN_SYNCOOKIE_H
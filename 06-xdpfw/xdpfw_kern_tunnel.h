@@ -0,0 +1,397 @@
+#ifndef _XDPFW_KERN_TUNNEL_H
+#define _XDPFW_KERN_TUNNEL_H
+
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/udp.h>
+
+/*
+    GRE头部中的标志位和版本，uapi中的定义是网络字节序的，这里使用主机字节序
+*/
+#define GRE_FLAG_CSUM 0x8000
+#define GRE_FLAG_ROUTING 0x4000
+#define GRE_FLAG_KEY 0x2000
+#define GRE_FLAG_SEQ 0x1000
+#define GRE_VERSION_MASK 0x0007
+
+/*
+    GRE头部中固定的部分，之后按照标志位依次跟着校验和、密钥和序号，每个4字节
+*/
+struct gre_hdr
+{
+    __be16 flags;
+    __be16 protocol;
+};
+
+/*
+    VXLAN头部，'flags'中的I标志位代表VNI有效，其余的字段这里不关心
+*/
+#define VXLAN_FLAG_VNI 0x08
+
+struct vxlan_hdr
+{
+    __u8 flags;
+    __u8 reserved1[3];
+    __u8 vni[3];
+    __u8 reserved2;
+};
+
+/*
+    MPLS标签栈中每一项的栈底标志位
+*/
+#define MPLS_BOS 0x00000100
+
+/*
+    tunnel_stats统计每种封装的解析结果，下标为common.h中的'tunnel_type'，结构的定义见common.h中的'tunnel_stats'
+*/
+struct bpf_map_def SEC("maps") tunnel_stats = {
+    .type = BPF_MAP_TYPE_PERCPU_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(struct tunnel_stats),
+    .max_entries = TUNNEL_TYPES,
+};
+
+static __always_inline void update_tunnel_stats(__u32 type, int decapsulated)
+{
+    struct tunnel_stats *stats = bpf_map_lookup_elem(&tunnel_stats, &type);
+    if (!stats)
+    {
+        return;
+    }
+
+    if (decapsulated)
+    {
+        stats->decapsulated += 1;
+    }
+    else
+    {
+        stats->unparsed += 1;
+    }
+}
+
+/*
+    swap_layers交换context中外层和内层的头部偏移与协议，之后的检查函数不需要知道自己检查的是哪一层
+    交换两次就回到了原来的状态，流水线中的每一层都是检查完内层之后立即换回来
+*/
+static __always_inline void swap_layers(struct context *ctx)
+{
+    __u32 tmp;
+
+    tmp = ctx->l2_offset;
+    ctx->l2_offset = ctx->inner_l2_offset;
+    ctx->inner_l2_offset = tmp;
+
+    tmp = ctx->l3_proto;
+    ctx->l3_proto = ctx->inner_l3_proto;
+    ctx->inner_l3_proto = tmp;
+
+    tmp = ctx->l3_offset;
+    ctx->l3_offset = ctx->inner_l3_offset;
+    ctx->inner_l3_offset = tmp;
+
+    tmp = ctx->l4_proto;
+    ctx->l4_proto = ctx->inner_l4_proto;
+    ctx->inner_l4_proto = tmp;
+
+    tmp = ctx->l4_offset;
+    ctx->l4_offset = ctx->inner_l4_offset;
+    ctx->inner_l4_offset = tmp;
+
+    ctx->inner ^= 1;
+}
+
+/*
+    parse_mpls跳过'nh_offset'处的MPLS标签栈，栈底之后是IPv4或IPv6时把'nh_proto'设置为对应的以太网协议号
+    标签栈在栈底之前被截断时丢弃这个数据包；标签超过MPLS_MAX_DEPTH个或者栈底之后不是IP时，'nh_proto'保持为MPLS，之后的解析会忽略它
+*/
+static __always_inline __u32 parse_mpls(struct context *ctx)
+{
+#pragma unroll
+    for (int i = 0; i < MPLS_MAX_DEPTH; i++)
+    {
+        __be32 *label = ctx->data_start + ctx->nh_offset;
+        if (label + 1 > ctx->data_end)
+        {
+            return drop_malformed(ctx, malformed_mpls);
+        }
+
+        ctx->nh_offset += sizeof(*label);
+        if (!(bpf_ntohl(*label) & MPLS_BOS))
+        {
+            continue;
+        }
+
+        /*
+            MPLS头部中没有下一层的协议，只能根据IP头部第一个字节中的版本号判断
+        */
+        __u8 *version = ctx->data_start + ctx->nh_offset;
+        if (version + 1 > ctx->data_end)
+        {
+            return drop_malformed(ctx, malformed_mpls);
+        }
+
+        switch (*version >> 4)
+        {
+        case 4:
+            ctx->nh_proto = ETH_P_IP;
+            update_tunnel_stats(tunnel_mpls, 1);
+            return XDP_PASS;
+        case 6:
+            ctx->nh_proto = ETH_P_IPV6;
+            update_tunnel_stats(tunnel_mpls, 1);
+            return XDP_PASS;
+        }
+
+        break;
+    }
+
+    update_tunnel_stats(tunnel_mpls, 0);
+    return XDP_PASS;
+}
+
+/*
+    skip_mpls在parse_eth之后调用，以太网之后的MPLS标签栈和vlan头一样只是被跳过，标签栈之后的IP头部被当作外层的第三层
+*/
+static __always_inline __u32 skip_mpls(struct context *ctx)
+{
+    if (ctx->nh_proto != ETH_P_MPLS_UC && ctx->nh_proto != ETH_P_MPLS_MC)
+    {
+        return XDP_PASS;
+    }
+
+    __u32 action = parse_mpls(ctx);
+    ctx->l3_offset = ctx->nh_offset;
+    ctx->l3_proto = ctx->nh_proto;
+
+    return action;
+}
+
+/*
+    parse_vxlan检查目的端口为VXLAN_PORT的UDP载荷是否是一个VXLAN头部，成功时返回0，内层总是以太网
+*/
+static __always_inline int parse_vxlan(struct context *ctx, __u32 *offset, __u32 *proto)
+{
+    struct udphdr *udp = ctx->data_start + ctx->l4_offset;
+    struct vxlan_hdr *vxlan = (void *)(udp + 1);
+    if (vxlan + 1 > ctx->data_end || !(vxlan->flags & VXLAN_FLAG_VNI))
+    {
+        return -1;
+    }
+
+    *offset = ctx->l4_offset + sizeof(*udp) + sizeof(*vxlan);
+    *proto = ETH_P_TEB;
+    return 0;
+}
+
+/*
+    parse_gre解析一个版本0的GRE头部，成功时返回0，并得到内层的偏移和以太网协议号
+    带有源路由的GRE已经被RFC废弃，版本1是PPTP使用的增强GRE，它们都不被解开
+*/
+static __always_inline int parse_gre(struct context *ctx, __u32 *offset, __u32 *proto)
+{
+    struct gre_hdr *gre = ctx->data_start + ctx->l4_offset;
+    if (gre + 1 > ctx->data_end)
+    {
+        return -1;
+    }
+
+    __u16 flags = bpf_ntohs(gre->flags);
+    if (flags & (GRE_FLAG_ROUTING | GRE_VERSION_MASK))
+    {
+        return -1;
+    }
+
+    __u32 len = sizeof(*gre);
+    if (flags & GRE_FLAG_CSUM)
+    {
+        len += 4;
+    }
+    if (flags & GRE_FLAG_KEY)
+    {
+        len += 4;
+    }
+    if (flags & GRE_FLAG_SEQ)
+    {
+        len += 4;
+    }
+
+    *proto = bpf_ntohs(gre->protocol);
+    switch (*proto)
+    {
+    case ETH_P_TEB:
+    case ETH_P_IP:
+    case ETH_P_IPV6:
+    case ETH_P_MPLS_UC:
+    case ETH_P_MPLS_MC:
+        break;
+    default:
+        return -1;
+    }
+
+    *offset = ctx->l4_offset + len;
+    return 0;
+}
+
+/*
+    parse_inner从封装之后的'nh_offset'开始解析内层的头部，调用之前外层的字段已经被swap_layers换到了'inner_*'中
+    这里使用和外层相同的解析函数，所以内层的头部被截断时同样会被当作格式错误丢弃，只是规则会带上RULE_INNER
+*/
+static __always_inline __u32 parse_inner(struct context *ctx, __u32 proto)
+{
+    __u32 action = XDP_PASS;
+
+    ctx->nh_proto = proto;
+    ctx->l2_offset = ctx->nh_offset;
+    ctx->l3_proto = 0;
+    ctx->l4_proto = 0;
+    ctx->frag = ipv4_frag_none;
+
+    if (proto == ETH_P_TEB)
+    {
+        action = parse_eth(ctx);
+    }
+    else
+    {
+        ctx->l3_offset = ctx->nh_offset;
+        ctx->l3_proto = ctx->nh_proto;
+    }
+
+    if (action == XDP_PASS && (config.tunnels & TUNNEL_BIT(tunnel_mpls)))
+    {
+        action = skip_mpls(ctx);
+    }
+    if (action != XDP_PASS)
+    {
+        return action;
+    }
+
+    switch (ctx->l3_proto)
+    {
+    case ETH_P_IP:
+        if (config.ipv4)
+        {
+            action = parse_ipv4(ctx);
+        }
+        break;
+    case ETH_P_IPV6:
+        if (config.ipv6)
+        {
+            action = parse_ipv6(ctx);
+        }
+        break;
+    }
+    if (action != XDP_PASS)
+    {
+        return action;
+    }
+
+    /*
+        内层的后续分片中没有第四层的头部，内层只检查到第三层
+    */
+    if (ctx->frag == ipv4_frag_later)
+    {
+        ctx->l4_proto = 0;
+    }
+
+    switch (ctx->l4_proto)
+    {
+    case IPPROTO_UDP:
+        action = parse_udp(ctx);
+        break;
+    case IPPROTO_TCP:
+        action = parse_tcp(ctx);
+        break;
+    }
+
+    return action;
+}
+
+/*
+    parse_tunnel在外层的第四层头部解析完之后调用，解开加载时启用了的封装，把内层头部的偏移和协议记录在'inner_*'中
+    外层的'frag'和'tcp_flags'属于外层的数据包，分片跟踪和连接跟踪都使用它们，所以不会被内层覆盖
+    解开了封装的数据包不能使用流表缓存和连接跟踪，它们都是按照外层的五元组记录的，同一个隧道中不同的内层流会共用同一个结果
+*/
+static __always_inline __u32 parse_tunnel(struct context *ctx)
+{
+    __u32 type = tunnel_none;
+    __u32 proto = 0;
+    __u32 offset = 0;
+    int parsed = -1;
+
+    switch (ctx->l4_proto)
+    {
+    case IPPROTO_UDP:
+    {
+        struct udphdr *udp = ctx->data_start + ctx->l4_offset;
+        if ((config.tunnels & TUNNEL_BIT(tunnel_vxlan)) && udp + 1 <= ctx->data_end &&
+            udp->dest == bpf_htons(VXLAN_PORT))
+        {
+            type = tunnel_vxlan;
+            parsed = parse_vxlan(ctx, &offset, &proto);
+        }
+        break;
+    }
+    case IPPROTO_GRE:
+        if (config.tunnels & TUNNEL_BIT(tunnel_gre))
+        {
+            type = tunnel_gre;
+            parsed = parse_gre(ctx, &offset, &proto);
+        }
+        break;
+    case IPPROTO_IPIP:
+    case IPPROTO_IPV6:
+        if (config.tunnels & TUNNEL_BIT(tunnel_ipip))
+        {
+            type = tunnel_ipip;
+            offset = ctx->l4_offset;
+            proto = ctx->l4_proto == IPPROTO_IPIP ? ETH_P_IP : ETH_P_IPV6;
+            parsed = 0;
+        }
+        break;
+    }
+
+    if (type == tunnel_none)
+    {
+        return XDP_PASS;
+    }
+    if (parsed != 0 || offset > HEADER_OFFSET_MASK)
+    {
+        update_tunnel_stats(type, 0);
+        return XDP_PASS;
+    }
+
+    __u32 frag = ctx->frag;
+    __u32 tcp_flags = ctx->tcp_flags;
+
+    swap_layers(ctx);
+    ctx->nh_offset = offset & HEADER_OFFSET_MASK;
+    __u32 action = parse_inner(ctx, proto);
+    __u32 l3_proto = ctx->l3_proto;
+    swap_layers(ctx);
+
+    ctx->frag = frag;
+    ctx->tcp_flags = tcp_flags;
+
+    if (action != XDP_PASS)
+    {
+        return action;
+    }
+
+    /*
+        内层既没有以太网头部也不是IP时没有什么可以检查的，这个数据包只检查外层
+    */
+    if (proto != ETH_P_TEB && l3_proto != ETH_P_IP && l3_proto != ETH_P_IPV6)
+    {
+        update_tunnel_stats(type, 0);
+        return XDP_PASS;
+    }
+
+    ctx->tunnel = type;
+    ctx->inner_eth = proto == ETH_P_TEB;
+    ctx->nocache = 1;
+    update_tunnel_stats(type, 1);
+
+    return XDP_PASS;
+}
+
+#endif // _XDPFW_KERN_TUNNEL_H
@@ -17,6 +17,36 @@
 
 #include "common.h"
 
+/*
+    这个程序的加载时配置，结构的定义和每个字段的含义见common.h中的'xdpfw_config'
+    这里的值是用户态没有指定时的默认值：启用所有的功能，通过检查的数据包返回XDP_PASS
+    注意.rodata段中只能有这一个变量，用户态会用一个'xdpfw_config'覆盖整个段
+*/
+const volatile struct xdpfw_config config = {
+    .default_action = XDP_PASS,
+    .layers = XDPFW_ALL_LAYERS,
+    .vlan_depth = VLAN_MAX_DEPTH,
+    .ipv4 = 1,
+    .ipv6 = 1,
+    .ratelimit = 1,
+    .ipv6_ext_depth = IPV6_EXT_MAX_DEPTH,
+    .ipv6_ext_policy = ipv6_ext_count,
+    .frag_limit = FRAG_DEFAULT_LIMIT,
+    .frag_orphan = orphan_default,
+    .mac_bloom = 1,
+    .v4_engine = v4_engine_lpm,
+    .conntrack = ct_off,
+    .sketch = 1,
+    .tunnels = 0,
+    .flows = 0,
+};
+
+/*
+    在尾调用之间保存的偏移会经过这个掩码，这样验证器就可以知道用它们计算出来的数据包指针是有界的
+    正常的数据包中，第四层头部的偏移不会超过这个值
+*/
+#define HEADER_OFFSET_MASK 0x3ff
+
 /*
     对xdp_md进行一个封装
 */
@@ -27,12 +57,26 @@ static __always_inline struct context to_ctx(struct xdp_md *xdp_ctx)
         .data_end = (void *)(long)xdp_ctx->data_end,
         .nh_proto = 0,
         .nh_offset = 0,
+        .rx_queue = xdp_ctx->rx_queue_index,
+        .ifindex = xdp_ctx->ingress_ifindex,
+        .verdict_priority = POLICY_NONE,
     };
     ctx.length = ctx.data_end - ctx.data_start;
 
     return ctx;
 }
 
+/*
+    refresh_ctx在调整了数据包的长度之后重新读取数据包的指针和长度
+    bpf_xdp_adjust_tail之类的函数无论成功与否都会让原来所有的数据包指针失效，之后的每一步都只能使用重新读取的值
+*/
+static __always_inline void refresh_ctx(struct xdp_md *xdp_ctx, struct context *ctx)
+{
+    ctx->data_start = (void *)(long)xdp_ctx->data;
+    ctx->data_end = (void *)(long)xdp_ctx->data_end;
+    ctx->length = ctx->data_end - ctx->data_start;
+}
+
 /*
     和上一节的相同
 */
@@ -60,4 +104,71 @@ static __always_inline __u32 update_action_stats(struct context *ctx, __u32 acti
     return action;
 }
 
+/*
+    drop_stats按照丢弃的原因统计被丢弃的数据包，下标为common.h中的'DROP_REASON'
+    这样可以区分被我们自己的规则丢弃的数据包和格式错误的数据包，后者在'action_counters'中是混在一起的
+*/
+struct bpf_map_def SEC("maps") drop_stats = {
+    .type = BPF_MAP_TYPE_PERCPU_ARRAY,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(struct counters),
+    .max_entries = DROP_REASONS * DROP_LAYERS,
+};
+
+/*
+    update_drop_stats在一个数据包最终被丢弃时，按照决定了它命运的规则更新'drop_stats'
+*/
+static __always_inline void update_drop_stats(struct context *ctx, __u32 action)
+{
+    if (action != XDP_DROP)
+    {
+        return;
+    }
+
+    __u32 reason = DROP_REASON(ctx->rule);
+    struct counters *counters = bpf_map_lookup_elem(&drop_stats, &reason);
+    if (counters)
+    {
+        counters->packets += 1;
+        counters->bytes += ctx->length;
+    }
+}
+
+/*
+    layer_rule在正在检查隧道的内层头部时给规则加上RULE_INNER，这样丢弃的统计可以区分是哪一层命中的
+*/
+static __always_inline __u32 layer_rule(struct context *ctx, __u32 rule)
+{
+    return ctx->inner ? rule | RULE_INNER : rule;
+}
+
+/*
+    drop_malformed记录一个格式错误的数据包的丢弃原因，然后返回XDP_DROP
+*/
+static __always_inline __u32 drop_malformed(struct context *ctx, enum malformed_reason reason)
+{
+    ctx->rule = layer_rule(ctx, RULE_ID(rule_malformed, reason));
+    return XDP_DROP;
+}
+
+/*
+    update_rule_stats用来更新某一条黑名单规则的命中计数
+    用于PERCPU类型的MAP，每个CPU只会修改自己的那一份数据，所以不需要原子操作
+*/
+static __always_inline void update_rule_stats(struct context *ctx, struct counters *counters)
+{
+    counters->packets += 1;
+    counters->bytes += ctx->length;
+}
+
+/*
+    update_shared_rule_stats的作用和update_rule_stats相同
+    但是LPM_TRIE没有PERCPU的版本，同一条规则可能同时在多个CPU上被命中，所以这里需要使用原子加法
+*/
+static __always_inline void update_shared_rule_stats(struct context *ctx, struct counters *counters)
+{
+    __sync_fetch_and_add(&counters->packets, 1);
+    __sync_fetch_and_add(&counters->bytes, ctx->length);
+}
+
 #endif /* _UTILS_H */
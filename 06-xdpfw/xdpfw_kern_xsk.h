@@ -0,0 +1,39 @@
+#ifndef _XDPFW_KERN_XSK_H
+#define _XDPFW_KERN_XSK_H
+
+/*
+    xsk_map是用来把数据包交给用户态的'BPF_MAP_TYPE_XSKMAP'，键是网卡队列的编号，值是绑定在这个队列上的AF_XDP socket
+    它由用户态的'xdpfw_xsk'填充，每个队列一个socket，这些socket共享同一块UMEM
+    需要进行BPF做不到的深度检查的流，可以通过规则的'XDP_REDIRECT'结果被送到这里
+*/
+struct bpf_map_def SEC("maps") xsk_map = {
+    .type = BPF_MAP_TYPE_XSKMAP,
+    .key_size = sizeof(__u32),
+    .value_size = sizeof(__u32),
+    .max_entries = XSK_MAX_QUEUES,
+};
+
+/*
+    redirect_xsk把最终结果为XDP_REDIRECT的数据包重定向到收到它的队列上绑定的AF_XDP socket，其他的结果原样返回
+    AF_XDP socket只能收到它所绑定的队列上的数据包，所以这里不能像引流一样选择其他的队列
+    这个队列上没有socket时（例如'xdpfw_xsk'没有运行），数据包会以XDP_PASS交给协议栈，而不是被丢弃
+*/
+static __always_inline __u32 redirect_xsk(struct context *ctx, __u32 action)
+{
+    if (action != XDP_REDIRECT)
+    {
+        return action;
+    }
+
+    /*
+        规则指定了目标网卡时直接重定向到那块网卡
+    */
+    if (ctx->redirect_ifindex)
+    {
+        return bpf_redirect(ctx->redirect_ifindex, 0);
+    }
+
+    return bpf_redirect_map(&xsk_map, ctx->rx_queue, XDP_PASS);
+}
+
+#endif // _XDPFW_KERN_XSK_H
@@ -7,43 +7,5193 @@
     been moved into the common/headers/xdp_prog_helpers.h file in the root of this repo.
 */
 
+static __u64 clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+    reset_hll清空所有CPU上的HyperLogLog寄存器，并把清空的时间和刚刚结束的区间的结果记录在'hll_meta'中
+    内核的bpf_ktime_get_ns和CLOCK_MONOTONIC使用同一个时钟
+*/
+static int reset_hll(__u64 last_estimate, __u64 last_interval_ns)
+{
+    int hll_fd = open_bpf_map(HLL_PATH);
+    if (hll_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    int meta_fd = open_bpf_map(HLL_META_PATH);
+    if (meta_fd < 0)
+    {
+        close(hll_fd);
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    unsigned int num_cpus = bpf_num_possible_cpus();
+    struct hll_registers *registers = calloc(num_cpus, sizeof(struct hll_registers));
+    int ret = EXIT_OK;
+    __u32 idx = 0;
+    struct hll_meta meta = {
+        .reset_ns = clock_ns(CLOCK_MONOTONIC),
+        .last_estimate = last_estimate,
+        .last_interval_ns = last_interval_ns,
+    };
+
+    if (registers == NULL)
+    {
+        ret = EXIT_FAIL_GENERIC;
+    }
+    else if (bpf_map_update_elem(hll_fd, &idx, registers, BPF_ANY) != 0 ||
+             bpf_map_update_elem(meta_fd, &idx, &meta, BPF_ANY) != 0)
+    {
+        ret = EXIT_FAIL_XDP_MAP_UPDATE;
+    }
+
+    free(registers);
+    close(meta_fd);
+    close(hll_fd);
+    return ret;
+}
+
+/*
+    reset_sketch清空所有CPU上的count-min sketch、所有的候选地址和HyperLogLog寄存器，开始一个新的统计窗口
+    sketch的计数只增不减，时间长了之后小流量的来源也会因为哈希冲突被多估，需要时可以用'--sketch-reset'重新开始
+*/
+static int reset_sketch()
+{
+    int sketch_fd = open_bpf_map(SKETCH_PATH);
+    if (sketch_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    int candidates_fd = open_bpf_map(SKETCH_CANDIDATES_PATH);
+    if (candidates_fd < 0)
+    {
+        close(sketch_fd);
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    unsigned int num_cpus = bpf_num_possible_cpus();
+    struct counters zeros[num_cpus];
+    memset(zeros, 0, sizeof(zeros));
+    int ret = EXIT_OK;
+
+    for (__u32 i = 0; i < SKETCH_DEPTH * SKETCH_WIDTH; i++)
+    {
+        if (bpf_map_update_elem(sketch_fd, &i, zeros, BPF_ANY) != 0)
+        {
+            printf("ERR: Failed to reset sketch counter '%u' err(%d): %s\n", i, errno, strerror(errno));
+            ret = EXIT_FAIL_XDP_MAP_UPDATE;
+            break;
+        }
+    }
+
+    struct sketch_key key;
+    while (ret == EXIT_OK && bpf_map_get_next_key(candidates_fd, NULL, &key) == 0)
+    {
+        if (bpf_map_delete_elem(candidates_fd, &key) != 0 && errno != ENOENT)
+        {
+            printf("ERR: Failed to delete a candidate source err(%d): %s\n", errno, strerror(errno));
+            ret = EXIT_FAIL_XDP_MAP_UPDATE;
+        }
+    }
+
+    close(candidates_fd);
+    close(sketch_fd);
+
+    if (ret == EXIT_OK)
+    {
+        ret = reset_hll(0, 0);
+    }
+
+    return ret;
+}
+
+/*
+    read_flow_generation读取黑名单当前的版本号，它的最低位同时也决定了内核正在使用'xdpfw_stages'中的哪一半
+*/
+static int read_flow_generation(__u32 *generation)
+{
+    int map_fd = open_bpf_map(FLOW_GENERATION_PATH);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    int ret = EXIT_OK;
+    __u32 idx = 0;
+    if (bpf_map_lookup_elem(map_fd, &idx, generation) != 0)
+    {
+        ret = EXIT_FAIL_XDP_MAP_LOOKUP;
+    }
+
+    close(map_fd);
+    return ret;
+}
+
+/*
+    bump_flow_generation将黑名单的版本号加1
+    内核中流表缓存的每一项都记录了写入时的版本号，版本号改变之后所有旧的缓存项都会失效，
+    这样黑名单的修改可以立即对已经建立的流生效，同时内核也会切换到'xdpfw_stages'的另一半
+*/
+static int bump_flow_generation()
+{
+    int map_fd = open_bpf_map(FLOW_GENERATION_PATH);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    int ret = EXIT_OK;
+    __u32 idx = 0;
+    __u32 generation = 0;
+    if (bpf_map_lookup_elem(map_fd, &idx, &generation) != 0)
+    {
+        ret = EXIT_FAIL_XDP_MAP_LOOKUP;
+    }
+    else
+    {
+        generation++;
+        if (bpf_map_update_elem(map_fd, &idx, &generation, BPF_ANY) != 0)
+        {
+            ret = EXIT_FAIL_XDP_MAP_UPDATE;
+        }
+    }
+
+    close(map_fd);
+    return ret;
+}
+
+/*
+    map_is_empty判断指定的BPF MAP中是否没有任何条目
+*/
+static bool map_is_empty(int map_fd, size_t key_size)
+{
+    void *key = alloca(key_size);
+    return bpf_map_get_next_key(map_fd, NULL, key) != 0;
+}
+
+/*
+    bitmap_has_bits判断一个由'words'个64位的字组成的位图中是否有任何一位被设置
+*/
+static int bitmap_has_bits(int map_fd, __u32 words, bool *has_bits)
+{
+    *has_bits = false;
+    for (__u32 idx = 0; idx < words && !*has_bits; idx++)
+    {
+        __u64 word = 0;
+        if (bpf_map_lookup_elem(map_fd, &idx, &word) != 0)
+        {
+            return EXIT_FAIL_XDP_MAP_LOOKUP;
+        }
+        *has_bits = word != 0;
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    stage_has_rules判断流水线中的某一层是否有规则
+    MAC和第三层看对应的黑名单是否为空，第四层则需要看端口位图中是否有任何一位被设置
+*/
+static int stage_has_rules(enum xdpfw_stage stage, bool *has_rules)
+{
+    int map_fd = -1;
+    *has_rules = false;
+
+    switch (stage)
+    {
+    case stage_mac:
+        map_fd = open_bpf_map(MAC_BLACKLIST_PATH);
+        if (map_fd < 0)
+        {
+            return EXIT_FAIL_XDP_MAP_OPEN;
+        }
+        *has_rules = !map_is_empty(map_fd, ETH_ALEN);
+        break;
+    case stage_l3:
+        map_fd = open_bpf_map(V4_BLACKLIST_PATH);
+        if (map_fd < 0)
+        {
+            return EXIT_FAIL_XDP_MAP_OPEN;
+        }
+        *has_rules = !map_is_empty(map_fd, sizeof(struct lpm_v4_key));
+        close(map_fd);
+
+        map_fd = open_bpf_map(V4_DIR_IDS_PATH);
+        if (map_fd < 0)
+        {
+            return EXIT_FAIL_XDP_MAP_OPEN;
+        }
+        *has_rules = *has_rules || !map_is_empty(map_fd, sizeof(struct lpm_v4_key));
+        close(map_fd);
+
+        map_fd = open_bpf_map(V6_BLACKLIST_PATH);
+        if (map_fd < 0)
+        {
+            return EXIT_FAIL_XDP_MAP_OPEN;
+        }
+        *has_rules = *has_rules || !map_is_empty(map_fd, sizeof(struct lpm_v6_key));
+        close(map_fd);
+
+        map_fd = open_bpf_map(V6_BLACKLIST_64_PATH);
+        if (map_fd < 0)
+        {
+            return EXIT_FAIL_XDP_MAP_OPEN;
+        }
+        *has_rules = *has_rules || !map_is_empty(map_fd, sizeof(struct v6_prefix_key));
+        close(map_fd);
+
+        map_fd = open_bpf_map(V6_BLACKLIST_48_PATH);
+        if (map_fd < 0)
+        {
+            return EXIT_FAIL_XDP_MAP_OPEN;
+        }
+        *has_rules = *has_rules || !map_is_empty(map_fd, sizeof(struct v6_prefix_key));
+        break;
+    case stage_acl:
+        map_fd = open_bpf_map(ACL_RULES_PATH);
+        if (map_fd < 0)
+        {
+            return EXIT_FAIL_XDP_MAP_OPEN;
+        }
+        *has_rules = !map_is_empty(map_fd, sizeof(struct acl_key));
+        break;
+    case stage_l4:
+        map_fd = open_bpf_map(PORT_BLACKLIST_PATH);
+        if (map_fd < 0)
+        {
+            return EXIT_FAIL_XDP_MAP_OPEN;
+        }
+        if (bitmap_has_bits(map_fd, PORT_BITMAP_WORDS * 4, has_rules) != EXIT_OK)
+        {
+            close(map_fd);
+            return EXIT_FAIL_XDP_MAP_LOOKUP;
+        }
+        break;
+    case stage_syncookie:
+        map_fd = open_bpf_map(SYNCOOKIE_PORTS_PATH);
+        if (map_fd < 0)
+        {
+            return EXIT_FAIL_XDP_MAP_OPEN;
+        }
+        if (bitmap_has_bits(map_fd, PORT_BITMAP_WORDS, has_rules) != EXIT_OK)
+        {
+            close(map_fd);
+            return EXIT_FAIL_XDP_MAP_LOOKUP;
+        }
+        break;
+    default:
+        return EXIT_FAIL_GENERIC;
+    }
+
+    close(map_fd);
+    return EXIT_OK;
+}
+
+/*
+    sync_pipeline根据每一层当前是否有规则，重新拼接'xdpfw_stages'中的检查流水线
+    'xdpfw_stages'分成两半，内核根据黑名单版本号的最低位决定使用哪一半，这里只会改写当前没有被使用的那一半：
+    有规则的层按照'xdpfw_stage'的顺序依次放入这一半的前面几个位置，剩下的位置全部清空，
+    最后把版本号加1，一次性地切换到新的流水线，同时让流表缓存中所有的旧结果失效
+    这样正在经过旧流水线的数据包不会因为位置的移动而跳过某一层检查
+    检查程序的文件描述符是通过'xdpfw_stage_progs'中保存的程序ID获得的
+*/
+static int sync_pipeline()
+{
+    __u32 generation = 0;
+    int ret = read_flow_generation(&generation);
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    int stages_fd = open_bpf_map(XDPFW_STAGES_PATH);
+    if (stages_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    int progs_fd = open_bpf_map(XDPFW_STAGE_PROGS_PATH);
+    if (progs_fd < 0)
+    {
+        close(stages_fd);
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    __u32 base = ((generation + 1) & 1) * XDPFW_PIPELINE_SLOTS;
+    __u32 slot = base;
+    for (__u32 stage = 0; stage < XDPFW_STAGES && ret == EXIT_OK; stage++)
+    {
+        /*
+            从用户态查询PROG_ARRAY时，得到的是程序的ID而不是文件描述符
+            查询失败说明这一层在加载时被关闭了，没有被注册
+        */
+        __u32 prog_id = 0;
+        if (bpf_map_lookup_elem(progs_fd, &stage, &prog_id) != 0)
+        {
+            continue;
+        }
+
+        bool has_rules = false;
+        ret = stage_has_rules(stage, &has_rules);
+        if (ret != EXIT_OK || !has_rules)
+        {
+            continue;
+        }
+
+        int prog_fd = bpf_prog_get_fd_by_id(prog_id);
+        if (prog_fd < 0 || bpf_map_update_elem(stages_fd, &slot, &prog_fd, BPF_ANY) != 0)
+        {
+            printf("ERR: Failed to splice stage '%s' into the pipeline err(%d): %s\n",
+                   stage_names[stage], errno, strerror(errno));
+            ret = EXIT_FAIL_XDP_MAP_UPDATE;
+        }
+        if (prog_fd >= 0)
+        {
+            close(prog_fd);
+        }
+        slot++;
+    }
+
+    /*
+        清空这一半中剩下的位置，这些位置原来可能放着已经没有规则的层
+        每一半的最后一个位置永远是空的，保证流水线在用完这一半之前一定会结束
+    */
+    for (; ret == EXIT_OK && slot < base + XDPFW_PIPELINE_SLOTS; slot++)
+    {
+        bpf_map_delete_elem(stages_fd, &slot);
+    }
+
+    close(progs_fd);
+    close(stages_fd);
+
+    /*
+        新的流水线已经完整地写好了，现在才切换过去
+    */
+    if (ret == EXIT_OK)
+    {
+        ret = bump_flow_generation();
+    }
+
+    return ret;
+}
+
+/*
+    lower_allow_priority在'policy'是白名单规则并且比'priority'更优先时，用它的优先级替换'priority'
+*/
+static void lower_allow_priority(const struct rule_policy *policy, __u32 *priority)
+{
+    if (policy->action == policy_pass && policy->priority < *priority)
+    {
+        *priority = policy->priority;
+    }
+}
+
+/*
+    scan_allow_priority遍历一个值为'rule_value'的黑名单，找到其中最优先的白名单规则
+    PERCPU类型的MAP中每个CPU上的规则都是相同的，所以只需要看第一个CPU上的值
+*/
+static int scan_allow_priority(const char *map, size_t key_size, bool percpu, __u32 *priority)
+{
+    int map_fd = open_bpf_map(map);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    unsigned int num_values = percpu ? bpf_num_possible_cpus() : 1;
+    struct rule_value values[num_values];
+    void *key = alloca(key_size);
+    void *prev_key = NULL;
+
+    while (bpf_map_get_next_key(map_fd, prev_key, key) == 0)
+    {
+        if (bpf_map_lookup_elem(map_fd, key, values) == 0)
+        {
+            lower_allow_priority(&values[0].policy, priority);
+        }
+
+        if (prev_key == NULL)
+        {
+            prev_key = alloca(key_size);
+        }
+        memcpy(prev_key, key, key_size);
+    }
+
+    close(map_fd);
+    return EXIT_OK;
+}
+
+/*
+    scan_dir_allow_priority通过'v4_dir_ids'找到DIR-24-8引擎中所有正在使用的规则，找到其中最优先的白名单规则
+*/
+static int scan_dir_allow_priority(__u32 *priority)
+{
+    int ids_fd = open_bpf_map(V4_DIR_IDS_PATH);
+    if (ids_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    int rules_fd = open_bpf_map(V4_DIR_RULES_PATH);
+    if (rules_fd < 0)
+    {
+        close(ids_fd);
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    struct lpm_v4_key key;
+    struct lpm_v4_key prev_key;
+    bool first = true;
+    while (bpf_map_get_next_key(ids_fd, first ? NULL : &prev_key, &key) == 0)
+    {
+        __u32 id = 0;
+        struct dir_rule rule;
+        if (bpf_map_lookup_elem(ids_fd, &key, &id) == 0 && bpf_map_lookup_elem(rules_fd, &id, &rule) == 0)
+        {
+            lower_allow_priority(&rule.policy, priority);
+        }
+
+        prev_key = key;
+        first = false;
+    }
+
+    close(rules_fd);
+    close(ids_fd);
+    return EXIT_OK;
+}
+
+/*
+    scan_port_allow_priority遍历'port_policy'，找到其中最优先的白名单端口
+*/
+static int scan_port_allow_priority(__u32 *priority)
+{
+    int map_fd = open_bpf_map(PORT_POLICY_PATH);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    __u32 key = 0;
+    __u32 prev_key = 0;
+    bool first = true;
+    while (bpf_map_get_next_key(map_fd, first ? NULL : &prev_key, &key) == 0)
+    {
+        struct rule_policy policy;
+        if (bpf_map_lookup_elem(map_fd, &key, &policy) == 0)
+        {
+            lower_allow_priority(&policy, priority);
+        }
+
+        prev_key = key;
+        first = false;
+    }
+
+    close(map_fd);
+    return EXIT_OK;
+}
+
+/*
+    sync_policy_state重新计算所有黑名单中最优先的白名单规则的优先级，写入'policy_state'
+    内核根据它判断一条被命中的规则能不能立即执行：比所有白名单都优先的规则不可能被覆盖，不需要等到流水线结束
+*/
+static int sync_policy_state()
+{
+    struct policy_state state = {
+        .allow_priority = POLICY_NONE,
+    };
+
+    int ret = scan_allow_priority(MAC_BLACKLIST_PATH, ETH_ALEN, true, &state.allow_priority);
+    if (ret == EXIT_OK)
+    {
+        ret = scan_allow_priority(V4_BLACKLIST_PATH, sizeof(struct lpm_v4_key), false, &state.allow_priority);
+    }
+    if (ret == EXIT_OK)
+    {
+        ret = scan_allow_priority(V6_BLACKLIST_PATH, sizeof(struct lpm_v6_key), false, &state.allow_priority);
+    }
+    if (ret == EXIT_OK)
+    {
+        ret = scan_allow_priority(V6_BLACKLIST_64_PATH, sizeof(struct v6_prefix_key), true, &state.allow_priority);
+    }
+    if (ret == EXIT_OK)
+    {
+        ret = scan_allow_priority(V6_BLACKLIST_48_PATH, sizeof(struct v6_prefix_key), true, &state.allow_priority);
+    }
+    if (ret == EXIT_OK)
+    {
+        ret = scan_dir_allow_priority(&state.allow_priority);
+    }
+    if (ret == EXIT_OK)
+    {
+        ret = scan_port_allow_priority(&state.allow_priority);
+    }
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    int map_fd = open_bpf_map(POLICY_STATE_PATH);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    __u32 idx = 0;
+    ret = bpf_map_update_elem(map_fd, &idx, &state, BPF_ANY) == 0 ? EXIT_OK : EXIT_FAIL_XDP_MAP_UPDATE;
+    close(map_fd);
+    return ret;
+}
+
+/*
+    rules_changed在任何黑名单被修改之后调用
+    它先重新计算白名单的优先级，再根据最新的规则重新拼接检查流水线，切换流水线的同时流表缓存中所有的旧结果也会失效
+*/
+static int rules_changed()
+{
+    int ret = sync_policy_state();
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    return sync_pipeline();
+}
+
+/*
+    register_stages在XDP程序加载之后，把每一层的检查程序放入'xdpfw_stage_progs'中
+    之后的每次修改都可以从这里取出程序，重新拼接流水线
+    加载时配置中被关闭的层不会被注册，所以也永远不会被放进流水线
+*/
+static int register_stages(struct bpf_object *bpf_obj, struct xdpfw_config *config)
+{
+    struct bpf_map *progs = bpf_object__find_map_by_name(bpf_obj, "xdpfw_stage_progs");
+    if (progs == NULL)
+    {
+        printf("ERR: Unable to find the 'xdpfw_stage_progs' map in the loaded bpf object.\n");
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    int progs_fd = bpf_map__fd(progs);
+    for (__u32 stage = 0; stage < XDPFW_STAGES; stage++)
+    {
+        if (!(config->layers & STAGE_BIT(stage)))
+        {
+            continue;
+        }
+
+        int prog_fd = load_section(bpf_obj, (char *)stage_sections[stage]);
+        if (prog_fd < 0)
+        {
+            printf("ERR: Unable to load stage section '%s' err(%d): %s\n",
+                   stage_sections[stage], -prog_fd, strerror(-prog_fd));
+            return EXIT_FAIL_XDP_ATTACH;
+        }
+
+        if (bpf_map_update_elem(progs_fd, &stage, &prog_fd, BPF_ANY) != 0)
+        {
+            printf("ERR: Failed to register stage '%s' err(%d): %s\n",
+                   stage_names[stage], errno, strerror(errno));
+            return EXIT_FAIL_XDP_MAP_UPDATE;
+        }
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    setup_steering在开启了引流时，为每个目标CPU在'cpu_map'中创建条目，并挂载统计程序'xdpfw_steer_fn'
+    创建条目时内核会为这个CPU启动一个内核线程，并分配一个能容纳'qsize'个数据包的队列
+*/
+static int setup_steering(struct bpf_object *bpf_obj, struct xdpfw_config *config, __u32 qsize)
+{
+    if (config->steer_cpu_count == 0)
+    {
+        return EXIT_OK;
+    }
+
+    struct bpf_map *cpu_map = bpf_object__find_map_by_name(bpf_obj, "cpu_map");
+    if (cpu_map == NULL)
+    {
+        printf("ERR: Unable to find the 'cpu_map' map in the loaded bpf object.\n");
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    int prog_fd = load_section(bpf_obj, STEER_SECTION);
+    if (prog_fd < 0)
+    {
+        printf("ERR: Unable to load section '%s' err(%d): %s\n", STEER_SECTION, -prog_fd, strerror(-prog_fd));
+        return EXIT_FAIL_XDP_ATTACH;
+    }
+
+    int map_fd = bpf_map__fd(cpu_map);
+    for (__u32 i = 0; i < config->steer_cpu_count; i++)
+    {
+        __u32 cpu = config->steer_cpus[i];
+        struct bpf_cpumap_val value = {
+            .qsize = qsize,
+            .bpf_prog.fd = prog_fd,
+        };
+
+        if (bpf_map_update_elem(map_fd, &cpu, &value, BPF_ANY) != 0)
+        {
+            printf("ERR: Failed to add CPU %u to the steering CPUs err(%d): %s\n", cpu, errno, strerror(errno));
+            return EXIT_FAIL_XDP_MAP_UPDATE;
+        }
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    shrink_maps把给定的BPF MAP都缩小到一个元素，只能在xdpfw_kern.o加载之前调用
+*/
+static int shrink_maps(struct bpf_object *bpf_obj, const char **maps, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        struct bpf_map *map = bpf_object__find_map_by_name(bpf_obj, maps[i]);
+        if (map == NULL)
+        {
+            return -ENOENT;
+        }
+
+        int ret = bpf_map__set_max_entries(map, 1);
+        if (ret != 0)
+        {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+/*
+    prepare_firewall在xdpfw_kern.o加载之前调整其中的BPF MAP
+    DIR-24-8的表一共需要大约90MB的内存，没有选择这个引擎时把它们缩小到一个元素，这样默认的LPM引擎不会为它们付出任何代价
+    流量统计表在每个CPU上都有一份，没有开启流量统计时同样把它缩小到一个元素
+*/
+static int prepare_firewall(struct bpf_object *bpf_obj, const void *config)
+{
+    const struct xdpfw_config *cfg = config;
+    int ret = 0;
+
+    if (cfg->v4_engine != v4_engine_dir24)
+    {
+        static const char *dir_maps[] = {"v4_dir24", "v4_dir8", "v4_dir_rules", "v4_dir_ids"};
+        ret = shrink_maps(bpf_obj, dir_maps, sizeof(dir_maps) / sizeof(dir_maps[0]));
+        if (ret != 0)
+        {
+            return ret;
+        }
+    }
+
+    if (!cfg->flows)
+    {
+        static const char *flow_maps[] = {"flow_table"};
+        ret = shrink_maps(bpf_obj, flow_maps, sizeof(flow_maps) / sizeof(flow_maps[0]));
+    }
+
+    return ret;
+}
+
+/*
+    setup_v4_engine把加载时选择的IPv4查找引擎写入'v4_dir_meta'，之后添加或删除IPv4前缀时根据它选择要修改的表
+    规则编号和组编号都从1开始，0代表空表项和空链表
+*/
+static int setup_v4_engine(struct bpf_object *bpf_obj, struct xdpfw_config *config)
+{
+    struct bpf_map *meta_map = bpf_object__find_map_by_name(bpf_obj, "v4_dir_meta");
+    if (meta_map == NULL)
+    {
+        printf("ERR: Unable to find the 'v4_dir_meta' map in the loaded bpf object.\n");
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    __u32 idx = 0;
+    struct dir_meta meta = {
+        .engine = config->v4_engine,
+        .next_rule = 1,
+        .next_group = 1,
+    };
+    if (bpf_map_update_elem(bpf_map__fd(meta_map), &idx, &meta, BPF_ANY) != 0)
+    {
+        printf("ERR: Failed to set the IPv4 lookup engine err(%d): %s\n", errno, strerror(errno));
+        return EXIT_FAIL_XDP_MAP_UPDATE;
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    setup_flows把流量统计的活动超时和空闲超时写入'flow_meta'，内核和导出程序都从这里读取
+*/
+static int setup_flows(struct bpf_object *bpf_obj, const struct flow_meta *timeouts)
+{
+    struct bpf_map *meta_map = bpf_object__find_map_by_name(bpf_obj, "flow_meta");
+    if (meta_map == NULL)
+    {
+        printf("ERR: Unable to find the 'flow_meta' map in the loaded bpf object.\n");
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    __u32 idx = 0;
+    if (bpf_map_update_elem(bpf_map__fd(meta_map), &idx, timeouts, BPF_ANY) != 0)
+    {
+        printf("ERR: Failed to set the flow timeouts err(%d): %s\n", errno, strerror(errno));
+        return EXIT_FAIL_XDP_MAP_UPDATE;
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    attach_firewall使用给定的加载时配置加载并挂载XDP程序，然后注册各层的检查程序，并根据已有的规则拼接流水线
+*/
+static int attach_firewall(int if_index, char *prog_path, char *section, struct xdpfw_config *config, __u32 steer_qsize,
+                           const struct flow_meta *flow_timeouts)
+{
+    struct bpf_object *bpf_obj = NULL;
+    int ret = load_and_attach(if_index, prog_path, section, config, sizeof(*config), prepare_firewall, &bpf_obj);
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    ret = setup_v4_engine(bpf_obj, config);
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    ret = setup_flows(bpf_obj, flow_timeouts);
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    ret = register_stages(bpf_obj, config);
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    ret = setup_steering(bpf_obj, config, steer_qsize);
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    ret = sync_policy_state();
+    if (ret != EXIT_OK)
+    {
+        printf("ERR: Failed to initialize the rule policy state err(%d): %s\n", errno, strerror(errno));
+        return ret;
+    }
+
+    ret = reset_hll(0, 0);
+    if (ret != EXIT_OK)
+    {
+        printf("ERR: Failed to initialize the distinct source estimator err(%d): %s\n", errno, strerror(errno));
+        return ret;
+    }
+
+    return sync_pipeline();
+}
+
+/*
+    update_map处理从给定的BPF MAP中插入或删除一个给定的键。这是通过利用libbpf的'bpf_map_update_elem'和'bpf_map_delete_elem'
+    和上一节的处理是几乎相同的，插入时'policy'是这条规则的动作和优先级
+*/
+static int update_map(const char *map, void *key, bool percpu, const struct rule_policy *policy, bool insert)
+{
+    /*
+        在我们可以更新/删除黑名单中的元素之前
+        我们需要抓取有关BPF MAP的文件描述符
+    */
+    int map_fd = open_bpf_map(map);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    if (insert)
+    {
+        /*
+            就像上一节一样，我们传入map的文件描述符，然后传入key
+            值是这条规则的命中计数和动作，新插入的规则计数从0开始
+            对于PERCPU类型的MAP，我们需要为每一个CPU都提供一份值，每一份中的动作都是相同的
+        */
+        unsigned int num_values = percpu ? bpf_num_possible_cpus() : 1;
+        struct rule_value values[num_values];
+        memset(values, 0, sizeof(values));
+        for (int i = 0; i < num_values; i++)
+        {
+            values[i].policy = *policy;
+        }
+        if (bpf_map_update_elem(map_fd, key, values, BPF_NOEXIST) != 0)
+        {
+            close(map_fd);
+            return EXIT_FAIL_XDP_MAP_UPDATE;
+        }
+    }
+    else
+    {
+        /*
+            使用libbpf提供的bpf_map_delete_elem进行删除
+        */
+        if (bpf_map_delete_elem(map_fd, key) != 0)
+        {
+            close(map_fd);
+            return EXIT_FAIL_XDP_MAP_UPDATE;
+        }
+    }
+    close(map_fd);
+
+    /*
+        黑名单已经改变，让流表缓存中所有的旧结果失效，并重新拼接检查流水线
+    */
+    return rules_changed();
+}
+
+/*
+    mac_bloom_add把一个MAC地址对应的位加入'mac_bloom'
+    插入黑名单之前就要先设置这些位，否则在两者之间到达的数据包会被过滤器判断为不在黑名单中
+*/
+static int mac_bloom_add(const unsigned char *mac)
+{
+    int map_fd = open_bpf_map(MAC_BLOOM_PATH);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    __u32 h1, h2;
+    mac_bloom_hashes(mac, &h1, &h2);
+
+    int ret = EXIT_OK;
+    for (__u32 i = 0; i < MAC_BLOOM_HASHES; i++)
+    {
+        __u32 bit = (h1 + i * h2) % MAC_BLOOM_BITS;
+        __u32 idx = bit / 64;
+        __u64 word = 0;
+
+        if (bpf_map_lookup_elem(map_fd, &idx, &word) != 0)
+        {
+            ret = EXIT_FAIL_XDP_MAP_LOOKUP;
+            break;
+        }
+
+        word |= 1ULL << (bit % 64);
+        if (bpf_map_update_elem(map_fd, &idx, &word, BPF_ANY) != 0)
+        {
+            ret = EXIT_FAIL_XDP_MAP_UPDATE;
+            break;
+        }
+    }
+
+    close(map_fd);
+    return ret;
+}
+
+/*
+    mac_bloom_rebuild在删除黑名单中的地址之后，用剩下的所有地址重新计算'mac_bloom'
+    布隆过滤器中的位不能直接清除，因为同一个位可能同时属于其他的地址
+*/
+static int mac_bloom_rebuild()
+{
+    int bloom_fd = open_bpf_map(MAC_BLOOM_PATH);
+    if (bloom_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    int blacklist_fd = open_bpf_map(MAC_BLACKLIST_PATH);
+    if (blacklist_fd < 0)
+    {
+        close(bloom_fd);
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    __u64 *words = calloc(MAC_BLOOM_WORDS, sizeof(__u64));
+    if (words == NULL)
+    {
+        close(blacklist_fd);
+        close(bloom_fd);
+        return EXIT_FAIL_GENERIC;
+    }
+
+    unsigned char mac[ETH_ALEN];
+    unsigned char next[ETH_ALEN];
+    void *prev = NULL;
+
+    while (bpf_map_get_next_key(blacklist_fd, prev, next) == 0)
+    {
+        __u32 h1, h2;
+        mac_bloom_hashes(next, &h1, &h2);
+
+        for (__u32 i = 0; i < MAC_BLOOM_HASHES; i++)
+        {
+            __u32 bit = (h1 + i * h2) % MAC_BLOOM_BITS;
+            words[bit / 64] |= 1ULL << (bit % 64);
+        }
+
+        memcpy(mac, next, sizeof(mac));
+        prev = mac;
+    }
+
+    int ret = EXIT_OK;
+    for (__u32 idx = 0; idx < MAC_BLOOM_WORDS; idx++)
+    {
+        if (bpf_map_update_elem(bloom_fd, &idx, &words[idx], BPF_ANY) != 0)
+        {
+            ret = EXIT_FAIL_XDP_MAP_UPDATE;
+            break;
+        }
+    }
+
+    free(words);
+    close(blacklist_fd);
+    close(bloom_fd);
+    return ret;
+}
+
+/*
+    handle_mac处理从mac_blacklist中添加或删除一个给定的MAC地址
+*/
+static int handle_mac(char *mac_addr, const struct rule_policy *policy, bool insert)
+{
+    /*
+        首先，由于我们传入的是一个MAC地址的字符串表示，形式为'00:00:00:00:00'，我们需要将其转换为适当的形式
+    */
+    unsigned char mac[6];
+    if (6 != sscanf(mac_addr, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]))
+    {
+        printf("ERR: Invalid MAC address specifed must be in the form '00:00:00:00:00:00', got '%s",
+               mac_addr);
+        return EXIT_FAIL_OPTIONS;
+    }
+
+    /*
+        打印日志
+    */
+    printf("%s source MAC address '%s'.\n", insert ? "Blacklisting" : "Whitelisting", mac_addr);
+
+    /*
+        插入时先把地址加入布隆过滤器，再插入黑名单
+    */
+    int ret = EXIT_OK;
+    if (insert)
+    {
+        ret = mac_bloom_add(mac);
+        if (ret != EXIT_OK)
+        {
+            printf("ERR: Failed to add MAC address '%s' to the bloom filter.\n", mac_addr);
+            return ret;
+        }
+    }
+
+    /*
+        然后我们调用update_map，处理打开指定的MAP并插入或删除给定的键
+    */
+    ret = update_map(MAC_BLACKLIST_PATH, &mac, true, policy, insert);
+    if (ret != 0)
+    {
+        printf("ERR: Failed to %s specified MAC address '%s' err(%d): %s\n",
+               insert ? "blacklist" : "whitelist", mac_addr, errno, strerror(errno));
+        return ret;
+    }
+
+    /*
+        删除之后再重建布隆过滤器，去掉只属于这个地址的位
+    */
+    if (!insert)
+    {
+        ret = mac_bloom_rebuild();
+        if (ret != EXIT_OK)
+        {
+            printf("ERR: Failed to rebuild the MAC bloom filter.\n");
+        }
+    }
+
+    return ret;
+}
+
+/*
+    dir_tables是DIR-24-8引擎的所有表的文件描述符，以及从'v4_dir_meta'中读出的分配情况
+*/
+struct dir_tables
+{
+    int tbl24;
+    int tbl8;
+    int rules;
+    int ids;
+    int meta_fd;
+    struct dir_meta meta;
+};
+
+static void close_dir_tables(struct dir_tables *tables)
+{
+    int fds[] = {tables->tbl24, tables->tbl8, tables->rules, tables->ids, tables->meta_fd};
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++)
+    {
+        if (fds[i] >= 0)
+        {
+            close(fds[i]);
+        }
+    }
+}
+
+/*
+    open_dir_tables打开DIR-24-8引擎的所有表并读出'v4_dir_meta'
+*/
+static int open_dir_tables(struct dir_tables *tables)
+{
+    tables->tbl24 = open_bpf_map(V4_DIR24_PATH);
+    tables->tbl8 = open_bpf_map(V4_DIR8_PATH);
+    tables->rules = open_bpf_map(V4_DIR_RULES_PATH);
+    tables->ids = open_bpf_map(V4_DIR_IDS_PATH);
+    tables->meta_fd = open_bpf_map(V4_DIR_META_PATH);
+    if (tables->tbl24 < 0 || tables->tbl8 < 0 || tables->rules < 0 || tables->ids < 0 || tables->meta_fd < 0)
+    {
+        close_dir_tables(tables);
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    __u32 idx = 0;
+    if (bpf_map_lookup_elem(tables->meta_fd, &idx, &tables->meta) != 0)
+    {
+        close_dir_tables(tables);
+        return EXIT_FAIL_XDP_MAP_LOOKUP;
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    dir_rule_prefixlen返回一个规则编号对应的前缀长度，空表项返回-1
+    更新一段范围时相邻的表项大多属于同一条规则，所以这里缓存了上一次查询的结果
+*/
+static int dir_rule_prefixlen(struct dir_tables *tables, __u32 id, __u32 *cached_id, int *cached_len)
+{
+    if (id == 0)
+    {
+        return -1;
+    }
+
+    if (id != *cached_id)
+    {
+        struct dir_rule rule = {0};
+        if (bpf_map_lookup_elem(tables->rules, &id, &rule) != 0)
+        {
+            return -1;
+        }
+        *cached_id = id;
+        *cached_len = rule.prefixlen;
+    }
+
+    return *cached_len;
+}
+
+/*
+    dir_update_entries更新从'base'开始的'count'个表项
+    插入时，只覆盖空表项和前缀不比'prefixlen'更长的表项，更具体的前缀仍然优先
+    删除时，把所有指向'old_id'的表项替换成'new_id'，也就是覆盖这个前缀的次长前缀，没有时为0
+*/
+static int dir_update_entries(struct dir_tables *tables, int map_fd, __u32 base, __u32 count, __u32 prefixlen,
+                              bool insert, __u32 old_id, __u32 new_id)
+{
+    __u32 cached_id = 0;
+    int cached_len = -1;
+
+    for (__u32 idx = base; idx < base + count; idx++)
+    {
+        __u32 entry = 0;
+        if (bpf_map_lookup_elem(map_fd, &idx, &entry) != 0)
+        {
+            return EXIT_FAIL_XDP_MAP_LOOKUP;
+        }
+
+        bool replace = insert ? dir_rule_prefixlen(tables, entry, &cached_id, &cached_len) <= (int)prefixlen
+                              : entry == old_id;
+        if (replace && bpf_map_update_elem(map_fd, &idx, &new_id, BPF_ANY) != 0)
+        {
+            return EXIT_FAIL_XDP_MAP_UPDATE;
+        }
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    dir_alloc_group分配一个第二级的组，并把它的256个表项都填成'fill'，也就是第一级表项原来的值
+    组在被第一级的表项指向之前就已经写好了，所以并发的查找不会看到一个不完整的组
+*/
+static int dir_alloc_group(struct dir_tables *tables, __u32 fill, __u32 *group)
+{
+    if (tables->meta.free_group != 0)
+    {
+        *group = tables->meta.free_group;
+        __u32 idx = *group * DIR8_GROUP_ENTRIES;
+        if (bpf_map_lookup_elem(tables->tbl8, &idx, &tables->meta.free_group) != 0)
+        {
+            return EXIT_FAIL_XDP_MAP_LOOKUP;
+        }
+    }
+    else if (tables->meta.next_group < DIR8_MAX_GROUPS)
+    {
+        *group = tables->meta.next_group++;
+    }
+    else
+    {
+        printf("ERR: All %u DIR-24-8 groups are in use.\n", DIR8_MAX_GROUPS - 1);
+        return EXIT_FAIL_XDP_MAP_UPDATE;
+    }
+
+    for (__u32 i = 0; i < DIR8_GROUP_ENTRIES; i++)
+    {
+        __u32 idx = *group * DIR8_GROUP_ENTRIES + i;
+        if (bpf_map_update_elem(tables->tbl8, &idx, &fill, BPF_ANY) != 0)
+        {
+            return EXIT_FAIL_XDP_MAP_UPDATE;
+        }
+    }
+
+    tables->meta.groups++;
+    return EXIT_OK;
+}
+
+/*
+    dir_collapse_group在一个组的256个表项都相同时，把这个值直接写回第一级的表项，然后回收这个组
+    先修改第一级的表项再回收，这样并发的查找不会访问到已经被回收的组
+*/
+static int dir_collapse_group(struct dir_tables *tables, __u32 idx24, __u32 group)
+{
+    __u32 first = 0;
+    for (__u32 i = 0; i < DIR8_GROUP_ENTRIES; i++)
+    {
+        __u32 idx = group * DIR8_GROUP_ENTRIES + i;
+        __u32 entry = 0;
+        if (bpf_map_lookup_elem(tables->tbl8, &idx, &entry) != 0)
+        {
+            return EXIT_FAIL_XDP_MAP_LOOKUP;
+        }
+
+        if (i == 0)
+        {
+            first = entry;
+        }
+        else if (entry != first)
+        {
+            return EXIT_OK;
+        }
+    }
+
+    if (bpf_map_update_elem(tables->tbl24, &idx24, &first, BPF_ANY) != 0)
+    {
+        return EXIT_FAIL_XDP_MAP_UPDATE;
+    }
+
+    __u32 idx = group * DIR8_GROUP_ENTRIES;
+    if (bpf_map_update_elem(tables->tbl8, &idx, &tables->meta.free_group, BPF_ANY) != 0)
+    {
+        return EXIT_FAIL_XDP_MAP_UPDATE;
+    }
+
+    tables->meta.free_group = group;
+    tables->meta.groups--;
+    return EXIT_OK;
+}
+
+/*
+    dir_update把一个前缀覆盖的所有表项更新为'new_id'，'addr'是主机字节序的、已经去掉了主机位的地址
+    长度不超过24的前缀覆盖了第一级中连续的2^(24-prefixlen)个表项，已经展开成组的表项需要更新组内的全部256个表项
+    长度超过24的前缀只落在第一级的一个表项中，这个表项还没有展开时先分配一个组
+    这里的更新是逐个表项进行的，所以修改的开销和前缀覆盖的范围成正比，/8需要更新65536个表项
+*/
+static int dir_update(struct dir_tables *tables, __u32 addr, __u32 prefixlen, bool insert, __u32 old_id, __u32 new_id)
+{
+    __u32 first = addr >> 8;
+    __u32 count = prefixlen <= 24 ? 1U << (24 - prefixlen) : 1;
+    __u32 cached_id = 0;
+    int cached_len = -1;
+
+    for (__u32 idx24 = first; idx24 < first + count; idx24++)
+    {
+        __u32 entry = 0;
+        if (bpf_map_lookup_elem(tables->tbl24, &idx24, &entry) != 0)
+        {
+            return EXIT_FAIL_XDP_MAP_LOOKUP;
+        }
+
+        int ret = EXIT_OK;
+        if (prefixlen > 24 && !(entry & DIR_EXTENDED))
+        {
+            /*
+                删除时第一级的表项一定已经展开了，插入时才需要分配新的组
+            */
+            if (!insert)
+            {
+                continue;
+            }
+
+            __u32 group = 0;
+            ret = dir_alloc_group(tables, entry, &group);
+            if (ret != EXIT_OK)
+            {
+                return ret;
+            }
+
+            ret = dir_update_entries(tables, tables->tbl8, group * DIR8_GROUP_ENTRIES + (addr & 0xff),
+                                     1U << (32 - prefixlen), prefixlen, insert, old_id, new_id);
+            if (ret != EXIT_OK)
+            {
+                return ret;
+            }
+
+            entry = group | DIR_EXTENDED;
+            if (bpf_map_update_elem(tables->tbl24, &idx24, &entry, BPF_ANY) != 0)
+            {
+                return EXIT_FAIL_XDP_MAP_UPDATE;
+            }
+        }
+        else if (entry & DIR_EXTENDED)
+        {
+            __u32 group = entry & ~DIR_EXTENDED;
+            __u32 base = group * DIR8_GROUP_ENTRIES;
+            __u32 entries = DIR8_GROUP_ENTRIES;
+            if (prefixlen > 24)
+            {
+                base += addr & 0xff;
+                entries = 1U << (32 - prefixlen);
+            }
+
+            ret = dir_update_entries(tables, tables->tbl8, base, entries, prefixlen, insert, old_id, new_id);
+            if (ret == EXIT_OK)
+            {
+                ret = dir_collapse_group(tables, idx24, group);
+            }
+        }
+        else
+        {
+            bool replace = insert ? dir_rule_prefixlen(tables, entry, &cached_id, &cached_len) <= (int)prefixlen
+                                  : entry == old_id;
+            if (replace && bpf_map_update_elem(tables->tbl24, &idx24, &new_id, BPF_ANY) != 0)
+            {
+                return EXIT_FAIL_XDP_MAP_UPDATE;
+            }
+        }
+
+        if (ret != EXIT_OK)
+        {
+            return ret;
+        }
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    dir_find_parent查找覆盖给定前缀的最长的更短前缀的规则编号，没有时返回0
+    删除一个前缀之后，原来指向它的表项都应该指向这条规则
+*/
+static __u32 dir_find_parent(struct dir_tables *tables, __u32 addr, __u32 prefixlen)
+{
+    for (int len = prefixlen - 1; len >= 0; len--)
+    {
+        __u32 masked = htonl(len == 0 ? 0 : addr & (0xffffffffU << (32 - len)));
+        struct lpm_v4_key key = {.prefixlen = len};
+        memcpy(key.address, &masked, sizeof(masked));
+
+        __u32 id = 0;
+        if (bpf_map_lookup_elem(tables->ids, &key, &id) == 0)
+        {
+            return id;
+        }
+    }
+
+    return 0;
+}
+
+/*
+    dir_reparent把被前缀'addr/prefixlen'覆盖、'parent'为'old_parent'的所有规则改为指向'new_parent'，'addr'是主机字节序的
+    添加一个前缀时，被它覆盖并且原来指向它的父前缀的规则改为指向它；删除时，原来指向它的规则改为指向它的父前缀
+    编号最多只分配到'next_rule'，所以只需要遍历这么多条规则
+*/
+static int dir_reparent(struct dir_tables *tables, __u32 addr, __u32 prefixlen, __u32 self, __u32 old_parent, __u32 new_parent)
+{
+    __u32 mask = prefixlen == 0 ? 0 : 0xffffffffU << (32 - prefixlen);
+
+    for (__u32 id = 1; id < tables->meta.next_rule; id++)
+    {
+        if (id == self)
+        {
+            continue;
+        }
+
+        struct dir_rule rule;
+        if (bpf_map_lookup_elem(tables->rules, &id, &rule) != 0)
+        {
+            return EXIT_FAIL_XDP_MAP_LOOKUP;
+        }
+
+        if (!rule.in_use || rule.parent != old_parent || rule.prefixlen <= prefixlen || (ntohl(rule.address) & mask) != addr)
+        {
+            continue;
+        }
+
+        rule.parent = new_parent;
+        if (bpf_map_update_elem(tables->rules, &id, &rule, BPF_ANY) != 0)
+        {
+            return EXIT_FAIL_XDP_MAP_UPDATE;
+        }
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    handle_dir_prefix在加载时选择了DIR-24-8引擎时，处理IPv4前缀的添加和删除
+    'v4_dir_ids'中记录了前缀和规则编号的对应关系，内核只查询两级表和'v4_dir_rules'
+    添加时先写好规则再修改表项，删除时先修改表项再回收规则，这样内核永远不会查到一个无效的规则编号
+    它不会调用rules_changed，这样清理过期规则时一次删除多个前缀只需要让缓存失效一次
+*/
+static int handle_dir_prefix(struct lpm_v4_key *key, const struct rule_policy *policy, bool insert)
+{
+    if (key->prefixlen > 32)
+    {
+        printf("ERR: Invalid IPv4 prefix length %u.\n", key->prefixlen);
+        return EXIT_FAIL_OPTIONS;
+    }
+
+    __u32 addr = 0;
+    memcpy(&addr, key->address, sizeof(addr));
+    addr = ntohl(addr);
+    if (key->prefixlen < 32)
+    {
+        addr &= key->prefixlen == 0 ? 0 : 0xffffffffU << (32 - key->prefixlen);
+    }
+
+    __u32 masked = htonl(addr);
+    memcpy(key->address, &masked, sizeof(masked));
+
+    struct dir_tables tables;
+    int ret = open_dir_tables(&tables);
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    __u32 id = 0;
+    bool exists = bpf_map_lookup_elem(tables.ids, key, &id) == 0;
+    if (exists == insert)
+    {
+        errno = insert ? EEXIST : ENOENT;
+        close_dir_tables(&tables);
+        return EXIT_FAIL_XDP_MAP_UPDATE;
+    }
+
+    struct dir_rule rule = {0};
+    if (insert)
+    {
+        if (tables.meta.free_rule != 0)
+        {
+            id = tables.meta.free_rule;
+            if (bpf_map_lookup_elem(tables.rules, &id, &rule) != 0)
+            {
+                close_dir_tables(&tables);
+                return EXIT_FAIL_XDP_MAP_LOOKUP;
+            }
+            tables.meta.free_rule = rule.next_free;
+        }
+        else if (tables.meta.next_rule < DIR_MAX_RULES)
+        {
+            id = tables.meta.next_rule++;
+        }
+        else
+        {
+            printf("ERR: All %u DIR-24-8 rules are in use.\n", DIR_MAX_RULES - 1);
+            close_dir_tables(&tables);
+            return EXIT_FAIL_XDP_MAP_UPDATE;
+        }
+
+        memset(&rule, 0, sizeof(rule));
+        rule.address = masked;
+        rule.prefixlen = key->prefixlen;
+        rule.in_use = 1;
+        rule.parent = dir_find_parent(&tables, addr, key->prefixlen);
+        rule.policy = *policy;
+        if (bpf_map_update_elem(tables.rules, &id, &rule, BPF_ANY) != 0 ||
+            bpf_map_update_elem(tables.ids, key, &id, BPF_NOEXIST) != 0)
+        {
+            close_dir_tables(&tables);
+            return EXIT_FAIL_XDP_MAP_UPDATE;
+        }
+
+        ret = dir_update(&tables, addr, key->prefixlen, true, 0, id);
+        if (ret == EXIT_OK)
+        {
+            ret = dir_reparent(&tables, addr, key->prefixlen, id, rule.parent, id);
+        }
+        tables.meta.rules++;
+    }
+    else
+    {
+        __u32 parent = dir_find_parent(&tables, addr, key->prefixlen);
+        ret = dir_update(&tables, addr, key->prefixlen, false, id, parent);
+        if (ret == EXIT_OK)
+        {
+            ret = dir_reparent(&tables, addr, key->prefixlen, id, id, parent);
+        }
+        if (ret == EXIT_OK)
+        {
+            rule.next_free = tables.meta.free_rule;
+            if (bpf_map_delete_elem(tables.ids, key) != 0 || bpf_map_update_elem(tables.rules, &id, &rule, BPF_ANY) != 0)
+            {
+                ret = EXIT_FAIL_XDP_MAP_UPDATE;
+            }
+            else
+            {
+                tables.meta.free_rule = id;
+                tables.meta.rules--;
+            }
+        }
+    }
+
+    /*
+        即使更新只完成了一部分，分配情况也要写回去，否则已经被使用的组和编号可能被再次分配
+    */
+    __u32 idx = 0;
+    if (bpf_map_update_elem(tables.meta_fd, &idx, &tables.meta, BPF_ANY) != 0 && ret == EXIT_OK)
+    {
+        ret = EXIT_FAIL_XDP_MAP_UPDATE;
+    }
+
+    close_dir_tables(&tables);
+    return ret;
+}
+
+/*
+    handle_prefix'处理从各自的'v4_blacklist'或'v6_blacklist'中添加或删除一个给定的IP地址
+    无论是IPv4还是IPv6，它的方式与上面的'handle_mac'函数相同。
+*/
+static int handle_prefix(char *prefix, const struct rule_policy *policy, bool insert, bool v4)
+{
+    /*
+        根据v4还是v6来创建key
+    */
+    struct bpf_lpm_trie_key *key = alloca(v4 ? sizeof(struct lpm_v4_key) : sizeof(struct lpm_v6_key));
+
+    /*
+        由于我们传入的是IP地址前缀的字符串表示，形式为'0.0.0.0/0'或':/0'，我们需要将其转换为适当的形式
+    */
+    int addr_len = v4 ? INET_ADDRSTRLEN : INET6_ADDRSTRLEN;
+    char *addr = alloca(addr_len);
+    if (2 != sscanf(prefix, "%[^/]%*c%d", addr, &key->prefixlen))
+    {
+        printf("ERR: Invalid IP address prefix specifed must be in the form '1.1.1.1/32' or '::1/128', got '%s'.\n",
+               prefix);
+        return EXIT_FAIL_OPTIONS;
+    }
+
+    /*
+        inet_pton:将IP地址从字符串格式转换成网络地址格式
+    */
+    if (inet_pton(v4 ? AF_INET : AF_INET6, addr, key->data) != 1)
+    {
+        printf("ERR: Invalid IP address specified as part of the supplied prefix '%s'\n",
+               prefix);
+        return EXIT_FAIL_OPTIONS;
+    }
+
+    /*
+        打印日志
+    */
+    printf("%s source IP%s prefix '%s'.\n", insert ? "Blacklisting" : "Whitelisting", v4 ? "v4" : "v6", prefix);
+
+    /*
+        长度正好是64或48的IPv6前缀放在对应的哈希表中，哈希表是精确匹配的，所以要先去掉前缀之外的位
+    */
+    if (!v4 && (key->prefixlen == 64 || key->prefixlen == 48))
+    {
+        struct v6_prefix_key prefix_key = {0};
+        memcpy(prefix_key.address, key->data, key->prefixlen / 8);
+
+        int ret = update_map(key->prefixlen == 64 ? V6_BLACKLIST_64_PATH : V6_BLACKLIST_48_PATH, &prefix_key, true, policy, insert);
+        if (ret != 0)
+        {
+            printf("ERR: Failed to %s specified IP address prefix '%s' err(%d): %s\n",
+                   insert ? "blacklist" : "whitelist", prefix, errno, strerror(errno));
+        }
+        return ret;
+    }
+
+    /*
+        加载时选择了DIR-24-8引擎时，IPv4前缀要写入它的表而不是'v4_blacklist'
+    */
+    int ret = EXIT_OK;
+    struct dir_meta meta = {0};
+    if (v4)
+    {
+        int meta_fd = open_bpf_map(V4_DIR_META_PATH);
+        if (meta_fd < 0)
+        {
+            return EXIT_FAIL_XDP_MAP_OPEN;
+        }
+
+        __u32 idx = 0;
+        ret = bpf_map_lookup_elem(meta_fd, &idx, &meta) == 0 ? EXIT_OK : EXIT_FAIL_XDP_MAP_LOOKUP;
+        close(meta_fd);
+        if (ret != EXIT_OK)
+        {
+            return ret;
+        }
+    }
+
+    /*
+        同处理handle_mac
+    */
+    if (v4 && meta.engine == v4_engine_dir24)
+    {
+        ret = handle_dir_prefix((struct lpm_v4_key *)key, policy, insert);
+        if (ret == EXIT_OK)
+        {
+            ret = rules_changed();
+        }
+    }
+    else
+    {
+        /*
+            LPM中的规则记录了自己的前缀长度，过期时内核从比它更短的前缀继续查找
+        */
+        struct rule_policy lpm_policy = *policy;
+        lpm_policy.prefixlen = key->prefixlen;
+        ret = update_map(v4 ? V4_BLACKLIST_PATH : V6_BLACKLIST_PATH, key, false, &lpm_policy, insert);
+    }
+    if (ret != 0)
+    {
+        printf("ERR: Failed to %s specified IP address prefix '%s' err(%d): %s\n",
+               insert ? "blacklist" : "whitelist", prefix, errno, strerror(errno));
+    }
+    return ret;
+}
+
+/*
+    set_port_bits在从下标'base'开始的一个65536位的端口位图中，设置或清除[first, last]范围内的所有端口
+    位图是按64位的字存放的，所以我们一次读取一个字，修改范围内对应的所有位之后再写回去
+    这样即使是'1000-2000'这样的范围，也只需要十几次map更新
+*/
+static int set_port_bits(int map_fd, __u32 base, __u32 first, __u32 last, bool insert)
+{
+    for (__u32 port = first; port <= last;)
+    {
+        __u32 idx = base + port / PORT_BITMAP_WORD_BITS;
+        __u64 word = 0;
+        if (bpf_map_lookup_elem(map_fd, &idx, &word) != 0)
+        {
+            return EXIT_FAIL_XDP_MAP_LOOKUP;
+        }
+
+        /*
+            计算这个字中位于范围内的所有位的掩码
+        */
+        __u64 mask = 0;
+        for (; port <= last && base + port / PORT_BITMAP_WORD_BITS == idx; port++)
+        {
+            mask |= PORT_BITMAP_BIT(port);
+        }
+
+        word = insert ? (word | mask) : (word & ~mask);
+        if (bpf_map_update_elem(map_fd, &idx, &word, BPF_ANY) != 0)
+        {
+            return EXIT_FAIL_XDP_MAP_UPDATE;
+        }
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    parse_port_range解析形如'53'或'1000-2000'的端口或端口范围
+*/
+static int parse_port_range(char *port, __u32 *first, __u32 *last)
+{
+    unsigned int from = 0;
+    unsigned int to = 0;
+
+    int matched = sscanf(port, "%u-%u", &from, &to);
+    if (matched == 1)
+    {
+        to = from;
+    }
+    if (matched < 1 || from > to || to > 65535)
+    {
+        printf("ERR: Invalid port specified must be in the form '53' or '1000-2000', got '%s'.\n",
+               port);
+        return EXIT_FAIL_OPTIONS;
+    }
+
+    *first = from;
+    *last = to;
+    return EXIT_OK;
+}
+
+/*
+    update_port_policy在'port_policy'中写入或删除[first, last]范围内所有端口的动作
+    优先级为默认值并且永不过期的丢弃规则不需要写入，内核找不到端口的动作时就是这样处理的
+    插入时要在设置位图之前调用，删除时要在清除位图之后调用，这样内核永远不会用错误的动作处理一个被设置的端口
+*/
+static int update_port_policy(enum port_type type, enum port_protocol proto, __u32 first, __u32 last,
+                              const struct rule_policy *policy, bool insert)
+{
+    int map_fd = open_bpf_map(PORT_POLICY_PATH);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    bool stored = insert && (policy->action != policy_drop || policy->priority != POLICY_DEFAULT_PRIORITY ||
+                             policy->expires != 0);
+    for (__u32 port = first; port <= last; port++)
+    {
+        __u32 key = PORT_RULE_KEY(type, proto, port);
+        if (!stored)
+        {
+            bpf_map_delete_elem(map_fd, &key);
+        }
+        else if (bpf_map_update_elem(map_fd, &key, policy, BPF_ANY) != 0)
+        {
+            close(map_fd);
+            return EXIT_FAIL_XDP_MAP_UPDATE;
+        }
+    }
+
+    close(map_fd);
+    return EXIT_OK;
+}
+
+/*
+    update_port_bitmap处理在'port_blacklist'的位图中设置或清除[first, last]范围内的所有端口
+*/
+static int update_port_bitmap(enum port_type type, enum port_protocol proto, __u32 first, __u32 last,
+                              const struct rule_policy *policy, bool insert)
+{
+    int map_fd = open_bpf_map(PORT_BLACKLIST_PATH);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    int ret = EXIT_OK;
+    if (insert)
+    {
+        ret = update_port_policy(type, proto, first, last, policy, insert);
+        if (ret != EXIT_OK)
+        {
+            close(map_fd);
+            return ret;
+        }
+    }
+
+    ret = set_port_bits(map_fd, PORT_BITMAP_INDEX(type, proto, 0), first, last, insert);
+    close(map_fd);
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    /*
+        删除端口时，同时删除这些端口在'port_rule_counters'中的命中计数和在'port_policy'中的动作
+        没有被命中过的端口在其中并不存在，所以这里忽略删除失败的情况
+    */
+    if (!insert)
+    {
+        int counters_fd = open_bpf_map(PORT_RULE_COUNTERS_PATH);
+        if (counters_fd < 0)
+        {
+            return EXIT_FAIL_XDP_MAP_OPEN;
+        }
+
+        for (__u32 port = first; port <= last; port++)
+        {
+            __u32 key = PORT_RULE_KEY(type, proto, port);
+            bpf_map_delete_elem(counters_fd, &key);
+        }
+        close(counters_fd);
+
+        ret = update_port_policy(type, proto, first, last, policy, insert);
+        if (ret != EXIT_OK)
+        {
+            return ret;
+        }
+    }
+
+    return rules_changed();
+}
+
+/*
+    handle_port'处理从'port_blacklist'BPF MAP中添加或删除一个指定的端口/协议/类型
+    端口既可以是单个端口'53'，也可以是一个范围'1000-2000'
+*/
+static int handle_port(char *port, const struct rule_policy *policy, bool insert, bool udp, bool src)
+{
+    __u32 first = 0;
+    __u32 last = 0;
+
+    if (parse_port_range(port, &first, &last) != EXIT_OK)
+    {
+        return EXIT_FAIL_OPTIONS;
+    }
+
+    printf("%s %s port '%s/%s'.\n", insert ? "Blacklisting" : "Whitelisting", src ? "source" : "dest", port, udp ? "udp" : "tcp");
+
+    int ret = update_port_bitmap(src ? source_port : destination_port, udp ? udp_port : tcp_port, first, last, policy, insert);
+    if (ret != 0)
+    {
+        printf("ERR: Failed to %s specified %s port '%s/%s' err(%d): %s\n",
+               insert ? "blacklist" : "whitelist", src ? "source" : "dest", port, udp ? "udp" : "tcp", errno, strerror(errno));
+    }
+    return ret;
+}
+
+/*
+    rule_key_list是清理过期规则时收集到的键，每个键的大小都是'key_size'
+*/
+struct rule_key_list
+{
+    __u8 *keys;
+    size_t key_size;
+    size_t count;
+    size_t capacity;
+};
+
+static int rule_key_list_add(struct rule_key_list *list, const void *key)
+{
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity == 0 ? 64 : list->capacity * 2;
+        list->keys = realloc(list->keys, list->capacity * list->key_size);
+        if (list->keys == NULL)
+        {
+            printf("ERR: Failed to allocate memory for expired rules.\n");
+            return EXIT_FAIL_GENERIC;
+        }
+    }
+
+    memcpy(list->keys + list->count * list->key_size, key, list->key_size);
+    list->count++;
+    return EXIT_OK;
+}
+
+static bool policy_expired(const struct rule_policy *policy, __u64 now)
+{
+    return policy->expires != 0 && policy->expires <= now;
+}
+
+/*
+    collect_expired遍历一个值为'rule_value'或'rule_policy'的MAP，收集其中所有在'now'之前过期的键
+    遍历的同时不能删除，被删除的键会让bpf_map_get_next_key从头开始，所以先收集再一批删除
+    PERCPU的MAP中每个CPU上的动作都是相同的，只需要检查第一份
+*/
+static int collect_expired(int map_fd, size_t value_size, bool percpu, __u64 now, struct rule_key_list *list)
+{
+    unsigned int num_values = percpu ? bpf_num_possible_cpus() : 1;
+    __u8 values[num_values][value_size];
+    void *key = alloca(list->key_size);
+    void *prev_key = NULL;
+
+    while (bpf_map_get_next_key(map_fd, prev_key, key) == 0)
+    {
+        if (bpf_map_lookup_elem(map_fd, key, values) != 0)
+        {
+            return EXIT_FAIL_XDP_MAP_LOOKUP;
+        }
+
+        const struct rule_policy *policy = value_size == sizeof(struct rule_policy)
+                                               ? (const struct rule_policy *)values[0]
+                                               : &((const struct rule_value *)values[0])->policy;
+        if (policy_expired(policy, now) && rule_key_list_add(list, key) != EXIT_OK)
+        {
+            return EXIT_FAIL_GENERIC;
+        }
+
+        if (prev_key == NULL)
+        {
+            prev_key = alloca(list->key_size);
+        }
+        memcpy(prev_key, key, list->key_size);
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    sweep_map删除一个黑名单中所有已经过期的规则，删除的数量累加到'removed'中
+*/
+static int sweep_map(const char *map, size_t key_size, bool percpu, __u64 now, __u32 *removed)
+{
+    int map_fd = open_bpf_map(map);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    struct rule_key_list list = {.key_size = key_size};
+    int ret = collect_expired(map_fd, sizeof(struct rule_value), percpu, now, &list);
+    for (size_t i = 0; ret == EXIT_OK && i < list.count; i++)
+    {
+        if (bpf_map_delete_elem(map_fd, list.keys + i * key_size) == 0)
+        {
+            (*removed)++;
+        }
+    }
+
+    free(list.keys);
+    close(map_fd);
+    return ret;
+}
+
+/*
+    sweep_dir_rules删除DIR-24-8引擎中所有已经过期的前缀，前缀和规则编号的对应关系在'v4_dir_ids'中
+    使用LPM引擎时'v4_dir_ids'是空的，这里什么都不会做
+*/
+static int sweep_dir_rules(__u64 now, __u32 *removed)
+{
+    int ids_fd = open_bpf_map(V4_DIR_IDS_PATH);
+    if (ids_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    int rules_fd = open_bpf_map(V4_DIR_RULES_PATH);
+    if (rules_fd < 0)
+    {
+        close(ids_fd);
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    struct rule_key_list list = {.key_size = sizeof(struct lpm_v4_key)};
+    struct lpm_v4_key key;
+    struct lpm_v4_key prev_key;
+    void *prev = NULL;
+    int ret = EXIT_OK;
+
+    while (bpf_map_get_next_key(ids_fd, prev, &key) == 0)
+    {
+        __u32 id = 0;
+        struct dir_rule rule;
+        if (bpf_map_lookup_elem(ids_fd, &key, &id) == 0 && bpf_map_lookup_elem(rules_fd, &id, &rule) == 0 &&
+            policy_expired(&rule.policy, now))
+        {
+            ret = rule_key_list_add(&list, &key);
+            if (ret != EXIT_OK)
+            {
+                break;
+            }
+        }
+
+        prev_key = key;
+        prev = &prev_key;
+    }
+
+    close(ids_fd);
+    close(rules_fd);
+
+    for (size_t i = 0; ret == EXIT_OK && i < list.count; i++)
+    {
+        ret = handle_dir_prefix((struct lpm_v4_key *)(list.keys + i * list.key_size), NULL, false);
+        if (ret == EXIT_OK)
+        {
+            (*removed)++;
+        }
+    }
+
+    free(list.keys);
+    return ret;
+}
+
+/*
+    sweep_port_rules删除所有已经过期的端口，会过期的端口一定在'port_policy'中有一个动作
+    和删除端口时的顺序一样，先清除位图再删除命中计数和动作
+*/
+static int sweep_port_rules(__u64 now, __u32 *removed)
+{
+    int policy_fd = open_bpf_map(PORT_POLICY_PATH);
+    if (policy_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    int bitmap_fd = open_bpf_map(PORT_BLACKLIST_PATH);
+    if (bitmap_fd < 0)
+    {
+        close(policy_fd);
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    int counters_fd = open_bpf_map(PORT_RULE_COUNTERS_PATH);
+    if (counters_fd < 0)
+    {
+        close(bitmap_fd);
+        close(policy_fd);
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    struct rule_key_list list = {.key_size = sizeof(__u32)};
+    int ret = collect_expired(policy_fd, sizeof(struct rule_policy), false, now, &list);
+    for (size_t i = 0; ret == EXIT_OK && i < list.count; i++)
+    {
+        __u32 key = ((__u32 *)list.keys)[i];
+        __u32 pair = key >> 16;
+        __u32 port = key & 0xffff;
+
+        ret = set_port_bits(bitmap_fd, PORT_BITMAP_INDEX(pair / 2, pair % 2, 0), port, port, false);
+        if (ret == EXIT_OK)
+        {
+            bpf_map_delete_elem(counters_fd, &key);
+            bpf_map_delete_elem(policy_fd, &key);
+            (*removed)++;
+        }
+    }
+
+    free(list.keys);
+    close(policy_fd);
+    close(bitmap_fd);
+    close(counters_fd);
+    return ret;
+}
+
+/*
+    sweep_rules删除MAC、IPv4、IPv6和端口黑名单中所有已经过期的规则
+    内核在查找时已经忽略了过期的规则，这里只是回收它们占用的空间，并让流表缓存中由它们得到的结果失效
+    所有的黑名单都清理完之后才调用一次rules_changed，而不是每删除一条规则调用一次
+*/
+static int sweep_rules()
+{
+    __u64 now = clock_ns(CLOCK_MONOTONIC);
+    __u32 removed = 0;
+    __u32 mac_removed = 0;
+
+    int ret = sweep_map(MAC_BLACKLIST_PATH, ETH_ALEN, true, now, &mac_removed);
+    if (ret == EXIT_OK && mac_removed != 0)
+    {
+        ret = mac_bloom_rebuild();
+    }
+    removed += mac_removed;
+
+    if (ret == EXIT_OK)
+    {
+        ret = sweep_map(V4_BLACKLIST_PATH, sizeof(struct lpm_v4_key), false, now, &removed);
+    }
+    if (ret == EXIT_OK)
+    {
+        ret = sweep_map(V6_BLACKLIST_PATH, sizeof(struct lpm_v6_key), false, now, &removed);
+    }
+    if (ret == EXIT_OK)
+    {
+        ret = sweep_map(V6_BLACKLIST_64_PATH, sizeof(struct v6_prefix_key), true, now, &removed);
+    }
+    if (ret == EXIT_OK)
+    {
+        ret = sweep_map(V6_BLACKLIST_48_PATH, sizeof(struct v6_prefix_key), true, now, &removed);
+    }
+    if (ret == EXIT_OK)
+    {
+        ret = sweep_dir_rules(now, &removed);
+    }
+    if (ret == EXIT_OK)
+    {
+        ret = sweep_port_rules(now, &removed);
+    }
+
+    /*
+        即使清理只完成了一部分，已经删除的规则也要让缓存失效
+    */
+    if (removed != 0)
+    {
+        printf("Removed %u expired rules.\n", removed);
+        int changed = rules_changed();
+        if (ret == EXIT_OK)
+        {
+            ret = changed;
+        }
+    }
+
+    if (ret != EXIT_OK)
+    {
+        printf("ERR: Failed to remove the expired rules err(%d): %s\n", errno, strerror(errno));
+    }
+    return ret;
+}
+
+static volatile sig_atomic_t sweep_stopping = 0;
+
+static void stop_sweep(int sig)
+{
+    sweep_stopping = 1;
+}
+
+/*
+    sweep_expired在'interval'为0时只清理一次，否则每隔'interval'秒清理一次，直到收到SIGINT或SIGTERM
+*/
+static int sweep_expired(__u32 interval)
+{
+    if (interval == 0)
+    {
+        return sweep_rules();
+    }
+
+    signal(SIGINT, stop_sweep);
+    signal(SIGTERM, stop_sweep);
+
+    while (!sweep_stopping)
+    {
+        int ret = sweep_rules();
+        if (ret != EXIT_OK)
+        {
+            return ret;
+        }
+
+        for (__u32 i = 0; i < interval && !sweep_stopping; i++)
+        {
+            sleep(1);
+        }
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    handle_syncookie_port处理添加或删除需要SYN cookie保护的TCP目的端口
+*/
+static int handle_syncookie_port(char *port, bool insert)
+{
+    __u32 first = 0;
+    __u32 last = 0;
+
+    if (parse_port_range(port, &first, &last) != EXIT_OK)
+    {
+        return EXIT_FAIL_OPTIONS;
+    }
+
+    int map_fd = open_bpf_map(SYNCOOKIE_PORTS_PATH);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    printf("%s SYN cookie protection of tcp port '%s'.\n", insert ? "Enabling" : "Disabling", port);
+
+    int ret = set_port_bits(map_fd, 0, first, last, insert);
+    close(map_fd);
+    if (ret != EXIT_OK)
+    {
+        printf("ERR: Failed to update SYN cookie port '%s' err(%d): %s\n", port, errno, strerror(errno));
+        return ret;
+    }
+
+    return rules_changed();
+}
+
+/*
+    prefix_to_mask根据前缀长度计算网络字节序的地址掩码，'words'为1代表IPv4，为4代表IPv6
+*/
+static void prefix_to_mask(__u32 prefixlen, int words, __u32 *mask)
+{
+    memset(mask, 0, 4 * sizeof(__u32));
+    for (int i = 0; i < words; i++)
+    {
+        int bits = (int)prefixlen - 32 * i;
+        bits = bits < 0 ? 0 : (bits > 32 ? 32 : bits);
+        mask[i] = htonl(bits == 0 ? 0 : 0xffffffffU << (32 - bits));
+    }
+}
+
+/*
+    parse_acl_prefix解析ACL规则中的一个地址前缀，'any'代表匹配任意地址
+    解析的同时确定规则的地址族，同一条规则的源地址和目的地址必须属于同一个地址族
+*/
+static int parse_acl_prefix(char *value, __u8 *family, __u32 *addr, __u32 *prefixlen)
+{
+    if (strcmp(value, "any") == 0)
+    {
+        *prefixlen = 0;
+        return EXIT_OK;
+    }
+
+    char *slash = strchr(value, '/');
+    __u8 value_family = strchr(value, ':') != NULL ? 6 : 4;
+    *prefixlen = value_family == 4 ? 32 : 128;
+    if (slash != NULL)
+    {
+        *slash = '\0';
+        *prefixlen = atoi(slash + 1);
+    }
+
+    if (*family != 0 && *family != value_family)
+    {
+        printf("ERR: The addresses of an ACL rule must all be IPv4 or all be IPv6, got '%s'.\n", value);
+        return EXIT_FAIL_OPTIONS;
+    }
+    *family = value_family;
+
+    if (inet_pton(value_family == 4 ? AF_INET : AF_INET6, value, addr) != 1 ||
+        *prefixlen > (value_family == 4 ? 32 : 128))
+    {
+        printf("ERR: Invalid IP address prefix specified in ACL rule, got '%s'.\n", value);
+        return EXIT_FAIL_OPTIONS;
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    parse_acl_port解析ACL规则中的一个端口，'any'代表匹配任意端口，此时掩码为0
+*/
+static int parse_acl_port(char *value, __u16 *port, __u16 *mask)
+{
+    if (strcmp(value, "any") == 0)
+    {
+        *port = 0;
+        *mask = 0;
+        return EXIT_OK;
+    }
+
+    unsigned int parsed = 0;
+    if (sscanf(value, "%u", &parsed) != 1 || parsed > 65535)
+    {
+        printf("ERR: Invalid port specified in ACL rule, got '%s'.\n", value);
+        return EXIT_FAIL_OPTIONS;
+    }
+
+    *port = htons(parsed);
+    *mask = 0xffff;
+    return EXIT_OK;
+}
+
+/*
+    parse_acl_rule把形如'src=10.0.0.0/8,proto=udp,dport=53,priority=10,action=drop'的规则编译成
+    它所属的元组的描述（掩码部分），以及按照这个元组的掩码处理过的键和值
+    没有指定的字段匹配任意值
+*/
+static int parse_acl_rule(char *str, struct acl_tuple *tuple, struct acl_key *key, struct acl_rule *rule)
+{
+    __u32 src_prefixlen = 0;
+    __u32 dst_prefixlen = 0;
+
+    memset(tuple, 0, sizeof(*tuple));
+    memset(key, 0, sizeof(*key));
+    rule->priority = ACL_DEFAULT_PRIORITY;
+    rule->action = XDP_DROP;
+
+    for (char *field = strtok(str, ","); field != NULL; field = strtok(NULL, ","))
+    {
+        char *value = strchr(field, '=');
+        if (value == NULL)
+        {
+            printf("ERR: Invalid ACL rule field must be in the form 'name=value', got '%s'.\n", field);
+            return EXIT_FAIL_OPTIONS;
+        }
+        *value++ = '\0';
+
+        int ret = EXIT_OK;
+        if (strcmp(field, "family") == 0)
+        {
+            key->family = atoi(value);
+            if (key->family != 4 && key->family != 6)
+            {
+                printf("ERR: Invalid ACL family must be '4' or '6', got '%s'.\n", value);
+                return EXIT_FAIL_OPTIONS;
+            }
+        }
+        else if (strcmp(field, "src") == 0)
+        {
+            ret = parse_acl_prefix(value, &key->family, key->src_addr, &src_prefixlen);
+        }
+        else if (strcmp(field, "dst") == 0)
+        {
+            ret = parse_acl_prefix(value, &key->family, key->dst_addr, &dst_prefixlen);
+        }
+        else if (strcmp(field, "proto") == 0)
+        {
+            tuple->proto_mask = 0xff;
+            if (strcmp(value, "any") == 0)
+            {
+                tuple->proto_mask = 0;
+            }
+            else if (strcmp(value, "tcp") == 0)
+            {
+                key->proto = IPPROTO_TCP;
+            }
+            else if (strcmp(value, "udp") == 0)
+            {
+                key->proto = IPPROTO_UDP;
+            }
+            else if (strcmp(value, "icmp") == 0)
+            {
+                key->proto = IPPROTO_ICMP;
+            }
+            else
+            {
+                char *end = NULL;
+                unsigned long proto = strtoul(value, &end, 10);
+                if (*value == '\0' || *end != '\0' || proto > 255)
+                {
+                    printf("ERR: Invalid ACL protocol must be 'any', 'tcp', 'udp', 'icmp' or a number up to 255, got '%s'.\n",
+                           value);
+                    return EXIT_FAIL_OPTIONS;
+                }
+                key->proto = proto;
+            }
+        }
+        else if (strcmp(field, "sport") == 0)
+        {
+            ret = parse_acl_port(value, &key->src_port, &tuple->src_port_mask);
+        }
+        else if (strcmp(field, "dport") == 0)
+        {
+            ret = parse_acl_port(value, &key->dst_port, &tuple->dst_port_mask);
+        }
+        else if (strcmp(field, "priority") == 0)
+        {
+            rule->priority = atoi(value);
+        }
+        else if (strcmp(field, "action") == 0)
+        {
+            if (strcmp(value, "drop") == 0)
+            {
+                rule->action = XDP_DROP;
+            }
+            else if (strcmp(value, "pass") == 0)
+            {
+                rule->action = XDP_PASS;
+            }
+            else if (strcmp(value, "redirect") == 0)
+            {
+                rule->action = XDP_REDIRECT;
+            }
+            else
+            {
+                printf("ERR: Invalid ACL action must be 'drop', 'pass' or 'redirect', got '%s'.\n", value);
+                return EXIT_FAIL_OPTIONS;
+            }
+        }
+        else
+        {
+            printf("ERR: Unknown ACL rule field '%s'.\n", field);
+            return EXIT_FAIL_OPTIONS;
+        }
+
+        if (ret != EXIT_OK)
+        {
+            return ret;
+        }
+    }
+
+    /*
+        两个地址都是'any'并且没有指定地址族时，默认为IPv4
+    */
+    if (key->family == 0)
+    {
+        key->family = 4;
+    }
+
+    tuple->family = key->family;
+    prefix_to_mask(src_prefixlen, key->family == 4 ? 1 : 4, tuple->src_mask);
+    prefix_to_mask(dst_prefixlen, key->family == 4 ? 1 : 4, tuple->dst_mask);
+
+    /*
+        按照元组的掩码处理规则中的各个字段，这和内核中处理数据包的方式完全相同
+    */
+    key->proto &= tuple->proto_mask;
+    for (int i = 0; i < 4; i++)
+    {
+        key->src_addr[i] &= tuple->src_mask[i];
+        key->dst_addr[i] &= tuple->dst_mask[i];
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    same_tuple判断两个元组的掩码是否完全相同，也就是它们是否是同一个元组
+*/
+static bool same_tuple(struct acl_tuple *a, struct acl_tuple *b)
+{
+    return a->family == b->family && a->proto_mask == b->proto_mask &&
+           a->src_port_mask == b->src_port_mask && a->dst_port_mask == b->dst_port_mask &&
+           memcmp(a->src_mask, b->src_mask, sizeof(a->src_mask)) == 0 &&
+           memcmp(a->dst_mask, b->dst_mask, sizeof(a->dst_mask)) == 0;
+}
+
+/*
+    tuple_best_priority遍历'acl_rules'，重新计算某个元组中所有规则里最高的优先级
+    删除规则之后需要这样做，因为被删除的可能正是优先级最高的那条规则
+*/
+static __u32 tuple_best_priority(int rules_fd, __u32 tuple_id)
+{
+    struct acl_key key;
+    struct acl_key prev_key;
+    struct acl_rule rule;
+    __u32 best = 0xffffffff;
+    bool first = true;
+
+    while (bpf_map_get_next_key(rules_fd, first ? NULL : &prev_key, &key) == 0)
+    {
+        if (key.tuple == tuple_id && bpf_map_lookup_elem(rules_fd, &key, &rule) == 0 && rule.priority < best)
+        {
+            best = rule.priority;
+        }
+        prev_key = key;
+        first = false;
+    }
+
+    return best;
+}
+
+/*
+    update_acl在'tuples_fd'和'rules_fd'中添加或删除一条已经解析好的规则
+    添加规则时会先找到掩码相同的元组，如果不存在就占用一个空的元组，然后以元组的ID和处理过的字段作为键插入规则
+    同时维护元组中规则的数量和最高的优先级，这样内核就可以跳过不可能产生更好结果的元组
+*/
+static int update_acl(int tuples_fd, int rules_fd, char *str, struct acl_tuple *wanted, struct acl_key key,
+                      struct acl_rule *rule, bool insert)
+{
+    /*
+        找到这条规则所属的元组，插入时如果不存在就使用第一个空的位置
+    */
+    struct acl_tuple tuple;
+    __u32 tuple_id = ACL_MAX_TUPLES;
+    __u32 free_id = ACL_MAX_TUPLES;
+    for (__u32 i = 0; i < ACL_MAX_TUPLES; i++)
+    {
+        if (bpf_map_lookup_elem(tuples_fd, &i, &tuple) != 0)
+        {
+            return EXIT_FAIL_XDP_MAP_LOOKUP;
+        }
+        if (tuple.rules == 0)
+        {
+            free_id = free_id == ACL_MAX_TUPLES ? i : free_id;
+            continue;
+        }
+        if (same_tuple(&tuple, wanted))
+        {
+            tuple_id = i;
+            break;
+        }
+    }
+
+    if (tuple_id == ACL_MAX_TUPLES)
+    {
+        if (!insert)
+        {
+            printf("ERR: ACL rule '%s' does not exist.\n", str);
+            return EXIT_FAIL_XDP_MAP_DELETE;
+        }
+        if (free_id == ACL_MAX_TUPLES)
+        {
+            printf("ERR: Too many distinct ACL tuples, at most %d are supported.\n", ACL_MAX_TUPLES);
+            return EXIT_FAIL_XDP_MAP_UPDATE;
+        }
+        tuple_id = free_id;
+        tuple = *wanted;
+    }
+
+    key.tuple = tuple_id;
+    printf("%s ACL rule '%s' in tuple %u.\n", insert ? "Inserting" : "Removing", str, tuple_id);
+
+    if (insert)
+    {
+        if (bpf_map_update_elem(rules_fd, &key, rule, BPF_NOEXIST) != 0)
+        {
+            printf("ERR: Failed to insert ACL rule '%s' err(%d): %s\n", str, errno, strerror(errno));
+            return EXIT_FAIL_XDP_MAP_UPDATE;
+        }
+
+        tuple.priority = tuple.rules == 0 || rule->priority < tuple.priority ? rule->priority : tuple.priority;
+        tuple.rules++;
+    }
+    else
+    {
+        if (bpf_map_delete_elem(rules_fd, &key) != 0)
+        {
+            printf("ERR: Failed to remove ACL rule '%s' err(%d): %s\n", str, errno, strerror(errno));
+            return EXIT_FAIL_XDP_MAP_DELETE;
+        }
+
+        tuple.rules--;
+        if (tuple.rules == 0)
+        {
+            memset(&tuple, 0, sizeof(tuple));
+        }
+        else
+        {
+            tuple.priority = tuple_best_priority(rules_fd, tuple_id);
+        }
+    }
+
+    if (bpf_map_update_elem(tuples_fd, &tuple_id, &tuple, BPF_ANY) != 0)
+    {
+        return EXIT_FAIL_XDP_MAP_UPDATE;
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    handle_acl处理在ACL分类器中添加或删除一条规则，真正的修改由update_acl完成
+*/
+static int handle_acl(char *str, bool insert)
+{
+    char *rule_str = alloca(strlen(str) + 1);
+    strcpy(rule_str, str);
+
+    struct acl_tuple wanted;
+    struct acl_key key;
+    struct acl_rule rule;
+    int ret = parse_acl_rule(rule_str, &wanted, &key, &rule);
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    int tuples_fd = open_bpf_map(ACL_TUPLES_PATH);
+    int rules_fd = open_bpf_map(ACL_RULES_PATH);
+
+    ret = EXIT_FAIL_XDP_MAP_OPEN;
+    if (tuples_fd >= 0 && rules_fd >= 0)
+    {
+        ret = update_acl(tuples_fd, rules_fd, str, &wanted, key, &rule, insert);
+    }
+
+    if (rules_fd >= 0)
+    {
+        close(rules_fd);
+    }
+    if (tuples_fd >= 0)
+    {
+        close(tuples_fd);
+    }
+
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+    return rules_changed();
+}
+
+/*
+    lookup_exact_prefix在LPM_TRIE中查找与'key'完全相同的前缀
+    直接对LPM_TRIE调用bpf_map_lookup_elem得到的是最长前缀匹配的结果，不一定是这个前缀本身，所以这里需要遍历所有的键
+*/
+static int lookup_exact_prefix(int map_fd, const void *key, size_t key_size, void *value)
+{
+    void *cur = alloca(key_size);
+    void *prev = alloca(key_size);
+    bool first = true;
+
+    while (bpf_map_get_next_key(map_fd, first ? NULL : prev, cur) == 0)
+    {
+        if (memcmp(cur, key, key_size) == 0)
+        {
+            return bpf_map_lookup_elem(map_fd, cur, value);
+        }
+        memcpy(prev, cur, key_size);
+        first = false;
+    }
+
+    return -1;
+}
+
+/*
+    set_fill_time计算把一个空的令牌桶填满需要的纳秒数，这样内核中的consume_token就不需要做除法
+*/
+static void set_fill_time(struct ratelimit_rate *rate)
+{
+    rate->fill_ns = rate->rate == 0 ? 0 : (__u64)rate->burst * NSEC_PER_SEC / rate->rate;
+}
+
+/*
+    handle_ratelimit处理添加或删除某个源地址前缀上某种协议的限速
+    同一个前缀上不同协议的限速保存在同一个值中，删除最后一个协议的限速时才会删除整个前缀
+*/
+static int handle_ratelimit(char *str, bool insert)
+{
+    char *rule_str = alloca(strlen(str) + 1);
+    strcpy(rule_str, str);
+
+    __u8 family = 0;
+    __u32 prefix[4] = {0};
+    __u32 prefixlen = 0;
+    bool has_prefix = false;
+    __u32 proto = ratelimit_any;
+    struct ratelimit_rate rate = {0};
+    bool has_burst = false;
+    bool has_bucket = false;
+
+    for (char *field = strtok(rule_str, ","); field != NULL; field = strtok(NULL, ","))
+    {
+        char *value = strchr(field, '=');
+        if (value == NULL)
+        {
+            printf("ERR: Invalid rate limit field must be in the form 'name=value', got '%s'.\n", field);
+            return EXIT_FAIL_OPTIONS;
+        }
+        *value++ = '\0';
+
+        if (strcmp(field, "src") == 0)
+        {
+            if (strcmp(value, "any") == 0 || parse_acl_prefix(value, &family, prefix, &prefixlen) != EXIT_OK)
+            {
+                printf("ERR: A rate limit needs a source prefix in CIDR notation.\n");
+                return EXIT_FAIL_OPTIONS;
+            }
+            has_prefix = true;
+        }
+        else if (strcmp(field, "proto") == 0)
+        {
+            for (proto = 0; proto < RATELIMIT_PROTOS; proto++)
+            {
+                if (strcmp(value, ratelimit_proto_names[proto]) == 0)
+                {
+                    break;
+                }
+            }
+            if (proto == RATELIMIT_PROTOS)
+            {
+                printf("ERR: Invalid rate limit protocol must be one of 'any', 'tcp', 'udp' or 'icmp', got '%s'.\n", value);
+                return EXIT_FAIL_OPTIONS;
+            }
+        }
+        else if (strcmp(field, "rate") == 0)
+        {
+            rate.rate = strtoul(value, NULL, 10);
+        }
+        else if (strcmp(field, "burst") == 0)
+        {
+            rate.burst = strtoul(value, NULL, 10);
+            has_burst = true;
+        }
+        else if (strcmp(field, "bucket") == 0)
+        {
+            rate.bucket = strtoul(value, NULL, 10);
+            has_bucket = true;
+        }
+        else
+        {
+            printf("ERR: Unknown rate limit field '%s'.\n", field);
+            return EXIT_FAIL_OPTIONS;
+        }
+    }
+
+    if (!has_prefix)
+    {
+        printf("ERR: A rate limit needs a source prefix, e.g. 'src=10.0.0.0/8'.\n");
+        return EXIT_FAIL_OPTIONS;
+    }
+
+    __u32 max_prefixlen = family == 4 ? 32 : 128;
+    if (!has_burst)
+    {
+        rate.burst = rate.rate;
+    }
+    if (!has_bucket)
+    {
+        rate.bucket = max_prefixlen;
+    }
+
+    if (insert && (rate.rate == 0 || rate.burst == 0 || rate.bucket > max_prefixlen))
+    {
+        printf("ERR: A rate limit needs a non-zero 'rate' and 'burst', and a 'bucket' of at most %u.\n", max_prefixlen);
+        return EXIT_FAIL_OPTIONS;
+    }
+    set_fill_time(&rate);
+
+    int map_fd = open_bpf_map(family == 4 ? RATELIMIT_V4_PATH : RATELIMIT_V6_PATH);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    size_t key_size = family == 4 ? sizeof(struct lpm_v4_key) : sizeof(struct lpm_v6_key);
+    struct bpf_lpm_trie_key *key = alloca(key_size);
+    key->prefixlen = prefixlen;
+    memcpy(key->data, prefix, key_size - sizeof(key->prefixlen));
+
+    struct ratelimit_limit limit;
+    if (lookup_exact_prefix(map_fd, key, key_size, &limit) != 0)
+    {
+        memset(&limit, 0, sizeof(limit));
+    }
+
+    printf("%s the %s rate limit of source prefix '%s'.\n", insert ? "Setting" : "Removing", ratelimit_proto_names[proto], str);
+
+    if (!insert)
+    {
+        memset(&limit.rates[proto], 0, sizeof(limit.rates[proto]));
+
+        bool empty = true;
+        for (int i = 0; i < RATELIMIT_PROTOS; i++)
+        {
+            empty = empty && limit.rates[i].rate == 0;
+        }
+
+        if (empty)
+        {
+            if (bpf_map_delete_elem(map_fd, key) != 0)
+            {
+                printf("ERR: Failed to remove rate limit '%s' err(%d): %s\n", str, errno, strerror(errno));
+                return EXIT_FAIL_XDP_MAP_DELETE;
+            }
+            return EXIT_OK;
+        }
+    }
+    else
+    {
+        limit.rates[proto] = rate;
+    }
+
+    if (bpf_map_update_elem(map_fd, key, &limit, BPF_ANY) != 0)
+    {
+        printf("ERR: Failed to update rate limit '%s' err(%d): %s\n", str, errno, strerror(errno));
+        return EXIT_FAIL_XDP_MAP_UPDATE;
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    print_ratelimit_stats汇总所有CPU上因为超过限速而被丢弃的数据包
+*/
+static int print_ratelimit_stats()
+{
+    int map_fd = open_bpf_map(RATELIMIT_COUNTERS_PATH);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    unsigned int num_cpus = bpf_num_possible_cpus();
+    struct counters values[num_cpus];
+    struct counters overall = {0};
+    __u32 idx = 0;
+
+    if (bpf_map_lookup_elem(map_fd, &idx, values) != 0)
+    {
+        printf("ERR: Failed to lookup rate limit counters err(%d): %s\n", errno, strerror(errno));
+        return EXIT_FAIL_XDP_MAP_LOOKUP;
+    }
+
+    for (int i = 0; i < num_cpus; i++)
+    {
+        overall.packets += values[i].packets;
+        overall.bytes += values[i].bytes;
+    }
+
+    printf("Rate limited:\n\tPackets: %llu\n\tBytes:   %llu Bytes\n\n", overall.packets, overall.bytes);
+
+    return EXIT_OK;
+}
+
+/*
+    print_syncookie_stats汇总所有CPU上SYN cookie这一层的处理结果
+*/
+static int print_syncookie_stats()
+{
+    int map_fd = open_bpf_map(SYNCOOKIE_STATS_PATH);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    unsigned int num_cpus = bpf_num_possible_cpus();
+    __u64 values[num_cpus];
+    __u64 totals[SYNCOOKIE_RESULTS] = {0};
+
+    for (__u32 i = 0; i < SYNCOOKIE_RESULTS; i++)
+    {
+        if (bpf_map_lookup_elem(map_fd, &i, values) != 0)
+        {
+            printf("ERR: Failed to lookup SYN cookie counter '%u' err(%d): %s\n",
+                   i, errno, strerror(errno));
+            return EXIT_FAIL_XDP_MAP_LOOKUP;
+        }
+
+        for (int j = 0; j < num_cpus; j++)
+        {
+            totals[i] += values[j];
+        }
+    }
+
+    printf("SYN cookies:\n\tSent:    %llu\n\tValid:   %llu\n\tInvalid: %llu\n\n",
+           totals[syncookie_sent], totals[syncookie_valid], totals[syncookie_invalid]);
+
+    return EXIT_OK;
+}
+
+/*
+    print_ipv6_ext_stats汇总所有CPU上带有扩展头的IPv6数据包的解析结果，只有在'count'模式下才有计数
+*/
+static int print_ipv6_ext_stats()
+{
+    int map_fd = open_bpf_map(IPV6_EXT_STATS_PATH);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    unsigned int num_cpus = bpf_num_possible_cpus();
+    __u64 values[num_cpus];
+    __u64 totals[IPV6_EXT_RESULTS] = {0};
+
+    for (__u32 i = 0; i < IPV6_EXT_RESULTS; i++)
+    {
+        if (bpf_map_lookup_elem(map_fd, &i, values) != 0)
+        {
+            printf("ERR: Failed to lookup IPv6 extension header counter '%u' err(%d): %s\n",
+                   i, errno, strerror(errno));
+            return EXIT_FAIL_XDP_MAP_LOOKUP;
+        }
+
+        for (int j = 0; j < num_cpus; j++)
+        {
+            totals[i] += values[j];
+        }
+    }
+
+    printf("IPv6 extension headers:\n\tResolved:   %llu\n\tUnresolved: %llu\n\n",
+           totals[ipv6_ext_resolved], totals[ipv6_ext_unresolved]);
+
+    return EXIT_OK;
+}
+
+/*
+    print_drop_stats汇总所有CPU上每一种丢弃原因的计数，只打印出现过的原因
+    原因的下标见common.h中的'DROP_REASON'：前面是规则的类别，后面是格式错误的数据包在哪一个头部被丢弃
+    在隧道内层命中的原因在所有外层的原因之后，打印时带上'inner'
+*/
+static int print_drop_stats()
+{
+    int map_fd = open_bpf_map(DROP_STATS_PATH);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    unsigned int num_cpus = bpf_num_possible_cpus();
+    struct counters values[num_cpus];
+
+    printf("Drops by reason:\n");
+    for (__u32 i = 0; i < DROP_REASONS * DROP_LAYERS; i++)
+    {
+        if (bpf_map_lookup_elem(map_fd, &i, values) != 0)
+        {
+            printf("ERR: Failed to lookup drop reason counter '%u' err(%d): %s\n",
+                   i, errno, strerror(errno));
+            close(map_fd);
+            return EXIT_FAIL_XDP_MAP_LOOKUP;
+        }
+
+        struct counters total = {0};
+        for (int j = 0; j < num_cpus; j++)
+        {
+            total.packets += values[j].packets;
+            total.bytes += values[j].bytes;
+        }
+
+        if (total.packets == 0)
+        {
+            continue;
+        }
+
+        char name[32];
+        __u32 reason = i % DROP_REASONS;
+        const char *layer = i < DROP_REASONS ? "" : "inner ";
+        if (reason < RULE_SOURCES)
+        {
+            snprintf(name, sizeof(name), "%s%s", layer, rule_source_names[reason]);
+        }
+        else
+        {
+            snprintf(name, sizeof(name), "%smalformed %s", layer, malformed_reason_names[reason - RULE_SOURCES]);
+        }
+        printf("\t%-24s  %llu packets, %llu bytes\n", name, total.packets, total.bytes);
+    }
+    printf("\n");
+
+    close(map_fd);
+    return EXIT_OK;
+}
+
+/*
+    hll_estimate根据合并之后的寄存器估计不同源地址的数量，也就是HyperLogLog论文中的调和平均加上小范围和大范围的修正
+    小范围修正在还有很多空寄存器时改用线性计数；哈希值只有32位，接近2^32时要修正哈希冲突
+*/
+static double hll_estimate(const __u8 *registers)
+{
+    double m = HLL_REGISTERS;
+    double alpha = 0.7213 / (1 + 1.079 / m);
+    double sum = 0;
+    unsigned int zeros = 0;
+
+    for (__u32 i = 0; i < HLL_REGISTERS; i++)
+    {
+        sum += ldexp(1.0, -registers[i]);
+        zeros += registers[i] == 0;
+    }
+
+    double estimate = alpha * m * m / sum;
+    if (estimate <= 2.5 * m && zeros != 0)
+    {
+        return m * log(m / zeros);
+    }
+
+    double two32 = 4294967296.0;
+    if (estimate > two32 / 30)
+    {
+        return -two32 * log(1 - estimate / two32);
+    }
+
+    return estimate;
+}
+
+/*
+    read_hll合并所有CPU上的HyperLogLog寄存器，返回从上一次清空到现在见过的不同源地址数量的估计值，以及'hll_meta'
+*/
+static int read_hll(double *estimate, struct hll_meta *meta)
+{
+    int map_fd = open_bpf_map(HLL_PATH);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    int meta_fd = open_bpf_map(HLL_META_PATH);
+    if (meta_fd < 0)
+    {
+        close(map_fd);
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    unsigned int num_cpus = bpf_num_possible_cpus();
+    struct hll_registers *values = calloc(num_cpus, sizeof(struct hll_registers));
+    if (values == NULL)
+    {
+        close(meta_fd);
+        close(map_fd);
+        return EXIT_FAIL_GENERIC;
+    }
+
+    __u32 idx = 0;
+    if (bpf_map_lookup_elem(map_fd, &idx, values) != 0 || bpf_map_lookup_elem(meta_fd, &idx, meta) != 0)
+    {
+        printf("ERR: Failed to lookup the distinct source registers err(%d): %s\n", errno, strerror(errno));
+        free(values);
+        close(meta_fd);
+        close(map_fd);
+        return EXIT_FAIL_XDP_MAP_LOOKUP;
+    }
+    close(meta_fd);
+    close(map_fd);
+
+    /*
+        HyperLogLog的合并就是逐个寄存器取最大值，合并之后和所有数据包都在一个CPU上处理的结果相同
+    */
+    struct hll_registers merged = {0};
+    for (int i = 0; i < num_cpus; i++)
+    {
+        for (__u32 j = 0; j < HLL_REGISTERS; j++)
+        {
+            if (values[i].registers[j] > merged.registers[j])
+            {
+                merged.registers[j] = values[i].registers[j];
+            }
+        }
+    }
+    free(values);
+
+    *estimate = hll_estimate(merged.registers);
+    return EXIT_OK;
+}
+
+/*
+    print_hll_stats打印上一个完整区间内的不同源地址数量和每秒的数量，以及当前这个还没有结束的区间到现在为止的数量
+    这里只读取寄存器，不会清空它们，定期清空由'--hll-interval'完成
+*/
+static int print_hll_stats()
+{
+    double estimate = 0;
+    struct hll_meta meta = {0};
+    int ret = read_hll(&estimate, &meta);
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    printf("Distinct sources:\n");
+    if (meta.last_interval_ns != 0)
+    {
+        double last_seconds = meta.last_interval_ns / 1e9;
+        printf("\tLast interval: %llu in %.1f seconds\n\tPer second:    %.1f\n",
+               meta.last_estimate, last_seconds, meta.last_estimate / last_seconds);
+    }
+    else
+    {
+        printf("\tLast interval: none, run '-H|--hll-interval' to measure the sources per second\n");
+    }
+    printf("\tCurrent:       %.0f in the last %.1f seconds so far\n\n",
+           estimate, (clock_ns(CLOCK_MONOTONIC) - meta.reset_ns) / 1e9);
+
+    return EXIT_OK;
+}
+
+static volatile sig_atomic_t hll_stopping = 0;
+
+static void stop_hll(int sig)
+{
+    hll_stopping = 1;
+}
+
+/*
+    rotate_hll结束当前的区间：读出这个区间的估计值，清空寄存器，并把结果留在'hll_meta'中给'--stats'使用
+*/
+static int rotate_hll()
+{
+    double estimate = 0;
+    struct hll_meta meta = {0};
+    int ret = read_hll(&estimate, &meta);
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    __u64 interval_ns = clock_ns(CLOCK_MONOTONIC) - meta.reset_ns;
+    ret = reset_hll((__u64)(estimate + 0.5), interval_ns);
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    double seconds = interval_ns / 1e9;
+    printf("Distinct sources: %.0f in %.1f seconds, %.1f per second\n", estimate, seconds,
+           seconds > 0 ? estimate / seconds : 0.0);
+    return EXIT_OK;
+}
+
+/*
+    rotate_hll_loop每隔'interval'秒结束一个区间并清空寄存器，直到收到SIGINT或SIGTERM，'interval'为0时只结束当前的区间
+*/
+static int rotate_hll_loop(__u32 interval)
+{
+    if (interval == 0)
+    {
+        return rotate_hll();
+    }
+
+    signal(SIGINT, stop_hll);
+    signal(SIGTERM, stop_hll);
+
+    while (!hll_stopping)
+    {
+        for (__u32 i = 0; i < interval && !hll_stopping; i++)
+        {
+            sleep(1);
+        }
+        if (hll_stopping)
+        {
+            break;
+        }
+
+        int ret = rotate_hll();
+        if (ret != EXIT_OK)
+        {
+            return ret;
+        }
+        fflush(stdout);
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    print_frag_stats汇总所有CPU上IPv4分片的处理结果
+*/
+static int print_frag_stats()
+{
+    int map_fd = open_bpf_map(FRAG_STATS_PATH);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    unsigned int num_cpus = bpf_num_possible_cpus();
+    __u64 values[num_cpus];
+    __u64 totals[FRAG_RESULTS] = {0};
+
+    for (__u32 i = 0; i < FRAG_RESULTS; i++)
+    {
+        if (bpf_map_lookup_elem(map_fd, &i, values) != 0)
+        {
+            printf("ERR: Failed to lookup fragment counter '%u' err(%d): %s\n",
+                   i, errno, strerror(errno));
+            return EXIT_FAIL_XDP_MAP_LOOKUP;
+        }
+
+        for (int j = 0; j < num_cpus; j++)
+        {
+            totals[i] += values[j];
+        }
+    }
+
+    printf("IPv4 fragments:\n\tFirst:      %llu\n\tInherited:  %llu\n\tOrphan:     %llu\n\tOver limit: %llu\n\n",
+           totals[frag_first], totals[frag_inherited], totals[frag_orphan], totals[frag_over_limit]);
+
+    return EXIT_OK;
+}
+
+/*
+    print_tunnel_stats打印每种封装被解开和无法解开的数据包数量，加载时没有启用的封装不打印
+*/
+static int print_tunnel_stats()
+{
+    int map_fd = open_bpf_map(TUNNEL_STATS_PATH);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    unsigned int num_cpus = bpf_num_possible_cpus();
+    struct tunnel_stats values[num_cpus];
+
+    printf("Tunnels:\n");
+    for (__u32 i = tunnel_none + 1; i < TUNNEL_TYPES; i++)
+    {
+        if (bpf_map_lookup_elem(map_fd, &i, values) != 0)
+        {
+            printf("ERR: Failed to lookup tunnel counter '%u' err(%d): %s\n",
+                   i, errno, strerror(errno));
+            close(map_fd);
+            return EXIT_FAIL_XDP_MAP_LOOKUP;
+        }
+
+        struct tunnel_stats total = {0};
+        for (int j = 0; j < num_cpus; j++)
+        {
+            total.decapsulated += values[j].decapsulated;
+            total.unparsed += values[j].unparsed;
+        }
+
+        if (total.decapsulated == 0 && total.unparsed == 0)
+        {
+            continue;
+        }
+
+        printf("\t%-6s  %llu decapsulated, %llu unparsed\n", tunnel_type_names[i], total.decapsulated, total.unparsed);
+    }
+    printf("\n");
+
+    close(map_fd);
+    return EXIT_OK;
+}
+
+/*
+    print_bloom_stats打印MAC布隆过滤器的填充率、按照填充率估算的理论误报率，以及实际观测到的误报率
+    误报率是被误判为可能在黑名单中的地址占所有不在黑名单中的地址的比例，可以用来决定MAC_BLOOM_WORDS的大小
+*/
+static int print_bloom_stats()
+{
+    int bloom_fd = open_bpf_map(MAC_BLOOM_PATH);
+    int stats_fd = open_bpf_map(MAC_BLOOM_STATS_PATH);
+    if (bloom_fd < 0 || stats_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    __u64 bits_set = 0;
+    for (__u32 idx = 0; idx < MAC_BLOOM_WORDS; idx++)
+    {
+        __u64 word = 0;
+        if (bpf_map_lookup_elem(bloom_fd, &idx, &word) != 0)
+        {
+            printf("ERR: Failed to lookup the MAC bloom filter err(%d): %s\n", errno, strerror(errno));
+            return EXIT_FAIL_XDP_MAP_LOOKUP;
+        }
+        bits_set += __builtin_popcountll(word);
+    }
+
+    unsigned int num_cpus = bpf_num_possible_cpus();
+    __u64 values[num_cpus];
+    __u64 totals[BLOOM_RESULTS] = {0};
+
+    for (__u32 i = 0; i < BLOOM_RESULTS; i++)
+    {
+        if (bpf_map_lookup_elem(stats_fd, &i, values) != 0)
+        {
+            printf("ERR: Failed to lookup bloom filter counter '%u' err(%d): %s\n", i, errno, strerror(errno));
+            return EXIT_FAIL_XDP_MAP_LOOKUP;
+        }
+
+        for (int j = 0; j < num_cpus; j++)
+        {
+            totals[i] += values[j];
+        }
+    }
+
+    double fill = (double)bits_set / MAC_BLOOM_BITS;
+    double estimated = 1;
+    for (int i = 0; i < MAC_BLOOM_HASHES; i++)
+    {
+        estimated *= fill;
+    }
+
+    __u64 misses = totals[bloom_negative] + totals[bloom_false_positive];
+    double observed = misses ? (double)totals[bloom_false_positive] / misses : 0;
+
+    printf("MAC bloom filter:\n\tBits set:        %llu/%u (%.2f%%)\n\tEstimated FPR:   %.4f%%\n"
+           "\tNegative:        %llu\n\tHit:             %llu\n\tFalse positive:  %llu\n\tObserved FPR:    %.4f%%\n\n",
+           bits_set, MAC_BLOOM_BITS, fill * 100, estimated * 100, totals[bloom_negative], totals[bloom_hit],
+           totals[bloom_false_positive], observed * 100);
+
+    return EXIT_OK;
+}
+
+/*
+    print_steer_stats打印每个目标CPU入队、处理和丢弃的数据包数量，用来判断引流之后各个CPU的负载是否均衡
+    丢弃的数量是入队和处理的数量之差，其中可能包含少量还在队列中的数据包
+*/
+static int print_steer_stats()
+{
+    int map_fd = open_bpf_map(STEER_STATS_PATH);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    unsigned int num_cpus = bpf_num_possible_cpus();
+    struct steer_counters values[num_cpus];
+    bool header = false;
+
+    for (__u32 cpu = 0; cpu < STEER_MAX_CPUS; cpu++)
+    {
+        if (bpf_map_lookup_elem(map_fd, &cpu, values) != 0)
+        {
+            printf("ERR: Failed to lookup steering counters of CPU %u err(%d): %s\n", cpu, errno, strerror(errno));
+            return EXIT_FAIL_XDP_MAP_LOOKUP;
+        }
+
+        struct steer_counters total = {0};
+        for (int i = 0; i < num_cpus; i++)
+        {
+            total.enqueued += values[i].enqueued;
+            total.processed += values[i].processed;
+        }
+
+        if (total.enqueued == 0 && total.processed == 0)
+        {
+            continue;
+        }
+
+        if (!header)
+        {
+            printf("CPU steering:\n");
+            header = true;
+        }
+        printf("\tCPU %-3u Enqueued: %-12llu Processed: %-12llu Dropped: %llu\n", cpu, total.enqueued, total.processed,
+               total.enqueued > total.processed ? total.enqueued - total.processed : 0);
+    }
+
+    if (header)
+    {
+        printf("\n");
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    print_conntrack_stats汇总所有CPU上连接跟踪的查询结果，以及表中当前的连接数量
+*/
+static int print_conntrack_stats()
+{
+    int map_fd = open_bpf_map(CONNTRACK_STATS_PATH);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    unsigned int num_cpus = bpf_num_possible_cpus();
+    __u64 values[num_cpus];
+    __u64 totals[CT_RESULTS] = {0};
+
+    for (__u32 i = 0; i < CT_RESULTS; i++)
+    {
+        if (bpf_map_lookup_elem(map_fd, &i, values) != 0)
+        {
+            printf("ERR: Failed to lookup conntrack counter '%u' err(%d): %s\n",
+                   i, errno, strerror(errno));
+            close(map_fd);
+            return EXIT_FAIL_XDP_MAP_LOOKUP;
+        }
+
+        for (int j = 0; j < num_cpus; j++)
+        {
+            totals[i] += values[j];
+        }
+    }
+    close(map_fd);
+
+    map_fd = open_bpf_map(CONNTRACK_PATH);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    __u64 connections = 0;
+    struct ct_key key;
+    void *prev = NULL;
+    while (bpf_map_get_next_key(map_fd, prev, &key) == 0)
+    {
+        connections++;
+        prev = &key;
+    }
+    close(map_fd);
+
+    printf("Connection tracking:\n\tConnections: %llu\n", connections);
+    for (__u32 i = 0; i < CT_RESULTS; i++)
+    {
+        printf("\t%-11s  %llu\n", ct_result_names[i], totals[i]);
+    }
+    printf("\n");
+
+    return EXIT_OK;
+}
+
+/*
+    print_flow_cache_stats汇总所有CPU上流表缓存的命中和未命中次数，并打印出命中率
+*/
+static int print_flow_cache_stats()
+{
+    int map_fd = open_bpf_map(FLOW_CACHE_STATS_PATH);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    unsigned int num_cpus = bpf_num_possible_cpus();
+    __u64 values[num_cpus];
+    __u64 totals[FLOW_CACHE_RESULTS] = {0};
+
+    for (__u32 i = 0; i < FLOW_CACHE_RESULTS; i++)
+    {
+        if (bpf_map_lookup_elem(map_fd, &i, values) != 0)
+        {
+            printf("ERR: Failed to lookup flow cache counter '%u' err(%d): %s\n",
+                   i, errno, strerror(errno));
+            return EXIT_FAIL_XDP_MAP_LOOKUP;
+        }
+
+        for (int j = 0; j < num_cpus; j++)
+        {
+            totals[i] += values[j];
+        }
+    }
+
+    __u64 lookups = totals[flow_cache_hit] + totals[flow_cache_miss];
+    printf("Flow cache:\n\tHits:     %llu\n\tMisses:   %llu\n\tHit rate: %.2f%%\n\n",
+           totals[flow_cache_hit], totals[flow_cache_miss],
+           lookups == 0 ? 0.0 : 100.0 * totals[flow_cache_hit] / lookups);
+
+    return EXIT_OK;
+}
+
+/*
+    read_flow_stats汇总所有CPU上流量统计表的变化，下标为common.h中的'flow_result'
+*/
+static int read_flow_stats(int map_fd, __u64 *totals)
+{
+    unsigned int num_cpus = bpf_num_possible_cpus();
+    __u64 values[num_cpus];
+
+    for (__u32 i = 0; i < FLOW_RESULTS; i++)
+    {
+        if (bpf_map_lookup_elem(map_fd, &i, values) != 0)
+        {
+            printf("ERR: Failed to lookup flow counter '%u' err(%d): %s\n",
+                   i, errno, strerror(errno));
+            return EXIT_FAIL_XDP_MAP_LOOKUP;
+        }
+
+        totals[i] = 0;
+        for (int j = 0; j < num_cpus; j++)
+        {
+            totals[i] += values[j];
+        }
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    print_flow_stats打印流量统计表中新建的流的数量，表满时单独导出的数据包数，以及因为ring buffer满了而丢失的记录数
+*/
+static int print_flow_stats()
+{
+    int map_fd = open_bpf_map(FLOW_STATS_PATH);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    __u64 totals[FLOW_RESULTS];
+    int ret = read_flow_stats(map_fd, totals);
+    close(map_fd);
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    printf("Flows:\n\tCreated:    %llu\n\tTable full: %llu\n\tLost:       %llu\n\n",
+           totals[flow_created], totals[flow_overflow], totals[flow_lost]);
+
+    return EXIT_OK;
+}
+
+/*
+    rule_stats代表某一条黑名单规则以及它在所有CPU上汇总之后的命中计数
+*/
+struct rule_stats
+{
+    char rule[INET6_ADDRSTRLEN + 16];
+    struct counters counters;
+};
+
+/*
+    rule_stats_list是一个可以动态增长的rule_stats数组，用来收集所有黑名单中的规则
+*/
+struct rule_stats_list
+{
+    struct rule_stats *rules;
+    size_t count;
+    size_t capacity;
+};
+
+typedef void (*format_rule_fn)(const void *key, char *buf, size_t len);
+
+static void format_mac_rule(const void *key, char *buf, size_t len)
+{
+    const unsigned char *mac = key;
+    snprintf(buf, len, "mac %02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+static void format_v4_rule(const void *key, char *buf, size_t len)
+{
+    const struct lpm_v4_key *v4 = key;
+    char addr[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, v4->address, addr, sizeof(addr));
+    snprintf(buf, len, "ipv4 %s/%u", addr, v4->prefixlen);
+}
+
+static void format_v6_rule(const void *key, char *buf, size_t len)
+{
+    const struct lpm_v6_key *v6 = key;
+    char addr[INET6_ADDRSTRLEN];
+    inet_ntop(AF_INET6, v6->address, addr, sizeof(addr));
+    snprintf(buf, len, "ipv6 %s/%u", addr, v6->prefixlen);
+}
+
+static void format_v6_prefix_rule(const void *key, __u32 prefixlen, char *buf, size_t len)
+{
+    struct in6_addr addr6 = {0};
+    memcpy(&addr6, key, sizeof(struct v6_prefix_key));
+    char addr[INET6_ADDRSTRLEN];
+    inet_ntop(AF_INET6, &addr6, addr, sizeof(addr));
+    snprintf(buf, len, "ipv6 %s/%u", addr, prefixlen);
+}
+
+static void format_v6_64_rule(const void *key, char *buf, size_t len)
+{
+    format_v6_prefix_rule(key, 64, buf, len);
+}
+
+static void format_v6_48_rule(const void *key, char *buf, size_t len)
+{
+    format_v6_prefix_rule(key, 48, buf, len);
+}
+
+static void format_port_rule(const void *key, char *buf, size_t len)
+{
+    __u32 port_key = *(const __u32 *)key;
+    __u32 pair = port_key >> 16;
+    snprintf(buf, len, "%s port %u/%s", pair / 2 == source_port ? "source" : "dest",
+             port_key & 0xffff, pair % 2 == udp_port ? "udp" : "tcp");
+}
+
+/*
+    collect_rule_stats使用bpf_map_get_next_key遍历指定的黑名单，将其中每条规则的命中计数汇总之后放入'list'中
+    对于PERCPU类型的MAP，需要把所有CPU上的计数加起来
+    'value_size'是每个值的大小，黑名单的值是'rule_value'，端口的计数是单独的'counters'，两者都以命中计数开头
+*/
+static int collect_rule_stats(const char *map, size_t key_size, size_t value_size, bool percpu, format_rule_fn format,
+                              struct rule_stats_list *list)
+{
+    int map_fd = open_bpf_map(map);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    unsigned int num_values = percpu ? bpf_num_possible_cpus() : 1;
+    __u8 values[num_values][value_size];
+    void *key = alloca(key_size);
+    void *prev_key = NULL;
+    int ret = EXIT_OK;
+
+    while (bpf_map_get_next_key(map_fd, prev_key, key) == 0)
+    {
+        if (bpf_map_lookup_elem(map_fd, key, values) != 0)
+        {
+            printf("ERR: Failed to lookup rule counters in '%s' err(%d): %s\n",
+                   map, errno, strerror(errno));
+            ret = EXIT_FAIL_XDP_MAP_LOOKUP;
+            break;
+        }
+
+        /*
+            realloc失败时原来的内存仍然有效，所以先放在临时变量中，成功之后再替换，原来的内存由调用者释放
+        */
+        if (list->count == list->capacity)
+        {
+            size_t capacity = list->capacity == 0 ? 64 : list->capacity * 2;
+            struct rule_stats *rules = realloc(list->rules, capacity * sizeof(struct rule_stats));
+            if (rules == NULL)
+            {
+                printf("ERR: Failed to allocate memory for rule statistics.\n");
+                ret = EXIT_FAIL_GENERIC;
+                break;
+            }
+            list->rules = rules;
+            list->capacity = capacity;
+        }
+
+        struct rule_stats *rule = &list->rules[list->count++];
+        memset(rule, 0, sizeof(*rule));
+        format(key, rule->rule, sizeof(rule->rule));
+        for (int i = 0; i < num_values; i++)
+        {
+            struct counters *counters = (struct counters *)values[i];
+            rule->counters.packets += counters->packets;
+            rule->counters.bytes += counters->bytes;
+        }
+
+        if (prev_key == NULL)
+        {
+            prev_key = alloca(key_size);
+        }
+        memcpy(prev_key, key, key_size);
+    }
+
+    close(map_fd);
+    return ret;
+}
+
+static int compare_rule_stats(const void *a, const void *b)
+{
+    const struct rule_stats *left = a;
+    const struct rule_stats *right = b;
+
+    if (left->counters.packets == right->counters.packets)
+    {
+        return 0;
+    }
+    return left->counters.packets < right->counters.packets ? 1 : -1;
+}
+
+/*
+    print_rule_stats打印所有黑名单中每一条规则的命中计数，按照命中的数据包数从多到少排序
+    从来没有被命中过的规则会排在最后，可以考虑把它们删除，以减少LPM查找的开销
+*/
+static int print_rule_stats()
+{
+    struct rule_stats_list list = {0};
+    int ret = collect_rule_stats(MAC_BLACKLIST_PATH, ETH_ALEN, sizeof(struct rule_value), true, format_mac_rule, &list);
+    if (ret == EXIT_OK)
+    {
+        ret = collect_rule_stats(V4_BLACKLIST_PATH, sizeof(struct lpm_v4_key), sizeof(struct rule_value), false, format_v4_rule, &list);
+    }
+    if (ret == EXIT_OK)
+    {
+        ret = collect_rule_stats(V6_BLACKLIST_PATH, sizeof(struct lpm_v6_key), sizeof(struct rule_value), false, format_v6_rule, &list);
+    }
+    if (ret == EXIT_OK)
+    {
+        ret = collect_rule_stats(V6_BLACKLIST_64_PATH, sizeof(struct v6_prefix_key), sizeof(struct rule_value), true, format_v6_64_rule, &list);
+    }
+    if (ret == EXIT_OK)
+    {
+        ret = collect_rule_stats(V6_BLACKLIST_48_PATH, sizeof(struct v6_prefix_key), sizeof(struct rule_value), true, format_v6_48_rule, &list);
+    }
+    if (ret == EXIT_OK)
+    {
+        ret = collect_rule_stats(PORT_RULE_COUNTERS_PATH, sizeof(__u32), sizeof(struct counters), true, format_port_rule, &list);
+    }
+
+    if (ret == EXIT_OK)
+    {
+        qsort(list.rules, list.count, sizeof(struct rule_stats), compare_rule_stats);
+
+        printf("%-48s %20s %20s\n", "Rule", "Packets", "Bytes");
+        for (size_t i = 0; i < list.count; i++)
+        {
+            printf("%-48s %20llu %20llu\n", list.rules[i].rule,
+                   list.rules[i].counters.packets, list.rules[i].counters.bytes);
+        }
+    }
+
+    free(list.rules);
+    return ret;
+}
+
+/*
+    print_pipeline打印当前流水线中依次执行的检查
+*/
+static int print_pipeline()
+{
+    int stages_fd = open_bpf_map(XDPFW_STAGES_PATH);
+    if (stages_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    int progs_fd = open_bpf_map(XDPFW_STAGE_PROGS_PATH);
+    if (progs_fd < 0)
+    {
+        close(stages_fd);
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    /*
+        只打印内核当前正在使用的那一半
+    */
+    __u32 generation = 0;
+    int ret = read_flow_generation(&generation);
+    if (ret != EXIT_OK)
+    {
+        close(progs_fd);
+        close(stages_fd);
+        return ret;
+    }
+
+    printf("Pipeline:\n\t");
+    __u32 base = (generation & 1) * XDPFW_PIPELINE_SLOTS;
+    __u32 slot = base;
+    for (; slot < base + XDPFW_STAGES; slot++)
+    {
+        __u32 prog_id = 0;
+        if (bpf_map_lookup_elem(stages_fd, &slot, &prog_id) != 0)
+        {
+            break;
+        }
+
+        /*
+            通过比较程序ID找出这个位置放的是哪一层
+        */
+        const char *name = "unknown";
+        for (__u32 stage = 0; stage < XDPFW_STAGES; stage++)
+        {
+            __u32 stage_id = 0;
+            if (bpf_map_lookup_elem(progs_fd, &stage, &stage_id) == 0 && stage_id == prog_id)
+            {
+                name = stage_names[stage];
+            }
+        }
+        printf("%s%s", slot == base ? "" : " -> ", name);
+    }
+    printf("%s\n\n", slot == base ? "(empty)" : "");
+
+    close(progs_fd);
+    close(stages_fd);
+    return EXIT_OK;
+}
+
+/*
+    print_stats打印每个XDP action的统计数据、流表缓存的命中率以及当前的检查流水线
+*/
+static int print_stats()
+{
+    int ret = print_action_stats();
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    ret = print_drop_stats();
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    ret = print_ratelimit_stats();
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    ret = print_syncookie_stats();
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    ret = print_ipv6_ext_stats();
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    ret = print_frag_stats();
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    ret = print_tunnel_stats();
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    ret = print_bloom_stats();
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    ret = print_steer_stats();
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    ret = print_flow_cache_stats();
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    ret = print_flow_stats();
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    ret = print_conntrack_stats();
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    ret = print_hll_stats();
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    return print_pipeline();
+}
+
+/*
+    prof_percentile返回直方图中第'fraction'分位所在的桶，'total'是直方图中所有的次数
+*/
+static __u32 prof_percentile(const __u64 *hist, __u64 total, double fraction)
+{
+    __u64 seen = 0;
+    for (__u32 i = 0; i < PROF_BUCKETS; i++)
+    {
+        seen += hist[i];
+        if (seen >= fraction * total)
+        {
+            return i;
+        }
+    }
+
+    return PROF_BUCKETS - 1;
+}
+
+/*
+    print_latency_stats汇总所有CPU上每个计时点的延迟直方图，打印它们的分位数和直方图
+    直方图的桶是以2为底的对数，所以分位数只能精确到它所在的桶，这里打印的是桶的上界
+*/
+static int print_latency_stats()
+{
+    int map_fd = open_bpf_map(PROF_HIST_PATH);
+    if (map_fd < 0)
+    {
+        printf("ERR: The loaded XDP program was not built with 'make PROFILE=1'.\n");
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    unsigned int num_cpus = bpf_num_possible_cpus();
+    __u64 values[num_cpus];
+
+    for (__u32 point = 0; point < PROF_POINTS; point++)
+    {
+        __u64 hist[PROF_BUCKETS] = {0};
+        __u64 total = 0;
+        __u64 peak = 0;
+
+        for (__u32 i = 0; i < PROF_BUCKETS; i++)
+        {
+            __u32 idx = point * PROF_BUCKETS + i;
+            if (bpf_map_lookup_elem(map_fd, &idx, values) != 0)
+            {
+                printf("ERR: Failed to lookup latency bucket '%u' err(%d): %s\n", idx, errno, strerror(errno));
+                close(map_fd);
+                return EXIT_FAIL_XDP_MAP_LOOKUP;
+            }
+
+            for (int j = 0; j < num_cpus; j++)
+            {
+                hist[i] += values[j];
+            }
+            total += hist[i];
+            peak = hist[i] > peak ? hist[i] : peak;
+        }
+
+        if (total == 0)
+        {
+            continue;
+        }
+
+        printf("Latency of '%s' (%llu samples):\n\tp50 < %lluns  p90 < %lluns  p99 < %lluns  p99.9 < %lluns\n",
+               point < XDPFW_STAGES ? stage_names[point] : prof_point_names[point], total,
+               1ULL << (prof_percentile(hist, total, 0.5) + 1), 1ULL << (prof_percentile(hist, total, 0.9) + 1),
+               1ULL << (prof_percentile(hist, total, 0.99) + 1), 1ULL << (prof_percentile(hist, total, 0.999) + 1));
+
+        for (__u32 i = 0; i < PROF_BUCKETS; i++)
+        {
+            if (hist[i] == 0)
+            {
+                continue;
+            }
+
+            char bar[41] = {0};
+            memset(bar, '@', hist[i] * 40 / peak);
+            printf("\t[%10llu, %10llu) %12llu |%-40s|\n", i == 0 ? 0ULL : 1ULL << i, 1ULL << (i + 1), hist[i], bar);
+        }
+        printf("\n");
+    }
+
+    close(map_fd);
+    return EXIT_OK;
+}
+
+/*
+    format_rule_id把内核记录的'RULE_ID'转换为可读的字符串
+*/
+static void format_rule_id(__u32 rule, char *buf, size_t len)
+{
+    __u32 source = RULE_SOURCE(rule);
+    __u32 detail = RULE_DETAIL(rule);
+
+    if (source >= RULE_SOURCES)
+    {
+        snprintf(buf, len, "unknown %u", rule);
+        return;
+    }
+
+    switch (source)
+    {
+    case rule_v6:
+        if (detail != 0)
+        {
+            snprintf(buf, len, "ipv6 /%u", detail);
+        }
+        else
+        {
+            snprintf(buf, len, "ipv6");
+        }
+        break;
+    case rule_port:
+        format_port_rule(&detail, buf, len);
+        break;
+    case rule_acl:
+        snprintf(buf, len, "acl priority %u", detail);
+        break;
+    case rule_ratelimit:
+        snprintf(buf, len, "ratelimit %s", detail < RATELIMIT_PROTOS ? ratelimit_proto_names[detail] : "?");
+        break;
+    case rule_frag:
+        snprintf(buf, len, "frag %s", detail < FRAG_RESULTS ? frag_result_names[detail] : "?");
+        break;
+    case rule_conntrack:
+        snprintf(buf, len, "conntrack %s", detail < CT_RESULTS ? ct_result_names[detail] : "?");
+        break;
+    case rule_malformed:
+        snprintf(buf, len, "malformed %s", detail < MALFORMED_REASONS ? malformed_reason_names[detail] : "?");
+        break;
+    default:
+        snprintf(buf, len, "%s", rule_source_names[source]);
+        break;
+    }
+
+    size_t used = strlen(buf);
+    if (RULE_IS_INNER(rule) && used < len)
+    {
+        snprintf(buf + used, len - used, " (inner)");
+    }
+}
+
+/*
+    capture_state是抓包期间ring buffer回调函数使用的状态
+    boot_offset_ns是CLOCK_REALTIME和CLOCK_MONOTONIC之差，用来把bpf_ktime_get_ns的时间转换为墙上时间
+*/
+struct capture_state
+{
+    FILE *file;
+    __u64 boot_offset_ns;
+    __u64 captured;
+};
+
+static volatile sig_atomic_t capture_stopping = 0;
+
+static void stop_capture(int sig)
+{
+    capture_stopping = 1;
+}
+
+/*
+    pcapng的各个块都按照本机字节序写入，读取的一方通过Section Header Block中的byte-order magic判断字节序
+*/
+struct pcapng_option
+{
+    __u16 code;
+    __u16 length;
+} __attribute__((packed));
+
+struct pcapng_shb
+{
+    __u32 type;
+    __u32 length;
+    __u32 magic;
+    __u16 major;
+    __u16 minor;
+    __s64 section_length;
+    __u32 trailing_length;
+} __attribute__((packed));
+
+struct pcapng_idb
+{
+    __u32 type;
+    __u32 length;
+    __u16 linktype;
+    __u16 reserved;
+    __u32 snaplen;
+    struct pcapng_option tsresol;
+    __u8 tsresol_value[4];
+    struct pcapng_option end;
+    __u32 trailing_length;
+} __attribute__((packed));
+
+struct pcapng_epb
+{
+    __u32 type;
+    __u32 length;
+    __u32 interface;
+    __u32 ts_high;
+    __u32 ts_low;
+    __u32 caplen;
+    __u32 len;
+} __attribute__((packed));
+
+/*
+    write_pcapng_header写入pcapng文件的Section Header Block和唯一的Interface Description Block
+    时间戳的精度通过if_tsresol选项设置为纳秒
+    这里使用pcapng而不是pcap，是因为只有pcapng的每个数据包都可以携带一段注释，用来保存规则、ifindex和队列这些元数据
+*/
+static int write_pcapng_header(FILE *file, __u32 snaplen)
+{
+    struct pcapng_shb shb = {
+        .type = 0x0a0d0d0a,
+        .length = sizeof(shb),
+        .magic = 0x1a2b3c4d,
+        .major = 1,
+        .minor = 0,
+        .section_length = -1,
+        .trailing_length = sizeof(shb),
+    };
+
+    struct pcapng_idb idb = {
+        .type = 1,
+        .length = sizeof(idb),
+        .linktype = 1,
+        .snaplen = snaplen,
+        .tsresol = {.code = 9, .length = 1},
+        .tsresol_value = {9},
+        .end = {.code = 0, .length = 0},
+        .trailing_length = sizeof(idb),
+    };
+
+    if (fwrite(&shb, sizeof(shb), 1, file) != 1 || fwrite(&idb, sizeof(idb), 1, file) != 1)
+    {
+        return EXIT_FAIL_GENERIC;
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    handle_capture_record是ring buffer的回调函数，把一条记录写成一个Enhanced Packet Block
+    文件使用带缓冲的stdio写入，回调函数本身不会阻塞在磁盘上
+*/
+static int handle_capture_record(void *ctx, void *data, size_t size)
+{
+    struct capture_state *state = ctx;
+    const struct capture_record *record = data;
+
+    if (size < sizeof(*record) || record->caplen > CAPTURE_MAX_SNAPLEN)
+    {
+        return 0;
+    }
+
+    char rule[64];
+    char comment[128];
+    format_rule_id(record->rule, rule, sizeof(rule));
+    int comment_len = snprintf(comment, sizeof(comment), "rule=%s ifindex=%u rxq=%u", rule, record->ifindex, record->rx_queue);
+    if (comment_len < 0)
+    {
+        return 0;
+    }
+    if (comment_len >= (int)sizeof(comment))
+    {
+        comment_len = sizeof(comment) - 1;
+    }
+
+    /*
+        数据和注释都需要补齐到4字节，块的末尾是opt_endofopt和重复的块长度
+    */
+    __u32 data_len = (record->caplen + 3) & ~3U;
+    __u32 comment_pad = (comment_len + 3) & ~3U;
+    struct pcapng_option comment_option = {.code = 1, .length = comment_len};
+    struct pcapng_option end_option = {0};
+    __u32 total = sizeof(struct pcapng_epb) + data_len + sizeof(comment_option) + comment_pad + sizeof(end_option) + sizeof(total);
+
+    __u64 ts = record->timestamp + state->boot_offset_ns;
+    struct pcapng_epb epb = {
+        .type = 6,
+        .length = total,
+        .interface = 0,
+        .ts_high = ts >> 32,
+        .ts_low = (__u32)ts,
+        .caplen = record->caplen,
+        .len = record->len,
+    };
+    __u8 pad[4] = {0};
+
+    fwrite(&epb, sizeof(epb), 1, state->file);
+    fwrite(record->data, 1, record->caplen, state->file);
+    fwrite(pad, 1, data_len - record->caplen, state->file);
+    fwrite(&comment_option, sizeof(comment_option), 1, state->file);
+    fwrite(comment, 1, comment_len, state->file);
+    fwrite(pad, 1, comment_pad - comment_len, state->file);
+    fwrite(&end_option, sizeof(end_option), 1, state->file);
+    fwrite(&total, sizeof(total), 1, state->file);
+
+    state->captured++;
+    return 0;
+}
+
+/*
+    max_capture_busy_ns读取每个CPU上抓包累计花费的时间，返回其中增长最多的那个CPU在这段时间内增长的值
+    'last'保存了上一次读取到的每个CPU的值
+*/
+static __u64 max_capture_busy_ns(int stats_fd, __u64 *last, struct capture_stats *totals)
+{
+    unsigned int num_cpus = bpf_num_possible_cpus();
+    struct capture_stats values[num_cpus];
+    __u32 idx = 0;
+    __u64 max_delta = 0;
+
+    if (bpf_map_lookup_elem(stats_fd, &idx, values) != 0)
+    {
+        return 0;
+    }
+
+    memset(totals, 0, sizeof(*totals));
+    for (int i = 0; i < num_cpus; i++)
+    {
+        if (values[i].busy_ns - last[i] > max_delta)
+        {
+            max_delta = values[i].busy_ns - last[i];
+        }
+        last[i] = values[i].busy_ns;
+
+        totals->sampled += values[i].sampled;
+        totals->lost += values[i].lost;
+        totals->busy_ns += values[i].busy_ns;
+    }
+
+    return max_delta;
+}
+
+/*
+    run_capture把抽样得到的被丢弃的数据包写入'path'指定的pcapng文件，直到收到SIGINT或SIGTERM
+    每隔CAPTURE_ADJUST_MS毫秒，用开销最大的那个CPU上抓包花费的时间占比和'budget'比较：
+    超出预算时抽样率减半（K加倍），远低于预算时再逐步恢复，但不会超过最初指定的抽样率
+*/
+static int run_capture(int ring_fd, int control_fd, int stats_fd, char *path, __u32 rate, __u32 snaplen, double budget)
+{
+    struct capture_state state = {
+        .file = fopen(path, "wb"),
+        .boot_offset_ns = clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_MONOTONIC),
+    };
+    if (state.file == NULL)
+    {
+        printf("ERR: Unable to open '%s' err(%d): %s\n", path, errno, strerror(errno));
+        return EXIT_FAIL_GENERIC;
+    }
+    setvbuf(state.file, NULL, _IOFBF, 1 << 20);
+
+    int ret = write_pcapng_header(state.file, snaplen);
+    if (ret != EXIT_OK)
+    {
+        printf("ERR: Unable to write to '%s'.\n", path);
+        fclose(state.file);
+        return ret;
+    }
+
+    struct ring_buffer *ring = ring_buffer__new(ring_fd, handle_capture_record, &state, NULL);
+    if (libbpf_get_error(ring) != 0)
+    {
+        printf("ERR: Unable to open the capture ring buffer.\n");
+        fclose(state.file);
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    unsigned int num_cpus = bpf_num_possible_cpus();
+    __u64 last_busy[num_cpus];
+    struct capture_stats totals;
+    memset(last_busy, 0, sizeof(last_busy));
+    max_capture_busy_ns(stats_fd, last_busy, &totals);
+    __u64 initial_lost = totals.lost;
+
+    __u32 idx = 0;
+    struct capture_control control = {
+        .sample_rate = rate,
+        .snaplen = snaplen,
+    };
+    if (bpf_map_update_elem(control_fd, &idx, &control, BPF_ANY) != 0)
+    {
+        printf("ERR: Failed to start capturing err(%d): %s\n", errno, strerror(errno));
+        ring_buffer__free(ring);
+        fclose(state.file);
+        return EXIT_FAIL_XDP_MAP_UPDATE;
+    }
+
+    signal(SIGINT, stop_capture);
+    signal(SIGTERM, stop_capture);
+    printf("Capturing 1 in %u dropped packets to '%s', press Ctrl-C to stop.\n", rate, path);
+
+    __u64 last_adjust = clock_ns(CLOCK_MONOTONIC);
+    while (!capture_stopping)
+    {
+        usleep(CAPTURE_POLL_MS * 1000);
+        ring_buffer__consume(ring);
+
+        __u64 now = clock_ns(CLOCK_MONOTONIC);
+        if (now - last_adjust < CAPTURE_ADJUST_MS * 1000000ULL)
+        {
+            continue;
+        }
+
+        double share = 100.0 * max_capture_busy_ns(stats_fd, last_busy, &totals) / (now - last_adjust);
+        last_adjust = now;
+
+        __u32 next = control.sample_rate;
+        if (share > budget && next < CAPTURE_MAX_RATE)
+        {
+            next *= 2;
+        }
+        else if (share < budget / 4 && next / 2 >= rate)
+        {
+            next /= 2;
+        }
+
+        if (next != control.sample_rate)
+        {
+            printf("Capture cost %.3f%% of a CPU, sampling 1 in %u dropped packets.\n", share, next);
+            control.sample_rate = next;
+            bpf_map_update_elem(control_fd, &idx, &control, BPF_ANY);
+        }
+    }
+
+    control.sample_rate = 0;
+    bpf_map_update_elem(control_fd, &idx, &control, BPF_ANY);
+
+    ring_buffer__consume(ring);
+    ring_buffer__free(ring);
+    fclose(state.file);
+
+    max_capture_busy_ns(stats_fd, last_busy, &totals);
+    printf("\nCaptured %llu packets, %llu lost because the ring buffer was full.\n", state.captured, totals.lost - initial_lost);
+
+    return EXIT_OK;
+}
+
+/*
+    capture_drops打开抓包使用的三个BPF MAP，由run_capture完成真正的抓包，不论结果如何最后都关闭它们
+*/
+static int capture_drops(char *path, __u32 rate, __u32 snaplen, double budget)
+{
+    int ring_fd = open_bpf_map(CAPTURE_RING_PATH);
+    int control_fd = open_bpf_map(CAPTURE_CONTROL_PATH);
+    int stats_fd = open_bpf_map(CAPTURE_STATS_PATH);
+
+    int ret = EXIT_FAIL_XDP_MAP_OPEN;
+    if (ring_fd >= 0 && control_fd >= 0 && stats_fd >= 0)
+    {
+        ret = run_capture(ring_fd, control_fd, stats_fd, path, rate, snaplen, budget);
+    }
+
+    if (stats_fd >= 0)
+    {
+        close(stats_fd);
+    }
+    if (control_fd >= 0)
+    {
+        close(control_fd);
+    }
+    if (ring_fd >= 0)
+    {
+        close(ring_fd);
+    }
+    return ret;
+}
+
+/*
+    ipfix_exporter是导出流记录期间使用的状态，'records'中按照地址族分别积攒已经编码好的数据记录，下标1是IPv6
+    sequence是已经发送的数据记录的总数，收集器根据它发现丢失的消息
+    boot_offset_ns和抓包时一样用来把bpf_ktime_get_ns的时间转换为墙上时间
+*/
+struct ipfix_exporter
+{
+    int sock;
+    __u32 sequence;
+    __u64 boot_offset_ns;
+    __u64 last_template_ns;
+    __u8 records[2][IPFIX_RECORDS_MAX];
+    __u32 pending_len[2];
+    __u32 pending_count[2];
+    __u64 exported;
+    __u64 messages;
+    __u64 send_errors;
+};
+
+static volatile sig_atomic_t flow_export_stopping = 0;
+
+static void stop_flow_export(int sig)
+{
+    flow_export_stopping = 1;
+}
+
+/*
+    ipfix_put按照网络字节序把'value'的低'len'个字节写入'buf'，返回写入之后的位置
+*/
+static __u8 *ipfix_put(__u8 *buf, __u64 value, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        buf[i] = value >> (8 * (len - 1 - i));
+    }
+
+    return buf + len;
+}
+
+static __u32 ipfix_record_len(const struct ipfix_field *fields)
+{
+    __u32 len = 0;
+    for (int i = 0; i < IPFIX_FIELDS; i++)
+    {
+        len += fields[i].length;
+    }
+
+    return len;
+}
+
+static __u8 *ipfix_put_template(__u8 *buf, __u16 id, const struct ipfix_field *fields)
+{
+    buf = ipfix_put(buf, id, 2);
+    buf = ipfix_put(buf, IPFIX_FIELDS, 2);
+    for (int i = 0; i < IPFIX_FIELDS; i++)
+    {
+        buf = ipfix_put(buf, fields[i].id, 2);
+        buf = ipfix_put(buf, fields[i].length, 2);
+    }
+
+    return buf;
+}
+
+/*
+    ipfix_put_templates写入一个包含IPv4和IPv6两个模板的模板集合，返回写入之后的位置
+*/
+static __u8 *ipfix_put_templates(__u8 *buf)
+{
+    __u8 *set = buf;
+
+    buf = ipfix_put_template(buf + IPFIX_SET_HEADER_LEN, IPFIX_TEMPLATE_V4, ipfix_v4_fields);
+    buf = ipfix_put_template(buf, IPFIX_TEMPLATE_V6, ipfix_v6_fields);
+    ipfix_put(ipfix_put(set, IPFIX_SET_TEMPLATE, 2), buf - set, 2);
+
+    return buf;
+}
+
+/*
+    ipfix_flush把一种地址族积攒的数据记录作为一个IPFIX消息发送出去，到了重发模板的时间时在数据集合之前带上模板集合
+    发送失败时这些记录就丢失了，序号仍然增加，收集器可以从序号的跳变中发现它们
+*/
+static void ipfix_flush(struct ipfix_exporter *exp, int v6)
+{
+    if (exp->pending_count[v6] == 0)
+    {
+        return;
+    }
+
+    __u8 msg[IPFIX_MAX_MESSAGE];
+    __u8 *buf = msg + IPFIX_HEADER_LEN;
+
+    __u64 now = clock_ns(CLOCK_MONOTONIC);
+    if (exp->last_template_ns == 0 || now - exp->last_template_ns >= IPFIX_TEMPLATE_INTERVAL * 1000000000ULL)
+    {
+        buf = ipfix_put_templates(buf);
+        exp->last_template_ns = now;
+    }
+
+    buf = ipfix_put(buf, v6 ? IPFIX_TEMPLATE_V6 : IPFIX_TEMPLATE_V4, 2);
+    buf = ipfix_put(buf, IPFIX_SET_HEADER_LEN + exp->pending_len[v6], 2);
+    memcpy(buf, exp->records[v6], exp->pending_len[v6]);
+    buf += exp->pending_len[v6];
+
+    __u8 *header = msg;
+    header = ipfix_put(header, IPFIX_VERSION, 2);
+    header = ipfix_put(header, buf - msg, 2);
+    header = ipfix_put(header, time(NULL), 4);
+    header = ipfix_put(header, exp->sequence, 4);
+    ipfix_put(header, IPFIX_DOMAIN_ID, 4);
+
+    if (send(exp->sock, msg, buf - msg, 0) < 0)
+    {
+        exp->send_errors++;
+    }
+    else
+    {
+        exp->messages++;
+    }
+
+    exp->sequence += exp->pending_count[v6];
+    exp->pending_len[v6] = 0;
+    exp->pending_count[v6] = 0;
+}
+
+/*
+    ipfix_add按照对应地址族的模板把一条流记录编码为一条数据记录，缓冲区放不下时先发送已经积攒的记录
+    'flow_key'中的端口已经是网络字节序，这里先转换回来再统一写入
+*/
+static void ipfix_add(struct ipfix_exporter *exp, const struct flow_export *record)
+{
+    const struct flow_counters *flow = &record->counters;
+    const struct flow_key *key = &record->key;
+    int v6 = flow->family == 6;
+    size_t addr_len = v6 ? sizeof(key->src_addr) : 4;
+    __u32 len = ipfix_record_len(v6 ? ipfix_v6_fields : ipfix_v4_fields);
+
+    if (exp->pending_len[v6] + len > IPFIX_RECORDS_MAX)
+    {
+        ipfix_flush(exp, v6);
+    }
+
+    __u8 *buf = exp->records[v6] + exp->pending_len[v6];
+    memcpy(buf, key->src_addr, addr_len);
+    buf += addr_len;
+    memcpy(buf, key->dst_addr, addr_len);
+    buf += addr_len;
+    buf = ipfix_put(buf, ntohs(key->src_port), 2);
+    buf = ipfix_put(buf, ntohs(key->dst_port), 2);
+    buf = ipfix_put(buf, key->proto, 1);
+    buf = ipfix_put(buf, flow->tcp_flags, 1);
+    buf = ipfix_put(buf, flow->bytes, 8);
+    buf = ipfix_put(buf, flow->packets, 8);
+    buf = ipfix_put(buf, (flow->first_ns + exp->boot_offset_ns) / 1000000, 8);
+    buf = ipfix_put(buf, (flow->last_ns + exp->boot_offset_ns) / 1000000, 8);
+    buf = ipfix_put(buf, record->reason, 1);
+    buf = ipfix_put(buf, flow->ifindex, 4);
+    memcpy(buf, key->src_mac, sizeof(key->src_mac));
+
+    exp->pending_len[v6] += len;
+    exp->pending_count[v6]++;
+    exp->exported++;
+}
+
+/*
+    handle_flow_export是ring buffer的回调函数，表满时内核单独导出的数据包从这里编码
+*/
+static int handle_flow_export(void *ctx, void *data, size_t size)
+{
+    if (size < sizeof(struct flow_export))
+    {
+        return 0;
+    }
+
+    ipfix_add(ctx, data);
+    return 0;
+}
+
+/*
+    sum_flow_counters把一条流在每个CPU上的计数合并为一份，没有这条流的数据包的CPU被跳过，返回是否有数据包
+*/
+static bool sum_flow_counters(const struct flow_counters *values, unsigned int num_cpus, struct flow_counters *total)
+{
+    memset(total, 0, sizeof(*total));
+    for (int i = 0; i < num_cpus; i++)
+    {
+        const struct flow_counters *flow = &values[i];
+        if (flow->packets == 0)
+        {
+            continue;
+        }
+
+        if (total->packets == 0 || flow->first_ns < total->first_ns)
+        {
+            total->first_ns = flow->first_ns;
+            total->ifindex = flow->ifindex;
+        }
+        if (flow->last_ns > total->last_ns)
+        {
+            total->last_ns = flow->last_ns;
+        }
+
+        total->packets += flow->packets;
+        total->bytes += flow->bytes;
+        total->tcp_flags |= flow->tcp_flags;
+        total->family = flow->family;
+    }
+
+    return total->packets != 0;
+}
+
+/*
+    sweep_flows在流量统计表中找出超过了空闲超时或者活动超时的流，把它们从表中取出并删除，合并所有CPU上的计数之后导出
+    'force'为真时不论是否超时都导出，用于退出时导出剩下的所有流
+    遍历的同时不能删除，所以先收集要导出的流，再用bpf_map_lookup_and_delete_elem一条一条地取出，
+    这样取出的是删除那一刻的计数，只有删除时正在被其他CPU更新的那几个数据包会被漏掉
+    活动超时的流被删除之后，下一个数据包会重新创建它，计数从那里重新开始
+*/
+static int sweep_flows(struct ipfix_exporter *exp, int table_fd, const struct flow_meta *meta, bool force)
+{
+    unsigned int num_cpus = bpf_num_possible_cpus();
+    struct flow_counters values[num_cpus];
+    struct rule_key_list ended = {.key_size = sizeof(struct flow_export)};
+    struct flow_key key;
+    struct flow_key prev_key;
+    bool has_prev = false;
+    __u64 now = clock_ns(CLOCK_MONOTONIC);
+    int ret = EXIT_OK;
+
+    while (bpf_map_get_next_key(table_fd, has_prev ? &prev_key : NULL, &key) == 0)
+    {
+        prev_key = key;
+        has_prev = true;
+
+        struct flow_export record = {.key = key};
+        if (bpf_map_lookup_elem(table_fd, &key, values) != 0 || !sum_flow_counters(values, num_cpus, &record.counters))
+        {
+            continue;
+        }
+
+        if (force)
+        {
+            record.reason = flow_end_forced;
+        }
+        else if (meta->idle_ns && record.counters.last_ns + meta->idle_ns <= now)
+        {
+            record.reason = flow_end_idle;
+        }
+        else if (meta->active_ns && record.counters.first_ns + meta->active_ns <= now)
+        {
+            record.reason = flow_end_active;
+        }
+        else
+        {
+            continue;
+        }
+
+        ret = rule_key_list_add(&ended, &record);
+        if (ret != EXIT_OK)
+        {
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < ended.count; i++)
+    {
+        struct flow_export *record = (struct flow_export *)(ended.keys + i * ended.key_size);
+        if (bpf_map_lookup_and_delete_elem(table_fd, &record->key, values) == 0 &&
+            sum_flow_counters(values, num_cpus, &record->counters))
+        {
+            ipfix_add(exp, record);
+        }
+    }
+
+    free(ended.keys);
+    return ret;
+}
+
+/*
+    open_ipfix_socket创建一个连接到收集器的UDP套接字，'target'形如'HOST:PORT'、'[IPv6]:PORT'或者只有主机，
+    没有端口时使用IPFIX_DEFAULT_PORT
+*/
+static int open_ipfix_socket(const char *target)
+{
+    char buf[256];
+    char *host = buf;
+    char *port = IPFIX_DEFAULT_PORT;
+
+    snprintf(buf, sizeof(buf), "%s", target);
+    if (buf[0] == '[')
+    {
+        char *end = strchr(buf, ']');
+        if (end == NULL || (end[1] != '\0' && end[1] != ':'))
+        {
+            printf("ERR: Invalid collector specified with '-V|--ipfix' must be in the form 'HOST:PORT' or '[IPv6]:PORT', "
+                   "got '%s'.\n", target);
+            return -1;
+        }
+
+        if (end[1] == ':')
+        {
+            port = end + 2;
+        }
+        *end = '\0';
+        host = buf + 1;
+    }
+    else
+    {
+        /*
+            只有一个冒号时才是'HOST:PORT'，否则是一个没有端口的IPv6地址
+        */
+        char *colon = strrchr(buf, ':');
+        if (colon != NULL && colon == strchr(buf, ':'))
+        {
+            *colon = '\0';
+            port = colon + 1;
+        }
+    }
+
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_DGRAM,
+    };
+    struct addrinfo *res = NULL;
+    int err = getaddrinfo(host, port, &hints, &res);
+    if (err != 0)
+    {
+        printf("ERR: Unable to resolve the collector '%s': %s\n", target, gai_strerror(err));
+        return -1;
+    }
+
+    int sock = -1;
+    for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next)
+    {
+        sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sock < 0)
+        {
+            continue;
+        }
+
+        if (connect(sock, ai->ai_addr, ai->ai_addrlen) == 0)
+        {
+            break;
+        }
+
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res);
+
+    if (sock < 0)
+    {
+        printf("ERR: Unable to connect to the collector '%s' err(%d): %s\n", target, errno, strerror(errno));
+    }
+    return sock;
+}
+
+/*
+    run_flow_export把流量统计表中结束的流编码为IPFIX，通过UDP发送给'target'指定的收集器，直到收到SIGINT或SIGTERM
+    表满时内核单独导出的数据包每隔FLOW_POLL_MS毫秒从'flow_ring'中批量读取；
+    超时的流每隔FLOW_SWEEP_MS毫秒从'flow_table'中取出，同时发送积攒的记录
+    退出时导出并删除表中剩下的所有流
+*/
+static int run_flow_export(int ring_fd, int table_fd, int meta_fd, int stats_fd, char *target)
+{
+    __u32 idx = 0;
+    struct flow_meta meta;
+    if (bpf_map_lookup_elem(meta_fd, &idx, &meta) != 0)
+    {
+        printf("ERR: Failed to read the flow timeouts err(%d): %s\n", errno, strerror(errno));
+        return EXIT_FAIL_XDP_MAP_LOOKUP;
+    }
+
+    __u64 initial[FLOW_RESULTS];
+    __u64 totals[FLOW_RESULTS];
+    int ret = read_flow_stats(stats_fd, initial);
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    struct ipfix_exporter exp = {
+        .sock = open_ipfix_socket(target),
+        .boot_offset_ns = clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_MONOTONIC),
+    };
+    if (exp.sock < 0)
+    {
+        return EXIT_FAIL_OPTIONS;
+    }
+
+    struct ring_buffer *ring = ring_buffer__new(ring_fd, handle_flow_export, &exp, NULL);
+    if (libbpf_get_error(ring) != 0)
+    {
+        printf("ERR: Unable to open the flow ring buffer.\n");
+        close(exp.sock);
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    signal(SIGINT, stop_flow_export);
+    signal(SIGTERM, stop_flow_export);
+    printf("Exporting flows as IPFIX to '%s', press Ctrl-C to stop.\n", target);
+
+    __u64 last_sweep = clock_ns(CLOCK_MONOTONIC);
+    while (!flow_export_stopping)
+    {
+        usleep(FLOW_POLL_MS * 1000);
+        ring_buffer__consume(ring);
+
+        __u64 now = clock_ns(CLOCK_MONOTONIC);
+        if (now - last_sweep < FLOW_SWEEP_MS * 1000000ULL)
+        {
+            continue;
+        }
+        last_sweep = now;
+
+        ret = sweep_flows(&exp, table_fd, &meta, false);
+        if (ret != EXIT_OK)
+        {
+            break;
+        }
+
+        ipfix_flush(&exp, 0);
+        ipfix_flush(&exp, 1);
+    }
+
+    ring_buffer__consume(ring);
+    if (ret == EXIT_OK)
+    {
+        ret = sweep_flows(&exp, table_fd, &meta, true);
+    }
+    ipfix_flush(&exp, 0);
+    ipfix_flush(&exp, 1);
+
+    ring_buffer__free(ring);
+    close(exp.sock);
+
+    if (read_flow_stats(stats_fd, totals) != EXIT_OK)
+    {
+        memcpy(totals, initial, sizeof(totals));
+    }
+    printf("\nExported %llu flow records in %llu IPFIX messages, %llu messages failed to send, "
+           "%llu records lost because the ring buffer was full.\n",
+           exp.exported, exp.messages, exp.send_errors, totals[flow_lost] - initial[flow_lost]);
+
+    return ret;
+}
+
+/*
+    export_flows打开导出流记录使用的BPF MAP，由run_flow_export完成真正的导出，不论结果如何最后都关闭它们
+*/
+static int export_flows(char *target)
+{
+    int ring_fd = open_bpf_map(FLOW_RING_PATH);
+    int table_fd = open_bpf_map(FLOW_TABLE_PATH);
+    int meta_fd = open_bpf_map(FLOW_META_PATH);
+    int stats_fd = open_bpf_map(FLOW_STATS_PATH);
+
+    int ret = EXIT_FAIL_XDP_MAP_OPEN;
+    if (ring_fd >= 0 && table_fd >= 0 && meta_fd >= 0 && stats_fd >= 0)
+    {
+        ret = run_flow_export(ring_fd, table_fd, meta_fd, stats_fd, target);
+    }
+
+    if (stats_fd >= 0)
+    {
+        close(stats_fd);
+    }
+    if (meta_fd >= 0)
+    {
+        close(meta_fd);
+    }
+    if (table_fd >= 0)
+    {
+        close(table_fd);
+    }
+    if (ring_fd >= 0)
+    {
+        close(ring_fd);
+    }
+    return ret;
+}
+
+/*
+    format_ct_endpoint把连接跟踪表中的一端格式化为'地址:端口'，IPv6地址放在方括号中
+*/
+static void format_ct_endpoint(const struct ct_key *key, const __u8 *addr, __u16 port, char *buf, size_t len)
+{
+    char str[INET6_ADDRSTRLEN];
+    inet_ntop(key->family == 4 ? AF_INET : AF_INET6, addr, str, sizeof(str));
+    snprintf(buf, len, key->family == 4 ? "%s:%u" : "[%s]:%u", str, ntohs(port));
+}
+
+/*
+    read_sketch读取'sketch'中的每一个计数，并把所有CPU上的值加起来放入'cells'中
+    每个CPU上的sketch都是同样大小、使用同样哈希的，所以逐个计数相加之后仍然是一个合法的count-min sketch
+*/
+static int read_sketch(int map_fd, struct counters *cells)
+{
+    unsigned int num_cpus = bpf_num_possible_cpus();
+    struct counters values[num_cpus];
+
+    for (__u32 i = 0; i < SKETCH_DEPTH * SKETCH_WIDTH; i++)
+    {
+        if (bpf_map_lookup_elem(map_fd, &i, values) != 0)
+        {
+            printf("ERR: Failed to lookup sketch counter '%u' err(%d): %s\n", i, errno, strerror(errno));
+            return EXIT_FAIL_XDP_MAP_LOOKUP;
+        }
+
+        memset(&cells[i], 0, sizeof(cells[i]));
+        for (int j = 0; j < num_cpus; j++)
+        {
+            cells[i].packets += values[j].packets;
+            cells[i].bytes += values[j].bytes;
+        }
+    }
+
+    return EXIT_OK;
+}
+
 /*
-    update_map处理从给定的BPF MAP中插入或删除一个给定的键。这是通过利用libbpf的'bpf_map_update_elem'和'bpf_map_delete_elem'
-    和上一节的处理是几乎相同的
+    top_source是'--top'中的一个源地址，以及它在时间窗口内的估计流量
+*/
+struct top_source
+{
+    struct sketch_key key;
+    struct counters counters;
+};
+
+static int compare_top_sources(const void *a, const void *b)
+{
+    const struct top_source *left = a;
+    const struct top_source *right = b;
+
+    if (left->counters.packets == right->counters.packets)
+    {
+        return 0;
+    }
+    return left->counters.packets < right->counters.packets ? 1 : -1;
+}
+
+/*
+    print_top_sources在'window'秒的时间窗口前后各读取一次sketch，两次之差就是这段时间内的流量
+    sketch本身无法列出其中的地址，所以只估计'sketch_candidates'中的地址，每个地址的包数和字节数分别在每一行中取最小值
+*/
+static int print_top_sources(__u32 top, __u32 window)
+{
+    int sketch_fd = open_bpf_map(SKETCH_PATH);
+    if (sketch_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    int candidates_fd = open_bpf_map(SKETCH_CANDIDATES_PATH);
+    if (candidates_fd < 0)
+    {
+        close(sketch_fd);
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    struct counters *before = calloc(SKETCH_DEPTH * SKETCH_WIDTH, sizeof(struct counters));
+    struct counters *after = calloc(SKETCH_DEPTH * SKETCH_WIDTH, sizeof(struct counters));
+    struct top_source *sources = calloc(SKETCH_CANDIDATES, sizeof(struct top_source));
+    int ret = EXIT_OK;
+    if (before == NULL || after == NULL || sources == NULL)
+    {
+        printf("ERR: Failed to allocate memory for the sketch.\n");
+        ret = EXIT_FAIL_GENERIC;
+        goto out;
+    }
+
+    ret = read_sketch(sketch_fd, before);
+    if (ret != EXIT_OK)
+    {
+        goto out;
+    }
+
+    sleep(window);
+
+    ret = read_sketch(sketch_fd, after);
+    if (ret != EXIT_OK)
+    {
+        goto out;
+    }
+
+    size_t count = 0;
+    struct sketch_key key;
+    void *prev = NULL;
+    while (count < SKETCH_CANDIDATES && bpf_map_get_next_key(candidates_fd, prev, &key) == 0)
+    {
+        prev = &key;
+
+        __u32 h1 = 0;
+        __u32 h2 = 0;
+        sketch_hashes(&key, &h1, &h2);
+
+        struct top_source *source = &sources[count++];
+        source->key = key;
+        source->counters.packets = (__u64)-1;
+        source->counters.bytes = (__u64)-1;
+        for (__u32 row = 0; row < SKETCH_DEPTH; row++)
+        {
+            __u32 idx = SKETCH_INDEX(row, h1, h2);
+            /*
+                窗口内sketch被'--sketch-reset'清空时，之后的计数就是窗口内的流量
+            */
+            bool reset = after[idx].packets < before[idx].packets;
+            __u64 packets = reset ? after[idx].packets : after[idx].packets - before[idx].packets;
+            __u64 bytes = reset ? after[idx].bytes : after[idx].bytes - before[idx].bytes;
+            source->counters.packets = packets < source->counters.packets ? packets : source->counters.packets;
+            source->counters.bytes = bytes < source->counters.bytes ? bytes : source->counters.bytes;
+        }
+    }
+
+    qsort(sources, count, sizeof(struct top_source), compare_top_sources);
+
+    printf("%-40s %14s %14s %14s\n", "Source", "Packets", "Packets/s", "Bits/s");
+    for (size_t i = 0; i < count && i < top; i++)
+    {
+        if (sources[i].counters.packets == 0)
+        {
+            break;
+        }
+
+        char addr[INET6_ADDRSTRLEN];
+        inet_ntop(sources[i].key.family == 4 ? AF_INET : AF_INET6, sources[i].key.addr, addr, sizeof(addr));
+        printf("%-40s %14llu %14llu %14llu\n", addr, sources[i].counters.packets,
+               sources[i].counters.packets / window, sources[i].counters.bytes * 8 / window);
+    }
+
+out:
+    free(sources);
+    free(after);
+    free(before);
+    close(candidates_fd);
+    close(sketch_fd);
+    return ret;
+}
+
+/*
+    dump_conntrack打印连接跟踪表中的每一条连接，发起连接的一端总是打印在前面
+    'idle'是距离最后一个数据包的时间，内核的时间戳和CLOCK_MONOTONIC使用同一个时钟
+*/
+static int dump_conntrack()
+{
+    int map_fd = open_bpf_map(CONNTRACK_PATH);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    __u64 now = clock_ns(CLOCK_MONOTONIC);
+    __u64 count = 0;
+    struct ct_key key;
+    void *prev = NULL;
+
+    printf("%-5s %-47s %-47s %-12s %8s %12s %14s\n", "Proto", "Initiator", "Responder", "State", "Idle", "Packets", "Bytes");
+    while (bpf_map_get_next_key(map_fd, prev, &key) == 0)
+    {
+        prev = &key;
+
+        struct ct_entry entry;
+        if (bpf_map_lookup_elem(map_fd, &key, &entry) != 0)
+        {
+            continue;
+        }
+
+        char a[64];
+        char b[64];
+        format_ct_endpoint(&key, key.addr_a, key.port_a, a, sizeof(a));
+        format_ct_endpoint(&key, key.addr_b, key.port_b, b, sizeof(b));
+
+        __u64 idle = now > entry.last_seen ? (now - entry.last_seen) / 1000000000ULL : 0;
+        printf("%-5s %-47s %-47s %-12s %7llus %12llu %14llu\n", key.proto == IPPROTO_TCP ? "tcp" : "udp",
+               entry.initiator == 0 ? a : b, entry.initiator == 0 ? b : a,
+               entry.state < CT_STATES ? ct_state_names[entry.state] : "?", idle, entry.packets, entry.bytes);
+        count++;
+    }
+
+    printf("%llu connections\n", count);
+    close(map_fd);
+    return EXIT_OK;
+}
+
+/*
+    flush_conntrack删除连接跟踪表中的所有连接，之后每条连接的下一个数据包都会重新经过完整的检查
+    删除当前的键之后再查找下一个键是不可靠的，所以这里每次都从头开始取第一个键
+*/
+static int flush_conntrack()
+{
+    int map_fd = open_bpf_map(CONNTRACK_PATH);
+    if (map_fd < 0)
+    {
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    __u64 count = 0;
+    struct ct_key key;
+    while (bpf_map_get_next_key(map_fd, NULL, &key) == 0)
+    {
+        if (bpf_map_delete_elem(map_fd, &key) != 0)
+        {
+            printf("ERR: Failed to delete a connection err(%d): %s\n", errno, strerror(errno));
+            close(map_fd);
+            return EXIT_FAIL_XDP_MAP_UPDATE;
+        }
+        count++;
+    }
+
+    printf("Flushed %llu connections.\n", count);
+    close(map_fd);
+    return EXIT_OK;
+}
+
+/*
+    handle_policy_action解析'-A|--action'指定的规则动作，形如'drop'、'redirect:eth1'或'ratelimit:3'
+*/
+static int handle_policy_action(char *str, struct rule_policy *policy)
+{
+    char *arg = strchr(str, ':');
+    if (arg != NULL)
+    {
+        *arg++ = '\0';
+    }
+
+    __u32 action = 0;
+    for (; action < POLICY_ACTIONS; action++)
+    {
+        if (strcmp(str, policy_action_names[action]) == 0)
+        {
+            break;
+        }
+    }
+
+    if (action == POLICY_ACTIONS || (arg != NULL && action != policy_redirect && action != policy_ratelimit) ||
+        (arg == NULL && action == policy_ratelimit))
+    {
+        printf("ERR: Invalid action specified with '-A|--action' must be one of 'drop', 'pass', 'tx', 'redirect', "
+               "'redirect:IFNAME' or 'ratelimit:CLASS', got '%s'.\n", str);
+        return EXIT_FAIL_OPTIONS;
+    }
+
+    policy->action = action;
+    policy->arg = 0;
+    if (action == policy_redirect && arg != NULL)
+    {
+        int if_index = get_ifindex(arg);
+        if (if_index < 0)
+        {
+            return EXIT_FAIL_OPTIONS;
+        }
+        policy->arg = if_index;
+    }
+    else if (action == policy_ratelimit)
+    {
+        policy->arg = strtoul(arg, NULL, 10);
+        if (policy->arg >= POLICY_MAX_CLASSES)
+        {
+            printf("ERR: Invalid rate limit class must be between 0 and %d, got '%s'.\n", POLICY_MAX_CLASSES - 1, arg);
+            return EXIT_FAIL_OPTIONS;
+        }
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    handle_ttl解析'-Y|--ttl'指定的规则存活时间，形如'300'、'300s'、'5m'、'1h'或'1d'，没有单位时为秒
 */
-static int update_map(const char *map, void *key, bool insert)
+static int handle_ttl(char *str, __u64 *ttl_ns)
 {
+    char *end = NULL;
+    unsigned long long value = strtoull(str, &end, 10);
+    __u64 unit = 0;
+
+    if (strcmp(end, "") == 0 || strcmp(end, "s") == 0)
+    {
+        unit = 1;
+    }
+    else if (strcmp(end, "m") == 0)
+    {
+        unit = 60;
+    }
+    else if (strcmp(end, "h") == 0)
+    {
+        unit = 3600;
+    }
+    else if (strcmp(end, "d") == 0)
+    {
+        unit = 86400;
+    }
+
+    if (end == str || unit == 0 || value == 0)
+    {
+        printf("ERR: Invalid time to live specified with '-Y|--ttl' must be in the form '300', '300s', '5m', '1h' or '1d', "
+               "got '%s'.\n", str);
+        return EXIT_FAIL_OPTIONS;
+    }
+
     /*
-        在我们可以更新/删除黑名单中的元素之前
-        我们需要抓取有关BPF MAP的文件描述符
+        过期时间是CLOCK_MONOTONIC的当前时间加上存活时间，两者相加不能超出__u64的范围，否则规则一插入就已经过期
     */
-    int map_fd = open_bpf_map(map);
+    __u64 now = clock_ns(CLOCK_MONOTONIC);
+    if (value > (~0ULL - now) / (unit * 1000000000ULL))
+    {
+        printf("ERR: Time to live specified with '-Y|--ttl' is too long, got '%s'.\n", str);
+        return EXIT_FAIL_OPTIONS;
+    }
+
+    *ttl_ns = value * unit * 1000000000ULL;
+    return EXIT_OK;
+}
+
+/*
+    handle_rate_class处理设置或清除一个限速类别的速率，形如'3=1000/2000'，清除之后这个类别不再限速
+    令牌桶在内核中第一次使用时上一次补充的时间为0，会被一次性补满，所以刚设置的类别可以立即通过'burst'个数据包
+    'burst'为0代表桶的容量为0，这个类别会丢弃所有的数据包，所以不允许显式地指定0
+*/
+static int handle_rate_class(char *str, bool insert)
+{
+    unsigned int class = 0;
+    struct ratelimit_rate rate = {0};
+
+    int matched = sscanf(str, "%u=%u/%u", &class, &rate.rate, &rate.burst);
+    if (class >= POLICY_MAX_CLASSES || (insert && (matched < 2 || rate.rate == 0)) || (!insert && matched < 1))
+    {
+        printf("ERR: Invalid rate limit class must be in the form 'CLASS=RATE[/BURST]' with a class between 0 and %d, got '%s'.\n",
+               POLICY_MAX_CLASSES - 1, str);
+        return EXIT_FAIL_OPTIONS;
+    }
+
+    if (insert && matched == 3 && rate.burst == 0)
+    {
+        printf("ERR: A rate limit class needs a non-zero 'rate' and 'burst', got '%s'.\n", str);
+        return EXIT_FAIL_OPTIONS;
+    }
+
+    if (!insert)
+    {
+        memset(&rate, 0, sizeof(rate));
+    }
+    else
+    {
+        if (matched < 3)
+        {
+            rate.burst = rate.rate;
+        }
+        set_fill_time(&rate);
+    }
+
+    int map_fd = open_bpf_map(POLICY_CLASSES_PATH);
     if (map_fd < 0)
     {
         return EXIT_FAIL_XDP_MAP_OPEN;
     }
 
-    if (insert)
+    printf("%s rate limit class %u.\n", insert ? "Setting" : "Clearing", class);
+
+    __u32 key = class;
+    if (bpf_map_update_elem(map_fd, &key, &rate, BPF_ANY) != 0)
+    {
+        printf("ERR: Failed to update rate limit class %u err(%d): %s\n", class, errno, strerror(errno));
+        close(map_fd);
+        return EXIT_FAIL_XDP_MAP_UPDATE;
+    }
+
+    close(map_fd);
+    return EXIT_OK;
+}
+
+/*
+    handle_conntrack_mode解析'-T|--conntrack'指定的连接跟踪模式
+*/
+static int handle_conntrack_mode(char *mode, struct xdpfw_config *config)
+{
+    for (__u32 i = 0; i < CT_MODES; i++)
+    {
+        if (strcmp(mode, ct_mode_names[i]) == 0)
+        {
+            config->conntrack = i;
+            return EXIT_OK;
+        }
+    }
+
+    printf("ERR: Invalid mode specified with '-T|--conntrack' must be one of 'off', 'on' or 'strict', got '%s'.\n", mode);
+    return EXIT_FAIL_OPTIONS;
+}
+
+/*
+    handle_ipv6_ext_policy解析'-g|--ipv6-ext-policy'指定的处理方式
+*/
+static int handle_ipv6_ext_policy(char *policy, struct xdpfw_config *config)
+{
+    for (__u32 i = 0; i < IPV6_EXT_POLICIES; i++)
+    {
+        if (strcmp(policy, ipv6_ext_policy_names[i]) == 0)
+        {
+            config->ipv6_ext_policy = i;
+            return EXIT_OK;
+        }
+    }
+
+    printf("ERR: Invalid policy specified with '-g|--ipv6-ext-policy' must be one of 'drop', 'pass' or 'count', got '%s'.\n",
+           policy);
+    return EXIT_FAIL_OPTIONS;
+}
+
+/*
+    handle_frag_orphan解析'-M|--frag-orphan'指定的孤立分片的处理方式
+*/
+static int handle_frag_orphan(char *policy, struct xdpfw_config *config)
+{
+    for (__u32 i = 0; i < ORPHAN_POLICIES; i++)
+    {
+        if (strcmp(policy, frag_orphan_policy_names[i]) == 0)
+        {
+            config->frag_orphan = i;
+            return EXIT_OK;
+        }
+    }
+
+    printf("ERR: Invalid policy specified with '-M|--frag-orphan' must be one of 'default', 'drop' or 'pass', got '%s'.\n",
+           policy);
+    return EXIT_FAIL_OPTIONS;
+}
+
+/*
+    handle_v4_engine解析'-E|--v4-engine'指定的IPv4查找引擎
+*/
+static int handle_v4_engine(char *engine, struct xdpfw_config *config)
+{
+    for (__u32 i = 0; i < V4_ENGINES; i++)
+    {
+        if (strcmp(engine, v4_engine_names[i]) == 0)
+        {
+            config->v4_engine = i;
+            return EXIT_OK;
+        }
+    }
+
+    printf("ERR: Invalid engine specified with '-E|--v4-engine' must be 'lpm' or 'dir24', got '%s'.\n", engine);
+    return EXIT_FAIL_OPTIONS;
+}
+
+/*
+    handle_steer_cpus解析'-o|--steer-cpus'指定的CPU列表，例如'0-3,6'
+*/
+static int handle_steer_cpus(char *cpus, struct xdpfw_config *config)
+{
+    unsigned int num_cpus = bpf_num_possible_cpus();
+    config->steer_cpu_count = 0;
+
+    for (char *range = strtok(cpus, ","); range != NULL; range = strtok(NULL, ","))
+    {
+        unsigned int first = 0;
+        unsigned int last = 0;
+
+        int matched = sscanf(range, "%u-%u", &first, &last);
+        if (matched == 1)
+        {
+            last = first;
+        }
+        if (matched < 1 || first > last || last >= num_cpus || last >= STEER_MAX_CPUS)
+        {
+            printf("ERR: Invalid CPU range specified with '-o|--steer-cpus', got '%s'.\n", range);
+            return EXIT_FAIL_OPTIONS;
+        }
+
+        for (__u32 cpu = first; cpu <= last; cpu++)
+        {
+            bool duplicate = false;
+            for (__u32 i = 0; i < config->steer_cpu_count; i++)
+            {
+                duplicate = duplicate || config->steer_cpus[i] == cpu;
+            }
+
+            if (!duplicate)
+            {
+                config->steer_cpus[config->steer_cpu_count++] = cpu;
+            }
+        }
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    handle_layers解析'--layers'的参数，例如'mac,l4'，并设置配置中启用的层
+*/
+static int handle_layers(char *layers, struct xdpfw_config *config)
+{
+    config->layers = 0;
+    config->ratelimit = 0;
+
+    for (char *layer = strtok(layers, ","); layer != NULL; layer = strtok(NULL, ","))
     {
         /*
-            就像上一节一样，我们传入map的文件描述符，然后传入key
-            在本例中是解析后提供的key和0，
-            在这里我们不关心值，只关心它是否存在于map中
+            限速不是流水线中的一层，它在查询流表缓存之前进行，所以单独处理
         */
-        __u8 value = 0;
-        if (bpf_map_update_elem(map_fd, key, &value, BPF_NOEXIST) != 0)
+        if (strcmp(layer, "ratelimit") == 0)
         {
-            return EXIT_FAIL_XDP_MAP_UPDATE;
+            config->ratelimit = 1;
+            continue;
+        }
+
+        int stage = 0;
+        for (; stage < XDPFW_STAGES; stage++)
+        {
+            if (strcmp(layer, stage_names[stage]) == 0)
+            {
+                config->layers |= STAGE_BIT(stage);
+                break;
+            }
         }
-    }
-    else
-    {
-        /*
-            使用libbpf提供的bpf_map_delete_elem进行删除
-        */
-        if (bpf_map_delete_elem(map_fd, key) != 0)
+
+        if (stage == XDPFW_STAGES)
         {
-            return EXIT_FAIL_XDP_MAP_UPDATE;
+            printf("ERR: Invalid layer specified with '-l|--layers' must be one of 'mac', 'l3', 'l4', 'acl', 'syncookie' or 'ratelimit', got '%s'.\n",
+                   layer);
+            return EXIT_FAIL_OPTIONS;
         }
     }
 
@@ -51,109 +5201,98 @@ static int update_map(const char *map, void *key, bool insert)
 }
 
 /*
-    handle_mac处理从mac_blacklist中添加或删除一个给定的MAC地址
+    handle_tunnels解析'-G|--tunnels'的参数，例如'vxlan,gre'、'all'或'none'
 */
-static int handle_mac(char *mac_addr, bool insert)
+static int handle_tunnels(char *tunnels, struct xdpfw_config *config)
 {
-    /*
-        首先，由于我们传入的是一个MAC地址的字符串表示，形式为'00:00:00:00:00'，我们需要将其转换为适当的形式
-    */
-    unsigned char mac[6];
-    if (6 != sscanf(mac_addr, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]))
+    config->tunnels = 0;
+
+    for (char *tunnel = strtok(tunnels, ","); tunnel != NULL; tunnel = strtok(NULL, ","))
     {
-        printf("ERR: Invalid MAC address specifed must be in the form '00:00:00:00:00:00', got '%s",
-               mac_addr);
-        return EXIT_FAIL_OPTIONS;
-    }
+        if (strcmp(tunnel, "all") == 0)
+        {
+            config->tunnels = TUNNEL_BIT(tunnel_vxlan) | TUNNEL_BIT(tunnel_gre) | TUNNEL_BIT(tunnel_ipip) |
+                              TUNNEL_BIT(tunnel_mpls);
+            continue;
+        }
 
-    /*
-        打印日志
-    */
-    printf("%s source MAC address '%s'.\n", insert ? "Blacklisting" : "Whitelisting", mac_addr);
+        int type = 0;
+        for (; type < TUNNEL_TYPES; type++)
+        {
+            if (strcmp(tunnel, tunnel_type_names[type]) == 0)
+            {
+                break;
+            }
+        }
 
-    /*
-        然后我们调用update_map，处理打开指定的MAP并插入或删除给定的键
-    */
-    int ret = update_map(MAC_BLACKLIST_PATH, &mac, insert);
-    if (ret != 0)
-    {
-        printf("ERR: Failed to %s specified MAC address '%s' err(%d): %s\n",
-               insert ? "blacklist" : "whitelist", mac_addr, errno, strerror(errno));
+        if (type == TUNNEL_TYPES)
+        {
+            printf("ERR: Invalid tunnel specified with '-G|--tunnels' must be one of 'vxlan', 'gre', 'ipip', 'mpls', "
+                   "'all' or 'none', got '%s'.\n", tunnel);
+            return EXIT_FAIL_OPTIONS;
+        }
+        if (type != tunnel_none)
+        {
+            config->tunnels |= TUNNEL_BIT(type);
+        }
     }
-    return ret;
+
+    return EXIT_OK;
 }
 
 /*
-    handle_prefix'处理从各自的'v4_blacklist'或'v6_blacklist'中添加或删除一个给定的IP地址
-    无论是IPv4还是IPv6，它的方式与上面的'handle_mac'函数相同。
+    handle_flow_timeouts解析'-U|--flow-timeouts'指定的活动超时和空闲超时，形如'60,15'，单位为秒，为0代表没有这个超时
 */
-static int handle_prefix(char *prefix, bool insert, bool v4)
+static int handle_flow_timeouts(char *str, struct flow_meta *timeouts)
 {
-    /*
-        根据v4还是v6来创建key
-    */
-    struct bpf_lpm_trie_key *key = alloca(v4 ? sizeof(struct lpm_v4_key) : sizeof(struct lpm_v6_key));
-
-    /*
-        由于我们传入的是IP地址前缀的字符串表示，形式为'0.0.0.0/0'或':/0'，我们需要将其转换为适当的形式
-    */
-    int addr_len = v4 ? INET_ADDRSTRLEN : INET6_ADDRSTRLEN;
-    char *addr = alloca(addr_len);
-    if (2 != sscanf(prefix, "%[^/]%*c%d", addr, &key->prefixlen))
+    char *end = NULL;
+    unsigned long active = strtoul(str, &end, 10);
+    if (end == str || *end != ',')
     {
-        printf("ERR: Invalid IP address prefix specifed must be in the form '1.1.1.1/32' or '::1/128', got '%s'.\n",
-               prefix);
+        printf("ERR: Invalid timeouts specified with '-U|--flow-timeouts' must be in the form 'ACTIVE,IDLE', got '%s'.\n", str);
         return EXIT_FAIL_OPTIONS;
     }
 
-    /*
-        inet_pton:将IP地址从字符串格式转换成网络地址格式
-    */
-    if (inet_pton(v4 ? AF_INET : AF_INET6, addr, key->data) != 1)
+    char *idle_str = end + 1;
+    unsigned long idle = strtoul(idle_str, &end, 10);
+    if (end == idle_str || *end != '\0')
     {
-        printf("ERR: Invalid IP address specified as part of the supplied prefix '%s'\n",
-               prefix);
+        printf("ERR: Invalid timeouts specified with '-U|--flow-timeouts' must be in the form 'ACTIVE,IDLE', got '%s'.\n", str);
         return EXIT_FAIL_OPTIONS;
     }
 
-    /*
-        打印日志
-    */
-    printf("%s source IP%s prefix '%s'.\n", insert ? "Blacklisting" : "Whitelisting", v4 ? "v4" : "v6", prefix);
-
-    /*
-        同处理handle_mac
-    */
-    int ret = update_map(v4 ? V4_BLACKLIST_PATH : V6_BLACKLIST_PATH, key, insert);
-    if (ret != 0)
-    {
-        printf("ERR: Failed to %s specified IP address prefix '%s' err(%d): %s\n",
-               insert ? "blacklist" : "whitelist", prefix, errno, strerror(errno));
-    }
-    return ret;
+    timeouts->active_ns = active * 1000000000ULL;
+    timeouts->idle_ns = idle * 1000000000ULL;
+    return EXIT_OK;
 }
 
 /*
-    handle_port'处理从'port_blacklist'BPF MAP中添加或删除一个指定的端口/协议/类型
-    它的方式与上面的'handle_mac'和'handle_prefix'函数相同。
+    handle_ip_versions解析'--ip-versions'的参数，例如'4'或'4,6'
 */
-static int handle_port(char *port, bool insert, bool udp, bool src)
+static int handle_ip_versions(char *versions, struct xdpfw_config *config)
 {
-    struct port_key *key = alloca(sizeof(struct port_key));
+    config->ipv4 = 0;
+    config->ipv6 = 0;
 
-    key->type = src ? source_port : destination_port;
-    key->proto = udp ? udp_port : tcp_port;
-    key->port = atoi(port);
-
-    printf("%s %s port '%s/%s'.\n", insert ? "Blacklisting" : "Whitelisting", src ? "source" : "dest", port, udp ? "udp" : "tcp");
-
-    int ret = update_map(PORT_BLACKLIST_PATH, key, insert);
-    if (ret != 0)
+    for (char *version = strtok(versions, ","); version != NULL; version = strtok(NULL, ","))
     {
-        printf("ERR: Failed to %s specified %s port '%s/%s' err(%d): %s\n",
-               insert ? "blacklist" : "whitelist", src ? "source" : "dest", port, udp ? "udp" : "tcp", errno, strerror(errno));
+        if (strcmp(version, "4") == 0)
+        {
+            config->ipv4 = 1;
+        }
+        else if (strcmp(version, "6") == 0)
+        {
+            config->ipv6 = 1;
+        }
+        else
+        {
+            printf("ERR: Invalid IP version specified with '-f|--ip-versions' must be '4' or '6', got '%s'.\n",
+                   version);
+            return EXIT_FAIL_OPTIONS;
+        }
     }
-    return ret;
+
+    return EXIT_OK;
 }
 
 int main(int argc, char **argv)
@@ -180,13 +5319,71 @@ int main(int argc, char **argv)
     char *dest_port = NULL;
     char *src_port = NULL;
 
+    char *acl_rule = NULL;
+    char *ratelimit_rule = NULL;
+    char *syncookie_port = NULL;
+    char *rate_class = NULL;
+
+    __u32 top = 0;
+    __u32 top_window = TOP_DEFAULT_WINDOW;
+
+    __u64 ttl_ns = 0;
+    bool should_sweep = false;
+    __u32 sweep_interval = 0;
+
+    bool should_rotate_hll = false;
+    __u32 hll_interval = 0;
+
+    /*
+        新插入的黑名单规则的动作和优先级，默认和原来一样是丢弃
+    */
+    struct rule_policy policy = {
+        .action = policy_drop,
+        .priority = POLICY_DEFAULT_PRIORITY,
+    };
+
+    __u32 steer_qsize = STEER_DEFAULT_QSIZE;
+
+    char *capture_path = NULL;
+    __u32 capture_rate = 1;
+    __u32 capture_snaplen = CAPTURE_DEFAULT_SNAPLEN;
+    double capture_budget = CAPTURE_DEFAULT_BUDGET;
+
+    char *ipfix_target = NULL;
+    struct flow_meta flow_timeouts = {
+        .active_ns = FLOW_DEFAULT_ACTIVE_TIMEOUT * 1000000000ULL,
+        .idle_ns = FLOW_DEFAULT_IDLE_TIMEOUT * 1000000000ULL,
+    };
+
+    /*
+        加载时配置的默认值，和xdpfw_kern_utils.h中的默认值相同
+    */
+    struct xdpfw_config config = {
+        .default_action = XDP_PASS,
+        .layers = XDPFW_ALL_LAYERS,
+        .vlan_depth = VLAN_MAX_DEPTH,
+        .ipv4 = 1,
+        .ipv6 = 1,
+        .ratelimit = 1,
+        .ipv6_ext_depth = IPV6_EXT_MAX_DEPTH,
+        .ipv6_ext_policy = ipv6_ext_count,
+        .frag_limit = FRAG_DEFAULT_LIMIT,
+        .frag_orphan = orphan_default,
+        .mac_bloom = 1,
+        .v4_engine = v4_engine_lpm,
+        .conntrack = ct_off,
+        .sketch = 1,
+        .tunnels = 0,
+        .flows = 0,
+    };
+
     int rlimit_ret = set_rlimit();
     if (rlimit_ret != EXIT_OK)
     {
         return rlimit_ret;
     }
 
-    while ((opt = getopt_long(argc, argv, "hx::n::a:d:sirm:4:6:t:c:p:", long_options, &longindex)) != -1)
+    while ((opt = getopt_long(argc, argv, "hx::n::a:d:suirm:4:6:t:c:p:e:l:v:f:k:b:y:w:g:z:o:q:C:K:N:B:F:E:T:DXA:P:R:LS:O:W:Y:Z:G:J:U:V:QM:H:", long_options, &longindex)) != -1)
     {
         char *tmp_value = optarg;
         switch (opt)
@@ -236,7 +5433,47 @@ int main(int argc, char **argv)
             }
             break;
         case 's':
-            return print_action_stats();
+            return print_stats();
+        case 'u':
+            return print_rule_stats();
+        case 'D':
+            return dump_conntrack();
+        case 'X':
+            return flush_conntrack();
+        case 'L':
+            return print_latency_stats();
+        case 'Q':
+            return reset_sketch();
+        case 'O':
+            top = strtoul(optarg, NULL, 10);
+            if (top == 0)
+            {
+                printf("ERR: Invalid number of sources specified with '-O|--top', got '%s'.\n", optarg);
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'W':
+            top_window = strtoul(optarg, NULL, 10);
+            if (top_window == 0)
+            {
+                printf("ERR: Invalid window specified with '-W|--top-window', got '%s'.\n", optarg);
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'Y':
+            if (handle_ttl(optarg, &ttl_ns) != EXIT_OK)
+            {
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'Z':
+            should_sweep = true;
+            sweep_interval = strtoul(optarg, NULL, 10);
+            break;
+        case 'H':
+            should_rotate_hll = true;
+            hll_interval = strtoul(optarg, NULL, 10);
+            break;
         case 'i':
             insert = true;
             break;
@@ -278,6 +5515,186 @@ int main(int argc, char **argv)
                    "'udp' or 'tcp', got '%s'.",
                    optarg);
             return EXIT_FAIL_OPTIONS;
+        case 'e':
+            config.default_action = str2action(optarg);
+            if ((int)config.default_action < 0)
+            {
+                printf("ERR: Invalid action specified with '-e|--default-action', got '%s'.\n", optarg);
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'l':
+            if (handle_layers(optarg, &config) != EXIT_OK)
+            {
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'v':
+            config.vlan_depth = atoi(optarg);
+            if (config.vlan_depth > VLAN_MAX_DEPTH)
+            {
+                printf("ERR: Invalid vlan depth specified with '-v|--vlan-depth' must be between 0 and %d, got '%s'.\n",
+                       VLAN_MAX_DEPTH, optarg);
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'f':
+            if (handle_ip_versions(optarg, &config) != EXIT_OK)
+            {
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'G':
+            if (handle_tunnels(optarg, &config) != EXIT_OK)
+            {
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'J':
+            if (strcmp(optarg, "on") == 0 || strcmp(optarg, "off") == 0)
+            {
+                config.flows = strcmp(optarg, "on") == 0;
+            }
+            else
+            {
+                printf("ERR: Invalid value specified with '-J|--flows' must be 'on' or 'off', got '%s'.\n", optarg);
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'U':
+            if (handle_flow_timeouts(optarg, &flow_timeouts) != EXIT_OK)
+            {
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'V':
+            ipfix_target = optarg;
+            break;
+        case 'k':
+            acl_rule = optarg;
+            break;
+        case 'b':
+            ratelimit_rule = optarg;
+            break;
+        case 'y':
+            syncookie_port = optarg;
+            break;
+        case 'w':
+            config.ipv6_ext_depth = atoi(optarg);
+            if (config.ipv6_ext_depth > IPV6_EXT_MAX_DEPTH)
+            {
+                printf("ERR: Invalid depth specified with '-w|--ipv6-ext-depth' must be between 0 and %d, got '%s'.\n",
+                       IPV6_EXT_MAX_DEPTH, optarg);
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'g':
+            if (handle_ipv6_ext_policy(optarg, &config) != EXIT_OK)
+            {
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'z':
+            config.frag_limit = strtoul(optarg, NULL, 10);
+            break;
+        case 'M':
+            if (handle_frag_orphan(optarg, &config) != EXIT_OK)
+            {
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'o':
+            if (handle_steer_cpus(optarg, &config) != EXIT_OK)
+            {
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'q':
+            steer_qsize = strtoul(optarg, NULL, 10);
+            if (steer_qsize == 0)
+            {
+                printf("ERR: Invalid queue size specified with '-q|--steer-queue-size', got '%s'.\n", optarg);
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'F':
+            if (strcmp(optarg, "on") == 0 || strcmp(optarg, "off") == 0)
+            {
+                config.mac_bloom = strcmp(optarg, "on") == 0;
+            }
+            else
+            {
+                printf("ERR: Invalid value specified with '-F|--mac-bloom' must be 'on' or 'off', got '%s'.\n", optarg);
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'S':
+            if (strcmp(optarg, "on") == 0 || strcmp(optarg, "off") == 0)
+            {
+                config.sketch = strcmp(optarg, "on") == 0;
+            }
+            else
+            {
+                printf("ERR: Invalid value specified with '-S|--sketch' must be 'on' or 'off', got '%s'.\n", optarg);
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'E':
+            if (handle_v4_engine(optarg, &config) != EXIT_OK)
+            {
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'T':
+            if (handle_conntrack_mode(optarg, &config) != EXIT_OK)
+            {
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'A':
+            if (handle_policy_action(optarg, &policy) != EXIT_OK)
+            {
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'P':
+            policy.priority = strtoul(optarg, NULL, 10);
+            if (policy.priority == POLICY_NONE)
+            {
+                printf("ERR: Invalid priority specified with '-P|--priority', got '%s'.\n", optarg);
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'R':
+            rate_class = optarg;
+            break;
+        case 'C':
+            capture_path = optarg;
+            break;
+        case 'K':
+            capture_rate = strtoul(optarg, NULL, 10);
+            if (capture_rate == 0 || capture_rate > CAPTURE_MAX_RATE)
+            {
+                printf("ERR: Invalid sampling rate specified with '-K|--capture-rate', got '%s'.\n", optarg);
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'N':
+            capture_snaplen = strtoul(optarg, NULL, 10);
+            if (capture_snaplen == 0 || capture_snaplen > CAPTURE_MAX_SNAPLEN)
+            {
+                printf("ERR: Invalid snap length specified with '-N|--capture-snaplen', got '%s'.\n", optarg);
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'B':
+            capture_budget = strtod(optarg, NULL);
+            if (capture_budget <= 0 || capture_budget > 100)
+            {
+                printf("ERR: Invalid budget specified with '-B|--capture-budget', got '%s'.\n", optarg);
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
         case 'h':
         default:
             usage(argv, doc, long_options, long_options_descriptions);
@@ -292,7 +5709,41 @@ int main(int argc, char **argv)
 
     if (should_attach)
     {
-        return attach(if_index, prog_path == NULL ? default_prog_path : prog_path, section == NULL ? default_section : section);
+        return attach_firewall(if_index, prog_path == NULL ? default_prog_path : prog_path, section == NULL ? default_section : section,
+                               &config, steer_qsize, &flow_timeouts);
+    }
+
+    if (top != 0)
+    {
+        return print_top_sources(top, top_window);
+    }
+
+    if (should_sweep)
+    {
+        return sweep_expired(sweep_interval);
+    }
+
+    if (should_rotate_hll)
+    {
+        return rotate_hll_loop(hll_interval);
+    }
+
+    /*
+        过期时间和内核的bpf_ktime_get_ns一样使用CLOCK_MONOTONIC，在所有参数解析完之后再计算
+    */
+    if (ttl_ns != 0)
+    {
+        policy.expires = clock_ns(CLOCK_MONOTONIC) + ttl_ns;
+    }
+
+    if (capture_path != NULL)
+    {
+        return capture_drops(capture_path, capture_rate, capture_snaplen, capture_budget);
+    }
+
+    if (ipfix_target != NULL)
+    {
+        return export_flows(ipfix_target);
     }
 
     /*
@@ -300,25 +5751,45 @@ int main(int argc, char **argv)
     */
     if (mac_addr != NULL)
     {
-        return handle_mac(mac_addr, insert);
+        return handle_mac(mac_addr, &policy, insert);
     }
 
     if (prefix_v4 != NULL)
     {
-        return handle_prefix(prefix_v4, insert, true);
+        return handle_prefix(prefix_v4, &policy, insert, true);
     }
     if (prefix_v6 != NULL)
     {
-        return handle_prefix(prefix_v6, insert, false);
+        return handle_prefix(prefix_v6, &policy, insert, false);
     }
 
     if (dest_port != NULL)
     {
-        return handle_port(dest_port, insert, is_udp, false);
+        return handle_port(dest_port, &policy, insert, is_udp, false);
     }
     if (src_port != NULL)
     {
-        return handle_port(src_port, insert, is_udp, true);
+        return handle_port(src_port, &policy, insert, is_udp, true);
+    }
+
+    if (acl_rule != NULL)
+    {
+        return handle_acl(acl_rule, insert);
+    }
+
+    if (ratelimit_rule != NULL)
+    {
+        return handle_ratelimit(ratelimit_rule, insert);
+    }
+
+    if (syncookie_port != NULL)
+    {
+        return handle_syncookie_port(syncookie_port, insert);
+    }
+
+    if (rate_class != NULL)
+    {
+        return handle_rate_class(rate_class, insert);
     }
 
     return EXIT_OK;
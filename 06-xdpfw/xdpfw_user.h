@@ -13,9 +13,16 @@
 #include <bpf/bpf.h>
 #include <bpf/libbpf.h>
 #include <errno.h>
+#include <linux/if_ether.h>
+#include <math.h>
+#include <netdb.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "kernel/bpf_util.h"
@@ -34,9 +41,329 @@
 */
 
 #define MAC_BLACKLIST_PATH "/sys/fs/bpf/mac_blacklist"
+#define MAC_BLOOM_PATH "/sys/fs/bpf/mac_bloom"
+#define MAC_BLOOM_STATS_PATH "/sys/fs/bpf/mac_bloom_stats"
 #define V4_BLACKLIST_PATH "/sys/fs/bpf/v4_blacklist"
 #define V6_BLACKLIST_PATH "/sys/fs/bpf/v6_blacklist"
+#define V6_BLACKLIST_64_PATH "/sys/fs/bpf/v6_blacklist_64"
+#define V6_BLACKLIST_48_PATH "/sys/fs/bpf/v6_blacklist_48"
+#define V4_DIR24_PATH "/sys/fs/bpf/v4_dir24"
+#define V4_DIR8_PATH "/sys/fs/bpf/v4_dir8"
+#define V4_DIR_RULES_PATH "/sys/fs/bpf/v4_dir_rules"
+#define V4_DIR_IDS_PATH "/sys/fs/bpf/v4_dir_ids"
+#define V4_DIR_META_PATH "/sys/fs/bpf/v4_dir_meta"
 #define PORT_BLACKLIST_PATH "/sys/fs/bpf/port_blacklist"
+#define PORT_RULE_COUNTERS_PATH "/sys/fs/bpf/port_rule_counters"
+#define PORT_POLICY_PATH "/sys/fs/bpf/port_policy"
+
+#define POLICY_STATE_PATH "/sys/fs/bpf/policy_state"
+#define POLICY_CLASSES_PATH "/sys/fs/bpf/policy_classes"
+
+#define FLOW_GENERATION_PATH "/sys/fs/bpf/flow_generation"
+#define FLOW_CACHE_STATS_PATH "/sys/fs/bpf/flow_cache_stats"
+
+#define ACL_TUPLES_PATH "/sys/fs/bpf/acl_tuples"
+#define ACL_RULES_PATH "/sys/fs/bpf/acl_rules"
+
+/*
+    没有指定优先级时，ACL规则使用的默认优先级
+*/
+#define ACL_DEFAULT_PRIORITY 100
+
+#define RATELIMIT_V4_PATH "/sys/fs/bpf/ratelimit_v4"
+#define RATELIMIT_V6_PATH "/sys/fs/bpf/ratelimit_v6"
+#define RATELIMIT_COUNTERS_PATH "/sys/fs/bpf/ratelimit_counters"
+
+#define SYNCOOKIE_PORTS_PATH "/sys/fs/bpf/syncookie_ports"
+#define SYNCOOKIE_STATS_PATH "/sys/fs/bpf/syncookie_stats"
+
+#define IPV6_EXT_STATS_PATH "/sys/fs/bpf/ipv6_ext_stats"
+
+#define FRAG_STATS_PATH "/sys/fs/bpf/frag_stats"
+
+#define CONNTRACK_PATH "/sys/fs/bpf/conntrack"
+#define CONNTRACK_STATS_PATH "/sys/fs/bpf/conntrack_stats"
+
+#define DROP_STATS_PATH "/sys/fs/bpf/drop_stats"
+
+#define TUNNEL_STATS_PATH "/sys/fs/bpf/tunnel_stats"
+
+#define SKETCH_PATH "/sys/fs/bpf/sketch"
+#define SKETCH_CANDIDATES_PATH "/sys/fs/bpf/sketch_candidates"
+#define HLL_PATH "/sys/fs/bpf/hll"
+#define HLL_META_PATH "/sys/fs/bpf/hll_meta"
+
+/*
+    '--top'默认统计的时间窗口，单位为秒
+*/
+#define TOP_DEFAULT_WINDOW 5
+
+/*
+    只有使用'make PROFILE=1'编译的xdpfw_kern.o才会创建这个MAP
+*/
+#define PROF_HIST_PATH "/sys/fs/bpf/prof_hist"
+
+#define STEER_STATS_PATH "/sys/fs/bpf/steer_stats"
+
+/*
+    挂载在cpu_map每个条目上的统计程序所在的section
+*/
+#define STEER_SECTION "xdp_cpumap/steer"
+
+#define CAPTURE_RING_PATH "/sys/fs/bpf/capture_ring"
+#define CAPTURE_CONTROL_PATH "/sys/fs/bpf/capture_control"
+#define CAPTURE_STATS_PATH "/sys/fs/bpf/capture_stats"
+
+/*
+    抓包时每隔CAPTURE_POLL_MS毫秒批量读取一次ring buffer，每隔CAPTURE_ADJUST_MS毫秒根据开销调整一次抽样率
+    CAPTURE_DEFAULT_BUDGET是抓包默认最多能占用的每个CPU的时间的百分比
+*/
+#define CAPTURE_POLL_MS 100
+#define CAPTURE_ADJUST_MS 1000
+#define CAPTURE_DEFAULT_BUDGET 1.0
+#define CAPTURE_MAX_RATE (1U << 20)
+
+#define FLOW_TABLE_PATH "/sys/fs/bpf/flow_table"
+#define FLOW_RING_PATH "/sys/fs/bpf/flow_ring"
+#define FLOW_META_PATH "/sys/fs/bpf/flow_meta"
+#define FLOW_STATS_PATH "/sys/fs/bpf/flow_stats"
+
+/*
+    导出流记录时每隔FLOW_POLL_MS毫秒批量读取一次ring buffer，每隔FLOW_SWEEP_MS毫秒在流量统计表中找出超时的流并发送积攒的记录
+*/
+#define FLOW_POLL_MS 100
+#define FLOW_SWEEP_MS 1000
+
+/*
+    IPFIX(RFC 7011)的版本号、模板集合的编号、本程序使用的两个模板的编号和观察域编号，数据集合的编号就是模板的编号
+    一个IPFIX消息最多IPFIX_MAX_MESSAGE字节，这样在常见的MTU下UDP数据报不会被分片
+    UDP上的收集器可能重启或者丢失模板，所以每隔IPFIX_TEMPLATE_INTERVAL秒重发一次模板
+*/
+#define IPFIX_VERSION 10
+#define IPFIX_SET_TEMPLATE 2
+#define IPFIX_TEMPLATE_V4 256
+#define IPFIX_TEMPLATE_V6 257
+#define IPFIX_DOMAIN_ID 1
+#define IPFIX_HEADER_LEN 16
+#define IPFIX_SET_HEADER_LEN 4
+#define IPFIX_MAX_MESSAGE 1400
+#define IPFIX_TEMPLATE_INTERVAL 30
+#define IPFIX_DEFAULT_PORT "4739"
+
+#define XDPFW_STAGES_PATH "/sys/fs/bpf/xdpfw_stages"
+#define XDPFW_STAGE_PROGS_PATH "/sys/fs/bpf/xdpfw_stage_progs"
+
+/*
+    流水线中每一层检查的名字和它在xdpfw_kern.o中对应的section，下标为common.h中的'xdpfw_stage'
+*/
+static const char *stage_names[XDPFW_STAGES] = {
+    [stage_mac] = "mac",
+    [stage_l3] = "l3",
+    [stage_l4] = "l4",
+    [stage_acl] = "acl",
+    [stage_syncookie] = "syncookie",
+};
+
+static const char *stage_sections[XDPFW_STAGES] = {
+    [stage_mac] = "xdpfw/mac",
+    [stage_l3] = "xdpfw/l3",
+    [stage_l4] = "xdpfw/l4",
+    [stage_acl] = "xdpfw/acl",
+    [stage_syncookie] = "xdpfw/syncookie",
+};
+
+/*
+    限速规则中每种协议的名字，下标为common.h中的'ratelimit_proto'
+*/
+static const char *ratelimit_proto_names[RATELIMIT_PROTOS] = {
+    [ratelimit_any] = "any",
+    [ratelimit_tcp] = "tcp",
+    [ratelimit_udp] = "udp",
+    [ratelimit_icmp] = "icmp",
+};
+
+/*
+    IPv6扩展头的处理方式的名字，下标为common.h中的'ipv6_ext_policy'
+*/
+static const char *ipv6_ext_policy_names[IPV6_EXT_POLICIES] = {
+    [ipv6_ext_drop] = "drop",
+    [ipv6_ext_pass] = "pass",
+    [ipv6_ext_count] = "count",
+};
+
+/*
+    后续分片找不到第一个分片时的处理方式的名字，下标为common.h中的'frag_orphan_policy'
+*/
+static const char *frag_orphan_policy_names[ORPHAN_POLICIES] = {
+    [orphan_default] = "default",
+    [orphan_drop] = "drop",
+    [orphan_pass] = "pass",
+};
+
+/*
+    IPv4查找引擎的名字，下标为common.h中的'v4_engine'
+*/
+static const char *v4_engine_names[V4_ENGINES] = {
+    [v4_engine_lpm] = "lpm",
+    [v4_engine_dir24] = "dir24",
+};
+
+/*
+    入口程序中计时点的名字，下标为common.h中的'prof_point'，流水线中每一层的名字见上面的'stage_names'
+*/
+static const char *prof_point_names[PROF_POINTS] = {
+    [prof_parse_l2] = "parse-l2",
+    [prof_parse_l3] = "parse-l3",
+    [prof_parse_l4] = "parse-l4",
+    [prof_prefilter] = "prefilter",
+    [prof_total] = "total",
+};
+
+/*
+    每一类规则的名字，下标为common.h中的'rule_source'
+*/
+static const char *rule_source_names[RULE_SOURCES] = {
+    [rule_none] = "none",
+    [rule_default] = "default",
+    [rule_mac] = "mac",
+    [rule_v4] = "ipv4",
+    [rule_v6] = "ipv6",
+    [rule_port] = "port",
+    [rule_acl] = "acl",
+    [rule_ratelimit] = "ratelimit",
+    [rule_syncookie] = "syncookie",
+    [rule_frag] = "frag",
+    [rule_conntrack] = "conntrack",
+    [rule_malformed] = "malformed",
+};
+
+/*
+    格式错误的数据包被丢弃的原因的名字，下标为common.h中的'malformed_reason'
+*/
+static const char *malformed_reason_names[MALFORMED_REASONS] = {
+    [malformed_eth] = "eth",
+    [malformed_vlan] = "vlan",
+    [malformed_ipv4] = "ipv4",
+    [malformed_ipv6] = "ipv6",
+    [malformed_ipv6_ext] = "ipv6-ext",
+    [malformed_udp] = "udp",
+    [malformed_tcp] = "tcp",
+    [malformed_mpls] = "mpls",
+};
+
+/*
+    每种封装的名字，下标为common.h中的'tunnel_type'，也是'-G|--tunnels'接受的值
+*/
+static const char *tunnel_type_names[TUNNEL_TYPES] = {
+    [tunnel_none] = "none",
+    [tunnel_vxlan] = "vxlan",
+    [tunnel_gre] = "gre",
+    [tunnel_ipip] = "ipip",
+    [tunnel_mpls] = "mpls",
+};
+
+/*
+    IPFIX模板中的一个字段，'id'是IANA分配的信息元素编号，'length'是它在数据记录中的字节数
+    两个模板中字段的顺序就是ipfix_add编码数据记录的顺序，只有地址的长度不同，依次为：
+    sourceIPv4Address/sourceIPv6Address、destinationIPv4Address/destinationIPv6Address、sourceTransportPort、
+    destinationTransportPort、protocolIdentifier、tcpControlBits、octetDeltaCount、packetDeltaCount、
+    flowStartMilliseconds、flowEndMilliseconds、flowEndReason、ingressInterface和sourceMacAddress
+*/
+struct ipfix_field
+{
+    __u16 id;
+    __u16 length;
+};
+
+#define IPFIX_FIELDS 13
+
+/*
+    IPFIX_TEMPLATE_SET_LEN是包含两个模板的模板集合的长度，IPFIX_RECORDS_MAX是一个消息中留给数据记录的空间
+    每个消息都按照带有模板集合计算，这样不论是否需要重发模板，积攒的数据记录总能放进一个消息中
+*/
+#define IPFIX_TEMPLATE_SET_LEN (IPFIX_SET_HEADER_LEN + 2 * (4 + 4 * IPFIX_FIELDS))
+#define IPFIX_RECORDS_MAX (IPFIX_MAX_MESSAGE - IPFIX_HEADER_LEN - IPFIX_TEMPLATE_SET_LEN - IPFIX_SET_HEADER_LEN)
+
+static const struct ipfix_field ipfix_v4_fields[IPFIX_FIELDS] = {
+    {8, 4},
+    {12, 4},
+    {7, 2},
+    {11, 2},
+    {4, 1},
+    {6, 1},
+    {1, 8},
+    {2, 8},
+    {152, 8},
+    {153, 8},
+    {136, 1},
+    {10, 4},
+    {56, 6},
+};
+
+static const struct ipfix_field ipfix_v6_fields[IPFIX_FIELDS] = {
+    {27, 16},
+    {28, 16},
+    {7, 2},
+    {11, 2},
+    {4, 1},
+    {6, 1},
+    {1, 8},
+    {2, 8},
+    {152, 8},
+    {153, 8},
+    {136, 1},
+    {10, 4},
+    {56, 6},
+};
+
+/*
+    规则动作的名字，下标为common.h中的'policy_action'
+*/
+static const char *policy_action_names[POLICY_ACTIONS] = {
+    [policy_drop] = "drop",
+    [policy_pass] = "pass",
+    [policy_ratelimit] = "ratelimit",
+    [policy_redirect] = "redirect",
+    [policy_tx] = "tx",
+};
+
+/*
+    分片处理结果的名字，下标为common.h中的'frag_result'
+*/
+static const char *frag_result_names[FRAG_RESULTS] = {
+    [frag_first] = "first",
+    [frag_inherited] = "inherited",
+    [frag_orphan] = "orphan",
+    [frag_over_limit] = "over-limit",
+};
+
+/*
+    连接跟踪的工作模式、连接状态和查询结果的名字，下标分别为common.h中的'ct_mode'、'ct_state'和'ct_result'
+*/
+static const char *ct_mode_names[CT_MODES] = {
+    [ct_off] = "off",
+    [ct_on] = "on",
+    [ct_strict] = "strict",
+};
+
+static const char *ct_state_names[CT_STATES] = {
+    [ct_syn_sent] = "syn-sent",
+    [ct_syn_recv] = "syn-recv",
+    [ct_established] = "established",
+    [ct_fin_wait] = "fin-wait",
+    [ct_time_wait] = "time-wait",
+    [ct_close] = "close",
+    [ct_udp_new] = "new",
+    [ct_udp_stream] = "stream",
+};
+
+static const char *ct_result_names[CT_RESULTS] = {
+    [ct_hit] = "hit",
+    [ct_new] = "new",
+    [ct_expired] = "expired",
+    [ct_stale] = "stale",
+    [ct_invalid] = "invalid",
+};
 
 static char *default_prog_path = "xdpfw_kern.o";
 static char *default_section = "xdpfw";
@@ -50,6 +377,7 @@ static const struct option long_options[] = {
     {"attach", required_argument, NULL, 'a'},
     {"detach", required_argument, NULL, 'd'},
     {"stats", no_argument, NULL, 's'},
+    {"rule-stats", no_argument, NULL, 'u'},
     {"insert", no_argument, NULL, 'i'},
     {"remove", no_argument, NULL, 'r'},
     {"mac-blacklist", required_argument, NULL, 'm'},
@@ -58,6 +386,43 @@ static const struct option long_options[] = {
     {"dest-port", required_argument, NULL, 't'},
     {"src-port", required_argument, NULL, 'c'},
     {"proto", required_argument, NULL, 'p'},
+    {"default-action", required_argument, NULL, 'e'},
+    {"layers", required_argument, NULL, 'l'},
+    {"vlan-depth", required_argument, NULL, 'v'},
+    {"ip-versions", required_argument, NULL, 'f'},
+    {"acl", required_argument, NULL, 'k'},
+    {"rate-limit", required_argument, NULL, 'b'},
+    {"syncookie-port", required_argument, NULL, 'y'},
+    {"ipv6-ext-depth", required_argument, NULL, 'w'},
+    {"ipv6-ext-policy", required_argument, NULL, 'g'},
+    {"frag-limit", required_argument, NULL, 'z'},
+    {"steer-cpus", required_argument, NULL, 'o'},
+    {"steer-queue-size", required_argument, NULL, 'q'},
+    {"capture", required_argument, NULL, 'C'},
+    {"capture-rate", required_argument, NULL, 'K'},
+    {"capture-snaplen", required_argument, NULL, 'N'},
+    {"capture-budget", required_argument, NULL, 'B'},
+    {"mac-bloom", required_argument, NULL, 'F'},
+    {"v4-engine", required_argument, NULL, 'E'},
+    {"conntrack", required_argument, NULL, 'T'},
+    {"ct-dump", no_argument, NULL, 'D'},
+    {"ct-flush", no_argument, NULL, 'X'},
+    {"action", required_argument, NULL, 'A'},
+    {"priority", required_argument, NULL, 'P'},
+    {"rate-class", required_argument, NULL, 'R'},
+    {"latency", no_argument, NULL, 'L'},
+    {"sketch", required_argument, NULL, 'S'},
+    {"top", required_argument, NULL, 'O'},
+    {"top-window", required_argument, NULL, 'W'},
+    {"ttl", required_argument, NULL, 'Y'},
+    {"sweep", required_argument, NULL, 'Z'},
+    {"tunnels", required_argument, NULL, 'G'},
+    {"flows", required_argument, NULL, 'J'},
+    {"flow-timeouts", required_argument, NULL, 'U'},
+    {"ipfix", required_argument, NULL, 'V'},
+    {"sketch-reset", no_argument, NULL, 'Q'},
+    {"frag-orphan", required_argument, NULL, 'M'},
+    {"hll-interval", required_argument, NULL, 'H'},
     {0, 0, NULL, 0}};
 
 static const char *long_options_descriptions[] = {
@@ -66,18 +431,81 @@ static const char *long_options_descriptions[] = {
     [2] = "The section name to load from the given xdp program.",
     [3] = "Attach the specified XDP program to the specified network device.",
     [4] = "Detach the specified XDP program from the specified network device.",
-    [5] = "Print statistics from the already loaded XDP program.",
-    [6] = "Insert the specified value into the blacklist.",
-    [7] = "Remove the specified value from the blacklist.",
-    [8] = "Insert/Remove the spcified MAC address to/from the blacklist. Must "
+    [5] = "Print statistics, the drops per reason and layer, the decapsulated tunnels, the flow cache hit rate, the aggregated flows and the active pipeline stages from the already loaded XDP program. "
+          "The distinct sources per second are those of the last interval completed by '-H|--hll-interval'.",
+    [6] = "Print the per-rule hit counters of every blacklist, sorted by packets.",
+    [7] = "Insert the specified value into the blacklist.",
+    [8] = "Remove the specified value from the blacklist.",
+    [9] = "Insert/Remove the spcified MAC address to/from the blacklist. Must "
           "be in the form '00:00:00:00:00:00'.",
-    [9] = "Insert/Remove the specified IPv4 prefix to/from the blacklist. Must "
-          "be in CIDR notation.",
-    [10] = "Insert/Remove the specified IPv6 prefix to/from the blacklist. Must "
+    [10] = "Insert/Remove the specified IPv4 prefix to/from the blacklist. Must "
            "be in CIDR notation.",
-    [11] = "Insert/Remove the specified destination port to the blacklist.",
-    [12] = "Insert/Remove the specified source port to the blacklist.",
-    [13] = "Set the protocol for the specified source/destination port.",
+    [11] = "Insert/Remove the specified IPv6 prefix to/from the blacklist. Must "
+           "be in CIDR notation, /64 and /48 prefixes are kept in hash tables probed before the LPM trie.",
+    [12] = "Insert/Remove the specified destination port or port range (e.g. '1000-2000') to the blacklist.",
+    [13] = "Insert/Remove the specified source port or port range (e.g. '1000-2000') to the blacklist.",
+    [14] = "Set the protocol for the specified source/destination port.",
+    [15] = "Set the XDP action returned for packets passing every check, used with '-a|--attach'.",
+    [16] = "Comma separated list of the layers to enable out of 'mac,l3,l4,acl,syncookie,ratelimit', used with '-a|--attach'.",
+    [17] = "Set how many vlan headers to unwrap (0-2), used with '-a|--attach'.",
+    [18] = "Comma separated list of the IP versions to parse out of '4,6', used with '-a|--attach'.",
+    [19] = "Insert/Remove the specified ACL rule, e.g. 'src=10.0.0.0/8,proto=udp,dport=53,priority=10,action=drop'. "
+           "Fields: family, src, dst, proto, sport, dport, priority, action; omitted fields match anything. "
+           "'action=redirect' hands the matching packets to the AF_XDP sockets of 'xdpfw_xsk'.",
+    [20] = "Insert/Remove the rate limit of the specified source prefix, e.g. 'src=10.0.0.0/8,proto=udp,rate=1000,burst=2000,bucket=24'. "
+           "'rate' is in packets per second per CPU, 'burst' defaults to 'rate', 'bucket' is the prefix length sharing one "
+           "token bucket and defaults to a bucket per source address, 'proto' is one of 'any,tcp,udp,icmp'.",
+    [21] = "Insert/Remove the specified tcp destination port or port range to/from the SYN cookie protected ports. "
+           "SYNs to these ports are answered from XDP, requires 'net.ipv4.tcp_syncookies=2'.",
+    [22] = "Set how many IPv6 extension headers to skip looking for the L4 header (0-6), used with '-a|--attach'.",
+    [23] = "Set what to do with IPv6 packets whose L4 header is not found out of 'drop,pass,count', used with '-a|--attach'.",
+    [24] = "Set the maximum number of fragments allowed per IPv4 datagram, 0 for no limit, used with '-a|--attach'.",
+    [25] = "Steer passed packets to the specified CPUs by flow hash through a CPUMAP, e.g. '0-3,6', used with '-a|--attach'.",
+    [26] = "Set the queue size of every CPU used for steering, used with '-a|--attach'.",
+    [27] = "Capture a sample of the dropped packets with the matching rule, ifindex and RX queue into the specified "
+           "pcapng file until interrupted.",
+    [28] = "Set the initial sampling rate of '-C|--capture' as 1 in K dropped packets, defaults to 1.",
+    [29] = "Set how many bytes of each dropped packet '-C|--capture' keeps (1-256), defaults to 128.",
+    [30] = "Set the percentage of each CPU's time '-C|--capture' may cost before the sampling rate is lowered, defaults to 1.",
+    [31] = "Check a bloom filter before the MAC blacklist hash table, 'on' or 'off', defaults to 'on', used with '-a|--attach'.",
+    [32] = "Set the IPv4 blacklist lookup engine, 'lpm' for the LPM trie or 'dir24' for DIR-24-8 tables (about 90MB), "
+           "defaults to 'lpm', used with '-a|--attach'.",
+    [33] = "Track TCP/UDP connections so packets of known connections skip every check, 'off', 'on' or 'strict' "
+           "which also drops TCP packets outside of any connection, defaults to 'off', used with '-a|--attach'.",
+    [34] = "Dump the connection tracking table.",
+    [35] = "Flush the connection tracking table.",
+    [36] = "Set the action of the inserted MAC, IPv4, IPv6 or port rule out of 'drop,pass,tx,redirect,redirect:IFNAME,ratelimit:CLASS', "
+           "defaults to 'drop'. 'pass' ends the checks and accepts the packet, 'redirect' without a device hands the packets "
+           "to the AF_XDP sockets of 'xdpfw_xsk'.",
+    [37] = "Set the priority of the inserted MAC, IPv4, IPv6 or port rule, lower values win when a packet matches "
+           "several rules, defaults to 100.",
+    [38] = "Insert/Remove the rate of the specified rate limit class used by 'ratelimit:CLASS' rules, e.g. '3=1000/2000' "
+           "for 1000 packets per second per CPU with a burst of 2000, the burst defaults to the rate.",
+    [39] = "Print the latency histogram and percentiles of every parsing step and pipeline stage, "
+           "requires an XDP program built with 'make PROFILE=1'.",
+    [40] = "Count the packets and bytes of every source address in a count-min sketch, 'on' or 'off', defaults to 'on', "
+           "used with '-a|--attach'.",
+    [41] = "Print the N source addresses sending the most packets during the window set by '-W|--top-window'.",
+    [42] = "Set the window of '-O|--top' in seconds, defaults to 5.",
+    [43] = "Expire the inserted MAC, IPv4, IPv6 or port rule after the specified time, e.g. '300s', '5m', '1h' or '1d', "
+           "by default rules never expire. Expired rules are ignored at once and removed by '-Z|--sweep'.",
+    [44] = "Remove the expired rules from every blacklist, once when N is 0 or every N seconds until interrupted.",
+    [45] = "Decapsulate the specified tunnels and check the MAC, IP and port rules against the inner headers as well, "
+           "out of 'vxlan,gre,ipip,mpls', 'all' or 'none', defaults to 'none', used with '-a|--attach'. "
+           "Decapsulated packets bypass the flow cache and connection tracking.",
+    [46] = "Count the packets and bytes of every TCP/UDP flow in a per-CPU flow table, 'on' or 'off', defaults to 'off', "
+           "used with '-a|--attach'. Flows are exported by '-V|--ipfix', packets of new flows arriving while the table is full "
+           "are exported one by one.",
+    [47] = "Set the active and idle timeouts of the flow table in seconds as 'ACTIVE,IDLE', 0 disables a timeout, "
+           "defaults to '60,15', used with '-a|--attach'.",
+    [48] = "Export the timed out flows as IPFIX over UDP to the specified collector, e.g. '192.0.2.1:4739' or '[2001:db8::1]:4739', "
+           "the port defaults to 4739, until interrupted. All remaining flows are exported on exit. "
+           "Try it against a local listener such as 'nc -ul 4739'.",
+    [49] = "Reset the source sketch, the candidates of '-O|--top' and the distinct source estimate to start a new counting window.",
+    [50] = "Set what to do with IPv4 fragments arriving without their first fragment out of 'default,drop,pass', "
+           "'default' applies '-e|--default-action', defaults to 'default', used with '-a|--attach'.",
+    [51] = "Estimate the distinct sources of every N second interval and reset the estimator after each one until interrupted, "
+           "or end the current interval once when N is 0. '-s|--stats' reports the last completed interval.",
 };
 
 #endif /* _LAYER4_USER_H */
@@ -0,0 +1,622 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#include "xdpfw_xsk.h"
+
+/*
+    xdpfw_xsk是xdpfw的用户态快速路径
+    被规则判定为XDP_REDIRECT的数据包会由xdpfw_kern.o通过'xsk_map'交给这里的AF_XDP socket，
+    每个RX队列一个socket和一个worker线程，所有的socket共享同一块UMEM，数据包在内核和用户态之间不需要复制
+    worker对数据包进行BPF做不到的检查之后，丢弃命中的数据包，并按照配置重新注入干净的数据包
+
+    在veth上测试时，先用'xdpfw_user -a'挂载防火墙并插入'action=redirect'的ACL规则，再运行'xdpfw_xsk -d <veth> -c'
+    veth的驱动不支持zero-copy，默认的auto模式也会自动退回到copy模式
+*/
+
+static struct xsk_options options = {
+    .queues = 1,
+    .batch = XSK_DEFAULT_BATCH,
+    .bind_mode = xsk_bind_auto,
+    .reinject = xsk_reinject_drop,
+};
+
+static struct xsk_umem *umem;
+static void *umem_area;
+static struct xsk_queue *queues;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void handle_signal(int sig)
+{
+    stopping = 1;
+}
+
+/*
+    free_frame把一个帧归还到它所属队列的空闲栈中
+    RX描述符中的地址可能带有headroom的偏移，这里只保留帧的起始地址
+*/
+static inline void free_frame(struct xsk_queue *q, __u64 addr)
+{
+    q->frames[q->free_frames++] = addr & ~((__u64)XSK_FRAME_SIZE - 1);
+}
+
+/*
+    refill_queue把空闲的帧尽可能多地放入fill ring中，内核只能把数据包写入fill ring中的帧
+*/
+static void refill_queue(struct xsk_queue *q)
+{
+    __u32 count = xsk_prod_nb_free(&q->fill, q->free_frames);
+    if (count > q->free_frames)
+    {
+        count = q->free_frames;
+    }
+    if (count == 0)
+    {
+        return;
+    }
+
+    __u32 idx = 0;
+    if (xsk_ring_prod__reserve(&q->fill, count, &idx) != count)
+    {
+        return;
+    }
+
+    for (__u32 i = 0; i < count; i++)
+    {
+        *xsk_ring_prod__fill_addr(&q->fill, idx++) = q->frames[--q->free_frames];
+    }
+    xsk_ring_prod__submit(&q->fill, count);
+}
+
+/*
+    complete_tx从completion ring中回收已经发送完成的帧
+    使用need_wakeup时，内核不会主动处理TX ring，需要通过sendto唤醒它
+*/
+static void complete_tx(struct xsk_queue *q)
+{
+    if (q->outstanding_tx == 0)
+    {
+        return;
+    }
+
+    if (xsk_ring_prod__needs_wakeup(&q->tx))
+    {
+        sendto(xsk_socket__fd(q->xsk), NULL, 0, MSG_DONTWAIT, NULL, 0);
+    }
+
+    __u32 idx = 0;
+    __u32 completed = xsk_ring_cons__peek(&q->comp, XSK_RING_SIZE, &idx);
+    for (__u32 i = 0; i < completed; i++)
+    {
+        free_frame(q, *xsk_ring_cons__comp_addr(&q->comp, idx++));
+    }
+
+    xsk_ring_cons__release(&q->comp, completed);
+    q->outstanding_tx -= completed;
+}
+
+/*
+    inspect是对数据包的深度检查，返回true代表这个数据包是干净的
+    这里只在整个帧中查找'-m|--match'指定的字节串，更复杂的检查可以直接替换这个函数
+*/
+static bool inspect(struct xsk_queue *q, void *pkt, __u32 len)
+{
+    if (options.match == NULL)
+    {
+        return true;
+    }
+
+    if (memmem(pkt, len, options.match, options.match_len) != NULL)
+    {
+        q->stats.matched++;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+    reserve_tx在TX ring中预留最多'wanted'个位置，返回实际预留到的数量
+    xsk_ring_prod__reserve要么全部预留成功，要么一个都不预留，所以这里先查询还有多少空位，只预留能拿到的那些
+    空位不够时先回收一次completion ring，再重新查询
+*/
+static __u32 reserve_tx(struct xsk_queue *q, __u32 wanted, __u32 *idx)
+{
+    __u32 available = xsk_prod_nb_free(&q->tx, wanted);
+    if (available < wanted)
+    {
+        complete_tx(q);
+        available = xsk_prod_nb_free(&q->tx, wanted);
+    }
+
+    if (available > wanted)
+    {
+        available = wanted;
+    }
+    if (available == 0)
+    {
+        return 0;
+    }
+
+    return xsk_ring_prod__reserve(&q->tx, available, idx);
+}
+
+/*
+    process_rx批量处理RX ring中的数据包
+    先检查这一批中所有的数据包，再一次性为其中干净的数据包预留TX ring的位置，这样每一批只需要操作一次TX ring
+    TX ring放不下所有干净的数据包时，放得下的那些照常发送，剩下的帧回到空闲帧中，由refill_queue重新放入fill ring
+*/
+static void process_rx(struct xsk_queue *q)
+{
+    __u32 idx_rx = 0;
+    __u32 received = xsk_ring_cons__peek(&q->rx, options.batch, &idx_rx);
+    if (received == 0)
+    {
+        return;
+    }
+
+    const struct xdp_desc *descs[XSK_MAX_BATCH];
+    bool clean[XSK_MAX_BATCH];
+    __u32 clean_count = 0;
+
+    for (__u32 i = 0; i < received; i++)
+    {
+        descs[i] = xsk_ring_cons__rx_desc(&q->rx, idx_rx + i);
+        clean[i] = inspect(q, xsk_umem__get_data(umem_area, descs[i]->addr), descs[i]->len);
+        clean_count += clean[i];
+    }
+
+    __u32 idx_tx = 0;
+    __u32 tx_slots = 0;
+    if (options.reinject == xsk_reinject_tx && clean_count > 0)
+    {
+        tx_slots = reserve_tx(q, clean_count, &idx_tx);
+    }
+
+    __u32 tx_used = 0;
+    for (__u32 i = 0; i < received; i++)
+    {
+        const struct xdp_desc *desc = descs[i];
+
+        if (!clean[i] || options.reinject == xsk_reinject_drop)
+        {
+            q->stats.dropped++;
+            free_frame(q, desc->addr);
+            continue;
+        }
+
+        if (options.reinject == xsk_reinject_tap)
+        {
+            if (write(q->tap_fd, xsk_umem__get_data(umem_area, desc->addr), desc->len) == desc->len)
+            {
+                q->stats.reinjected++;
+            }
+            else
+            {
+                q->stats.dropped++;
+            }
+            free_frame(q, desc->addr);
+            continue;
+        }
+
+        /*
+            预留到的位置已经用完了，这个干净的数据包只能被丢弃
+        */
+        if (tx_used == tx_slots)
+        {
+            q->stats.tx_full++;
+            q->stats.dropped++;
+            free_frame(q, desc->addr);
+            continue;
+        }
+
+        /*
+            UMEM是共享的，所以可以直接把RX描述符中的帧交给TX ring，不需要复制数据包
+        */
+        struct xdp_desc *tx_desc = xsk_ring_prod__tx_desc(&q->tx, idx_tx++);
+        tx_desc->addr = desc->addr;
+        tx_desc->len = desc->len;
+        tx_used++;
+        q->stats.reinjected++;
+    }
+
+    xsk_ring_cons__release(&q->rx, received);
+    q->stats.rx += received;
+
+    if (tx_slots > 0)
+    {
+        xsk_ring_prod__submit(&q->tx, tx_slots);
+        q->outstanding_tx += tx_slots;
+    }
+
+    refill_queue(q);
+}
+
+/*
+    xsk_worker是每个队列的worker线程
+    没有开启busy poll时，线程在poll中等待数据包到达；开启之后，每一轮都通过recvfrom直接驱动网卡队列的NAPI
+*/
+static void *xsk_worker(void *arg)
+{
+    struct xsk_queue *q = arg;
+    struct pollfd fds = {
+        .fd = xsk_socket__fd(q->xsk),
+        .events = POLLIN,
+    };
+
+    while (!stopping)
+    {
+        if (options.busy_poll)
+        {
+            recvfrom(fds.fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+        }
+        else if (poll(&fds, 1, 1000) <= 0)
+        {
+            complete_tx(q);
+            continue;
+        }
+
+        complete_tx(q);
+        process_rx(q);
+    }
+
+    return NULL;
+}
+
+/*
+    open_tap打开用来重新注入数据包的TAP设备，每个worker使用这个设备的一个独立的队列
+*/
+static int open_tap(const char *name)
+{
+    struct ifreq ifr = {
+        .ifr_flags = IFF_TAP | IFF_NO_PI | IFF_MULTI_QUEUE,
+    };
+
+    if (strlen(name) >= IFNAMSIZ)
+    {
+        printf("ERR: TAP device name '%s' too long.\n", name);
+        return -1;
+    }
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+
+    int fd = open("/dev/net/tun", O_RDWR);
+    if (fd < 0)
+    {
+        printf("ERR: Unable to open '/dev/net/tun' err(%d): %s\n", errno, strerror(errno));
+        return -1;
+    }
+
+    if (ioctl(fd, TUNSETIFF, &ifr) != 0)
+    {
+        printf("ERR: Unable to attach to TAP device '%s' err(%d): %s\n", name, errno, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+    create_socket在一个队列上创建共享UMEM的AF_XDP socket
+    第一个socket使用创建UMEM时给出的fill/completion ring，之后的socket各自创建新的ring
+    auto模式下先尝试zero-copy，失败之后再使用copy模式
+*/
+static int create_socket(struct xsk_queue *q)
+{
+    struct xsk_socket_config cfg = {
+        .rx_size = XSK_RING_SIZE,
+        .tx_size = XSK_RING_SIZE,
+        .libbpf_flags = XSK_LIBBPF_FLAGS__INHIBIT_PROG_LOAD,
+        .xdp_flags = 0,
+    };
+
+    enum xsk_bind_mode mode = options.bind_mode == xsk_bind_copy ? xsk_bind_copy : xsk_bind_zero_copy;
+    int ret = 0;
+
+    for (;;)
+    {
+        cfg.bind_flags = XDP_USE_NEED_WAKEUP | (mode == xsk_bind_copy ? XDP_COPY : XDP_ZEROCOPY);
+        ret = xsk_socket__create_shared(&q->xsk, options.ifname, q->queue_id, umem, &q->rx, &q->tx, &q->fill, &q->comp, &cfg);
+        if (ret == 0 || mode == xsk_bind_copy || options.bind_mode == xsk_bind_zero_copy)
+        {
+            break;
+        }
+
+        mode = xsk_bind_copy;
+    }
+
+    if (ret != 0)
+    {
+        printf("ERR: Unable to create the AF_XDP socket on queue %u of '%s' in %s mode err(%d): %s\n", q->queue_id, options.ifname,
+               xsk_bind_mode_names[mode], -ret, strerror(-ret));
+        return EXIT_FAIL_XDP_ATTACH;
+    }
+
+    printf("Queue %u: AF_XDP socket bound in %s mode.\n", q->queue_id, xsk_bind_mode_names[mode]);
+
+    if (options.busy_poll)
+    {
+        int fd = xsk_socket__fd(q->xsk);
+        int prefer = 1;
+        int usecs = 20;
+        int budget = options.batch;
+
+        if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer)) != 0 ||
+            setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) != 0 ||
+            setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &budget, sizeof(budget)) != 0)
+        {
+            printf("ERR: Unable to enable busy polling on queue %u err(%d): %s\n", q->queue_id, errno, strerror(errno));
+            return EXIT_FAIL_GENERIC;
+        }
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    setup_queues创建共享的UMEM以及每个队列的socket，然后把socket放入'xsk_map'，之后xdpfw_kern.o才会开始重定向数据包
+*/
+static int setup_queues(int xsk_map_fd)
+{
+    size_t size = (size_t)options.queues * XSK_QUEUE_FRAMES * XSK_FRAME_SIZE;
+
+    umem_area = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (umem_area == MAP_FAILED)
+    {
+        printf("ERR: Unable to allocate %zu bytes of UMEM err(%d): %s\n", size, errno, strerror(errno));
+        return EXIT_FAIL_GENERIC;
+    }
+
+    queues = calloc(options.queues, sizeof(*queues));
+    if (queues == NULL)
+    {
+        return EXIT_FAIL_GENERIC;
+    }
+
+    for (__u32 i = 0; i < options.queues; i++)
+    {
+        queues[i].queue_id = i;
+        queues[i].tap_fd = -1;
+    }
+
+    struct xsk_umem_config umem_cfg = {
+        .fill_size = XSK_RING_PROD__DEFAULT_NUM_DESCS,
+        .comp_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+        .frame_size = XSK_FRAME_SIZE,
+        .frame_headroom = XSK_UMEM__DEFAULT_FRAME_HEADROOM,
+        .flags = XSK_UMEM__DEFAULT_FLAGS,
+    };
+
+    int ret = xsk_umem__create(&umem, umem_area, size, &queues[0].fill, &queues[0].comp, &umem_cfg);
+    if (ret != 0)
+    {
+        printf("ERR: Unable to create the UMEM err(%d): %s\n", -ret, strerror(-ret));
+        return EXIT_FAIL_GENERIC;
+    }
+
+    for (__u32 i = 0; i < options.queues; i++)
+    {
+        struct xsk_queue *q = &queues[i];
+
+        /*
+            第i个队列独占UMEM中从i * XSK_QUEUE_FRAMES开始的帧
+        */
+        for (__u32 j = 0; j < XSK_QUEUE_FRAMES; j++)
+        {
+            q->frames[q->free_frames++] = ((__u64)i * XSK_QUEUE_FRAMES + j) * XSK_FRAME_SIZE;
+        }
+
+        ret = create_socket(q);
+        if (ret != EXIT_OK)
+        {
+            return ret;
+        }
+
+        refill_queue(q);
+
+        if (options.reinject == xsk_reinject_tap)
+        {
+            q->tap_fd = open_tap(options.tap_name);
+            if (q->tap_fd < 0)
+            {
+                return EXIT_FAIL_GENERIC;
+            }
+        }
+
+        int fd = xsk_socket__fd(q->xsk);
+        if (bpf_map_update_elem(xsk_map_fd, &q->queue_id, &fd, BPF_ANY) != 0)
+        {
+            printf("ERR: Failed to add the socket of queue %u to '%s' err(%d): %s\n", q->queue_id, XSK_MAP_PATH, errno,
+                   strerror(errno));
+            return EXIT_FAIL_XDP_MAP_UPDATE;
+        }
+    }
+
+    return EXIT_OK;
+}
+
+/*
+    teardown_queues把socket从'xsk_map'中移除，这之后被重定向的数据包会回到协议栈，然后释放所有的资源
+*/
+static void teardown_queues(int xsk_map_fd)
+{
+    if (queues == NULL)
+    {
+        return;
+    }
+
+    for (__u32 i = 0; i < options.queues; i++)
+    {
+        struct xsk_queue *q = &queues[i];
+
+        bpf_map_delete_elem(xsk_map_fd, &q->queue_id);
+        if (q->xsk != NULL)
+        {
+            xsk_socket__delete(q->xsk);
+        }
+        if (q->tap_fd >= 0)
+        {
+            close(q->tap_fd);
+        }
+    }
+
+    if (umem != NULL)
+    {
+        xsk_umem__delete(umem);
+    }
+
+    free(queues);
+}
+
+/*
+    print_xsk_stats打印每个队列以及所有队列合计的统计数据
+*/
+static void print_xsk_stats()
+{
+    struct xsk_stats total = {0};
+
+    for (__u32 i = 0; i < options.queues; i++)
+    {
+        struct xsk_stats *stats = &queues[i].stats;
+
+        printf("Queue %-3u RX: %-12llu Reinjected: %-12llu Dropped: %-12llu Matched: %-12llu TX full: %llu\n", queues[i].queue_id,
+               stats->rx, stats->reinjected, stats->dropped, stats->matched, stats->tx_full);
+
+        total.rx += stats->rx;
+        total.reinjected += stats->reinjected;
+        total.dropped += stats->dropped;
+        total.matched += stats->matched;
+        total.tx_full += stats->tx_full;
+    }
+
+    printf("Total     RX: %-12llu Reinjected: %-12llu Dropped: %-12llu Matched: %-12llu TX full: %llu\n\n", total.rx,
+           total.reinjected, total.dropped, total.matched, total.tx_full);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    int longindex = 0;
+
+    while ((opt = getopt_long(argc, argv, "hd:q:czbB:m:xt:i:", long_options, &longindex)) != -1)
+    {
+        switch (opt)
+        {
+        case 'd':
+            options.ifname = optarg;
+            break;
+        case 'q':
+            options.queues = strtoul(optarg, NULL, 10);
+            if (options.queues == 0 || options.queues > XSK_MAX_QUEUES)
+            {
+                printf("ERR: Invalid number of queues specified with '-q|--queues', must be 1-%d, got '%s'.\n", XSK_MAX_QUEUES, optarg);
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'c':
+            options.bind_mode = xsk_bind_copy;
+            break;
+        case 'z':
+            options.bind_mode = xsk_bind_zero_copy;
+            break;
+        case 'b':
+            options.busy_poll = true;
+            break;
+        case 'B':
+            options.batch = strtoul(optarg, NULL, 10);
+            if (options.batch == 0 || options.batch > XSK_MAX_BATCH)
+            {
+                printf("ERR: Invalid batch size specified with '-B|--batch', must be 1-%d, got '%s'.\n", XSK_MAX_BATCH, optarg);
+                return EXIT_FAIL_OPTIONS;
+            }
+            break;
+        case 'm':
+            options.match = optarg;
+            options.match_len = strlen(optarg);
+            break;
+        case 'x':
+            options.reinject = xsk_reinject_tx;
+            break;
+        case 't':
+            options.reinject = xsk_reinject_tap;
+            options.tap_name = optarg;
+            break;
+        case 'i':
+            options.interval = strtoul(optarg, NULL, 10);
+            break;
+        case 'h':
+        default:
+            usage(argv, doc, long_options, long_options_descriptions);
+            return EXIT_FAIL_OPTIONS;
+        }
+    }
+
+    if (options.ifname == NULL)
+    {
+        printf("ERR: The network device must be specified with '-d|--dev'.\n");
+        usage(argv, doc, long_options, long_options_descriptions);
+        return EXIT_FAIL_OPTIONS;
+    }
+
+    int ifindex = get_ifindex(options.ifname);
+    if (ifindex < 0)
+    {
+        return EXIT_FAIL_OPTIONS;
+    }
+
+    int ret = set_rlimit();
+    if (ret != EXIT_OK)
+    {
+        return ret;
+    }
+
+    int xsk_map_fd = open_bpf_map(XSK_MAP_PATH);
+    if (xsk_map_fd < 0)
+    {
+        printf("ERR: Is xdpfw attached? '%s' is pinned by 'xdpfw_user -a'.\n", XSK_MAP_PATH);
+        return EXIT_FAIL_XDP_MAP_OPEN;
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    ret = setup_queues(xsk_map_fd);
+    if (ret != EXIT_OK)
+    {
+        teardown_queues(xsk_map_fd);
+        return ret;
+    }
+
+    __u32 started = 0;
+    for (; started < options.queues; started++)
+    {
+        ret = pthread_create(&queues[started].thread, NULL, xsk_worker, &queues[started]);
+        if (ret != 0)
+        {
+            printf("ERR: Unable to start the worker of queue %u err(%d): %s\n", started, ret, strerror(ret));
+            stopping = 1;
+            break;
+        }
+    }
+
+    /*
+        统计数据由各个worker线程单独更新，这里的读取不加锁，打印出来的值只是近似的
+    */
+    while (!stopping)
+    {
+        sleep(options.interval > 0 ? options.interval : 1);
+        if (options.interval > 0 && !stopping)
+        {
+            print_xsk_stats();
+        }
+    }
+
+    for (__u32 i = 0; i < started; i++)
+    {
+        pthread_join(queues[i].thread, NULL);
+    }
+
+    print_xsk_stats();
+    teardown_queues(xsk_map_fd);
+
+    return ret == 0 ? EXIT_OK : EXIT_FAIL_GENERIC;
+}
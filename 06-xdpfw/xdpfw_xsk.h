@@ -0,0 +1,189 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#ifndef _XDPFW_XSK_H
+#define _XDPFW_XSK_H
+
+/*
+    memmem是GNU的扩展
+*/
+#define _GNU_SOURCE
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <bpf/xsk.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/if_link.h>
+#include <linux/if_tun.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "kernel/bpf_util.h"
+
+#include "workshop/common.h"
+#include "workshop/user/constants.h"
+#include "workshop/user/map_helpers.h"
+#include "workshop/user/options.h"
+#include "workshop/user/utils.h"
+
+#include "common.h"
+
+/*
+    xdpfw_kern.o在挂载时固定下来的'xsk_map'的路径
+*/
+#define XSK_MAP_PATH "/sys/fs/bpf/xsk_map"
+
+/*
+    UMEM被切分成大小相同的帧，每个队列独占其中的XSK_QUEUE_FRAMES个
+    这样每个队列的fill和completion ring只会用到自己的帧，worker线程之间不需要任何同步
+*/
+#define XSK_FRAME_SIZE XSK_UMEM__DEFAULT_FRAME_SIZE
+#define XSK_QUEUE_FRAMES 4096
+#define XSK_RING_SIZE XSK_RING_CONS__DEFAULT_NUM_DESCS
+
+/*
+    每次从RX ring中最多批量取出的描述符数量
+*/
+#define XSK_DEFAULT_BATCH 64
+#define XSK_MAX_BATCH 256
+
+/*
+    较老的系统头文件中没有busy poll相关的socket选项
+*/
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70
+#endif
+
+/*
+    xsk_bind_mode代表AF_XDP socket的工作模式
+    auto会先尝试zero-copy，驱动不支持时（例如veth）退回到copy模式
+*/
+enum xsk_bind_mode
+{
+    xsk_bind_auto,
+    xsk_bind_copy,
+    xsk_bind_zero_copy,
+};
+
+/*
+    xsk_reinject_mode代表通过检查的数据包的去向
+    drop代表全部丢弃，只进行统计；tx代表从收到它的队列重新发送出去；tap代表写入一个TAP设备，重新交给协议栈
+*/
+enum xsk_reinject_mode
+{
+    xsk_reinject_drop,
+    xsk_reinject_tx,
+    xsk_reinject_tap,
+};
+
+/*
+    xsk_options是worker的配置，由命令行参数填充，所有的worker线程共享
+*/
+struct xsk_options
+{
+    char *ifname;
+    __u32 queues;
+    __u32 batch;
+    enum xsk_bind_mode bind_mode;
+    enum xsk_reinject_mode reinject;
+    char *tap_name;
+    bool busy_poll;
+    char *match;
+    size_t match_len;
+    __u32 interval;
+};
+
+/*
+    xsk_stats是每个worker的统计数据
+    rx是收到的数据包数量，reinjected和dropped是检查之后重新注入和丢弃的数量，matched是命中了'match'的数量
+    tx_full是TX ring满了之后不得不丢弃的干净数据包的数量
+*/
+struct xsk_stats
+{
+    __u64 rx;
+    __u64 reinjected;
+    __u64 dropped;
+    __u64 matched;
+    __u64 tx_full;
+};
+
+/*
+    xsk_queue代表绑定在一个网卡队列上的AF_XDP socket和处理它的worker线程
+    每个socket有自己的RX/TX ring以及fill/completion ring，但是它们共享同一块UMEM
+    frames是这个队列当前空闲的帧的栈，free_frames是栈中帧的数量
+*/
+struct xsk_queue
+{
+    __u32 queue_id;
+    struct xsk_socket *xsk;
+    struct xsk_ring_cons rx;
+    struct xsk_ring_prod tx;
+    struct xsk_ring_prod fill;
+    struct xsk_ring_cons comp;
+
+    __u64 frames[XSK_QUEUE_FRAMES];
+    __u32 free_frames;
+    __u32 outstanding_tx;
+
+    int tap_fd;
+    pthread_t thread;
+    struct xsk_stats stats;
+};
+
+static const char *xsk_bind_mode_names[] = {
+    [xsk_bind_auto] = "auto",
+    [xsk_bind_copy] = "copy",
+    [xsk_bind_zero_copy] = "zero-copy",
+};
+
+static const char *doc = "XDP: AF_XDP worker pool inspecting the packets redirected by xdpfw\n";
+
+static const struct option long_options[] = {
+    {"help", no_argument, NULL, 'h'},
+    {"dev", required_argument, NULL, 'd'},
+    {"queues", required_argument, NULL, 'q'},
+    {"copy", no_argument, NULL, 'c'},
+    {"zero-copy", no_argument, NULL, 'z'},
+    {"busy-poll", no_argument, NULL, 'b'},
+    {"batch", required_argument, NULL, 'B'},
+    {"match", required_argument, NULL, 'm'},
+    {"tx", no_argument, NULL, 'x'},
+    {"tap", required_argument, NULL, 't'},
+    {"interval", required_argument, NULL, 'i'},
+    {0, 0, NULL, 0}};
+
+static const char *long_options_descriptions[] = {
+    [0] = "Display this help message.",
+    [1] = "The network device xdpfw is attached to.",
+    [2] = "Bind one AF_XDP socket and worker thread to each of the first N RX queues, defaults to 1.",
+    [3] = "Force copy mode, e.g. for veth.",
+    [4] = "Force zero-copy mode and fail when the driver does not support it, by default zero-copy is tried first.",
+    [5] = "Busy-poll the device queues from the worker threads instead of waiting for interrupts.",
+    [6] = "Set how many descriptors are processed per batch (1-256), defaults to 64.",
+    [7] = "Drop the packets containing the specified byte string anywhere in the frame.",
+    [8] = "Re-inject the clean packets by transmitting them back out of the queue they came from.",
+    [9] = "Re-inject the clean packets into the kernel stack through the specified TAP device.",
+    [10] = "Print the worker statistics every N seconds, by default only on exit.",
+};
+
+#endif /* _XDPFW_XSK_H */
@@ -173,6 +173,22 @@ static int (*bpf_skb_vlan_pop)(void *ctx) =
 	(void *) BPF_FUNC_skb_vlan_pop;
 static int (*bpf_rc_pointer_rel)(void *ctx, int rel_x, int rel_y) =
 	(void *) BPF_FUNC_rc_pointer_rel;
+static struct bpf_sock *(*bpf_skc_lookup_tcp)(void *ctx,
+					      struct bpf_sock_tuple *tuple,
+					      int size, unsigned long long netns_id,
+					      unsigned long long flags) =
+	(void *) BPF_FUNC_skc_lookup_tcp;
+static int (*bpf_tcp_check_syncookie)(struct bpf_sock *sk, void *ip,
+				      int ip_len, void *tcp, int tcp_len) =
+	(void *) BPF_FUNC_tcp_check_syncookie;
+static long long (*bpf_tcp_gen_syncookie)(struct bpf_sock *sk, void *ip,
+					  int ip_len, void *tcp, int tcp_len) =
+	(void *) BPF_FUNC_tcp_gen_syncookie;
+static void *(*bpf_ringbuf_reserve)(void *ringbuf, unsigned long long size,
+				    unsigned long long flags) =
+	(void *) BPF_FUNC_ringbuf_reserve;
+static void (*bpf_ringbuf_submit)(void *data, unsigned long long flags) =
+	(void *) BPF_FUNC_ringbuf_submit;
 
 /* llvm builtin functions that eBPF C program may use to
  * emit BPF_LD_ABS and BPF_LD_IND instructions
@@ -4,6 +4,7 @@
 #define _CONSTANTS_H
 
 #include <linux/bpf.h>
+#include <string.h>
 
 /* Exit codes */
 #define EXIT_OK 0
@@ -45,4 +46,17 @@ static const char *action2str(int action)
     return NULL;
 }
 
+static int str2action(const char *action)
+{
+    int i;
+    for (i = 0; i < XDP_MAX_ACTIONS; i++)
+    {
+        if (strcmp(xdp_action_names[i], action) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
 #endif // _CONSTANTS_H
\ No newline at end of file
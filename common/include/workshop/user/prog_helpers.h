@@ -14,17 +14,20 @@
 
 static __u32 xdp_flags = XDP_FLAGS_UPDATE_IF_NOEXIST;
 
+/*
+    The object is only opened to learn the names of its pinned maps, never loaded: loading would create
+    every map of the program again just to throw them away, which for large maps costs real memory and time.
+*/
 static int detach(int if_index, char *prog_path)
 {
-
     struct bpf_object *bpf_obj;
-    int bpf_prog_fd = -1;
     int ret = 0;
 
-    ret = bpf_prog_load(prog_path, BPF_PROG_TYPE_XDP, &bpf_obj, &bpf_prog_fd);
+    bpf_obj = bpf_object__open(prog_path);
+    ret = libbpf_get_error(bpf_obj);
     if (ret != 0)
     {
-        printf("ERR: Unable to load XDP program from file '%s' err(%d): %s\n",
+        printf("ERR: Unable to open XDP program from file '%s' err(%d): %s\n",
                prog_path, -ret, strerror(-ret));
         return EXIT_FAIL_XDP_DETACH;
     }
@@ -43,6 +46,7 @@ static int detach(int if_index, char *prog_path)
                prog_path, MAP_DIR, -ret, strerror(-ret));
     }
 
+    bpf_object__close(bpf_obj);
     return EXIT_OK;
 }
 
@@ -59,17 +63,116 @@ static int load_section(struct bpf_object *bpf_obj, char *section)
     return bpf_program__fd(bpf_prog);
 }
 
-static int attach(int if_index, char *prog_path, char *section)
+static struct bpf_map *find_rodata_map(struct bpf_object *bpf_obj)
+{
+    struct bpf_map *bpf_map;
+
+    bpf_object__for_each_map(bpf_map, bpf_obj)
+    {
+        const char *name = bpf_map__name(bpf_map);
+        if (name != NULL && strstr(name, ".rodata") != NULL)
+        {
+            return bpf_map;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+    Called after the object is opened and configured but before it is loaded, so the caller can still
+    adjust the maps, e.g. shrink the ones its configuration does not use.
+*/
+typedef int (*prepare_object_fn)(struct bpf_object *bpf_obj, const void *config);
+
+/*
+    Open the object, optionally overwrite its 'const volatile' .rodata block with 'config' and only then
+    load it, so the verifier sees the configured values as constants and prunes the disabled branches.
+    The .rodata block must hold nothing but the program's configuration struct.
+*/
+static int load_object(char *prog_path, const void *config, size_t config_size, prepare_object_fn prepare,
+                       struct bpf_object **loaded_obj, int *first_prog_fd)
 {
     struct bpf_object *bpf_obj;
-    int bpf_prog_fd = -1;
+    struct bpf_program *bpf_prog;
     int ret = 0;
 
-    ret = bpf_prog_load(prog_path, BPF_PROG_TYPE_XDP, &bpf_obj, &bpf_prog_fd);
+    bpf_obj = bpf_object__open(prog_path);
+    ret = libbpf_get_error(bpf_obj);
+    if (ret != 0)
+    {
+        printf("ERR: Unable to open XDP program from file '%s' err(%d): %s\n",
+               prog_path, -ret, strerror(-ret));
+        return ret;
+    }
+
+    bpf_object__for_each_program(bpf_prog, bpf_obj)
+    {
+        bpf_program__set_type(bpf_prog, BPF_PROG_TYPE_XDP);
+
+        /*
+            Programs meant to run on a CPUMAP entry must be loaded with the matching attach type,
+            otherwise the kernel refuses to install them into the map.
+        */
+        const char *title = bpf_program__title(bpf_prog, false);
+        if (title != NULL && strncmp(title, "xdp_cpumap/", strlen("xdp_cpumap/")) == 0)
+        {
+            bpf_program__set_expected_attach_type(bpf_prog, BPF_XDP_CPUMAP);
+        }
+    }
+
+    if (config != NULL)
+    {
+        struct bpf_map *rodata = find_rodata_map(bpf_obj);
+        if (rodata == NULL)
+        {
+            printf("ERR: XDP program '%s' has no .rodata configuration block\n", prog_path);
+            return -ENOENT;
+        }
+
+        ret = bpf_map__set_initial_value(rodata, config, config_size);
+        if (ret != 0)
+        {
+            printf("ERR: Unable to set the configuration of XDP program '%s' err(%d): %s\n",
+                   prog_path, -ret, strerror(-ret));
+            return ret;
+        }
+    }
+
+    if (prepare != NULL)
+    {
+        ret = prepare(bpf_obj, config);
+        if (ret != 0)
+        {
+            printf("ERR: Unable to prepare XDP program '%s' err(%d): %s\n", prog_path, -ret, strerror(-ret));
+            return ret;
+        }
+    }
+
+    ret = bpf_object__load(bpf_obj);
     if (ret != 0)
     {
         printf("ERR: Unable to load XDP program from file '%s' err(%d): %s\n",
                prog_path, -ret, strerror(-ret));
+        return ret;
+    }
+
+    *loaded_obj = bpf_obj;
+    *first_prog_fd = bpf_program__fd(bpf_program__next(NULL, bpf_obj));
+
+    return 0;
+}
+
+static int load_and_attach(int if_index, char *prog_path, char *section, const void *config, size_t config_size,
+                           prepare_object_fn prepare, struct bpf_object **loaded_obj)
+{
+    struct bpf_object *bpf_obj;
+    int bpf_prog_fd = -1;
+    int ret = 0;
+
+    ret = load_object(prog_path, config, config_size, prepare, &bpf_obj, &bpf_prog_fd);
+    if (ret != 0)
+    {
         return EXIT_FAIL_XDP_ATTACH;
     }
 
@@ -102,7 +205,17 @@ static int attach(int if_index, char *prog_path, char *section)
         return EXIT_FAIL_XDP_MAP_PIN;
     }
 
+    if (loaded_obj != NULL)
+    {
+        *loaded_obj = bpf_obj;
+    }
+
     return EXIT_OK;
 }
 
+static int attach(int if_index, char *prog_path, char *section, const void *config, size_t config_size)
+{
+    return load_and_attach(if_index, prog_path, section, config, config_size, NULL, NULL);
+}
+
 #endif // _LIBBPF_PROG_HELPERS_H
\ No newline at end of file